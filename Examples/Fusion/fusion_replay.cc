@@ -0,0 +1,308 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+// Offline replay of the iGPS fusion back end. A camera trajectory stands in for the VO output and an
+// iGPS position log is fed next to it, both streamed into inputVO/inputiGPS without running tracking.
+// Reports solve throughput, per-solve latency and ATE of the fused trajectory against ground truth. Solve count,
+// mean latency and wall time come from the counters of the fusion thread; the latency percentiles are taken over
+// the results a polling thread saw, which can skip solves at max speed.
+
+#include<iostream>
+#include<algorithm>
+#include<fstream>
+#include<sstream>
+#include<iomanip>
+#include<chrono>
+#include<thread>
+#include<atomic>
+#include<random>
+#include<cstdio>
+#include<cmath>
+#include<unistd.h>
+
+#include<opencv2/core/core.hpp>
+#include<Eigen/Core>
+#include<Eigen/Geometry>
+
+#include"iGPSTypes.h"
+#include"iGPSFusion.h"
+#include"RealTimeiGPSFusion.h"
+#include"Converter.h"
+
+using namespace std;
+using namespace ORB_SLAM3;
+
+int LoadTrajectory(const string &strFile, const double timeScale, vector<iGPS::Pose> &vPoses);
+int LoadResult(const string &strFile, const double timeScale, vector<iGPS::Pose> &vPoses);
+void MakeVOTrajectory(const vector<iGPS::Pose> &vGT, const double scale, const double drift, vector<iGPS::Pose> &vVO);
+bool InterpolatePosition(const vector<iGPS::Pose> &vGT, const double t, Eigen::Vector3d &p);
+double Percentile(vector<double> v, const double q);
+
+// Timestamps in Examples/E and Examples/FT are in ms, the fusion works in seconds
+const double kFileTimeScale = 1e-3;
+
+template<class Fusion>
+int Replay(Fusion &fusion, const vector<iGPS::Pose> &vVO, const vector<iGPS::Pose> &viGPS, const double speed,
+           vector<iGPS::FusionResult> &vSampled, iGPS::FusionResult &lastResult, double &wallTime)
+{
+    thread tFusion(&Fusion::optimize, &fusion);
+
+    // Sample the published result for the latency distribution, a new solve has a new solve count
+    atomic<bool> bStopMonitor(false);
+    std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+    const double tStartSec = std::chrono::duration<double>(tStart.time_since_epoch()).count();
+    thread tMonitor([&]()
+    {
+        iGPS::FusionResult result;
+        unsigned long nSeen = 0;
+        while(!bStopMonitor)
+        {
+            if(fusion.getFusionResult(result) && result.nSolves != nSeen)
+            {
+                vSampled.push_back(result);
+                nSeen = result.nSolves;
+            }
+            usleep(100);
+        }
+    });
+
+    // Merge both streams by time
+    const double t0 = min(vVO.front().t, viGPS.front().t);
+    size_t nVO = 0, niGPS = 0;
+    while(nVO < vVO.size() || niGPS < viGPS.size())
+    {
+        const bool bVO = niGPS == viGPS.size() || (nVO < vVO.size() && vVO[nVO].t <= viGPS[niGPS].t);
+        const double t = bVO ? vVO[nVO].t : viGPS[niGPS].t;
+
+        if(speed > 0)
+            std::this_thread::sleep_until(tStart + std::chrono::microseconds((long)((t - t0) / speed * 1e6)));
+
+        if(bVO)
+        {
+            const iGPS::Pose &pose = vVO[nVO++];
+            Eigen::Matrix3d Rcw = pose.rotation().toRotationMatrix().transpose();
+            Eigen::Vector3d tcw = -Rcw * pose.position();
+            fusion.inputVO(t, Converter::toCvSE3(Rcw, tcw));
+        }
+        else
+        {
+            const Eigen::Vector3d p = viGPS[niGPS++].position();
+            fusion.inputiGPS(t, cv::Point3f(p.x(), p.y(), p.z()));
+
+            // At max speed the next sample waits for the fusion to catch up, so every sample gets its own pass
+            if(speed <= 0)
+                while(!fusion.isIdle())
+                    usleep(20);
+        }
+    }
+
+    // Let the last solves finish: stop once no solve ended for half a second
+    const double fedTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+    double lastSolveTime = 0;
+    while(true)
+    {
+        if(fusion.getFusionResult(lastResult))
+            lastSolveTime = lastResult.stamp - tStartSec;
+        const double now = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+        if(now - max(fedTime, lastSolveTime) > 0.5)
+            break;
+        usleep(10000);
+    }
+    wallTime = max(fedTime, lastSolveTime);
+
+    fusion.RequestFinish();
+    tFusion.join();
+    bStopMonitor = true;
+    tMonitor.join();
+    fusion.getFusionResult(lastResult);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 5)
+    {
+        cerr << endl << "Usage: ./fusion_replay realtime|global path_to_vo_trajectory path_to_iGPS_positions path_to_ground_truth (speed) (vo_scale) (vo_drift)" << endl;
+        cerr << "  speed: 0 replays as fast as the fusion keeps up (default), 1 in real time, k at k times real time" << endl;
+        cerr << "  vo_scale, vo_drift: the VO trajectory is moved to its first pose, its translation scaled by vo_scale" << endl;
+        cerr << "                      and a random walk of vo_drift m per pose added, to emulate monocular VO" << endl;
+        cerr << "  e.g. ./fusion_replay realtime ../E/E01_GTcor.txt ../E/E01.txt ../E/E01_GTcor.txt 0 0.5 0.001" << endl;
+        return 1;
+    }
+
+    const string strMode = argv[1];
+    if(strMode != "realtime" && strMode != "global")
+    {
+        cerr << "Unknown fusion mode " << strMode << endl;
+        return 1;
+    }
+    const double speed = argc > 5 ? atof(argv[5]) : 0.0;
+    const double voScale = argc > 6 ? atof(argv[6]) : 1.0;
+    const double voDrift = argc > 7 ? atof(argv[7]) : 0.0;
+
+    vector<iGPS::Pose> vCamera, viGPS, vGT;
+    if(LoadTrajectory(argv[2], kFileTimeScale, vCamera) == 0 || LoadTrajectory(argv[3], kFileTimeScale, viGPS) == 0 ||
+       LoadTrajectory(argv[4], kFileTimeScale, vGT) == 0)
+    {
+        cerr << "ERROR: could not read the trajectory files" << endl;
+        return 1;
+    }
+    vector<iGPS::Pose> vVO;
+    MakeVOTrajectory(vCamera, voScale, voDrift, vVO);
+
+    cout << "VO poses: " << vVO.size() << ", iGPS positions: " << viGPS.size() << ", ground truth poses: " << vGT.size() << endl;
+    cout << "Replaying " << strMode << " fusion ";
+    if(speed > 0)
+        cout << "at " << speed << "x real time" << endl;
+    else
+        cout << "at max speed" << endl;
+
+    // Fused poses are appended by the fusion, start from an empty file
+    const string strResultFile = "fusion_replay_" + strMode + ".txt";
+    std::remove(strResultFile.c_str());
+
+    vector<iGPS::FusionResult> vSampled;
+    iGPS::FusionResult lastResult;
+    double wallTime = 0;
+    double resultTimeScale = 1.0;
+    if(strMode == "realtime")
+    {
+        RealTimeiGPSFusion* pFusion = new RealTimeiGPSFusion(strResultFile);
+        Replay(*pFusion, vVO, viGPS, speed, vSampled, lastResult, wallTime);
+        delete pFusion;
+    }
+    else
+    {
+        iGPSFusion* pFusion = new iGPSFusion(strResultFile);
+        Replay(*pFusion, vVO, viGPS, speed, vSampled, lastResult, wallTime);
+        delete pFusion;
+        resultTimeScale = 1e-9;
+    }
+
+    // Throughput and mean latency from the counters of the fusion thread, percentiles over the sampled solves
+    vector<double> vLatency;
+    for(size_t i = 0; i < vSampled.size(); i++)
+        vLatency.push_back(vSampled[i].latency);
+
+    const unsigned long nSolves = lastResult.nSolves;
+    cout << endl << "-------" << endl;
+    cout << fixed << setprecision(3);
+    cout << "Wall time: " << wallTime << " s, " << (vVO.size() + viGPS.size()) / max(wallTime, 1e-9) << " samples/s" << endl;
+    cout << "Solves: " << nSolves << ", " << nSolves / max(wallTime, 1e-9) << " solves/s" << endl;
+    if(nSolves > 0)
+        cout << "Solve latency (ms): mean " << lastResult.totalLatency / nSolves << endl;
+    if(!vLatency.empty())
+        cout << "Sampled solve latency (ms, " << vLatency.size() << " of " << nSolves << " solves): p50 " << Percentile(vLatency, 0.5)
+             << "  p90 " << Percentile(vLatency, 0.9) << "  p99 " << Percentile(vLatency, 0.99) << "  max " << Percentile(vLatency, 1.0) << endl;
+
+    // ATE of the fused trajectory written by the fusion
+    vector<iGPS::Pose> vFused;
+    LoadResult(strResultFile, resultTimeScale, vFused);
+    double sum2 = 0, maxErr = 0;
+    int nMatched = 0;
+    for(size_t i = 0; i < vFused.size(); i++)
+    {
+        Eigen::Vector3d pGT;
+        if(!InterpolatePosition(vGT, vFused[i].t, pGT))
+            continue;
+        const double err = (vFused[i].position() - pGT).norm();
+        sum2 += err * err;
+        maxErr = max(maxErr, err);
+        nMatched++;
+    }
+    if(nMatched > 0)
+        cout << "ATE: rmse " << sqrt(sum2 / nMatched) << " m  max " << maxErr << " m  over " << nMatched << " fused poses" << endl;
+    else
+        cout << "ATE: no fused pose could be matched with the ground truth" << endl;
+
+    return 0;
+}
+
+int LoadTrajectory(const string &strFile, const double timeScale, vector<iGPS::Pose> &vPoses)
+{
+    ifstream f(strFile.c_str());
+    if(!f)
+        return 0;
+
+    string s;
+    while(getline(f, s))
+    {
+        if(s.empty() || s[0] == '#')
+            continue;
+
+        stringstream ss(s);
+        double t, x, y, z, qx, qy, qz, qw;   //Tum form
+        if(!(ss >> t >> x >> y >> z >> qx >> qy >> qz >> qw))
+            continue;
+        vPoses.push_back(iGPS::Pose(timeScale * t, Eigen::Vector3d(x, y, z), Eigen::Quaterniond(qw, qx, qy, qz).normalized()));
+    }
+    return vPoses.size();
+}
+
+int LoadResult(const string &strFile, const double timeScale, vector<iGPS::Pose> &vPoses)
+{
+    ifstream f(strFile.c_str());
+    if(!f)
+        return 0;
+
+    string s;
+    while(getline(f, s))
+    {
+        double t, x, y, z, qx, qy, qz, qw;
+        if(sscanf(s.c_str(), "%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf", &t, &x, &y, &z, &qx, &qy, &qz, &qw) != 8)
+            continue;
+        vPoses.push_back(iGPS::Pose(timeScale * t, Eigen::Vector3d(x, y, z), Eigen::Quaterniond(qw, qx, qy, qz)));
+    }
+    return vPoses.size();
+}
+
+// Express the camera trajectory in the frame of its first pose, like a VO map, with the given scale and drift
+void MakeVOTrajectory(const vector<iGPS::Pose> &vGT, const double scale, const double drift, vector<iGPS::Pose> &vVO)
+{
+    std::mt19937 rng(0);
+    std::normal_distribution<double> noise(0.0, drift);
+    const Eigen::Quaterniond q0 = vGT.front().rotation();
+    const Eigen::Vector3d p0 = vGT.front().position();
+
+    Eigen::Vector3d walk = Eigen::Vector3d::Zero();
+    vVO.clear();
+    vVO.reserve(vGT.size());
+    for(size_t i = 0; i < vGT.size(); i++)
+    {
+        if(drift > 0 && i > 0)
+            walk += Eigen::Vector3d(noise(rng), noise(rng), noise(rng));
+        const Eigen::Vector3d p = q0.inverse() * (vGT[i].position() - p0) + walk;
+        vVO.push_back(iGPS::Pose(vGT[i].t, scale * p, q0.inverse() * vGT[i].rotation()));
+    }
+}
+
+// Linear interpolation between the bracketing ground truth samples, at most 0.2 s apart
+bool InterpolatePosition(const vector<iGPS::Pose> &vGT, const double t, Eigen::Vector3d &p)
+{
+    auto it = lower_bound(vGT.begin(), vGT.end(), t, [](const iGPS::Pose &pose, const double t){ return pose.t < t; });
+    if(it == vGT.end())
+        return false;
+    if(it->t == t)
+    {
+        p = it->position();
+        return true;
+    }
+    if(it == vGT.begin() || it->t - (it-1)->t > 0.2)
+        return false;
+
+    const iGPS::Pose &a = *(it-1);
+    const iGPS::Pose &b = *it;
+    const double s = (t - a.t) / (b.t - a.t);
+    p = (1.0 - s) * a.position() + s * b.position();
+    return true;
+}
+
+double Percentile(vector<double> v, const double q)
+{
+    sort(v.begin(), v.end());
+    const size_t n = min(v.size() - 1, (size_t)(q * (v.size() - 1) + 0.5));
+    return v[n];
+}
@@ -25,6 +25,7 @@
 #include<opencv2/core/core.hpp>
 
 #include<System.h>
+#include<iGPSLog.h>
 
 using namespace std;
 
@@ -123,9 +124,29 @@ int main(int argc, char **argv)
     cv::initUndistortRectifyMap(K_l,D_l,R_l,P_l.rowRange(0,3).colRange(0,3),cv::Size(cols_l,rows_l),CV_32F,M1l,M2l);
     cv::initUndistortRectifyMap(K_r,D_r,R_r,P_r.rowRange(0,3).colRange(0,3),cv::Size(cols_r,rows_r),CV_32F,M1r,M2r);
 
-    ORB_SLAM3::iGPS::Direction* iGPSDirection = new ORB_SLAM3::iGPS::Direction[50000];
+    // iGPS.Path may point to a binary log made by igps_log_convert, it is mapped instead of parsed
+    ORB_SLAM3::iGPS::LogReader iGPSLog;
+    string striGPSPath;
+    if(fsSettings["iGPS.Path"].isString())
+        fsSettings["iGPS.Path"] >> striGPSPath;
+
+    ORB_SLAM3::iGPS::Direction* iGPSDirection = NULL;
     vector<double> vTimestampsiGPSDir;
-    int ret = LoadFTDirection(vTimestampsiGPSDir,iGPSDirection,argv[2]);
+    int ret = 0;
+    if(ORB_SLAM3::iGPS::LogReader::isLog(striGPSPath))
+    {
+        if(!iGPSLog.Open(striGPSPath) || iGPSLog.kind() != ORB_SLAM3::iGPS::DIRECTION_LOG)
+        {
+            cout<< "Read iGPSDataFile fails";
+            return 1;
+        }
+        cout << "Mapped " << iGPSLog.size() << " iGPS directions from " << striGPSPath << endl;
+    }
+    else
+    {
+        iGPSDirection = new ORB_SLAM3::iGPS::Direction[50000];
+        ret = LoadFTDirection(vTimestampsiGPSDir,iGPSDirection,argv[2]);
+    }
     if(1 == ret)
     {
         cout << "Read fsSettings fails";
@@ -141,7 +162,16 @@ int main(int argc, char **argv)
     cout << "strFilePath = " << strFilePath <<endl;
     vector<double> vTimeStampsGT; //Camera Pose TimeStamps
     vector<Eigen::VectorXf> vCameraPose;
-    ret = LoadCamPose(vTimeStampsGT,vCameraPose,strFilePath);   //Notice!: EuRoC GT form is different from Tum, code needs change.
+    if(ORB_SLAM3::iGPS::LogReader::isLog(strFilePath))
+    {
+        ORB_SLAM3::iGPS::LogReader poseLog;
+        if(!poseLog.Open(strFilePath) || poseLog.kind() != ORB_SLAM3::iGPS::POSE_LOG)
+            ret = 2;
+        else
+            poseLog.GetCameraPoses(vTimeStampsGT,vCameraPose);
+    }
+    else
+        ret = LoadCamPose(vTimeStampsGT,vCameraPose,strFilePath);   //Notice!: EuRoC GT form is different from Tum, code needs change.
     if(2 == ret)
     {
         cout<< "Read CamPoseFile fails";
@@ -158,7 +188,9 @@ int main(int argc, char **argv)
     // Create SLAM system. It initializes all system threads and gets ready to process frames.
     ORB_SLAM3::System SLAM(argv[1],argv[2],ORB_SLAM3::System::STEREO, true);
 
-    if(!vTimestampsiGPSDir.empty())
+    if(iGPSLog.isOpen())
+        SLAM.LoadiGPSDirection(&iGPSLog);
+    else if(!vTimestampsiGPSDir.empty())
         SLAM.LoadiGPSDirection(vTimestampsiGPSDir,iGPSDirection);
 
     if(!vTimeStampsGT.empty())
@@ -0,0 +1,252 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+// Checks the analytic Jacobians (linearizeOplus) of the iGPS edges against central differences of
+// computeError under the vertex update, on random poses. Exits with 1 if an edge is off or not finite,
+// with 2 on bad arguments, so it can be run as a regression check of the edges.
+
+#include<iostream>
+#include<iomanip>
+#include<string>
+#include<vector>
+#include<random>
+#include<cmath>
+#include<cstdlib>
+
+#include<Eigen/Core>
+#include<Eigen/Geometry>
+
+#include "Thirdparty/g2o/g2o/core/jacobian_workspace.h"
+#include "Thirdparty/g2o/g2o/types/types_six_dof_expmap.h"
+
+#include"G2oTypes.h"
+#include"iGPSFusion.h"
+#include"RealTimeiGPSFusion.h"
+
+using namespace std;
+using namespace ORB_SLAM3;
+
+const char* ResidualNames[] = {"VectorAngle", "Vector", "Tangent", "Angles"};
+
+g2o::SE3Quat RandomPose(mt19937 &rng, const double range)
+{
+    uniform_real_distribution<double> u(-1.0, 1.0);
+    Eigen::Vector3d axis(u(rng), u(rng), u(rng));
+    if(axis.norm() < 1e-3)
+        axis = Eigen::Vector3d::UnitZ();
+    const Eigen::Quaterniond q(Eigen::AngleAxisd(0.95 * M_PI * u(rng), axis.normalized()));
+    return g2o::SE3Quat(q, range * Eigen::Vector3d(u(rng), u(rng), u(rng)));
+}
+
+// Largest difference between the analytic and the numeric Jacobian over all vertices of the edge,
+// relative to the largest analytic entry when that is above one
+double CheckEdge(g2o::OptimizableGraph::Edge* e, const double h)
+{
+    g2o::JacobianWorkspace workspace;
+    workspace.updateSize(e);
+    workspace.allocate();
+    e->linearizeOplus(workspace);
+
+    const int D = e->dimension();
+    double maxDiff = 0.0;
+    for(size_t i = 0; i < e->vertices().size(); i++)
+    {
+        g2o::OptimizableGraph::Vertex* v = static_cast<g2o::OptimizableGraph::Vertex*>(e->vertex(i));
+        const int n = v->dimension();
+        const Eigen::MatrixXd J = Eigen::Map<Eigen::MatrixXd>(workspace.workspaceForVertex(i), D, n);
+
+        Eigen::MatrixXd Jnum(D, n);
+        vector<double> delta(n, 0.0);
+        for(int k = 0; k < n; k++)
+        {
+            delta[k] = h;
+            v->push();
+            v->oplus(&delta[0]);
+            e->computeError();
+            const Eigen::VectorXd ep = Eigen::Map<const Eigen::VectorXd>(e->errorData(), D);
+            v->pop();
+
+            delta[k] = -h;
+            v->push();
+            v->oplus(&delta[0]);
+            e->computeError();
+            const Eigen::VectorXd em = Eigen::Map<const Eigen::VectorXd>(e->errorData(), D);
+            v->pop();
+
+            delta[k] = 0.0;
+            Jnum.col(k) = (ep - em) / (2 * h);
+        }
+
+        // A NaN in either Jacobian is reported as an infinite difference, max() would drop it
+        double diff = (J - Jnum).cwiseAbs().maxCoeff() / max(1.0, J.cwiseAbs().maxCoeff());
+        if(!std::isfinite(diff))
+            diff = INFINITY;
+        maxDiff = max(maxDiff, diff);
+    }
+    return maxDiff;
+}
+
+// Direction of the point Pc (camera frame) seen from the transmitter Tci, with some noise so the residual is not zero
+Eigen::Vector3d MeasuredDirection(mt19937 &rng, const g2o::SE3Quat &Tci, const Eigen::Vector3d &Pc)
+{
+    normal_distribution<double> n(0.0, 0.01);
+    const Eigen::Vector3d m = Tci.rotation().conjugate() * (Pc - Tci.translation()).normalized();
+    return (m + Eigen::Vector3d(n(rng), n(rng), n(rng))).normalized();
+}
+
+struct Report
+{
+    Report(const string &name): strName(name), maxDiff(0.0), nSkipped(0){}
+    string strName;
+    double maxDiff;
+    int nSkipped;
+};
+
+int main(int argc, char **argv)
+{
+    if(argc > 3)
+    {
+        cerr << endl << "Usage: ./igps_jacobian_check (trials) (tolerance)" << endl;
+        return 2;
+    }
+
+    const int nTrials = argc > 1 ? atoi(argv[1]) : 50;
+    const double tolerance = argc > 2 ? atof(argv[2]) : 1e-6;
+    if(nTrials <= 0 || !(tolerance > 0))
+    {
+        cerr << "igps_jacobian_check: trials and tolerance must be positive" << endl;
+        return 2;
+    }
+    const double h = 1e-6;
+
+    mt19937 rng(0);
+    uniform_real_distribution<double> u(-1.0, 1.0);
+
+    vector<Report> vReports;
+    vReports.push_back(Report("EdgeSE3Graph"));
+    vReports.push_back(Report("EdgeSE3iGPSFusion"));
+    vReports.push_back(Report("RealTimeEdgeSE3Graph"));
+    vReports.push_back(Report("RealTimeEdgeSE3iGPSFusion"));
+    vReports.push_back(Report("RealTimeEdgeSE3Prior"));
+    for(int m = 0; m < 4; m++)
+        vReports.push_back(Report(string("EdgeiGPSDirection<") + ResidualNames[m] + ">"));
+    for(int m = 0; m < 4; m++)
+        vReports.push_back(Report(string("EdgeiGPSDirectionUptoScale<") + ResidualNames[m] + ">"));
+
+    iGPS::ReceiverTable receivers;
+    receivers.insert(0, Eigen::Vector3d(0.1, -0.05, 0.02));
+
+    for(int t = 0; t < nTrials; t++)
+    {
+        g2o::VertexSE3Expmap* vi = new g2o::VertexSE3Expmap();
+        g2o::VertexSE3Expmap* vj = new g2o::VertexSE3Expmap();
+        g2o::VertexSE3Expmap* vTci = new g2o::VertexSE3Expmap();
+        VertexScale* vs = new VertexScale(1.0 + 0.4 * u(rng));
+        vi->setEstimate(RandomPose(rng, 5.0));
+        vj->setEstimate(RandomPose(rng, 5.0));
+
+        // Transmitter a few meters away from both cameras
+        g2o::SE3Quat Tci = RandomPose(rng, 1.0);
+        Tci.setTranslation(Tci.translation() + Eigen::Vector3d(8.0, 0.0, 0.0));
+        vTci->setEstimate(Tci);
+
+        const double scale = 1.0 + 0.5 * u(rng);
+        const g2o::SE3Quat iTj = vi->estimate().inverse() * vj->estimate() * RandomPose(rng, 0.1);
+        const Eigen::Vector3d fix = vj->estimate().translation() + 0.1 * Eigen::Vector3d(u(rng), u(rng), u(rng));
+        const Eigen::Vector3d lever(0.2 * u(rng), 0.2 * u(rng), 0.2 * u(rng));
+
+        vector<g2o::OptimizableGraph::Edge*> vpEdges;
+
+        EdgeSE3Graph* e0 = new EdgeSE3Graph(scale);
+        e0->setVertex(0, vi);
+        e0->setVertex(1, vj);
+        e0->setMeasurement(iTj);
+        vpEdges.push_back(e0);
+
+        EdgeSE3iGPSFusion* e1 = new EdgeSE3iGPSFusion();
+        e1->setVertex(0, vj);
+        e1->setMeasurement(fix);
+        vpEdges.push_back(e1);
+
+        RealTimeEdgeSE3Graph* e2 = new RealTimeEdgeSE3Graph(scale);
+        e2->setVertex(0, vi);
+        e2->setVertex(1, vj);
+        e2->setMeasurement(iTj);
+        vpEdges.push_back(e2);
+
+        RealTimeEdgeSE3iGPSFusion* e3 = new RealTimeEdgeSE3iGPSFusion(lever);
+        e3->setVertex(0, vj);
+        e3->setMeasurement(fix);
+        vpEdges.push_back(e3);
+
+        // Below ~0.005 rad SE3Quat::log is only first order, too coarse for the numeric reference
+        g2o::SE3Quat dT = RandomPose(rng, 0.5);
+        while(dT.log().head<3>().norm() < 0.01)
+            dT = RandomPose(rng, 0.5);
+        RealTimeEdgeSE3Prior* e4 = new RealTimeEdgeSE3Prior();
+        e4->setVertex(0, vj);
+        e4->setMeasurement(vj->estimate() * dT);
+        vpEdges.push_back(e4);
+
+        // Receiver on the camera Tcw = vi, in the camera (map) frame
+        const g2o::SE3Quat &Tcw = vi->estimate();
+        const Eigen::Vector3d Pw = Tcw.inverse().map(receivers[0]);
+        const Eigen::Vector3d DirReceiver = MeasuredDirection(rng, Tci, Pw);
+        for(int m = 0; m < 4; m++)
+        {
+            g2o::OptimizableGraph::Edge* e = CreateiGPSDirectionEdge(static_cast<iGPS::DirectionResidual>(m), &receivers, 0,
+                                                                     Tci.rotation().toRotationMatrix(), Tci.translation(), DirReceiver, 1.0);
+            e->setVertex(0, vi);
+            vpEdges.push_back(e);
+        }
+
+        // Monocular edge, camera center against the scaled transmitter position
+        const Eigen::Vector3d twc = Tcw.inverse().translation();
+        const g2o::SE3Quat Tci_s(Tci.rotation(), vs->estimate() * Tci.translation());
+        const Eigen::Vector3d DirCenter = MeasuredDirection(rng, Tci_s, twc);
+        for(int m = 0; m < 4; m++)
+        {
+            g2o::OptimizableGraph::Edge* e = CreateiGPSDirectionUptoScaleEdge(static_cast<iGPS::DirectionResidual>(m), DirCenter, 1.0);
+            e->setVertex(0, vi);
+            e->setVertex(1, vs);
+            e->setVertex(2, vTci);
+            vpEdges.push_back(e);
+        }
+
+        for(size_t i = 0; i < vpEdges.size(); i++)
+        {
+            // Edges 5-8 and 9-12 are the direction edges of each residual model. The angle residual is
+            // singular at the poles of the transmitter frame.
+            const bool bAngles = i >= 5 && (i - 5) % 4 == iGPS::DIR_ANGLES;
+            const Eigen::Vector3d &Dir = i < 9 ? DirReceiver : DirCenter;
+            if(bAngles && fabs(Dir.z()) > 0.99)
+                vReports[i].nSkipped++;
+            else
+                vReports[i].maxDiff = max(vReports[i].maxDiff, CheckEdge(vpEdges[i], h));
+            delete vpEdges[i];
+        }
+
+        delete vi;
+        delete vj;
+        delete vTci;
+        delete vs;
+    }
+
+    bool bOk = true;
+    cout << "Analytic vs. numeric Jacobians, " << nTrials << " random poses, tolerance " << tolerance << endl;
+    for(size_t i = 0; i < vReports.size(); i++)
+    {
+        const bool bEdgeOk = vReports[i].maxDiff <= tolerance;
+        bOk = bOk && bEdgeOk;
+        cout << setw(40) << left << vReports[i].strName << " max diff " << scientific << setprecision(2) << vReports[i].maxDiff
+             << (bEdgeOk ? "  ok" : "  FAILED");
+        if(vReports[i].nSkipped > 0)
+            cout << "  (" << vReports[i].nSkipped << " skipped near a pole)";
+        cout << endl;
+    }
+
+    return bOk ? 0 : 1;
+}
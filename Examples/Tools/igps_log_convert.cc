@@ -0,0 +1,123 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+// Converts the text iGPS direction and camera pose files read by the examples into the binary
+// log of iGPSLog.h, which stereo_euroc maps at startup instead of parsing.
+
+#include<iostream>
+#include<fstream>
+#include<string>
+#include<vector>
+#include<cstdlib>
+
+#include<Eigen/Core>
+
+#include"iGPSTypes.h"
+#include"iGPSLog.h"
+
+using namespace std;
+
+// Parses up to n numbers from a line, returns how many were read
+int ParseLine(const string &s, double* values, const int n)
+{
+    const char* p = s.c_str();
+    int i = 0;
+    for(; i < n; i++)
+    {
+        char* end;
+        values[i] = strtod(p, &end);
+        if(end == p)
+            break;
+        p = end;
+    }
+    return i;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 4)
+    {
+        cerr << endl << "Usage: ./igps_log_convert direction|ft|pose input_text_file output_log_file (rotation_speed)" << endl;
+        cerr << "  direction: t channel dx dy dz a1 a2, the transmitter is set to rotation_speed (default 1800)" << endl;
+        cerr << "  ft:        channel transmitter t dx dy dz" << endl;
+        cerr << "  pose:      t x y z qx qy qz qw (TUM)" << endl;
+        return 1;
+    }
+
+    const string strType = argv[1];
+    const int nRotationSpeed = argc > 4 ? atoi(argv[4]) : 1800;
+    if(strType != "direction" && strType != "ft" && strType != "pose")
+    {
+        cerr << "Unknown input type " << strType << endl;
+        return 1;
+    }
+
+    ifstream f(argv[2]);
+    if(!f)
+    {
+        cerr << "Could not open " << argv[2] << endl;
+        return 1;
+    }
+
+    vector<ORB_SLAM3::iGPS::Direction> vDirections;
+    vector<double> vTimestamps;
+    vector<Eigen::VectorXf> vCameraPose;
+    string s;
+    double v[8];
+    while(getline(f, s))
+    {
+        if(s.empty() || s[0] == '#')
+            continue;
+
+        if(strType == "pose")
+        {
+            if(ParseLine(s, v, 8) != 8)
+                continue;
+            Eigen::VectorXf CameraPose(7);
+            CameraPose << v[1], v[2], v[3], v[4], v[5], v[6], v[7];
+            vTimestamps.push_back(v[0]);
+            vCameraPose.push_back(CameraPose);
+            continue;
+        }
+
+        ORB_SLAM3::iGPS::Direction d;
+        if(strType == "direction")
+        {
+            if(ParseLine(s, v, 7) != 7)
+                continue;
+            d.time = v[0];
+            d.channel = (int)v[1];
+            d.transmitter = nRotationSpeed;
+            d.dir = Eigen::Vector3d(v[2], v[3], v[4]);
+            d.dirAngle = Eigen::Vector2d(v[5], v[6]);
+        }
+        else
+        {
+            if(ParseLine(s, v, 6) != 6)
+                continue;
+            d.channel = (int)v[0];
+            d.transmitter = (int)v[1];
+            d.time = v[2];
+            d.dir = Eigen::Vector3d(v[3], v[4], v[5]);
+            d.dirAngle = Eigen::Vector2d(0.0, 0.0);
+        }
+        vDirections.push_back(d);
+    }
+
+    bool bOk;
+    if(strType == "pose")
+    {
+        bOk = ORB_SLAM3::iGPS::WritePoseLog(argv[3], vTimestamps, vCameraPose);
+        cout << "Wrote " << vTimestamps.size() << " poses to " << argv[3] << endl;
+    }
+    else
+    {
+        bOk = ORB_SLAM3::iGPS::WriteDirectionLog(argv[3], vDirections);
+        cout << "Wrote " << vDirections.size() << " directions to " << argv[3] << endl;
+    }
+
+    return bOk ? 0 : 1;
+}
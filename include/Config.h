@@ -3,4 +3,9 @@
 
 //#define REGISTER_TIMES
 
+// LOG_MESS statements above this verbosity are compiled out (Logging.h), 4 keeps the debug ones
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL 2
+#endif
+
 #endif // CONFIG_H
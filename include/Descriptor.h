@@ -0,0 +1,72 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+
+#ifndef DESCRIPTOR_H
+#define DESCRIPTOR_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "Hamming.h"
+
+namespace ORB_SLAM3
+{
+
+// One ORB descriptor, aligned so that it is a single 256 bit load
+struct alignas(32) Descriptor
+{
+    uint8_t data[Hamming::DESCRIPTOR_BYTES];
+};
+
+// The descriptors of a frame in one aligned block. Not modified once built, Frame copies and KeyFrames
+// share it and see it through a cv::Mat header without copying.
+class DescriptorArray
+{
+public:
+    // Copies the rows of a N x 32 CV_8U matrix
+    explicit DescriptorArray(const cv::Mat &descriptors);
+    ~DescriptorArray();
+
+    const uint8_t* ptr(const size_t i) const { return mpData[i].data; }
+    const Descriptor& operator[](const size_t i) const { return mpData[i]; }
+    size_t size() const { return mN; }
+
+    // N x 32 CV_8U header over the block, valid while the array lives
+    cv::Mat mat() const;
+
+private:
+    DescriptorArray(const DescriptorArray&);
+    DescriptorArray& operator=(const DescriptorArray&);
+
+    Descriptor* mpData;
+    size_t mN;
+};
+
+// Descriptor read without locking (seqlock). Readers retry while a store is in progress, stores must be
+// serialized by the caller.
+class AtomicDescriptor
+{
+public:
+    AtomicDescriptor();
+
+    void store(const uint8_t* p);
+    Descriptor load() const;
+
+private:
+    static const int WORDS = Hamming::DESCRIPTOR_BYTES/8;
+
+    std::atomic<uint32_t> mnSeq;    // odd while a store is in progress
+    std::atomic<uint64_t> mvWords[WORDS];
+};
+
+} //namespace ORB_SLAM3
+
+#endif // DESCRIPTOR_H
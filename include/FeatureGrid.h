@@ -0,0 +1,49 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+
+#ifndef FEATUREGRID_H
+#define FEATUREGRID_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ORB_SLAM3
+{
+
+// Keypoint indices bucketed by image cell, stored as one offset array and one index array. Cells are
+// column-major, so the cells y0..y1 of a column are a single contiguous range of indices. The grid is
+// not modified once assigned, Frame copies and KeyFrames share it.
+class FeatureGrid
+{
+public:
+    FeatureGrid(const int nCols, const int nRows);
+
+    int cell(const int x, const int y) const { return x*mnRows + y; }
+
+    // Counting sort of the keypoints first..last-1 by vCells[i] (-1 leaves the keypoint out). Indices are
+    // stored relative to first and keep their order inside a cell.
+    void assign(const std::vector<int> &vCells, const size_t first, const size_t last);
+
+    // Indices of the cells (x,y0)..(x,y1)
+    const uint32_t* begin(const int x, const int y0) const { return mvIndices.data() + mvOffsets[cell(x,y0)]; }
+    const uint32_t* end(const int x, const int y1) const { return mvIndices.data() + mvOffsets[cell(x,y1)+1]; }
+
+    int cols() const { return mnCols; }
+    int rows() const { return mnRows; }
+    size_t size() const { return mvIndices.size(); }
+
+private:
+    int mnCols;
+    int mnRows;
+    std::vector<uint32_t> mvOffsets;    // cols*rows+1, indices of cell c are [mvOffsets[c], mvOffsets[c+1])
+    std::vector<uint32_t> mvIndices;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // FEATUREGRID_H
@@ -26,10 +26,14 @@
 #include "Thirdparty/DBoW2/DBoW2/FeatureVector.h"
 
 #include "ImuTypes.h"
+#include "iGPSTypes.h"
 #include "ORBVocabulary.h"
 #include "Config.h"
+#include "FeatureGrid.h"
+#include "Descriptor.h"
 
 #include <mutex>
+#include <memory>
 #include <opencv2/opencv.hpp>
 
 namespace ORB_SLAM3
@@ -177,6 +181,8 @@ public:
 
     // ORB descriptor, each row associated to a keypoint.
     cv::Mat mDescriptors, mDescriptorsRight;
+    // Aligned storage mDescriptors is a view of, shared by copies and KeyFrames
+    std::shared_ptr<const DescriptorArray> mpDescriptors;
 
     // MapPoints associated to keypoints, NULL pointer if no association.
     // Flag to identify outlier associations.
@@ -186,7 +192,7 @@ public:
     // Keypoints are assigned to cells in a grid to reduce matching complexity when projecting MapPoints.
     static float mfGridElementWidthInv;
     static float mfGridElementHeightInv;
-    std::vector<std::size_t> mGrid[FRAME_GRID_COLS][FRAME_GRID_ROWS];
+    std::shared_ptr<const FeatureGrid> mpGrid;
 
 
     // Camera pose.
@@ -261,6 +267,9 @@ private:
     // Assign keypoints to the grid for speed up feature matching (called in the constructor).
     void AssignFeaturesToGrid();
 
+    // Moves the final descriptors to the aligned shared storage (called in the constructor).
+    void PackDescriptors();
+
     // Rotation, translation and camera center
     cv::Mat mRcw;
     cv::Mat mtcw;
@@ -293,7 +302,7 @@ public:
     std::vector<cv::Mat> mvStereo3Dpoints;
 
     //Grid for the right image
-    std::vector<std::size_t> mGridRight[FRAME_GRID_COLS][FRAME_GRID_ROWS];
+    std::shared_ptr<const FeatureGrid> mpGridRight;
 
     cv::Mat mTlr, mRlr, mtlr, mTrl;
     cv::Matx34f mTrlx, mTlrx;
@@ -303,7 +312,7 @@ public:
     vector<Eigen::Vector2d> miGPSDirAngle;
     vector<int> miGPSTransmitter;
     vector<double>  miGPStime;
-    map<int, Eigen::Vector3d> miGPSReceive;
+    std::shared_ptr<const iGPS::ReceiverTable> mpiGPSReceive;
 
     map<int,Eigen::Vector3d> mmiGPSChDir;
     map<int,Eigen::Vector2d> mmiGPSChDirAngle;
@@ -972,329 +972,274 @@ public:
     g2o::SE3Quat Tcw;
 };
 
-//Tightly-coupled vision and iGPS direction optimization
-//class EdgeiGPSDir6DoFPose:public g2o::BaseBinaryEdge<3,Eigen::Vector3d,g2o::VertexSE3Expmap, VertexScale>
-//{
-//public:
-//    EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
-//
-//    EdgeiGPSDir6DoFPose(Eigen::Matrix4d eTci):Tci(eTci) {};
-//
-//    virtual bool read(std::istream& is) override{};
-//
-//    virtual bool write(std::ostream& os) const override{};
-//
-//    virtual void computeError() override
-//    {
-//        _error = Eigen::Vector3d(0.0,0.0,0.0);   //error initialization
-//        const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);    //Tcw
-//        Eigen::Matrix3d rwc = v1->estimate().rotation().toRotationMatrix().transpose();
-//        Eigen::Vector3d tcw = v1->estimate().translation();
-//        Eigen::Vector3d t = - rwc * tcw;
-//        const VertexScale * v2 = static_cast<const VertexScale*>(_vertices[1]);    //iGPS Position Scale
-//        double scale = v2->estimate();
-//        //t = scale * t;
-//
-//        Eigen::Vector3d obs(_measurement);
-//        Eigen::Matrix3d Rci = Tci.block<3,3>(0,0);
-//        Eigen::Vector3d GT = Rci * obs;
-//        //Eigen::Vector3d iGPSPosition = Tci.block<3,1>(0,3);    //scaled iGPS Position w.r.t camera frame
-//        Eigen::Vector3d iGPSPosition = scale * Tci.block<3,1>(0,3);    //scaled iGPS Position w.r.t camera frame
-//
-//        Eigen::Vector3d measurement = (t-iGPSPosition)/(t-iGPSPosition).norm();
-//
-//        Eigen::Vector3d result = measurement - GT;
-//        _error = measurement - GT;
-//        //cout << "CamDir = " << CamDir.transpose() <<endl;
-//        if(result.norm()>0.1)
-//        {
-//            cout << "scale = " << scale <<endl;
-//            cout << "t = " << t.transpose() <<endl;
-//            cout << "iGPSPosition = " << iGPSPosition.transpose() <<endl;
-//            cout << "measurement = " << measurement.transpose() <<endl;
-//            cout << "GT = " << GT.transpose() <<endl;
-//            cout << "Differences = " << result.transpose() <<endl;
-//        }
-//    }
-//
-//private:
-//    //double _precision;
-//    Eigen::Matrix4d Tci;
-//};
-
-
-class EdgeiGPSDirUptoScale6DoFPose:public g2o::BaseMultiEdge<3,Eigen::Vector3d>
+namespace iGPS
 {
-public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
 
-    EdgeiGPSDirUptoScale6DoFPose()
-    {
-        resize(3);
-    };
+// Direction residual models. Each one compares m, the unit vector from the transmitter to the receiver,
+// with the measured direction d, both expressed in the transmitter frame. error() fills the residual and
+// jacobian() its derivative with respect to m. Selected with iGPS.DirectionResidual in the settings file, without it
+// each edge family keeps its original model (iGPS::DIR_DEFAULT).
 
-    virtual bool read(std::istream& is) override{};
+// m - d and the angle between them (4D)
+struct DirResidualVectorAngle
+{
+    static const int D = 4;
+    typedef Eigen::Matrix<double,D,1> ErrorVector;
+    typedef Eigen::Matrix<double,D,3> JacobianType;
 
-    virtual bool write(std::ostream& os) const override{};
+    DirResidualVectorAngle(const Eigen::Vector3d &d_): d(d_){}
 
-    virtual void computeError() override
+    void error(const Eigen::Vector3d &m, ErrorVector &e) const
     {
-        _error = Eigen::Vector3d(0.0,0.0,0.0);   //error initialization
-        const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);    //Tcw
-        Eigen::Matrix3d rwc = v1->estimate().rotation().toRotationMatrix().transpose();
-        Eigen::Vector3d tcw = v1->estimate().translation();
-        Eigen::Vector3d t = - rwc * tcw;   //up-to-scale cam pose
-        const VertexScale * v2 = static_cast<const VertexScale*>(_vertices[1]);    // Scale between iGPS and cam
-        double scale = v2->estimate();
-
-        //t = scale * t;
-        const g2o::VertexSE3Expmap* v3 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[2]);  // iGPS Position in camera frame
-        Eigen::Matrix3d Rci = v3->estimate().rotation().toRotationMatrix();
-        Eigen::Vector3d tci = v3->estimate().translation();
+        e << m - d, acos(std::min(1.0,std::abs(m.dot(d))));
+    }
 
-        Eigen::Vector3d obs(_measurement);
-        Eigen::Vector3d GT = Rci * obs;
-        //Eigen::Vector3d iGPSPosition = Tci.block<3,1>(0,3);    //scaled iGPS Position w.r.t camera frame
-        Eigen::Vector3d iGPSPosition = scale * tci;    //scaled iGPS Position w.r.t camera frame
-
-        Eigen::Vector3d measurement = (t-iGPSPosition)/(t-iGPSPosition).norm();
-
-        Eigen::Vector3d result = measurement - GT;
-        _error = measurement - GT;
-        //cout << "CamDir = " << CamDir.transpose() <<endl;
-        if(result.norm()>0.1)
-        {
-            cout << "scale = " << scale <<endl;
-            cout << "t = " << t.transpose() <<endl;
-            cout << "iGPSPosition = " << iGPSPosition.transpose() <<endl;
-            cout << "measurement = " << measurement.transpose() <<endl;
-            cout << "GT = " << GT.transpose() <<endl;
-            cout << "Differences = " << result.transpose() <<endl;
-        }
+    void jacobian(const Eigen::Vector3d &m, JacobianType &J) const
+    {
+        J.block<3,3>(0,0).setIdentity();
+        // acos(|m.d|) is not differentiable at zero angle, leave that row out there
+        const double c = m.dot(d);
+        const double s2 = 1.0 - c*c;
+        if(s2 > 1e-12)
+            J.block<1,3>(3,0) = -(c < 0 ? -1.0 : 1.0)/sqrt(s2)*d.transpose();
+        else
+            J.block<1,3>(3,0).setZero();
     }
+
+    Eigen::Vector3d d;
 };
 
-/*
-class EdgeiGPSDir6DoFPose:public g2o::BaseMultiEdge<3,Eigen::Vector3d>
+// m - d (3D)
+struct DirResidualVector
 {
-public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+    static const int D = 3;
+    typedef Eigen::Matrix<double,D,1> ErrorVector;
+    typedef Eigen::Matrix<double,D,3> JacobianType;
+
+    DirResidualVector(const Eigen::Vector3d &d_): d(d_){}
 
-    EdgeiGPSDir6DoFPose()
+    void error(const Eigen::Vector3d &m, ErrorVector &e) const
     {
-        resize(2);
-    };
+        e = m - d;
+    }
 
-    virtual bool read(std::istream& is) override{};
+    void jacobian(const Eigen::Vector3d &m, JacobianType &J) const
+    {
+        J.setIdentity();
+    }
 
-    virtual bool write(std::ostream& os) const override{};
+    Eigen::Vector3d d;
+};
 
-    virtual void computeError() override
+// m projected on the plane orthogonal to d (2D), the cheapest model
+struct DirResidualTangent
+{
+    static const int D = 2;
+    typedef Eigen::Matrix<double,D,1> ErrorVector;
+    typedef Eigen::Matrix<double,D,3> JacobianType;
+
+    DirResidualTangent(const Eigen::Vector3d &d)
     {
-        _error = Eigen::Vector3d(0.0,0.0,0.0);   //error initialization
-        const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);    //Tcw
-        Eigen::Matrix3d rwc = v1->estimate().rotation().toRotationMatrix().transpose();
-        Eigen::Vector3d tcw = v1->estimate().translation();
-        Eigen::Vector3d t = - rwc * tcw;   //up-to-scale cam pose
+        // Orthonormal basis of the tangent plane, started from the axis least aligned with d
+        Eigen::Vector3d a = Eigen::Vector3d::Zero();
+        int k;
+        d.cwiseAbs().minCoeff(&k);
+        a[k] = 1.0;
+        const Eigen::Vector3d b1 = d.cross(a).normalized();
+        B.row(0) = b1.transpose();
+        B.row(1) = d.cross(b1).transpose();
+    }
 
-        const g2o::VertexSE3Expmap* v2 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[1]);  // iGPS Position in camera frame
-        Eigen::Matrix3d Rci = v2->estimate().rotation().toRotationMatrix();
-        Eigen::Vector3d tci = v2->estimate().translation();
+    void error(const Eigen::Vector3d &m, ErrorVector &e) const
+    {
+        e = B*m;
+    }
 
-        Eigen::Vector3d obs(_measurement);
-        Eigen::Vector3d GT = Rci * obs;
-        //Eigen::Vector3d iGPSPosition = Tci.block<3,1>(0,3);    //scaled iGPS Position w.r.t camera frame
-        Eigen::Vector3d iGPSPosition = tci;    //scaled iGPS Position w.r.t camera frame
-
-        Eigen::Vector3d measurement = (t-iGPSPosition)/(t-iGPSPosition).norm();
-
-        Eigen::Vector3d result = measurement - GT;
-        _error = measurement - GT;
-        //cout << "_error = " << _error <<endl;
-
-        //cout << "CamDir = " << CamDir.transpose() <<endl;
-        if(result.norm()>0.1)
-        {
-          cout << "t = " << t.transpose() <<endl;
-          cout << "iGPSPosition = " << iGPSPosition.transpose() <<endl;
-          cout << "measurement = " << measurement.transpose() <<endl;
-          cout << "GT = " << GT.transpose() <<endl;
-          cout << "Differences = " << result.transpose() <<endl;
-        }
+    void jacobian(const Eigen::Vector3d &m, JacobianType &J) const
+    {
+        J = B;
     }
+
+    JacobianType B;
 };
-*/
 
+// Azimuth and elevation of m minus those of d (2D), the angles a transmitter actually measures
+struct DirResidualAngles
+{
+    static const int D = 2;
+    typedef Eigen::Matrix<double,D,1> ErrorVector;
+    typedef Eigen::Matrix<double,D,3> JacobianType;
+
+    DirResidualAngles(const Eigen::Vector3d &d): azimuth(atan2(d.y(),d.x())), elevation(asin(std::max(-1.0,std::min(1.0,d.z())))){}
+
+    void error(const Eigen::Vector3d &m, ErrorVector &e) const
+    {
+        double da = atan2(m.y(),m.x()) - azimuth;
+        if(da > M_PI)
+            da -= 2*M_PI;
+        else if(da < -M_PI)
+            da += 2*M_PI;
+        e << da, asin(std::max(-1.0,std::min(1.0,m.z()))) - elevation;
+    }
+
+    void jacobian(const Eigen::Vector3d &m, JacobianType &J) const
+    {
+        // Both rows are singular at the poles of the transmitter frame
+        const double r2 = m.x()*m.x() + m.y()*m.y();
+        if(r2 > 1e-12)
+            J.row(0) << -m.y()/r2, m.x()/r2, 0.0;
+        else
+            J.row(0).setZero();
+        const double c2 = 1.0 - m.z()*m.z();
+        if(c2 > 1e-12)
+            J.row(1) << 0.0, 0.0, 1.0/sqrt(c2);
+        else
+            J.row(1).setZero();
+    }
+
+    double azimuth;
+    double elevation;
+};
+
+}
 
-class EdgeiGPSDir6DoFPose:public g2o::BaseMultiEdge<4,Eigen::Vector4d>
+// iGPS direction observed by a receiver on the camera, with a fixed transmitter pose. Receiver positions
+// come from a table shared by all edges, the transmitter pose is applied once when the edge is built.
+template<class Residual>
+class EdgeiGPSDirection:public g2o::BaseMultiEdge<Residual::D,typename Residual::ErrorVector>
 {
 public:
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
 
-    EdgeiGPSDir6DoFPose()
+    EdgeiGPSDirection(const iGPS::ReceiverTable* pReceivers, const int ch, const Eigen::Matrix3d &Rci, const Eigen::Vector3d &tci_, const Eigen::Vector3d &Dir):
+        channel(ch), mpReceivers(pReceivers), Ric(Rci.transpose()), tci(tci_), mResidual(Dir.normalized())
     {
-        resize(1);
+        this->resize(1);
     };
 
-    virtual bool read(std::istream& is) override{};
+    virtual bool read(std::istream& is) override{return false;};
 
-    virtual bool write(std::ostream& os) const override{};
+    virtual bool write(std::ostream& os) const override{return false;};
 
     virtual void computeError() override
     {
-        _error = Eigen::Vector4d(0.0,0.0,0.0,0.0);   //error initialization
-        const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);    //Tcw
-        Eigen::Matrix3d rcw = v1->estimate().rotation().toRotationMatrix();
-        Eigen::Vector3d tcw = v1->estimate().translation();
-        Eigen::Vector3d twc = - rcw.transpose() * tcw;   //up-to-scale cam pose
-
-        Eigen::Matrix4d Twc;
-        Twc.setIdentity();
-        Twc.block<3,3>(0,0) = rcw.transpose();
-        Twc.block<3,1>(0,3) = twc;
-        Eigen::Vector4d iGPSPosInCam4d = Eigen::Vector4d( miGPSReceive[channel].x(), miGPSReceive[channel].y(),miGPSReceive[channel].z() , 1.0);
-        Eigen::Vector4d iGPSPosition4d = Twc * iGPSPosInCam4d;
-        Eigen::Vector3d iGPSPosition3d = iGPSPosition4d.block<3,1>(0,0);
-
-        Eigen::Matrix3d Rci = Tci.rotation().toRotationMatrix();
-        Eigen::Vector3d tci = Tci.translation();
-
-        //Eigen::Vector4d obs4d(_measurement);
-        //Eigen::Vector3d obs = obs4d.block<3,1>(0,0);
-        Eigen::Vector3d GT = Rci * Dir;
-        GT.normalize();
-        //Eigen::Vector3d iGPSPosition = Tci.block<3,1>(0,3);    //scaled iGPS Position w.r.t camera frame
-        Eigen::Vector3d iGPSPosition = tci;    //scaled iGPS Position w.r.t camera frame
-
-        //Eigen::Vector3d measurement = (twc-iGPSPosition)/(twc-iGPSPosition).norm();
-        Eigen::Vector3d measurement = (iGPSPosition3d-iGPSPosition)/(iGPSPosition3d-iGPSPosition).norm();
-
-        Eigen::Vector3d result = measurement - GT;
-        //cout << "result = "<< result.transpose() <<endl;
-
-        double angle = acos((measurement.transpose() * GT).norm());
-
-        _error = Eigen::Vector4d(result.x(),result.y(),result.z(),angle);
-        //if(_error.norm()>0.05)
-        //{
-        //    cout << "iGPSPosition3d = "<< iGPSPosition3d.transpose() <<endl;
-        //    cout << "iGPSPosition = "<< iGPSPosition.transpose() <<endl;
-        //    cout << "measurement = "<< measurement.transpose() <<endl;
-        //    cout << "GT = "<< GT.transpose() <<endl <<endl;
-        //    cout << "_error = "<< _error.transpose() <<endl;
-        //}
+        const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(this->_vertices[0]);    //Tcw
+        const Eigen::Vector3d v = iGPSPosition(v1->estimate()) - tci;
+        mResidual.error(Ric*v/v.norm(), this->_error);
+    }
+
+    // Left perturbation on Tcw: receiver in world Pw = Rcw^T (pc - tcw) moves by Rcw^T [pc]x w - Rcw^T u
+    virtual void linearizeOplus() override
+    {
+        const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(this->_vertices[0]);    //Tcw
+        const g2o::SE3Quat &Tcw = v1->estimate();
+        const Eigen::Matrix3d Rwc = Tcw.rotation().toRotationMatrix().transpose();
+        const Eigen::Vector3d &pc = (*mpReceivers)[channel];
+
+        const Eigen::Vector3d v = Rwc*(pc - Tcw.translation()) - tci;
+        const double invNorm = 1.0/v.norm();
+        const Eigen::Vector3d u = v*invNorm;
+
+        Eigen::Matrix<double,3,6> dPw;
+        dPw.block<3,3>(0,0) = Rwc*g2o::skew(pc);
+        dPw.block<3,3>(0,3) = -Rwc;
+
+        // m = Ric v/|v|
+        const Eigen::Matrix<double,3,6> dm = invNorm*Ric*(Eigen::Matrix3d::Identity() - u*u.transpose())*dPw;
+
+        typename Residual::JacobianType J;
+        mResidual.jacobian(Ric*u, J);
+        this->_jacobianOplus[0] = J*dm;
+    }
+
+    Eigen::Vector3d iGPSPosition(const g2o::SE3Quat &Tcw) const
+    {
+        return Tcw.rotation().conjugate()*((*mpReceivers)[channel] - Tcw.translation());
     }
+
     int channel;
-    map<int, Eigen::Vector3d> miGPSReceive;
-    g2o::SE3Quat Tci;
-    Eigen::Vector3d Dir;
+    const iGPS::ReceiverTable* mpReceivers;
+    Eigen::Matrix3d Ric;    // camera (map) frame to transmitter frame
+    Eigen::Vector3d tci;    // transmitter position in the camera (map) frame
+    Residual mResidual;
 };
 
-/*
-class EdgeiGPSDir6DoFPose:public g2o::BaseMultiEdge<2,Eigen::Vector2d>
+// iGPS direction for monocular maps. Vertices are the camera pose Tcw, the scale between iGPS and the map
+// and the transmitter pose Tci; the camera center is compared with the scaled transmitter position.
+template<class Residual>
+class EdgeiGPSDirectionUptoScale:public g2o::BaseMultiEdge<Residual::D,typename Residual::ErrorVector>
 {
 public:
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
 
-    EdgeiGPSDir6DoFPose()
+    EdgeiGPSDirectionUptoScale(const Eigen::Vector3d &Dir): mResidual(Dir.normalized())
     {
-        resize(1);
+        this->resize(3);
     };
 
-    virtual bool read(std::istream& is) override{};
+    virtual bool read(std::istream& is) override{return false;};
 
-    virtual bool write(std::ostream& os) const override{};
+    virtual bool write(std::ostream& os) const override{return false;};
 
     virtual void computeError() override
     {
-        _error = Eigen::Vector2d(0.0,0.0);   //error initialization
-        const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);    //Tcw
-        Eigen::Matrix3d rcw = v1->estimate().rotation().toRotationMatrix();
-        Eigen::Vector3d tcw = v1->estimate().translation();
-        Eigen::Vector3d twc = - rcw.transpose() * tcw;   //up-to-scale cam pose
-
-        Eigen::Matrix4d Twc;
-        Twc.setIdentity();
-        Twc.block<3,3>(0,0) = rcw.transpose();
-        Twc.block<3,1>(0,3) = twc;
-        Eigen::Vector4d iGPSPosInCam4d = Eigen::Vector4d( miGPSReceive[channel].x(), miGPSReceive[channel].y(),miGPSReceive[channel].z() , 1.0);
-        Eigen::Vector4d iGPSPosition4d = Twc * iGPSPosInCam4d;
-        Eigen::Vector3d iGPSPosition3d = iGPSPosition4d.block<3,1>(0,0);
-
-        Eigen::Matrix3d Rci = Tci.rotation().toRotationMatrix();
-        Eigen::Vector3d tci = Tci.translation();
-
-        Eigen::Vector3d iGPS_GT = Dir;
-        iGPS_GT.normalize();
-        Eigen::Vector3d iGPSPosition = tci;
-
-        Eigen::Vector3d iGPS_meas = (iGPSPosition3d-iGPSPosition)/(iGPSPosition3d-iGPSPosition).norm();
-        iGPS_meas = Rci.transpose() * iGPS_meas;
-
-        //converter to Panoramic imagng model, origin of frame in iGPS transmitter
-        double u_meas, v_meas;
-        double u_GT  , v_GT;
-        CalculatePixelCoordinate(iGPS_meas,u_meas,v_meas);
-        CalculatePixelCoordinate(iGPS_GT,  u_GT,  v_GT);
-
-        //cout << " iGPS_GT   = " << iGPS_GT <<endl;
-        //cout << " iGPS_meas = " << iGPS_meas <<endl;
-        //cout << " u_meas , v_meas   = " << u_meas << " " << v_meas <<endl;
-        //cout << " u_GT , v_GT = " << u_GT << " " << v_GT <<endl;
-        _error = Eigen::Vector2d(u_meas - u_GT, v_meas - v_GT);
-        //if(_error.norm()>0.01)
-        //{
-            //cout << "_error = " << _error <<endl;
-        //}
+        Eigen::Matrix3d Ric;
+        Eigen::Vector3d v;
+        Direction(Ric, v);
+        mResidual.error(Ric*v/v.norm(), this->_error);
     }
 
-    int channel;
-    map<int, Eigen::Vector3d> miGPSReceive;
-    g2o::SE3Quat Tci;
-    Eigen::Vector3d Dir;
-
-    void CalculatePixelCoordinate(const Eigen::Vector3d direction,double& u, double& v)
+    // Left perturbations on Tcw and Tci, the scale is updated multiplicatively
+    virtual void linearizeOplus() override
     {
-        double Dx = direction.x(), Dy = direction.y(), Dz = direction.z();
-        double pi = 3.14159265;
-        double elevator = asin(Dz);
-        double azimuth = 0.0;
-        azimuth = asin(Dy/cos(elevator));
+        const double s = static_cast<const VertexScale*>(this->_vertices[1])->estimate();
+        const Eigen::Vector3d tci = static_cast<const g2o::VertexSE3Expmap*>(this->_vertices[2])->estimate().translation();
+        const Eigen::Matrix3d Rwc = static_cast<const g2o::VertexSE3Expmap*>(this->_vertices[0])->estimate().rotation().toRotationMatrix().transpose();
 
-        //if(Dy>0.0)
-        //{
-        //    if(Dx>0.0)
-        //    {
-        //        azimuth = asin(Dy/cos(elevator));
-        //    }
-        //    else
-        //    {
-        //        azimuth = pi - asin(Dy/cos(elevator));
-        //    }
-        //}
-        //else
-        //{
-        //    if(Dx>0.0)
-        //    {
-        //        azimuth = 2 * pi + asin(Dy/cos(elevator));
-        //    }
-        //    else
-        //    {
-        //        azimuth = pi - asin(Dy/cos(elevator));
-        //    }
-        //}
+        Eigen::Matrix3d Ric;
+        Eigen::Vector3d v;
+        Direction(Ric, v);
+        const double invNorm = 1.0/v.norm();
+        const Eigen::Vector3d u = v*invNorm;
+        const Eigen::Matrix3d dm = invNorm*Ric*(Eigen::Matrix3d::Identity() - u*u.transpose());
+
+        typename Residual::JacobianType J;
+        mResidual.jacobian(Ric*u, J);
+
+        // Camera center twc = -Rcw^T tcw
+        Eigen::Matrix<double,3,6> dv;
+        dv.block<3,3>(0,0).setZero();
+        dv.block<3,3>(0,3) = -Rwc;
+        this->_jacobianOplus[0] = J*dm*dv;
+
+        this->_jacobianOplus[1] = J*dm*(-s*tci);
 
-        double yita = tan(elevator);
-        double yipth = azimuth;
-        int nC = 5000,nR = 5000;
-        double Resolution_x = 2 * pi / nC;
-        double Resolution_y = 2 * pi / nR;
-        u = yipth / Resolution_x;
-        v = nR / 2 - yita / Resolution_y;
+        // v = twc - s tci, and Ric changes with the rotation of Tci
+        dv.block<3,3>(0,0) = s*g2o::skew(tci);
+        dv.block<3,3>(0,3) = -s*Eigen::Matrix3d::Identity();
+        Eigen::Matrix<double,3,6> dmi = dm*dv;
+        dmi.block<3,3>(0,0) += Ric*g2o::skew(u);
+        this->_jacobianOplus[2] = J*dmi;
     }
 
+    Residual mResidual;
+
+private:
+    void Direction(Eigen::Matrix3d &Ric, Eigen::Vector3d &v) const
+    {
+        const g2o::VertexSE3Expmap* v1 = static_cast<const g2o::VertexSE3Expmap*>(this->_vertices[0]);    //Tcw
+        const VertexScale* v2 = static_cast<const VertexScale*>(this->_vertices[1]);    // Scale between iGPS and cam
+        const g2o::VertexSE3Expmap* v3 = static_cast<const g2o::VertexSE3Expmap*>(this->_vertices[2]);  // iGPS Position in camera frame
+        const g2o::SE3Quat &Tcw = v1->estimate();
+        Ric = v3->estimate().rotation().toRotationMatrix().transpose();
+        v = Tcw.rotation().conjugate()*(-Tcw.translation()) - v2->estimate()*v3->estimate().translation();
+    }
 };
-*/
+
+// Builds a direction edge of the given residual model with information infoWeight*I
+g2o::OptimizableGraph::Edge* CreateiGPSDirectionEdge(const iGPS::DirectionResidual model, const iGPS::ReceiverTable* pReceivers, const int ch,
+                                                     const Eigen::Matrix3d &Rci, const Eigen::Vector3d &tci, const Eigen::Vector3d &Dir, const double infoWeight);
+g2o::OptimizableGraph::Edge* CreateiGPSDirectionUptoScaleEdge(const iGPS::DirectionResidual model, const Eigen::Vector3d &Dir, const double infoWeight);
 
 class Edge6DoFPoseVertex:public g2o::BaseUnaryEdge<6,Vector6d,g2o::VertexSE3Expmap>
 {
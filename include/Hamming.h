@@ -0,0 +1,68 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+
+#ifndef HAMMING_H
+#define HAMMING_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__POPCNT__)
+#include <immintrin.h>
+#endif
+
+namespace ORB_SLAM3
+{
+
+// Hamming distance kernels for 256 bit ORB descriptors. The instruction set is picked at compile time
+// (the release build uses -march=native): AVX-512 VPOPCNTDQ, AVX2 or hardware popcnt, else a SWAR popcount.
+namespace Hamming
+{
+
+const int DESCRIPTOR_BYTES = 32;
+
+inline int Distance(const uint8_t* a, const uint8_t* b)
+{
+#if defined(__AVX512VPOPCNTDQ__) && defined(__AVX512VL__)
+    const __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)a), _mm256_loadu_si256((const __m256i*)b));
+    const __m256i c = _mm256_popcnt_epi64(x);
+    const __m128i s = _mm_add_epi64(_mm256_castsi256_si128(c), _mm256_extracti128_si256(c,1));
+    return _mm_cvtsi128_si64(s) + _mm_extract_epi64(s,1);
+#else
+    uint64_t va[4], vb[4];
+    memcpy(va,a,DESCRIPTOR_BYTES);
+    memcpy(vb,b,DESCRIPTOR_BYTES);
+
+    int dist=0;
+    for(int i=0; i<4; i++)
+    {
+#if defined(__POPCNT__)
+        dist += __builtin_popcountll(va[i]^vb[i]);
+#else
+        uint64_t v = va[i]^vb[i];
+        v = v - ((v >> 1) & 0x5555555555555555ULL);
+        v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+        dist += (((v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL) * 0x0101010101010101ULL) >> 56;
+#endif
+    }
+    return dist;
+#endif
+}
+
+// Distances from q to the n descriptors vpD[0..n-1]
+void Distances(const uint8_t* q, const uint8_t* const* vpD, const int n, int* pDist);
+
+// Best and second best distance from q to vpD[0..n-1], in one pass. Distances start at 256 and are only
+// replaced by strictly smaller ones, as in the matcher loops. Returns the position of the best (-1 if none),
+// pBest2 gets the position of the second best.
+int BestTwo(const uint8_t* q, const uint8_t* const* vpD, const int n, int &bestDist, int &bestDist2, int* pBest2=NULL);
+
+}
+
+} //namespace ORB_SLAM3
+
+#endif // HAMMING_H
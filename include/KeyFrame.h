@@ -243,7 +243,8 @@ public:
     const std::vector<cv::KeyPoint> mvKeysUn;
     const std::vector<float> mvuRight; // negative value for monocular points
     const std::vector<float> mvDepth; // negative value for monocular points
-    const cv::Mat mDescriptors;
+    const cv::Mat mDescriptors; // view of mpDescriptors, shared with the Frame
+    const std::shared_ptr<const DescriptorArray> mpDescriptors;
 
     //BoW
     DBoW2::BowVector mBowVec;
@@ -291,7 +292,11 @@ public:
     vector<Eigen::Vector3d> miGPSDirection;
     vector<int> miGPSTransmitter;
     vector<double> miGPStime;
-    map<int, Eigen::Vector3d> miGPSReceive;
+    std::shared_ptr<const iGPS::ReceiverTable> mpiGPSReceive;
+    // Camera position located from the iGPS directions when the keyframe was created, in the iGPS world
+    // frame, so it does not drift with the map. mfiGPSPositionUncertainty < 0 if not located.
+    Eigen::Vector3d miGPSPosition;
+    float mfiGPSPositionUncertainty;
 
 
     // The following variables need to be accessed trough a mutex to be thread safe.
@@ -322,8 +327,8 @@ protected:
     KeyFrameDatabase* mpKeyFrameDB;
     ORBVocabulary* mpORBvocabulary;
 
-    // Grid over the image to speed up feature matching
-    std::vector< std::vector <std::vector<size_t> > > mGrid;
+    // Grid over the image to speed up feature matching, shared with the frame it was created from
+    std::shared_ptr<const FeatureGrid> mpGrid;
 
     std::map<KeyFrame*,int> mConnectedKeyFrameWeights;
     std::vector<KeyFrame*> mvpOrderedConnectedKeyFrames;
@@ -365,7 +370,7 @@ public:
 
     const int NLeft, NRight;
 
-    std::vector< std::vector <std::vector<size_t> > > mGridRight;
+    std::shared_ptr<const FeatureGrid> mpGridRight;
 
     cv::Mat GetRightPose();
     cv::Mat GetRightPoseInverse();
@@ -64,15 +64,24 @@ public:
    // Loop and Merge Detection
    void DetectCandidates(KeyFrame* pKF, float minScore,vector<KeyFrame*>& vpLoopCand, vector<KeyFrame*>& vpMergeCand);
    void DetectBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &vpLoopCand, vector<KeyFrame*> &vpMergeCand, int nMinWords);
-   void DetectNBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &vpLoopCand, vector<KeyFrame*> &vpMergeCand, int nNumCandidates);
+   // fiGPSGateRadius > 0 skips candidates whose iGPS position is farther than that (plus both uncertainties) from
+   // pKF, before they take one of the N places. pnGatePruned counts them.
+   void DetectNBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &vpLoopCand, vector<KeyFrame*> &vpMergeCand, int nNumCandidates,
+                              const float fiGPSGateRadius = 0.f, int* pnGatePruned = NULL);
 
    // Relocalization
    std::vector<KeyFrame*> DetectRelocalizationCandidates(Frame* F, Map* pMap);
+   // Same scoring restricted to keyframes already selected by position (iGPS prior), no inverted file scan
+   std::vector<KeyFrame*> DetectRelocalizationCandidates(Frame* F, Map* pMap, const std::vector<KeyFrame*> &vpNearKFs);
 
    void SetORBVocabulary(ORBVocabulary* pORBVoc);
 
 protected:
 
+  // Scoring shared by both relocalization searches: keyframes with mnRelocWords shared words (mnRelocQuery set
+  // to the frame) are scored, accumulated over their covisible keyframes and kept if close to the best
+  std::vector<KeyFrame*> ScoreRelocalizationCandidates(Frame* F, Map* pMap, const std::list<KeyFrame*> &lKFsSharingWords);
+
   // Associated vocabulary
   const ORBVocabulary* mpVoc;
 
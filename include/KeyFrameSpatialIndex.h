@@ -0,0 +1,66 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+
+#ifndef KEYFRAMESPATIALINDEX_H
+#define KEYFRAMESPATIALINDEX_H
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+namespace ORB_SLAM3
+{
+
+class KeyFrame;
+
+// Voxel hash over keyframe camera centers. Keyframes are kept in the voxel of their last reported
+// position, queries check the exact distance. Not thread safe, Map guards it with its own mutex.
+class KeyFrameSpatialIndex
+{
+public:
+    KeyFrameSpatialIndex(const double voxelSize = 1.0);
+
+    // Adds pKF or moves it to Ow if already indexed
+    void insert(KeyFrame* pKF, const Eigen::Vector3d &Ow);
+    void erase(KeyFrame* pKF);
+    // Moves pKF to Ow, ignored if pKF is not indexed
+    void update(KeyFrame* pKF, const Eigen::Vector3d &Ow);
+    void clear();
+
+    size_t size() const { return mmEntries.size(); }
+
+    // Keyframes with center closer than radius to Ow, closest first
+    std::vector<KeyFrame*> radiusSearch(const Eigen::Vector3d &Ow, const double radius) const;
+
+private:
+    struct Entry
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        Eigen::Vector3d Ow;
+        int64_t key;
+    };
+    typedef std::pair<double,KeyFrame*> Candidate;
+
+    Eigen::Vector3i voxel(const Eigen::Vector3d &p) const;
+    static int64_t key(const Eigen::Vector3i &v);
+
+    // Appends the keyframes of voxel v closer than radius
+    void collect(const Eigen::Vector3i &v, const Eigen::Vector3d &Ow, const double radius, std::vector<Candidate> &vCandidates) const;
+    void collectAll(const Eigen::Vector3d &Ow, const double radius, std::vector<Candidate> &vCandidates) const;
+
+    double mdInvVoxelSize;
+    std::unordered_map<int64_t, std::vector<KeyFrame*> > mmVoxels;
+    std::unordered_map<KeyFrame*, Entry, std::hash<KeyFrame*>, std::equal_to<KeyFrame*>,
+                       Eigen::aligned_allocator<std::pair<KeyFrame* const, Entry> > > mmEntries;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // KEYFRAMESPATIALINDEX_H
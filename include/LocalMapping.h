@@ -26,6 +26,8 @@
 #include "Tracking.h"
 #include "KeyFrameDatabase.h"
 #include "Initializer.h"
+#include "ThreadEvent.h"
+#include "iGPSTransmitters.h"
 
 #include <mutex>
 
@@ -49,7 +51,9 @@ public:
     void SetTracker(Tracking* pTracker);
 
     void LoadiGPSDirection(ORB_SLAM3::iGPS::Direction iGPSDirection);
-    void GetiGPStoCamTci(vector<cv::Mat> vTci);
+    void SetiGPSTransmitters(const iGPS::TransmitterRegistry &transmitters);
+    // A global visual-iGPS BA is requested once this many directions arrived in new keyframes
+    void SetiGPSGBATrigger(const int nMinNewDirections);
 
     // Main function
     void Run();
@@ -170,6 +174,9 @@ protected:
     bool mbFinished;
     std::mutex mMutexFinish;
 
+    // Wakes Run() on new keyframes, stop/release/reset requests and finish
+    ThreadEvent mWakeEvent;
+
     Atlas* mpAtlas;
 
     LoopClosing* mpLoopCloser;
@@ -213,9 +220,14 @@ protected:
         //DEBUG
     ofstream f_lm;
     vector<Eigen::Matrix<double,6,1>> vEstimatediGPSRt;
-    vector<cv::Mat> mvTci;
+    iGPS::TransmitterRegistry mTransmitters;
+    std::mutex mMutexTransmitters;  // Tracking replaces mTransmitters when the active map changes
     vector<Eigen::Matrix4d> mvTcw;
     bool mbScaleFixFlag = false;
+
+    // iGPS directions in keyframes inserted since the last global visual-iGPS BA request
+    int mnNewiGPSDirections;
+    int mnMinNewiGPSDirections;
 };
 
 } //namespace ORB_SLAM
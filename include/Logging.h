@@ -0,0 +1,103 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+
+#ifndef LOGGING_H
+#define LOGGING_H
+
+#include <string>
+#include <sstream>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "Config.h"
+
+namespace ORB_SLAM3
+{
+
+// Writes log lines to stdout from its own thread, so the threads that log never wait on the terminal.
+// When more than capacity lines are pending new ones are dropped, the writer reports how many.
+class LogSink
+{
+public:
+    static LogSink& Instance();
+
+    void Push(const std::string &line);
+    // Blocks until every line queued before the call is written
+    void Flush();
+
+    unsigned long dropped();
+
+private:
+    LogSink(const size_t capacity);
+    void Run();
+
+    std::mutex mMutex;
+    std::condition_variable mCondPush;
+    std::condition_variable mCondWritten;
+    std::deque<std::string> mqLines;
+    size_t mnCapacity;
+    unsigned long mnPushed;
+    unsigned long mnWritten;
+    unsigned long mnDropped;
+    unsigned long mnDroppedTotal;
+    std::thread* mptWriter;
+};
+
+class Verbose
+{
+public:
+    enum eLevel
+    {
+        VERBOSITY_QUIET=0,
+        VERBOSITY_NORMAL=1,
+        VERBOSITY_VERBOSE=2,
+        VERBOSITY_VERY_VERBOSE=3,
+        VERBOSITY_DEBUG=4
+    };
+
+    static eLevel th;
+
+public:
+    static void PrintMess(std::string str, eLevel lev)
+    {
+        if(lev <= th)
+            LogSink::Instance().Push(str);
+    }
+
+    static bool Enabled(eLevel lev)
+    {
+        return lev <= th;
+    }
+
+    static void SetTh(eLevel _th)
+    {
+        th = _th;
+    }
+};
+
+}
+
+// Queues the streamed message if lev passes the run time threshold (Verbose::SetTh). The message is only
+// formatted when it will be printed, and levels above LOG_MAX_LEVEL (Config.h) are compiled out:
+//   LOG_MESS(Verbose::VERBOSITY_DEBUG, "chi2 = " << chi2);
+#define LOG_MESS(lev, msg) \
+    do \
+    { \
+        if((lev) <= LOG_MAX_LEVEL && ORB_SLAM3::Verbose::Enabled(lev)) \
+        { \
+            std::ostringstream logStream; \
+            logStream << msg; \
+            ORB_SLAM3::LogSink::Instance().Push(logStream.str()); \
+        } \
+    } while(0)
+
+#define LOG_VERBOSE(msg) LOG_MESS(ORB_SLAM3::Verbose::VERBOSITY_VERBOSE, msg)
+#define LOG_DEBUG(msg) LOG_MESS(ORB_SLAM3::Verbose::VERBOSITY_DEBUG, msg)
+
+#endif // LOGGING_H
@@ -27,6 +27,8 @@
 #include "Tracking.h"
 #include "iGPSFusion.h"
 #include "Config.h"
+#include "ThreadEvent.h"
+#include "iGPSTransmitters.h"
 
 #include "KeyFrameDatabase.h"
 
@@ -63,6 +65,10 @@ public:
 
     void SetiGPSFusioner(iGPSFusion* piGPSFusioner);
 
+    // Loop and merge candidates whose iGPS position is farther than radius from the current keyframe are
+    // dropped before descriptor matching. 0 disables the gate.
+    void SetiGPSLoopGate(const float radius);
+
     // Main function
     void Run();
 
@@ -76,10 +82,21 @@ public:
     // This function will run in a separate thread
     void RunGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoopKF);
 
+    // Global visual-iGPS BA, requested by Local Mapping once enough new directions have arrived.
+    // It runs in the GBA thread when no loop closure GBA is running, and a loop closure aborts it.
+    void RequestiGPSGlobalBA(Map* pMap, const iGPS::TransmitterRegistry &transmitters, const bool bMonocular);
+    // idx is mnFullBAIdx at launch, an abort increases it
+    void RuniGPSGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoopKF, int idx);
+
     bool isRunningGBA(){
         unique_lock<std::mutex> lock(mMutexGBA);
         return mbRunningGBA;
     }
+    // The GBA thread runs an iGPS GBA, not a loop closure one
+    bool isRunningiGPSGBA(){
+        unique_lock<std::mutex> lock(mMutexGBA);
+        return mbRunningGBA && mniGPSGBAIdx == mnFullBAIdx;
+    }
     bool isFinishedGBA(){
         unique_lock<std::mutex> lock(mMutexGBA);
         return mbFinishedGBA;
@@ -117,6 +134,12 @@ protected:
 
     bool CheckNewKeyFrames();
 
+    void LaunchiGPSGlobalBA();
+    bool isiGPSGlobalBARequested();
+    // Aborts the GBA in flight and joins its thread, used at finish to make room for the final iGPS GBA
+    void StopGlobalBundleAdjustment();
+    void ApplyGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoopKF);
+
 
     //Methods to implement the new place recognition algorithm
     bool NewDetectCommonRegions();
@@ -151,6 +174,9 @@ protected:
     bool mbFinished;
     std::mutex mMutexFinish;
 
+    // Wakes Run() on new keyframes, reset requests and finish
+    ThreadEvent mWakeEvent;
+
     Atlas* mpAtlas;
     Tracking* mpTracker;
 
@@ -222,7 +248,22 @@ protected:
     bool mbFixScale;
 
 
-    bool mnFullBAIdx;
+    int mnFullBAIdx;
+
+    // Pending global visual-iGPS BA
+    std::mutex mMutexiGPSGBA;
+    bool mbiGPSGBARequested;
+    Map* mpiGPSGBAMap;
+    iGPS::TransmitterRegistry mTransmittersGBA;
+    bool mbMonocularGBA;
+    // mnFullBAIdx of the running iGPS GBA, -1 when it is done
+    int mniGPSGBAIdx;
+    double mdiGPSGBALambda;     // final damping of the last solve, the next one starts from it
+
+    // iGPS spatial gate of place recognition and its counters
+    float mfiGPSLoopGateRadius;
+    int mniGPSGateQueries;      // keyframes queried with the gate active
+    int mniGPSGatePruned;       // BoW candidates it rejected
 
 
 
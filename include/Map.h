@@ -22,6 +22,7 @@
 
 #include "MapPoint.h"
 #include "KeyFrame.h"
+#include "KeyFrameSpatialIndex.h"
 
 #include <set>
 #include <pangolin/pangolin.h>
@@ -57,6 +58,11 @@ public:
 
     std::vector<KeyFrame*> GetAllKeyFrames();
     std::vector<MapPoint*> GetAllMapPoints();
+
+    // Keyframes by camera center, closest first, without scanning the whole map
+    std::vector<KeyFrame*> GetKeyFramesInRadius(const Eigen::Vector3d &Ow, const double radius);
+    // Called by KeyFrame::SetPose, so local BA, loop corrections and GBA keep the index up to date
+    void UpdateKeyFramePosition(KeyFrame* pKF);
     std::vector<MapPoint*> GetReferenceMapPoints();
 
     long unsigned int MapPointsInMap();
@@ -158,6 +164,10 @@ protected:
     bool mbIMU_BA2;
 
     std::mutex mMutexMap;
+
+    // Keyframe camera centers, guarded by its own mutex so pose updates never wait on mMutexMap
+    KeyFrameSpatialIndex mKeyFrameIndex;
+    std::mutex mMutexKeyFrameIndex;
 };
 
 } //namespace ORB_SLAM3
@@ -84,7 +84,7 @@ public:
 
     void ComputeDistinctiveDescriptors();
 
-    cv::Mat GetDescriptor();
+    Descriptor GetDescriptor();
 
     void UpdateNormalAndDepth();
     void SetNormalVector(cv::Mat& normal);
@@ -158,7 +158,7 @@ protected:
      cv::Matx31f mNormalVectorx;
 
      // Best descriptor to fast matching
-     cv::Mat mDescriptor;
+     AtomicDescriptor mDescriptor;
 
      // Reference KeyFrame
      KeyFrame* mpRefKF;
@@ -38,6 +38,7 @@
 #include "Thirdparty/g2o/g2o/core/robust_kernel_impl.h"
 #include "Thirdparty/g2o/g2o/solvers/linear_solver_dense.h"
 #include "G2oTypes.h"
+#include "iGPSTransmitters.h"
 #include <algorithm>
 
 namespace ORB_SLAM3
@@ -53,12 +54,15 @@ public:
                                  int nIterations = 5, bool *pbStopFlag=NULL, const unsigned long nLoopKF=0,
                                  const bool bRobust = true);
     void static GlobalViBundleAdjustemnt(const std::vector<KeyFrame*> &vpKF, const std::vector<MapPoint*> &vpMP,
-                                 vector<cv::Mat>& mvTci, bool mbMonocular, int nIterations = 5, long weight = 1e5, bool *pbStopFlag=NULL, const unsigned long nLoopKF=0,
-                                 const bool bRobust = true);
+                                 const iGPS::TransmitterRegistry& transmitters, bool mbMonocular, int nIterations = 5, long weight = 1e5, bool *pbStopFlag=NULL, const unsigned long nLoopKF=0,
+                                 const bool bRobust = true, double* pLambda = NULL, const bool bStage = false);
     void static GlobalBundleAdjustemnt(Map* pMap, int nIterations=5, bool *pbStopFlag=NULL,
                                        const unsigned long nLoopKF=0, const bool bRobust = true);
-    bool static GlobalVisualiGPSBundleAdjustemnt(Map* pMap, vector<cv::Mat>& mvTci, bool mbMonocular, int nIterations=5, long weight = 1e5, bool *pbStopFlag=NULL,
-                                       const unsigned long nLoopKF=0, const bool bRobust = true);
+    // pLambda: Levenberg damping to start from (warm start if > 0), set to the final damping on return
+    // bStage: store the result in mTcwGBA/mPosGBA, tagged with nLoopKF, for LoopClosing to apply through the
+    // spanning tree, instead of writing it to the map
+    bool static GlobalVisualiGPSBundleAdjustemnt(Map* pMap, const iGPS::TransmitterRegistry& transmitters, bool mbMonocular, int nIterations=5, long weight = 1e5, bool *pbStopFlag=NULL,
+                                       const unsigned long nLoopKF=0, const bool bRobust = true, double* pLambda = NULL, const bool bStage = false);
     void static FullInertialBA(Map *pMap, int its, const bool bFixLocal=false, const unsigned long nLoopKF=0, bool *pbStopFlag=NULL, bool bInit=false, float priorG = 1e2, float priorA=1e6, Eigen::VectorXd *vSingVal = NULL, bool *bHess=NULL);
 
     void static LocalBundleAdjustment(KeyFrame* pKF, bool *pbStopFlag, vector<KeyFrame*> &vpNonEnoughOptKFs);
@@ -67,7 +71,10 @@ public:
     void static MergeBundleAdjustmentVisual(KeyFrame* pCurrentKF, vector<KeyFrame*> vpWeldingKFs, vector<KeyFrame*> vpFixedKFs, bool *pbStopFlag);
 
     int static PoseOptimization(Frame* pFrame);
-    int static iGPSDirectionPoseOptimization(Frame* pFrame,vector<cv::Mat>& vTci,double weight);
+    // PoseOptimization with the iGPS directions of the frame. Returns the visual inliers, pnDirInliers the directions
+    // kept. bDirectionsOnly ignores the map point matches, to refine a predicted pose before matching.
+    int static iGPSDirectionPoseOptimization(Frame* pFrame,const iGPS::TransmitterRegistry& transmitters,double weight,
+                                             int* pnDirInliers = NULL, const bool bDirectionsOnly = false);
 
     int static PoseInertialOptimizationLastKeyFrame(Frame* pFrame, bool bRecInit = false);
     int static PoseInertialOptimizationLastFrame(Frame *pFrame, bool bRecInit = false);
@@ -126,14 +133,24 @@ public:
     void static InertialOptimization(Map *pMap, Eigen::Matrix3d &Rwg, double &scale);
 
     //Tci denotes the iGPS pose in camera frame
-    void static LocaliGPSDirBA(KeyFrame* pKF, bool *pbStopFlag, Map *pMap, int& num_fixedKF, int& num_OptKF, int& num_MPs, int& num_edges, double& iGPSPoseScale, vector<cv::Mat>& vTci, vector<Eigen::Matrix4d>& vTcw,bool bScaleFixFlag, bool bMonocular, list<KeyFrame*> lKF, long weight);
+    void static LocaliGPSDirBA(KeyFrame* pKF, bool *pbStopFlag, Map *pMap, int& num_fixedKF, int& num_OptKF, int& num_MPs, int& num_edges, double& iGPSPoseScale, iGPS::TransmitterRegistry& transmitters, vector<Eigen::Matrix4d>& vTcw,bool bScaleFixFlag, bool bMonocular, list<KeyFrame*> lKF, long weight);
     void static iGPSDirectionOptimization(Map *pMap,Eigen::Matrix4d& T, int Channel);
 
+    // Keyframe pose and a direction of receiver channel 1, copied from the map so the transmitter
+    // calibrations can run without holding the map
+    struct iGPSCalibrationSample
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        g2o::SE3Quat Tcw;
+        Eigen::Vector3d Dir;
+        int transmitter;
+    };
+    void static GetiGPSCalibrationSamples(Map *pMap, vector<iGPSCalibrationSample>& vSamples);
+    void static iGPSDirectionOptimization(const vector<iGPSCalibrationSample>& vSamples,Eigen::Matrix4d& Twc, int TrmSpeed, bool bVerbose=true);
+
     template<class T>
-    void static addiGPSDirectionEdge(g2o::SparseOptimizer&,T,vector<cv::Mat>&,vector<EdgeiGPSDir6DoFPose*>&,long weight);
-    void static addiGPSDirectionPoseOptimizationEdge(g2o::SparseOptimizer&,Frame *,vector<cv::Mat>&,vector<EdgeiGPSDir6DoFPose*>&,double weight);
-    void static identifyTransmitter(int Trm,int &i);
-    void static calculateiGPSDirectionWeight(int td, int& weight);
+    void static addiGPSDirectionEdge(g2o::SparseOptimizer&,T,const iGPS::TransmitterRegistry&,vector<g2o::OptimizableGraph::Edge*>&,long weight);
+    void static addiGPSDirectionPoseOptimizationEdge(g2o::SparseOptimizer&,Frame *,const iGPS::TransmitterRegistry&,vector<g2o::OptimizableGraph::Edge*>&,double weight);
 
 };
 
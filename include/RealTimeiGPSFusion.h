@@ -12,6 +12,7 @@
 #include <map>
 #include <vector>
 #include <ctime>
+#include <iomanip>
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 #include <Eigen/Dense>
@@ -31,8 +32,11 @@
 #include "Thirdparty/g2o/g2o/solvers/linear_solver_dense.h"
 
 #include "Converter.h"
+#include "iGPSTypes.h"
 #include "Tracking.h"
 #include "LoopClosing.h"
+#include "ThreadEvent.h"
+#include "TrajectorySink.h"
 
 using namespace std;
 
@@ -71,7 +75,38 @@ namespace ORB_SLAM3
             _error[5] = 2 * errorQ.z();
 
         }
-        //virtual void linearizeOplus() override{};
+
+        // Left perturbation T <- exp(d)*T with d = [w,v]: translation error rows 0-2, rotation error rows 3-5
+        virtual void linearizeOplus() override{
+            const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);
+            const g2o::VertexSE3Expmap * v2 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[1]);
+            const g2o::SE3Quat wTi = v1->estimate();
+            const g2o::SE3Quat wTj = v2->estimate();
+            const Eigen::Matrix3d Riw = wTi.rotation().toRotationMatrix().transpose();
+            const Eigen::Matrix3d Rjw = wTj.rotation().toRotationMatrix().transpose();
+            const Eigen::Matrix3d tj_skew = g2o::skew(wTj.translation());
+
+            const Eigen::Quaterniond errorQ = _measurement.rotation().inverse() * (wTi.inverse() * wTj).rotation();
+            const Eigen::Matrix3d Jr = errorQ.w() * Eigen::Matrix3d::Identity() + g2o::skew(errorQ.vec());
+
+            _jacobianOplusXi.block<3,3>(0,0) = -Riw * tj_skew;
+            _jacobianOplusXi.block<3,3>(0,3) = Riw;
+            _jacobianOplusXi.block<3,3>(3,0) = -Jr * Rjw;
+            _jacobianOplusXi.block<3,3>(3,3) = Eigen::Matrix3d::Zero();
+
+            _jacobianOplusXj.block<3,3>(0,0) = Riw * tj_skew;
+            _jacobianOplusXj.block<3,3>(0,3) = -Riw;
+            _jacobianOplusXj.block<3,3>(3,0) = Jr * Rjw;
+            _jacobianOplusXj.block<3,3>(3,3) = Eigen::Matrix3d::Zero();
+        }
+
+        Eigen::Matrix<double,12,12> GetHessian(){
+            linearizeOplus();
+            Eigen::Matrix<double,6,12> J;
+            J.block<6,6>(0,0) = _jacobianOplusXi;
+            J.block<6,6>(0,6) = _jacobianOplusXj;
+            return J.transpose()*information()*J;
+        }
 
     private:
         double _scale;
@@ -81,7 +116,9 @@ namespace ORB_SLAM3
     public:
         EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
 
-        RealTimeEdgeSE3iGPSFusion(){};
+        // lever: body frame offset from the pose to where the iGPS fix was taken, non-zero when
+        // the fix falls between two VO poses and is attached to the nearest one
+        RealTimeEdgeSE3iGPSFusion(const Eigen::Vector3d &lever = Eigen::Vector3d::Zero()):_lever(lever){};
 
         virtual bool read(std::istream& is) override{};
 
@@ -90,11 +127,75 @@ namespace ORB_SLAM3
         virtual void computeError() override {
             const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);
             g2o::Vector3D obs(_measurement);
-            g2o::Vector3D P3d = v1->estimate().translation();
+            g2o::Vector3D P3d = v1->estimate().map(_lever);
             _error =  obs - P3d ;
         }
+
+        virtual void linearizeOplus() override{
+            const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);
+            g2o::Vector3D P3d = v1->estimate().map(_lever);
+            _jacobianOplusXi.block<3,3>(0,0) = g2o::skew(P3d);
+            _jacobianOplusXi.block<3,3>(0,3) = -Eigen::Matrix3d::Identity();
+        }
+
+        Eigen::Matrix<double,6,6> GetHessian(){
+            linearizeOplus();
+            return _jacobianOplusXi.transpose()*information()*_jacobianOplusXi;
+        }
     private:
-        //double _precision;
+        Eigen::Vector3d _lever;
+    };
+    //Prior left on the oldest pose of the sliding window by the marginalized poses
+    class RealTimeEdgeSE3Prior:public g2o::BaseUnaryEdge<6,g2o::SE3Quat,g2o::VertexSE3Expmap>
+    {
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+
+        RealTimeEdgeSE3Prior(){};
+
+        virtual bool read(std::istream& is) override{};
+
+        virtual bool write(std::ostream& os) const override{};
+
+        virtual void computeError() override {
+            const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);
+            _error = (v1->estimate() * _measurement.inverse()).log();
+        }
+
+        // Left perturbation T <- exp(d)*T: log(exp(d)*exp(e)) = e + Jl(e)^-1*d, with the SE3 left Jacobian
+        // (Barfoot, State Estimation for Robotics, 7.86) of e = [w,u] in the rotation first order of g2o
+        virtual void linearizeOplus() override{
+            const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);
+            const g2o::Vector6d e = (v1->estimate() * _measurement.inverse()).log();
+            const Eigen::Matrix3d W = g2o::skew(Eigen::Vector3d(e.head<3>()));
+            const Eigen::Matrix3d U = g2o::skew(Eigen::Vector3d(e.tail<3>()));
+            const Eigen::Matrix3d W2 = W * W;
+            const double theta = e.head<3>().norm();
+
+            // Series limits for small rotations
+            double cJ = 1.0/12.0, c1 = 1.0/6.0, c2 = 1.0/24.0, c3 = 1.0/120.0;
+            if(theta > 1e-4)
+            {
+                const double theta2 = theta * theta;
+                cJ = 1.0/theta2 - (1.0 + cos(theta))/(2.0 * theta * sin(theta));
+                c1 = (theta - sin(theta))/(theta2 * theta);
+                c2 = (theta2 + 2.0 * cos(theta) - 2.0)/(2.0 * theta2 * theta2);
+                c3 = (2.0 * theta - 3.0 * sin(theta) + theta * cos(theta))/(2.0 * theta2 * theta2 * theta);
+            }
+            const Eigen::Matrix3d Jinv = Eigen::Matrix3d::Identity() - 0.5 * W + cJ * W2;
+            const Eigen::Matrix3d Q = 0.5 * U + c1 * (W*U + U*W + W*U*W) + c2 * (W2*U + U*W2 - 3.0 * W*U*W)
+                                    + c3 * (W*U*W2 + W2*U*W);
+
+            _jacobianOplusXi.block<3,3>(0,0) = Jinv;
+            _jacobianOplusXi.block<3,3>(0,3) = Eigen::Matrix3d::Zero();
+            _jacobianOplusXi.block<3,3>(3,0) = -Jinv * Q * Jinv;
+            _jacobianOplusXi.block<3,3>(3,3) = Jinv;
+        }
+
+        Eigen::Matrix<double,6,6> GetHessian(){
+            linearizeOplus();
+            return _jacobianOplusXi.transpose()*information()*_jacobianOplusXi;
+        }
     };
     class RealTimeEdgeSim3:public g2o::BaseUnaryEdge<3,Eigen::Vector3d,g2o::VertexSim3Expmap>
     {
@@ -132,20 +233,36 @@ namespace ORB_SLAM3
     class RealTimeiGPSFusion
     {
     public:
-        RealTimeiGPSFusion();
+        // strResultFile: fused poses are streamed there (CSV, appended) by a background writer
+        RealTimeiGPSFusion(const string &strResultFile = "./RealTimeResult.txt");
+        ~RealTimeiGPSFusion();
         void RequestFinish();
         bool isFinished();
+        // True once optimize() has handled every iGPS sample received so far
+        bool isIdle();
 
         void optimize();
         void SetTracker(Tracking* mptTracker);
         void SetLoopCloser(LoopClosing* mptLoopCloser);
         void inputiGPS(double t, cv::Point3f p3D);
         void inputVO(double t, cv::Mat pose);
+        // Newest fused pose, safe to call from any thread. False until the first solve
         bool getFusionResult(Eigen::Vector3d & P,Eigen::Quaterniond & Q);
+        bool getFusionResult(iGPS::FusionResult & result);
 
 
     protected:
         void SetFinish();
+
+        // Fixed-lag pose graph kept alive between solves
+        void ResetWindow();
+        void AddPoseToWindow(double t);
+        void MarginalizeOldestPose();
+        bool ComputeLatestCovariance(Eigen::Matrix<double,6,6> &cov);
+
+        // SE(3) interpolation of a pose buffer at time t, translations multiplied by scale
+        bool InterpolatePose(const iGPS::TimeBuffer<iGPS::Pose> &poses, const double &t, g2o::SE3Quat &T, const double scale = 1.0);
+
         bool mbFinishRequested;
         bool mbFinished;
         bool mbStopped;
@@ -154,18 +271,37 @@ namespace ORB_SLAM3
         std::mutex mMutexFinish;
         std::mutex mMutexStop;
     private:
-        Eigen::Vector3d last_p;
-        Eigen::Quaterniond last_q;
+        iGPS::SeqLock<iGPS::FusionResult> mFusionResult;
+        // Solves published and their summed latency (ms), only touched by the fusion thread
+        unsigned long mnSolves;
+        double mdTotalSolveTime;
+        TrajectorySink* mpResultSink;
         Eigen::Matrix4d iGPS_T_VO;
-        std::map<double, std::vector<double>> VOPoseMap;
-        std::map<double, cv::Point3f> iGPSPositionMap;
-        std::map<double, std::vector<double>> mmFusionPoseMap;
+        iGPS::TimeBuffer<iGPS::Pose> mVOPoses;
+        iGPS::TimeBuffer<iGPS::Point> miGPSPositions;
+        iGPS::TimeBuffer<iGPS::Pose> mFusionPoses;
+        // Samples older than the newest one of their buffer, dropped by inputiGPS/inputVO
+        size_t mnRejectedSamples;
         double mScale,mLastScale;
         bool mbfusionFlag,mbScaleFlag;
+        bool mbProcessingiGPS;
         std::mutex mMutexiGPS,m_PoseMap;
+        // Raised by inputiGPS and RequestFinish, waited on by optimize()
+        ThreadEvent mWakeEvent;
         double mLast_time; // last iGPS receive time due to occupation phenomenon;
         double mEstimatedScale;
         Eigen::Matrix4d mEstimatedTransformation;
+
+        // Sliding window: poses older than mnWindowSize are marginalized into mpWindowPrior
+        g2o::SparseOptimizer* mpWindowOptimizer;
+        std::map<double, g2o::VertexSE3Expmap*> mmWindowVertices;
+        RealTimeEdgeSE3Prior* mpWindowPrior;
+        long unsigned int mnNextWindowId;
+        double mLastWindowiGPSTime;
+        size_t mnWindowSize;
+        int mnWindowIterations;
+        // iGPS fixes are only associated between VO poses closer in time than this (s)
+        double mdMaxAssociationGap;
     };
 }
 
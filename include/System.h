@@ -38,37 +38,16 @@
 #include "Viewer.h"
 #include "ImuTypes.h"
 #include "Config.h"
+#include "Logging.h"
 #include <iGPSTypes.h>
 
 namespace ORB_SLAM3
 {
 
-class Verbose
+namespace iGPS
 {
-public:
-    enum eLevel
-    {
-        VERBOSITY_QUIET=0,
-        VERBOSITY_NORMAL=1,
-        VERBOSITY_VERBOSE=2,
-        VERBOSITY_VERY_VERBOSE=3,
-        VERBOSITY_DEBUG=4
-    };
-
-    static eLevel th;
-
-public:
-    static void PrintMess(std::string str, eLevel lev)
-    {
-        if(lev <= th)
-            cout << str << endl;
-    }
-
-    static void SetTh(eLevel _th)
-    {
-        th = _th;
-    }
-};
+class LogReader;
+}
 
 class Viewer;
 class FrameDrawer;
@@ -116,7 +95,11 @@ public:
     // Returns the camera pose (empty if tracking fails).
     cv::Mat TrackMonocular(const cv::Mat &im, const double &timestamp, const vector<IMU::Point>& vImuMeas = vector<IMU::Point>(), string filename="");
 
-    void LoadiGPSDirection(vector<double> vTimestamps, ORB_SLAM3::iGPS::Direction* iGPSDirection);
+    void LoadiGPSDirection(const vector<double> &vTimestamps, ORB_SLAM3::iGPS::Direction* iGPSDirection);
+    // Binary direction log (see iGPSLog.h), must stay open while tracking
+    void LoadiGPSDirection(const iGPS::LogReader* piGPSLog);
+    // Live iGPS input, may be called from the receiver thread while frames are tracked
+    void GrabiGPSDirection(const iGPS::Direction &iGPSDirection);
     void LoadCameraPose(vector<double> &vTimeStamps,vector<Eigen::VectorXf> &vCameraPose);
 
     // This stops local mapping thread (map building) and performs only camera tracking.
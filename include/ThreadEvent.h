@@ -0,0 +1,41 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+
+#ifndef THREADEVENT_H
+#define THREADEVENT_H
+
+#include <mutex>
+#include <condition_variable>
+
+namespace ORB_SLAM3
+{
+
+// Wake-up channel for the worker thread loops. Producers call Notify() after queueing work,
+// the worker blocks in Wait() instead of sleeping. Shutdown() wakes the worker for good.
+class ThreadEvent
+{
+public:
+    ThreadEvent();
+
+    // A notification raised while the worker is busy is kept until its next Wait()
+    void Notify();
+    void Shutdown();
+    bool isShutdown();
+
+    // Blocks until notified, shut down or timeout_us microseconds elapsed. Returns false on timeout
+    bool Wait(const int timeout_us);
+
+private:
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    bool mbSignaled;
+    bool mbShutdown;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // THREADEVENT_H
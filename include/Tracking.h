@@ -38,11 +38,14 @@
 #include "System.h"
 #include "ImuTypes.h"
 #include "iGPSTypes.h"
+#include "iGPSLog.h"
+#include "iGPSTransmitters.h"
 #include "GeometricCamera.h"
 
 #include "RealTimeiGPSFusion.h"
 
 #include <mutex>
+#include <deque>
 #include <unordered_set>
 
 namespace ORB_SLAM3
@@ -55,6 +58,7 @@ class LocalMapping;
 class LoopClosing;
 class System;
 class RealTimeiGPSFusion;
+class ORBmatcher;
 
 class Tracking
 {  
@@ -80,6 +84,9 @@ public:
     // cv::Mat GrabImageImuMonocular(const cv::Mat &im, const double &timestamp);
 
     void GrabImuData(const IMU::Point &imuMeasurement);
+    // Live iGPS input. Samples are queued in time order and drained up to each frame,
+    // once used this replaces the preloaded directions
+    void GrabiGPSDirection(const iGPS::Direction &iGPSDirection);
 
     void SetLocalMapper(LocalMapping* pLocalMapper);
     void SetLoopClosing(LoopClosing* pLoopClosing);
@@ -87,13 +94,16 @@ public:
     void SetRealTimeiGPSFusioner(RealTimeiGPSFusion* pRealTimeiGPSFusioner);
     void SetStepByStep(bool bSet);
 
-    void LoadiGPSDirection(vector<double> vTimestamps, ORB_SLAM3::iGPS::Direction* iGPSDirection);
+    void LoadiGPSDirection(const vector<double> &vTimestamps, ORB_SLAM3::iGPS::Direction* iGPSDirection);
+    // Directions are read in place from the mapped log, which must stay open while tracking
+    void LoadiGPSDirection(const iGPS::LogReader* piGPSLog);
     void LoadCameraPose(vector<double> &vTimeStamps,vector<Eigen::VectorXf> &vCameraPose);
     void InitializeiGPS(KeyFrame* pKFini, KeyFrame* pKFcur);
     void GetiGPSMeasurement();
     void GetiGPSDirectionMeasurement();
     int GetiGSReceivesInCameraFrame();
     void GetInitialCamPoseTcw(const double ,cv::Mat &);
+    iGPS::Direction GetiGPSDirection(const size_t m);
 
     // Load new settings
     // The focal lenght should be similar or scale prediction will fail when projecting points
@@ -152,8 +162,13 @@ public:
     //vector<Eigen::Matrix<double,6,1>> mviGPSPosition;
     vector<double> mviGPSTimestamps;
     ORB_SLAM3::iGPS::Direction* miGPSAllDirection;
+    const iGPS::LogReader* mpiGPSLog;
     vector<double> mvCamTimestamps;
     vector<Eigen::VectorXf> mvCamPose;
+    // Per-frame lookups in the raw timestamp columns above (or the mapped log), searched in place with t*unit.
+    // No copy is kept, so a column must outlive its index and stay unmodified until the next assign.
+    iGPS::TimeIndex mTimeIndexiGPS;
+    iGPS::TimeIndex mTimeIndexCam;
     // Lists used to recover the full camera trajectory at the end of the execution.
     // Basically we store the reference keyframe for each frame and its relative transformation
     list<cv::Mat> mlRelativeFramePoses;
@@ -224,6 +239,27 @@ protected:
     bool PredictStateIMU();
 
     bool Relocalization();
+    // BoW matching and pose estimation against the candidates, seeded with TcwPrior if it is not empty
+    bool RelocalizeFromCandidates(const vector<KeyFrame*> &vpCandidateKFs, const cv::Mat &TcwPrior);
+    // Grows the inliers of a relocalization pose by projection of the map points of pKF
+    int RefineRelocalizationPose(KeyFrame* pKF, set<MapPoint*> &sFound, int nGood, ORBmatcher &matcher);
+    // Camera position from the iGPS directions of F, and the pose Tcw if three or more receivers are located.
+    // fUncertainty bounds the position error when only the receivers, not the camera, are located.
+    bool PredictiGPSPose(Frame &F, Eigen::Vector3d &Ow, cv::Mat &Tcw, float &fUncertainty);
+    // The iGPS directions are metric, a monocular map has no scale to compare them with until the IMU initializes it
+    bool MapHasMetricScale() const;
+    // The transmitter poses hold only in the map they were estimated in. Called when the active map changes,
+    // the directions give no prior until the next map initialization estimates them again.
+    void ResetTransmitterPoses();
+
+    // Motion-only BA of the current frame, with its iGPS directions when direction tracking is on.
+    // mnFrameDirInliers holds the directions kept.
+    int OptimizeFramePose();
+    // Moves the predicted pose of the current frame onto its iGPS directions, false if too few of them agree
+    bool RefinePoseWithDirections();
+    bool FrameHasDirections() const;
+    // Visual matches required instead of n when the directions constrain the pose
+    int MatchesNeeded(const int n, const bool biGPS) const;
 
     void UpdateLocalMap();
     void UpdateLocalPoints();
@@ -256,6 +292,12 @@ protected:
     std::vector<IMU::Point> mvImuFromLastFrame;
     std::mutex mMutexImuQueue;
 
+    // Queue of iGPS directions from GrabiGPSDirection, oldest first. Bounded to mnMaxiGPSQueue samples
+    std::deque<iGPS::Direction> mlQueueiGPSDirection;
+    size_t mnMaxiGPSQueue;
+    bool mbiGPSStreaming;
+    std::mutex mMutexiGPSQueue;
+
     // Imu calibration parameters
     IMU::Calib *mpImuCalib;
 
@@ -371,11 +413,22 @@ protected:
 
     long CountLines(string filename);
 
-    vector<cv::Mat> vTwi,vTci;
-    map<int, Eigen::Vector3d> miGPSReceive;
+    iGPS::TransmitterRegistry mTransmitters;
+    // Relocalization scores only the keyframes this close to the iGPS position (iGPS.RelocalizationRadius, 0 disables)
+    float mfiGPSRelocRadius;
+    // Place recognition drops candidates this far from the iGPS position (iGPS.LoopGateRadius, 0 disables)
+    float mfiGPSLoopGateRadius;
+    // New keyframe directions that trigger a global visual-iGPS BA (iGPS.GBAMinNewDirections)
+    int mniGPSGBAMinNewDirections;
+    // Per-frame pose optimization with the iGPS directions (iGPS.DirectionTracking). A frame with at least
+    // iGPS.TrackingMinDirections inlier directions is accepted with half the visual matches.
+    bool mbiGPSDirTracking;
+    int mniGPSMinDirInliers;
+    int mnFrameDirInliers;
+    std::shared_ptr<const iGPS::ReceiverTable> mpiGPSReceive;
     public:
     cv::Mat mImRight;
-    int mPnpWeight;
+    double mPnpWeight;
 };
 
 } //namespace ORB_SLAM
@@ -0,0 +1,74 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+
+#ifndef TRAJECTORYSINK_H
+#define TRAJECTORYSINK_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <atomic>
+
+#include "iGPSTypes.h"
+#include "ThreadEvent.h"
+
+namespace ORB_SLAM3
+{
+
+// Writes a pose stream to disk from a background thread. The producer only copies the pose into a
+// single-producer/single-consumer ring, so no file I/O happens on the caller's thread.
+// CSV rows are "t*timeScale x y z qx qy qz qw" with the given separator, BINARY rows are the same 8 doubles.
+class TrajectorySink
+{
+public:
+    enum eFormat{
+        CSV=0,
+        BINARY=1
+    };
+
+    TrajectorySink(const std::string &filename, const char separator = ',', const double timeScale = 1.0,
+                   const eFormat format = CSV, const bool bAppend = true, const size_t capacity = 4096);
+    ~TrajectorySink();
+
+    // Queue a pose (single producer). If the ring is full the pose is dropped and false returned,
+    // unless bWait is set, then it waits for the writer to make room.
+    bool Push(const iGPS::Pose &pose, const bool bWait = false);
+
+    // Block until every queued pose has been written
+    void Flush();
+
+    // Write what is left, stop the writer thread and close the file
+    void Close();
+
+    bool isOpen();
+    size_t GetDropped();
+
+protected:
+    void Run();
+    size_t WriteBatch();
+
+    std::string mFilename;
+    char mSeparator;
+    double mTimeScale;
+    eFormat mFormat;
+    std::ofstream mFile;
+
+    std::vector<iGPS::Pose> mvRing;
+    size_t mnMask;
+    std::atomic<size_t> mnHead;     // next pose to write, owned by the writer
+    std::atomic<size_t> mnTail;     // next free slot, owned by the producer
+    std::atomic<size_t> mnDropped;
+
+    ThreadEvent mWakeEvent;         // producer -> writer
+    ThreadEvent mDrainedEvent;      // writer -> Flush/Push(bWait)
+    std::thread* mptWriter;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // TRAJECTORYSINK_H
@@ -0,0 +1,61 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace ORB_SLAM3
+{
+
+// Threads started once and kept for the whole run. ParallelFor hands the indices of a loop out to the
+// workers and to the calling thread, so a task may itself call ParallelFor without deadlocking the pool.
+class WorkerPool
+{
+public:
+    // nThreads workers besides the callers
+    explicit WorkerPool(const int nThreads);
+    ~WorkerPool();
+
+    // Pool of the process, one worker less than the hardware threads
+    static WorkerPool& Shared();
+
+    // Runs f(i) for i in [0,n) and returns when all of them have finished
+    void ParallelFor(const int n, const std::function<void(int)> &f);
+
+    int size() const { return mvThreads.size(); }
+
+private:
+    struct Job
+    {
+        const std::function<void(int)>* pf;
+        int n;
+        int next;
+        int done;
+    };
+
+    void Run();
+    // Claims an index of the first queued job, false if none is left. Needs mMutex.
+    bool Claim(Job* &pJob, int &i);
+
+    std::vector<std::thread> mvThreads;
+    std::deque<Job*> mqJobs;
+    std::mutex mMutex;
+    std::condition_variable mCondWork;
+    std::condition_variable mCondDone;
+    bool mbFinish;
+};
+
+} //namespace ORB_SLAM3
+
+#endif // WORKERPOOL_H
@@ -34,7 +34,10 @@
 #include "Thirdparty/g2o/g2o/solvers/linear_solver_dense.h"
 
 #include "Converter.h"
+#include "iGPSTypes.h"
 #include "LoopClosing.h"
+#include "ThreadEvent.h"
+#include "TrajectorySink.h"
 
 using namespace std;
 
@@ -79,7 +82,38 @@ public:
         //std::cout<< "_measurement = " << _measurement <<std::endl;
 
     }
-    //virtual void linearizeOplus() override{};
+
+    // Left perturbation T <- exp(d)*T with d = [w,v]: translation error rows 0-2, rotation error rows 3-5
+    virtual void linearizeOplus() override{
+        const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);
+        const g2o::VertexSE3Expmap * v2 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[1]);
+        const g2o::SE3Quat wTi = v1->estimate();
+        const g2o::SE3Quat wTj = v2->estimate();
+        const Eigen::Matrix3d Riw = wTi.rotation().toRotationMatrix().transpose();
+        const Eigen::Matrix3d Rjw = wTj.rotation().toRotationMatrix().transpose();
+        const Eigen::Matrix3d tj_skew = g2o::skew(wTj.translation());
+
+        const Eigen::Quaterniond errorQ = _measurement.rotation().inverse() * (wTi.inverse() * wTj).rotation();
+        const Eigen::Matrix3d Jr = errorQ.w() * Eigen::Matrix3d::Identity() + g2o::skew(errorQ.vec());
+
+        _jacobianOplusXi.block<3,3>(0,0) = -Riw * tj_skew;
+        _jacobianOplusXi.block<3,3>(0,3) = Riw;
+        _jacobianOplusXi.block<3,3>(3,0) = -Jr * Rjw;
+        _jacobianOplusXi.block<3,3>(3,3) = Eigen::Matrix3d::Zero();
+
+        _jacobianOplusXj.block<3,3>(0,0) = Riw * tj_skew;
+        _jacobianOplusXj.block<3,3>(0,3) = -Riw;
+        _jacobianOplusXj.block<3,3>(3,0) = Jr * Rjw;
+        _jacobianOplusXj.block<3,3>(3,3) = Eigen::Matrix3d::Zero();
+    }
+
+    Eigen::Matrix<double,12,12> GetHessian(){
+        linearizeOplus();
+        Eigen::Matrix<double,6,12> J;
+        J.block<6,6>(0,0) = _jacobianOplusXi;
+        J.block<6,6>(0,6) = _jacobianOplusXj;
+        return J.transpose()*information()*J;
+    }
 
 private:
     double _scale;
@@ -105,12 +139,18 @@ public:
         //std::cout<< "_error3 = " << _error.transpose() <<std::endl;
     }
 
-    //virtual void linearizeOplus() override{
-    //    const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);
-    //    g2o::Vector3D P3d = v1->estimate().translation();
-    //    _jacobianOplusXi.block<3,3>(0,0) = Eigen::Matrix3d::Zero();
-    //    _jacobianOplusXi.block<3,3>(0,3) = -Eigen::Matrix3d::Identity();
-    //};
+    // The left perturbation also moves the translation, so the rotation block is not zero
+    virtual void linearizeOplus() override{
+        const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);
+        g2o::Vector3D P3d = v1->estimate().translation();
+        _jacobianOplusXi.block<3,3>(0,0) = g2o::skew(P3d);
+        _jacobianOplusXi.block<3,3>(0,3) = -Eigen::Matrix3d::Identity();
+    };
+
+    Eigen::Matrix<double,6,6> GetHessian(){
+        linearizeOplus();
+        return _jacobianOplusXi.transpose()*information()*_jacobianOplusXi;
+    }
 
 private:
     //double _precision;
@@ -153,19 +193,26 @@ private:
 class iGPSFusion
 {
 public:
-    iGPSFusion();
+    // strResultFile: fused poses are streamed there (CSV, appended) by a background writer
+    iGPSFusion(const string &strResultFile = "./result.txt");
+    ~iGPSFusion();
     void RequestFinish();
     bool isFinished();
+    // True once optimize() has handled every iGPS sample received so far
+    bool isIdle();
 
     void optimize();
     void SetLoopCloser(LoopClosing* mptLoopCloser);
     void inputiGPS(double t, cv::Point3f p3D);
     void inputVO(double t, cv::Mat pose);
+    // Newest fused pose, safe to call from any thread. False until the first solve
     bool getFusionResult(Eigen::Vector3d & P,Eigen::Quaterniond & Q);
+    bool getFusionResult(iGPS::FusionResult & result);
 
     
 protected:
     void SetFinish();
+    bool ComputeLatestCovariance(g2o::SparseOptimizer &optimizer, const int nPoses, Eigen::Matrix<double,6,6> &cov);
     bool mbFinishRequested;
     bool mbFinished;
     bool mbStopped;
@@ -173,15 +220,24 @@ protected:
     std::mutex mMutexFinish;
     std::mutex mMutexStop;
 private:
-    Eigen::Vector3d last_p;
-    Eigen::Quaterniond last_q;
+    iGPS::SeqLock<iGPS::FusionResult> mFusionResult;
+    // Solves published and their summed latency (ms), only touched by the fusion thread
+    unsigned long mnSolves;
+    double mdTotalSolveTime;
+    TrajectorySink* mpResultSink;
     Eigen::Matrix4d iGPS_T_VO;
-    std::map<double, std::vector<double>> VOPoseMap;
-    std::map<double, cv::Point3f> iGPSPositionMap;
-    std::map<double, std::vector<double>> mmFusionPoseMap;
+    // The global graph spans the whole sequence, the buffers grow instead of dropping old samples
+    iGPS::TimeBuffer<iGPS::Pose> mVOPoses;
+    iGPS::TimeBuffer<iGPS::Point> miGPSPositions;
+    iGPS::TimeBuffer<iGPS::Pose> mFusionPoses;
+    // Samples older than the newest one of their buffer, dropped by inputiGPS/inputVO
+    size_t mnRejectedSamples;
     double mScale,mLastScale;
     bool mbfusionFlag,mbScaleFlag;
+    bool mbProcessingiGPS;
     std::mutex mMutexiGPS,m_PoseMap;
+    // Raised by inputiGPS and RequestFinish, waited on by optimize()
+    ThreadEvent mWakeEvent;
 };
 
 } //namespace ORB_SLAM
@@ -0,0 +1,91 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+
+#ifndef IGPSLOG_H
+#define IGPSLOG_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <Eigen/Core>
+
+#include "iGPSTypes.h"
+
+namespace ORB_SLAM3
+{
+
+namespace iGPS
+{
+
+// Binary columnar log of iGPS directions or camera poses. The file is a LogHeader followed by one
+// 64-byte aligned column per field, in host byte order, so it can be mapped and used without parsing.
+//   DIRECTION_LOG: time, channel (int32), transmitter (int32), dir (x y z), dirAngle (2)
+//   POSE_LOG:      time, position (x y z), rotation (qx qy qz qw)
+// Times are stored as in the text files they were converted from.
+enum LogKind
+{
+    DIRECTION_LOG=0,
+    POSE_LOG=1
+};
+
+struct LogHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint64_t count;
+    uint64_t offsets[8];    // byte offset of each column from the start of the file
+};
+
+bool WriteDirectionLog(const std::string &filename, const std::vector<Direction> &vDirections);
+bool WritePoseLog(const std::string &filename, const std::vector<double> &vTimestamps, const std::vector<Eigen::VectorXf> &vCameraPose);
+
+// Read-only memory mapping of a log. Column pointers stay valid until Close().
+class LogReader
+{
+public:
+    LogReader();
+    ~LogReader();
+
+    bool Open(const std::string &filename);
+    void Close();
+    bool isOpen() const { return mpHeader != NULL; }
+
+    // True if the file starts with the log magic
+    static bool isLog(const std::string &filename);
+
+    LogKind kind() const { return (LogKind)mpHeader->kind; }
+    size_t size() const { return mpHeader ? mpHeader->count : 0; }
+    const double* times() const { return column<double>(0); }
+
+    // DIRECTION_LOG columns
+    const int32_t* channels() const { return column<int32_t>(1); }
+    const int32_t* transmitters() const { return column<int32_t>(2); }
+    const double* directions() const { return column<double>(3); }
+    const double* dirAngles() const { return column<double>(4); }
+    Direction direction(const size_t i) const;
+
+    // POSE_LOG columns, poses as x y z qx qy qz qw like Tracking::LoadCameraPose expects
+    const double* positions() const { return column<double>(1); }
+    const double* rotations() const { return column<double>(2); }
+    void GetCameraPoses(std::vector<double> &vTimestamps, std::vector<Eigen::VectorXf> &vCameraPose) const;
+
+private:
+    template<class T>
+    const T* column(const int i) const { return reinterpret_cast<const T*>(mpData + mpHeader->offsets[i]); }
+
+    const char* mpData;
+    size_t mnBytes;
+    const LogHeader* mpHeader;
+};
+
+}
+
+} //namespace ORB_SLAM3
+
+#endif // IGPSLOG_H
@@ -0,0 +1,110 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+
+#ifndef IGPSTRANSMITTERS_H
+#define IGPSTRANSMITTERS_H
+
+#include <vector>
+#include <utility>
+
+#include <opencv2/core/core.hpp>
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+#include "Thirdparty/g2o/g2o/types/se3quat.h"
+#include "iGPSTypes.h"
+
+namespace ORB_SLAM3
+{
+
+namespace iGPS
+{
+
+// One iGPS transmitter. id is the value of Direction::transmitter for its samples (the rotation speed).
+struct Transmitter
+{
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    int id;
+    Eigen::Matrix4d Twi;    // transmitter pose in the iGPS world frame, from the settings
+    double invSigma2;       // information scale of its directions, 1/noise^2
+
+    // Transmitter pose in the camera map frame, known once tracking is initialized
+    bool bTci;
+    g2o::SE3Quat Tci;
+    Eigen::Matrix3d Rci;
+    Eigen::Vector3d tci;
+};
+
+// Transmitters of an iGPS site, loaded from the settings file:
+//   iGPS.Transmitters: n
+//   iGPS.Transmitter1.Id: 1800        (rotation speed in the direction stream)
+//   iGPS.Transmitter1.Twi: 4x4 matrix
+//   iGPS.Transmitter1.Noise: 1.0      (optional, relative direction noise)
+//   iGPS.DirectionResidual: "VectorAngle"   (optional: VectorAngle, Vector, Tangent or Angles; if not set each
+//                                             edge family keeps its original model, see DIR_DEFAULT)
+// Files without iGPS.Transmitters are read the old way, Twi, Twi2 and Twi3 with ids 1800, 1900 and 2000.
+class TransmitterRegistry
+{
+public:
+    TransmitterRegistry(): mResidual(DIR_DEFAULT){}
+
+    bool Load(const cv::FileStorage &fSettings);
+    void Add(const int id, const Eigen::Matrix4d &Twi, const double noise = 1.0);
+    void Clear();
+
+    size_t size() const { return mvTransmitters.size(); }
+    bool empty() const { return mvTransmitters.empty(); }
+    const Transmitter& operator[](size_t i) const { return mvTransmitters[i]; }
+
+    // Index of the transmitter with this id, -1 if unknown
+    int index(const int id) const
+    {
+        if(id < 0 || id >= (int)mvIndex.size())
+            return -1;
+        return mvIndex[id];
+    }
+
+    // Sets Tci = Tcw * Twi for every transmitter
+    void SetCameraPose(const cv::Mat &Tcw);
+    void SetTci(const size_t i, const g2o::SE3Quat &Tci);
+    // Forgets every Tci, they were estimated in the frame of another map
+    void ResetTci();
+    bool isInitialized() const;
+
+    // Receiver positions in the camera map frame, intersecting the rays of the transmitters that see the
+    // same channel. Only channels seen by two or more calibrated transmitters at a usable angle are returned.
+    int TriangulateReceivers(const std::vector<int> &vChannels, const std::vector<int> &vTransmitters,
+                             const std::vector<Eigen::Vector3d> &vDirections,
+                             std::vector<std::pair<int,Eigen::Vector3d> > &vPositions) const;
+
+    // Camera position from the directions of one frame. With three or more receivers not on a line the whole
+    // pose Twc is recovered (bPose, uncertainty 0), otherwise the position is the mean of the located receivers
+    // and uncertainty bounds its distance to the camera.
+    bool LocateCamera(const std::vector<int> &vChannels, const std::vector<int> &vTransmitters,
+                      const std::vector<Eigen::Vector3d> &vDirections, const ReceiverTable &receivers,
+                      Eigen::Vector3d &Ow, double &uncertainty, Eigen::Matrix4d &Twc, bool &bPose) const;
+
+    // Point of the camera map frame in the iGPS world frame of Twi, common to every map of the atlas.
+    // Uses the first calibrated transmitter, p unchanged if there is none.
+    Eigen::Vector3d ToiGPSWorld(const Eigen::Vector3d &p) const;
+
+    // Residual model of the direction edges built for these transmitters
+    DirectionResidual residual() const { return mResidual; }
+    void SetResidual(const DirectionResidual model) { mResidual = model; }
+
+private:
+    std::vector<Transmitter, Eigen::aligned_allocator<Transmitter> > mvTransmitters;
+    std::vector<int> mvIndex;   // id -> index in mvTransmitters
+    DirectionResidual mResidual;
+};
+
+}
+
+} //namespace ORB_SLAM3
+
+#endif // IGPSTRANSMITTERS_H
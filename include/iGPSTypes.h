@@ -10,11 +10,17 @@
 
 #include<vector>
 #include<utility>
+#include<algorithm>
 #include<opencv2/core/core.hpp>
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 #include <Eigen/Dense>
 #include <mutex>
+#include <memory>
+#include <atomic>
+#include <cstring>
+#include <stdint.h>
+#include <type_traits>
 
 #include <boost/serialization/serialization.hpp>
 #include <boost/serialization/vector.hpp>
@@ -28,6 +34,7 @@ namespace iGPS
 class Point
 {
 public:
+    Point(){}
     Point(const float &p_x, const float &p_y, const float &p_z,
              const double &timestamp): p(p_x,p_y,p_z), t(timestamp){}
     Point(const cv::Point3f position, const double &timestamp):
@@ -46,6 +53,315 @@ struct Direction
     Eigen::Vector2d dirAngle;
 };
 
+// Residual model of the direction edges (G2oTypes.h), iGPS.DirectionResidual in the settings file
+enum DirectionResidual
+{
+    DIR_DEFAULT=-1,         // not set: VectorAngle for the receiver edges, Vector for the monocular up-to-scale edges
+    DIR_VECTOR_ANGLE=0,     // "VectorAngle": direction difference and angle, 4D
+    DIR_VECTOR=1,           // "Vector": direction difference, 3D
+    DIR_TANGENT=2,          // "Tangent": direction on the tangent plane of the measurement, 2D
+    DIR_ANGLES=3            // "Angles": azimuth and elevation difference, 2D
+};
+
+// Timestamped pose stored by value (position, quaternion w,x,y,z)
+struct Pose
+{
+    Pose(){}
+    Pose(const double &timestamp, const Eigen::Vector3d &P, const Eigen::Quaterniond &Q):
+        t(timestamp), p{P.x(),P.y(),P.z()}, q{Q.w(),Q.x(),Q.y(),Q.z()}{}
+
+    Eigen::Vector3d position() const { return Eigen::Vector3d(p[0],p[1],p[2]); }
+    Eigen::Quaterniond rotation() const { return Eigen::Quaterniond(q[0],q[1],q[2],q[3]); }
+
+    double t;
+    double p[3];
+    double q[4];
+};
+
+// Receiver positions in the camera frame, indexed by channel. Built once at startup and shared
+// read-only by frames, keyframes and the direction edges.
+class ReceiverTable
+{
+public:
+    void insert(const int channel, const Eigen::Vector3d &p)
+    {
+        if(channel < 0)
+            return;
+        if(channel >= (int)mvPositions.size())
+        {
+            mvPositions.resize(channel+1, Eigen::Vector3d::Zero());
+            mvbValid.resize(channel+1, false);
+        }
+        mvPositions[channel] = p;
+        mvbValid[channel] = true;
+    }
+
+    bool has(const int channel) const { return channel >= 0 && channel < (int)mvbValid.size() && mvbValid[channel]; }
+    const Eigen::Vector3d& operator[](const int channel) const { return mvPositions[channel]; }
+    size_t size() const { return std::count(mvbValid.begin(), mvbValid.end(), true); }
+    size_t capacity() const { return mvPositions.size(); }
+
+private:
+    std::vector<Eigen::Vector3d> mvPositions;
+    std::vector<bool> mvbValid;
+};
+
+// Newest fused pose, published by the fusion thread after every solve
+struct FusionResult
+{
+    FusionResult(): latency(0.0), nSolves(0), totalLatency(0.0), stamp(0.0)
+    {
+        std::fill(cov, cov+36, 0.0);
+    }
+
+    Eigen::Matrix<double,6,6> covariance() const { return Eigen::Map<const Eigen::Matrix<double,6,6,Eigen::RowMajor> >(cov); }
+
+    Pose pose;
+    double cov[36];  // row-major, same order as the VertexSE3Expmap update: rotation then translation
+    double latency;  // time spent in the solve that produced this result (ms)
+    // Counted by the fusion thread, so a reader that skips results still gets exact totals
+    unsigned long nSolves;  // solves published so far, this one included
+    double totalLatency;    // sum of the latency of those solves (ms)
+    double stamp;           // steady_clock time at the end of this solve (s)
+};
+
+// Single-writer sequence lock. The writer never blocks, readers copy the value and retry if a
+// write overlapped. T must be trivially copyable.
+template<class T>
+class SeqLock
+{
+public:
+    SeqLock(): mnSeq(0)
+    {
+        for(size_t i = 0; i < N; i++)
+            mvWords[i].store(0, std::memory_order_relaxed);
+    }
+
+    void write(const T &x)
+    {
+        uint64_t words[N] = {0};
+        std::memcpy(words, &x, sizeof(T));
+
+        const unsigned long seq = mnSeq.load(std::memory_order_relaxed);
+        mnSeq.store(seq+1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for(size_t i = 0; i < N; i++)
+            mvWords[i].store(words[i], std::memory_order_relaxed);
+        mnSeq.store(seq+2, std::memory_order_release);
+    }
+
+    // Returns false if nothing has been written yet
+    bool read(T &x) const
+    {
+        uint64_t words[N];
+        unsigned long seq0, seq1;
+        do
+        {
+            seq0 = mnSeq.load(std::memory_order_acquire);
+            for(size_t i = 0; i < N; i++)
+                words[i] = mvWords[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            seq1 = mnSeq.load(std::memory_order_relaxed);
+        }
+        while((seq0 & 1) || seq0 != seq1);
+
+        if(seq0 == 0)
+            return false;
+        std::memcpy(&x, words, sizeof(T));
+        return true;
+    }
+
+private:
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock needs a trivially copyable type");
+    static const size_t N = (sizeof(T)+sizeof(uint64_t)-1)/sizeof(uint64_t);
+    std::atomic<unsigned long> mnSeq;
+    std::atomic<uint64_t> mvWords[N];
+};
+
+// Time-ordered ring buffer. Elements need a timestamp member t and must be pushed in increasing time;
+// when full the oldest element is overwritten, or the capacity doubles if bGrow. Index 0 is the oldest element.
+template<class T>
+class TimeBuffer
+{
+public:
+    TimeBuffer(size_t capacity = 4096, bool bGrow = false): mnHead(0), mnSize(0), mbGrow(bGrow)
+    {
+        size_t n = 1;
+        while(n < capacity)
+            n <<= 1;
+        mvData.resize(n);
+        mnMask = n-1;
+    }
+
+    // Returns false if x is older than the newest element. A sample with the same time replaces it.
+    bool push_back(const T &x)
+    {
+        if(mnSize)
+        {
+            if(x.t < back().t)
+                return false;
+            if(x.t == back().t)
+            {
+                back() = x;
+                return true;
+            }
+        }
+        if(mnSize == mvData.size())
+        {
+            if(mbGrow)
+                grow();
+            else
+            {
+                mnHead = (mnHead+1) & mnMask;
+                mnSize--;
+            }
+        }
+        mvData[(mnHead+mnSize) & mnMask] = x;
+        mnSize++;
+        return true;
+    }
+
+    void pop_front()
+    {
+        mnHead = (mnHead+1) & mnMask;
+        mnSize--;
+    }
+
+    void clear()
+    {
+        mnHead = 0;
+        mnSize = 0;
+    }
+
+    size_t size() const { return mnSize; }
+    bool empty() const { return mnSize == 0; }
+    size_t capacity() const { return mvData.size(); }
+
+    T& operator[](size_t i) { return mvData[(mnHead+i) & mnMask]; }
+    const T& operator[](size_t i) const { return mvData[(mnHead+i) & mnMask]; }
+    T& front() { return (*this)[0]; }
+    T& back() { return (*this)[mnSize-1]; }
+    const T& front() const { return (*this)[0]; }
+    const T& back() const { return (*this)[mnSize-1]; }
+
+    // Index of the first element with time >= t (size() if none)
+    size_t lower_bound(const double &t) const
+    {
+        size_t first = 0, count = mnSize;
+        while(count > 0)
+        {
+            size_t step = count/2;
+            if((*this)[first+step].t < t)
+            {
+                first += step+1;
+                count -= step+1;
+            }
+            else
+                count = step;
+        }
+        return first;
+    }
+
+    // Index of the first element with time > t (size() if none)
+    size_t upper_bound(const double &t) const
+    {
+        size_t first = 0, count = mnSize;
+        while(count > 0)
+        {
+            size_t step = count/2;
+            if(!(t < (*this)[first+step].t))
+            {
+                first += step+1;
+                count -= step+1;
+            }
+            else
+                count = step;
+        }
+        return first;
+    }
+
+    // Index of the element with exactly time t, -1 if there is none
+    long find(const double &t) const
+    {
+        size_t i = lower_bound(t);
+        if(i < mnSize && (*this)[i].t == t)
+            return i;
+        return -1;
+    }
+
+private:
+    void grow()
+    {
+        std::vector<T> vData(2*mvData.size());
+        for(size_t i = 0; i < mnSize; i++)
+            vData[i] = (*this)[i];
+        mvData.swap(vData);
+        mnHead = 0;
+        mnMask = mvData.size()-1;
+    }
+
+    std::vector<T> mvData;
+    size_t mnHead;
+    size_t mnSize;
+    size_t mnMask;
+    bool mbGrow;
+};
+
+// Timestamps of a recorded stream, in seconds after division by unit, with a cursor for per-frame lookups.
+// The timestamps must be sorted. The index searches the column in place, so it must outlive the index
+// (a mapped log or a vector that is not modified until the next assign). Lookups with increasing time
+// walk the cursor a few steps, jumps and lookups back in time fall back to binary search.
+class TimeIndex
+{
+public:
+    TimeIndex(): mpTimes(NULL), mnSize(0), mdUnit(1.0), mnCursor(0){}
+
+    void assign(const std::vector<double> &vTimestamps, const double unit)
+    {
+        assign(vTimestamps.data(), vTimestamps.size(), unit);
+    }
+
+    void assign(const double* pTimestamps, const size_t n, const double unit)
+    {
+        mpTimes = pTimestamps;
+        mnSize = n;
+        mdUnit = unit;
+        mnCursor = 0;
+    }
+
+    // Index of the first timestamp >= t (size() if none)
+    size_t seek(const double &t)
+    {
+        const double tRaw = t * mdUnit;
+        if(mnCursor > mnSize || (mnCursor > 0 && !(mpTimes[mnCursor-1] < tRaw)))
+        {
+            mnCursor = std::lower_bound(mpTimes, mpTimes + mnSize, tRaw) - mpTimes;
+            return mnCursor;
+        }
+
+        for(int step = 0; mnCursor < mnSize && mpTimes[mnCursor] < tRaw; step++)
+        {
+            if(step == 8)
+            {
+                mnCursor = std::lower_bound(mpTimes + mnCursor, mpTimes + mnSize, tRaw) - mpTimes;
+                break;
+            }
+            mnCursor++;
+        }
+        return mnCursor;
+    }
+
+    size_t size() const { return mnSize; }
+    bool empty() const { return mnSize == 0; }
+    double operator[](size_t i) const { return mpTimes[i] / mdUnit; }
+
+private:
+    const double* mpTimes;
+    size_t mnSize;
+    double mdUnit;
+    size_t mnCursor;
+};
+
 }
 
 } //namespace ORB_SLAM3
@@ -0,0 +1,81 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+#include "Descriptor.h"
+
+#include <stdlib.h>
+#include <new>
+
+namespace ORB_SLAM3
+{
+
+DescriptorArray::DescriptorArray(const cv::Mat &descriptors): mpData(NULL), mN(descriptors.rows)
+{
+    if(mN == 0)
+        return;
+
+    CV_Assert(descriptors.type() == CV_8U && descriptors.cols == Hamming::DESCRIPTOR_BYTES);
+
+    void* p;
+    if(posix_memalign(&p, alignof(Descriptor), mN*sizeof(Descriptor)) != 0)
+        throw std::bad_alloc();
+    mpData = static_cast<Descriptor*>(p);
+
+    for(size_t i = 0; i < mN; i++)
+        memcpy(mpData[i].data, descriptors.ptr<uint8_t>(i), Hamming::DESCRIPTOR_BYTES);
+}
+
+DescriptorArray::~DescriptorArray()
+{
+    free(mpData);
+}
+
+cv::Mat DescriptorArray::mat() const
+{
+    if(mN == 0)
+        return cv::Mat();
+    return cv::Mat(mN, Hamming::DESCRIPTOR_BYTES, CV_8U, mpData);
+}
+
+AtomicDescriptor::AtomicDescriptor(): mnSeq(0)
+{
+    for(int i = 0; i < WORDS; i++)
+        mvWords[i].store(0, std::memory_order_relaxed);
+}
+
+void AtomicDescriptor::store(const uint8_t* p)
+{
+    uint64_t vWords[WORDS];
+    memcpy(vWords, p, Hamming::DESCRIPTOR_BYTES);
+
+    const uint32_t seq = mnSeq.load(std::memory_order_relaxed);
+    mnSeq.store(seq+1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for(int i = 0; i < WORDS; i++)
+        mvWords[i].store(vWords[i], std::memory_order_relaxed);
+    mnSeq.store(seq+2, std::memory_order_release);
+}
+
+Descriptor AtomicDescriptor::load() const
+{
+    uint64_t vWords[WORDS];
+    uint32_t seq0, seq1;
+    do
+    {
+        seq0 = mnSeq.load(std::memory_order_acquire);
+        for(int i = 0; i < WORDS; i++)
+            vWords[i] = mvWords[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq1 = mnSeq.load(std::memory_order_relaxed);
+    }
+    while((seq0 & 1) || seq0 != seq1);
+
+    Descriptor d;
+    memcpy(d.data, vWords, Hamming::DESCRIPTOR_BYTES);
+    return d;
+}
+
+} //namespace ORB_SLAM3
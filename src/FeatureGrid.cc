@@ -0,0 +1,38 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+#include "FeatureGrid.h"
+
+#include <algorithm>
+
+namespace ORB_SLAM3
+{
+
+FeatureGrid::FeatureGrid(const int nCols, const int nRows):
+    mnCols(nCols), mnRows(nRows), mvOffsets(nCols*nRows+1, 0)
+{
+}
+
+void FeatureGrid::assign(const std::vector<int> &vCells, const size_t first, const size_t last)
+{
+    const int nCells = mnCols*mnRows;
+    std::fill(mvOffsets.begin(), mvOffsets.end(), 0);
+
+    // Count, shifted by one so the prefix sum gives the start of every cell
+    for(size_t i = first; i < last; i++)
+        if(vCells[i] >= 0)
+            mvOffsets[vCells[i]+1]++;
+    for(int c = 0; c < nCells; c++)
+        mvOffsets[c+1] += mvOffsets[c];
+
+    mvIndices.resize(mvOffsets[nCells]);
+    std::vector<uint32_t> vNext(mvOffsets.begin(), mvOffsets.end()-1);
+    for(size_t i = first; i < last; i++)
+        if(vCells[i] >= 0)
+            mvIndices[vNext[vCells[i]]++] = i - first;
+}
+
+} //namespace ORB_SLAM3
@@ -26,7 +26,7 @@
 #include "ORBmatcher.h"
 #include "GeometricCamera.h"
 
-#include <thread>
+#include "WorkerPool.h"
 #include <include/CameraModels/Pinhole.h>
 #include <include/CameraModels/KannalaBrandt8.h>
 
@@ -58,7 +58,7 @@ Frame::Frame(const Frame &frame)
      mbf(frame.mbf), mb(frame.mb), mThDepth(frame.mThDepth), N(frame.N), mvKeys(frame.mvKeys),
      mvKeysRight(frame.mvKeysRight), mvKeysUn(frame.mvKeysUn), mvuRight(frame.mvuRight),
      mvDepth(frame.mvDepth), mBowVec(frame.mBowVec), mFeatVec(frame.mFeatVec),
-     mDescriptors(frame.mDescriptors.clone()), mDescriptorsRight(frame.mDescriptorsRight.clone()),
+     mDescriptors(frame.mDescriptors), mDescriptorsRight(frame.mDescriptorsRight.clone()), mpDescriptors(frame.mpDescriptors),
      mvpMapPoints(frame.mvpMapPoints), mvbOutlier(frame.mvbOutlier), mImuCalib(frame.mImuCalib), mnCloseMPs(frame.mnCloseMPs),
      mpImuPreintegrated(frame.mpImuPreintegrated), mpImuPreintegratedFrame(frame.mpImuPreintegratedFrame), mImuBias(frame.mImuBias),
      mnId(frame.mnId), mpReferenceKF(frame.mpReferenceKF), mnScaleLevels(frame.mnScaleLevels),
@@ -69,16 +69,9 @@ Frame::Frame(const Frame &frame)
      monoLeft(frame.monoLeft), monoRight(frame.monoRight), mvLeftToRightMatch(frame.mvLeftToRightMatch),
      mvRightToLeftMatch(frame.mvRightToLeftMatch), mvStereo3Dpoints(frame.mvStereo3Dpoints),
      mTlr(frame.mTlr.clone()), mRlr(frame.mRlr.clone()), mtlr(frame.mtlr.clone()), mTrl(frame.mTrl.clone()),
-     mTrlx(frame.mTrlx), mTlrx(frame.mTlrx), mOwx(frame.mOwx), mRcwx(frame.mRcwx), mtcwx(frame.mtcwx)
+     mTrlx(frame.mTrlx), mTlrx(frame.mTlrx), mOwx(frame.mOwx), mRcwx(frame.mRcwx), mtcwx(frame.mtcwx),
+     mpGrid(frame.mpGrid), mpGridRight(frame.mpGridRight)
 {
-    for(int i=0;i<FRAME_GRID_COLS;i++)
-        for(int j=0; j<FRAME_GRID_ROWS; j++){
-            mGrid[i][j]=frame.mGrid[i][j];
-            if(frame.Nleft > 0){
-                mGridRight[i][j] = frame.mGridRight[i][j];
-            }
-        }
-
     if(!frame.mTcw.empty())
         SetPose(frame.mTcw);
 
@@ -116,10 +109,11 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
 #ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_StartExtORB = std::chrono::steady_clock::now();
 #endif
-    thread threadLeft(&Frame::ExtractORB,this,0,imLeft,0,0);
-    thread threadRight(&Frame::ExtractORB,this,1,imRight,0,0);
-    threadLeft.join();
-    threadRight.join();
+    // Both images on the shared pool, the extractors split their levels on it too
+    WorkerPool::Shared().ParallelFor(2, [&](const int i)
+    {
+        ExtractORB(i,(i==0) ? imLeft : imRight,0,0);
+    });
 #ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_EndExtORB = std::chrono::steady_clock::now();
 
@@ -182,6 +176,7 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
         mVw = cv::Mat::zeros(3,1,CV_32F);
     }
 
+    PackDescriptors();
     AssignFeaturesToGrid();
 
     mpMutexImu = new std::mutex();
@@ -277,6 +272,7 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeSt
     monoLeft = -1;
     monoRight = -1;
 
+    PackDescriptors();
     AssignFeaturesToGrid();
 }
 
@@ -361,6 +357,7 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extra
     monoLeft = -1;
     monoRight = -1;
 
+    PackDescriptors();
     AssignFeaturesToGrid();
 
     if(pPrevF)
@@ -379,21 +376,10 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extra
 
 void Frame::AssignFeaturesToGrid()
 {
-    // Fill matrix with points
-    const int nCells = FRAME_GRID_COLS*FRAME_GRID_ROWS;
-
-    int nReserve = 0.5f*N/(nCells);
-
-    for(unsigned int i=0; i<FRAME_GRID_COLS;i++)
-        for (unsigned int j=0; j<FRAME_GRID_ROWS;j++){
-            mGrid[i][j].reserve(nReserve);
-            if(Nleft != -1){
-                mGridRight[i][j].reserve(nReserve);
-            }
-        }
-
-
+    std::shared_ptr<FeatureGrid> pGrid = std::make_shared<FeatureGrid>(FRAME_GRID_COLS,FRAME_GRID_ROWS);
 
+    // Cell of every keypoint, left image first
+    vector<int> vCells(N);
     for(int i=0;i<N;i++)
     {
         const cv::KeyPoint &kp = (Nleft == -1) ? mvKeysUn[i]
@@ -401,13 +387,30 @@ void Frame::AssignFeaturesToGrid()
                                                                  : mvKeysRight[i - Nleft];
 
         int nGridPosX, nGridPosY;
-        if(PosInGrid(kp,nGridPosX,nGridPosY)){
-            if(Nleft == -1 || i < Nleft)
-                mGrid[nGridPosX][nGridPosY].push_back(i);
-            else
-                mGridRight[nGridPosX][nGridPosY].push_back(i - Nleft);
-        }
+        if(PosInGrid(kp,nGridPosX,nGridPosY))
+            vCells[i] = pGrid->cell(nGridPosX,nGridPosY);
+        else
+            vCells[i] = -1;
+    }
+
+    pGrid->assign(vCells,0,(Nleft == -1) ? N : Nleft);
+    mpGrid = pGrid;
+
+    if(Nleft != -1)
+    {
+        std::shared_ptr<FeatureGrid> pGridRight = std::make_shared<FeatureGrid>(FRAME_GRID_COLS,FRAME_GRID_ROWS);
+        pGridRight->assign(vCells,Nleft,N);
+        mpGridRight = pGridRight;
     }
+    else
+        mpGridRight.reset();
+}
+
+void Frame::PackDescriptors()
+{
+    // Descriptors are final, move them to one aligned block and let mDescriptors view it
+    mpDescriptors = std::make_shared<const DescriptorArray>(mDescriptors);
+    mDescriptors = mpDescriptors->mat();
 }
 
 void Frame::ExtractORB(int flag, const cv::Mat &im, const int x0, const int x1)
@@ -674,34 +677,33 @@ vector<size_t> Frame::GetFeaturesInArea(const float &x, const float  &y, const f
 
     const bool bCheckLevels = (minLevel>0) || (maxLevel>=0);
 
+    const FeatureGrid* pGrid = (!bRight) ? mpGrid.get() : mpGridRight.get();
+    if(!pGrid)
+        return vIndices;
+
+    // The cells of a column are contiguous
     for(int ix = nMinCellX; ix<=nMaxCellX; ix++)
     {
-        for(int iy = nMinCellY; iy<=nMaxCellY; iy++)
+        for(const uint32_t* pIdx = pGrid->begin(ix,nMinCellY), *pEnd = pGrid->end(ix,nMaxCellY); pIdx!=pEnd; pIdx++)
         {
-            const vector<size_t> vCell = (!bRight) ? mGrid[ix][iy] : mGridRight[ix][iy];
-            if(vCell.empty())
-                continue;
-
-            for(size_t j=0, jend=vCell.size(); j<jend; j++)
+            const size_t idx = *pIdx;
+            const cv::KeyPoint &kpUn = (Nleft == -1) ? mvKeysUn[idx]
+                                                     : (!bRight) ? mvKeys[idx]
+                                                                 : mvKeysRight[idx];
+            if(bCheckLevels)
             {
-                const cv::KeyPoint &kpUn = (Nleft == -1) ? mvKeysUn[vCell[j]]
-                                                         : (!bRight) ? mvKeys[vCell[j]]
-                                                                     : mvKeysRight[vCell[j]];
-                if(bCheckLevels)
-                {
-                    if(kpUn.octave<minLevel)
+                if(kpUn.octave<minLevel)
+                    continue;
+                if(maxLevel>=0)
+                    if(kpUn.octave>maxLevel)
                         continue;
-                    if(maxLevel>=0)
-                        if(kpUn.octave>maxLevel)
-                            continue;
-                }
+            }
 
-                const float distx = kpUn.pt.x-x;
-                const float disty = kpUn.pt.y-y;
+            const float distx = kpUn.pt.x-x;
+            const float disty = kpUn.pt.y-y;
 
-                if(fabs(distx)<factorX && fabs(disty)<factorY)
-                    vIndices.push_back(vCell[j]);
-            }
+            if(fabs(distx)<factorX && fabs(disty)<factorY)
+                vIndices.push_back(idx);
         }
     }
 
@@ -1041,10 +1043,11 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
 #ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_StartExtORB = std::chrono::steady_clock::now();
 #endif
-    thread threadLeft(&Frame::ExtractORB,this,0,imLeft,static_cast<KannalaBrandt8*>(mpCamera)->mvLappingArea[0],static_cast<KannalaBrandt8*>(mpCamera)->mvLappingArea[1]);
-    thread threadRight(&Frame::ExtractORB,this,1,imRight,static_cast<KannalaBrandt8*>(mpCamera2)->mvLappingArea[0],static_cast<KannalaBrandt8*>(mpCamera2)->mvLappingArea[1]);
-    threadLeft.join();
-    threadRight.join();
+    WorkerPool::Shared().ParallelFor(2, [&](const int i)
+    {
+        KannalaBrandt8* pCamera = static_cast<KannalaBrandt8*>((i==0) ? mpCamera : mpCamera2);
+        ExtractORB(i,(i==0) ? imLeft : imRight,pCamera->mvLappingArea[0],pCamera->mvLappingArea[1]);
+    });
 #ifdef REGISTER_TIMES
     std::chrono::steady_clock::time_point time_EndExtORB = std::chrono::steady_clock::now();
 
@@ -1109,6 +1112,7 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
     mvpMapPoints = vector<MapPoint*>(N,static_cast<MapPoint*>(nullptr));
     mvbOutlier = vector<bool>(N,false);
 
+    PackDescriptors();
     AssignFeaturesToGrid();
 
     mpMutexImu = new std::mutex();
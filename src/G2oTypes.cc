@@ -897,4 +897,51 @@ Eigen::Matrix3d NormalizeRotation(const Eigen::Matrix3d &R)
     Eigen::JacobiSVD<Eigen::Matrix3d> svd(R,Eigen::ComputeFullU | Eigen::ComputeFullV);
     return svd.matrixU()*svd.matrixV();
 }
+namespace
+{
+
+template<class Edge>
+Edge* SetDirectionInformation(Edge* e, const double infoWeight)
+{
+    e->setInformation(infoWeight * Edge::InformationType::Identity());
+    return e;
+}
+
+}
+
+g2o::OptimizableGraph::Edge* CreateiGPSDirectionEdge(const iGPS::DirectionResidual model, const iGPS::ReceiverTable* pReceivers, const int ch,
+                                                     const Eigen::Matrix3d &Rci, const Eigen::Vector3d &tci, const Eigen::Vector3d &Dir, const double infoWeight)
+{
+    // The direction difference and angle is the original residual of this edge (DIR_DEFAULT)
+    switch(model)
+    {
+    case iGPS::DIR_VECTOR:
+        return SetDirectionInformation(new EdgeiGPSDirection<iGPS::DirResidualVector>(pReceivers,ch,Rci,tci,Dir), infoWeight);
+    case iGPS::DIR_TANGENT:
+        return SetDirectionInformation(new EdgeiGPSDirection<iGPS::DirResidualTangent>(pReceivers,ch,Rci,tci,Dir), infoWeight);
+    case iGPS::DIR_ANGLES:
+        return SetDirectionInformation(new EdgeiGPSDirection<iGPS::DirResidualAngles>(pReceivers,ch,Rci,tci,Dir), infoWeight);
+    default:
+        return SetDirectionInformation(new EdgeiGPSDirection<iGPS::DirResidualVectorAngle>(pReceivers,ch,Rci,tci,Dir), infoWeight);
+    }
+}
+
+g2o::OptimizableGraph::Edge* CreateiGPSDirectionUptoScaleEdge(const iGPS::DirectionResidual model, const Eigen::Vector3d &Dir, const double infoWeight)
+{
+    // The 3D direction difference is the original residual of this edge
+    switch(model)
+    {
+    case iGPS::DIR_DEFAULT:
+    case iGPS::DIR_VECTOR:
+        return SetDirectionInformation(new EdgeiGPSDirectionUptoScale<iGPS::DirResidualVector>(Dir), infoWeight);
+    case iGPS::DIR_TANGENT:
+        return SetDirectionInformation(new EdgeiGPSDirectionUptoScale<iGPS::DirResidualTangent>(Dir), infoWeight);
+    case iGPS::DIR_ANGLES:
+        return SetDirectionInformation(new EdgeiGPSDirectionUptoScale<iGPS::DirResidualAngles>(Dir), infoWeight);
+    case iGPS::DIR_VECTOR_ANGLE:
+    default:
+        return SetDirectionInformation(new EdgeiGPSDirectionUptoScale<iGPS::DirResidualVectorAngle>(Dir), infoWeight);
+    }
+}
+
 }
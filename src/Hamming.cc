@@ -0,0 +1,107 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+#include "Hamming.h"
+
+namespace ORB_SLAM3
+{
+
+namespace Hamming
+{
+
+namespace
+{
+
+#if defined(__AVX2__)
+
+// Per 64 bit lane popcount of x
+inline __m256i Popcount64(const __m256i x)
+{
+#if defined(__AVX512VPOPCNTDQ__) && defined(__AVX512VL__)
+    return _mm256_popcnt_epi64(x);
+#else
+    // Nibble lookup, then byte sums per lane
+    const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                         0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    const __m256i lo = _mm256_shuffle_epi8(lut,_mm256_and_si256(x,low));
+    const __m256i hi = _mm256_shuffle_epi8(lut,_mm256_and_si256(_mm256_srli_epi16(x,4),low));
+    return _mm256_sad_epu8(_mm256_add_epi8(lo,hi),_mm256_setzero_si256());
+#endif
+}
+
+// Distances from q to four descriptors, the four lane sums are reduced together
+inline void Distances4(const __m256i q, const uint8_t* const* vpD, int* pDist)
+{
+    const __m256i s0 = Popcount64(_mm256_xor_si256(q,_mm256_loadu_si256((const __m256i*)vpD[0])));
+    const __m256i s1 = Popcount64(_mm256_xor_si256(q,_mm256_loadu_si256((const __m256i*)vpD[1])));
+    const __m256i s2 = Popcount64(_mm256_xor_si256(q,_mm256_loadu_si256((const __m256i*)vpD[2])));
+    const __m256i s3 = Popcount64(_mm256_xor_si256(q,_mm256_loadu_si256((const __m256i*)vpD[3])));
+
+    // Lane sums are at most 64, pack two descriptors per lane: [s0 s1] and [s2 s3]
+    const __m256i t01 = _mm256_or_si256(s0,_mm256_slli_epi64(s1,32));
+    const __m256i t23 = _mm256_or_si256(s2,_mm256_slli_epi64(s3,32));
+    const __m128i v01 = _mm_add_epi32(_mm256_castsi256_si128(t01),_mm256_extracti128_si256(t01,1));
+    const __m128i v23 = _mm_add_epi32(_mm256_castsi256_si128(t23),_mm256_extracti128_si256(t23,1));
+    const __m128i d = _mm_add_epi32(_mm_unpacklo_epi64(v01,v23),_mm_unpackhi_epi64(v01,v23));
+    _mm_storeu_si128((__m128i*)pDist,d);
+}
+
+#endif
+
+}
+
+void Distances(const uint8_t* q, const uint8_t* const* vpD, const int n, int* pDist)
+{
+    int i=0;
+#if defined(__AVX2__)
+    const __m256i vq = _mm256_loadu_si256((const __m256i*)q);
+    for(; i+4<=n; i+=4)
+        Distances4(vq,vpD+i,pDist+i);
+#endif
+    for(; i<n; i++)
+        pDist[i] = Distance(q,vpD[i]);
+}
+
+int BestTwo(const uint8_t* q, const uint8_t* const* vpD, const int n, int &bestDist, int &bestDist2, int* pBest2)
+{
+    bestDist=256;
+    bestDist2=256;
+    int best=-1, best2=-1;
+
+    // Blocks of distances folded in order, so ties resolve as in a sequential loop
+    const int BLOCK = 32;
+    int vDist[BLOCK];
+    for(int i0=0; i0<n; i0+=BLOCK)
+    {
+        const int nb = (n-i0 < BLOCK) ? n-i0 : BLOCK;
+        Distances(q,vpD+i0,nb,vDist);
+        for(int j=0; j<nb; j++)
+        {
+            const int dist = vDist[j];
+            if(dist<bestDist)
+            {
+                bestDist2=bestDist;
+                bestDist=dist;
+                best2=best;
+                best=i0+j;
+            }
+            else if(dist<bestDist2)
+            {
+                bestDist2=dist;
+                best2=i0+j;
+            }
+        }
+    }
+
+    if(pBest2)
+        *pBest2=best2;
+    return best;
+}
+
+}
+
+} //namespace ORB_SLAM3
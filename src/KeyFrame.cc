@@ -40,7 +40,7 @@ KeyFrame::KeyFrame():
         mvInvLevelSigma2(0), mnMinX(0), mnMinY(0), mnMaxX(0),
         mnMaxY(0), /*mK(NULL),*/  mPrevKF(static_cast<KeyFrame*>(NULL)), mNextKF(static_cast<KeyFrame*>(NULL)), mbFirstConnection(true), mpParent(NULL), mbNotErase(false),
         mbToBeErased(false), mbBad(false), mHalfBaseline(0), mbCurrentPlaceRecognition(false), mbHasHessian(false), mnMergeCorrectedForKF(0),
-        NLeft(0),NRight(0), mnNumberOfOpt(0)
+        NLeft(0),NRight(0), mnNumberOfOpt(0), mfiGPSPositionUncertainty(-1.f)
 {
 
 }
@@ -52,7 +52,7 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
     mnLoopQuery(0), mnLoopWords(0), mnRelocQuery(0), mnRelocWords(0), mnBAGlobalForKF(0), mnPlaceRecognitionQuery(0), mnPlaceRecognitionWords(0), mPlaceRecognitionScore(0),
     fx(F.fx), fy(F.fy), cx(F.cx), cy(F.cy), invfx(F.invfx), invfy(F.invfy),
     mbf(F.mbf), mb(F.mb), mThDepth(F.mThDepth), N(F.N), mvKeys(F.mvKeys), mvKeysUn(F.mvKeysUn),
-    mvuRight(F.mvuRight), mvDepth(F.mvDepth), mDescriptors(F.mDescriptors.clone()),
+    mvuRight(F.mvuRight), mvDepth(F.mvDepth), mDescriptors(F.mDescriptors), mpDescriptors(F.mpDescriptors),
     mBowVec(F.mBowVec), mFeatVec(F.mFeatVec), mnScaleLevels(F.mnScaleLevels), mfScaleFactor(F.mfScaleFactor),
     mfLogScaleFactor(F.mfLogScaleFactor), mvScaleFactors(F.mvScaleFactors), mvLevelSigma2(F.mvLevelSigma2),
     mvInvLevelSigma2(F.mvInvLevelSigma2), mnMinX(F.mnMinX), mnMinY(F.mnMinY), mnMaxX(F.mnMaxX),
@@ -63,7 +63,8 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
     mpCamera(F.mpCamera), mpCamera2(F.mpCamera2),
     mvLeftToRightMatch(F.mvLeftToRightMatch),mvRightToLeftMatch(F.mvRightToLeftMatch),mTlr(F.mTlr.clone()),
     mvKeysRight(F.mvKeysRight), NLeft(F.Nleft), NRight(F.Nright), mTrl(F.mTrl), mnNumberOfOpt(0),
-    miGPSDirection(F.miGPSDirection),miGPSChannel(F.miGPSChannel),miGPSTransmitter(F.miGPSTransmitter),miGPStime(F.miGPStime),miGPSReceive(F.miGPSReceive)
+    miGPSDirection(F.miGPSDirection),miGPSChannel(F.miGPSChannel),miGPSTransmitter(F.miGPSTransmitter),miGPStime(F.miGPStime),mpiGPSReceive(F.mpiGPSReceive),
+    mfiGPSPositionUncertainty(-1.f), mpGrid(F.mpGrid), mpGridRight(F.mpGridRight)
 
 {
 
@@ -72,22 +73,6 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
 
     mnId=nNextId++;
 
-    mGrid.resize(mnGridCols);
-    if(F.Nleft != -1)  mGridRight.resize(mnGridCols);
-    for(int i=0; i<mnGridCols;i++)
-    {
-        mGrid[i].resize(mnGridRows);
-        if(F.Nleft != -1) mGridRight[i].resize(mnGridRows);
-        for(int j=0; j<mnGridRows; j++){
-            mGrid[i][j] = F.mGrid[i][j];
-            if(F.Nleft != -1){
-                mGridRight[i][j] = F.mGridRight[i][j];
-            }
-        }
-    }
-
-
-
     if(F.mVw.empty())
         Vw = cv::Mat::zeros(3,1,CV_32F);
     else
@@ -145,6 +130,12 @@ void KeyFrame::SetPose(const cv::Mat &Tcw_)
                                      Twc.at<float>(3,0),Twc.at<float>(3,1),Twc.at<float>(3,2),Twc.at<float>(3,3));
 
     this->Ow_ = cv::Matx31f(Ow.at<float>(0),Ow.at<float>(1),Ow.at<float>(2));
+    lock.unlock();
+
+    // Keep the spatial index of the map in step with the pose
+    Map* pMap = GetMap();
+    if(pMap)
+        pMap->UpdateKeyFramePosition(this);
 }
 
 void KeyFrame::SetVelocity(const cv::Mat &Vw_)
@@ -754,22 +745,24 @@ vector<size_t> KeyFrame::GetFeaturesInArea(const float &x, const float &y, const
     if(nMaxCellY<0)
         return vIndices;
 
+    const FeatureGrid* pGrid = (!bRight) ? mpGrid.get() : mpGridRight.get();
+    if(!pGrid)
+        return vIndices;
+
+    // The cells of a column are contiguous
     for(int ix = nMinCellX; ix<=nMaxCellX; ix++)
     {
-        for(int iy = nMinCellY; iy<=nMaxCellY; iy++)
+        for(const uint32_t* pIdx = pGrid->begin(ix,nMinCellY), *pEnd = pGrid->end(ix,nMaxCellY); pIdx!=pEnd; pIdx++)
         {
-            const vector<size_t> vCell = (!bRight) ? mGrid[ix][iy] : mGridRight[ix][iy];
-            for(size_t j=0, jend=vCell.size(); j<jend; j++)
-            {
-                const cv::KeyPoint &kpUn = (NLeft == -1) ? mvKeysUn[vCell[j]]
-                                                         : (!bRight) ? mvKeys[vCell[j]]
-                                                                     : mvKeysRight[vCell[j]];
-                const float distx = kpUn.pt.x-x;
-                const float disty = kpUn.pt.y-y;
-
-                if(fabs(distx)<r && fabs(disty)<r)
-                    vIndices.push_back(vCell[j]);
-            }
+            const size_t idx = *pIdx;
+            const cv::KeyPoint &kpUn = (NLeft == -1) ? mvKeysUn[idx]
+                                                     : (!bRight) ? mvKeys[idx]
+                                                                 : mvKeysRight[idx];
+            const float distx = kpUn.pt.x-x;
+            const float disty = kpUn.pt.y-y;
+
+            if(fabs(distx)<r && fabs(disty)<r)
+                vIndices.push_back(idx);
         }
     }
 
@@ -601,7 +601,8 @@ bool compFirst(const pair<float, KeyFrame*> & a, const pair<float, KeyFrame*> &
 }
 
 
-void KeyFrameDatabase::DetectNBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &vpLoopCand, vector<KeyFrame*> &vpMergeCand, int nNumCandidates)
+void KeyFrameDatabase::DetectNBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &vpLoopCand, vector<KeyFrame*> &vpMergeCand, int nNumCandidates,
+                                             const float fiGPSGateRadius, int* pnGatePruned)
 {
     list<KeyFrame*> lKFsSharingWords;
     set<KeyFrame*> spConnectedKF;
@@ -704,6 +705,7 @@ void KeyFrameDatabase::DetectNBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &v
     vpLoopCand.reserve(nNumCandidates);
     vpMergeCand.reserve(nNumCandidates);
     set<KeyFrame*> spAlreadyAddedKF;
+    const bool bGate = fiGPSGateRadius > 0 && pKF->mfiGPSPositionUncertainty >= 0;
     int i = 0;
     list<pair<float,KeyFrame*> >::iterator it=lAccScoreAndMatch.begin();
     while(i < lAccScoreAndMatch.size() && (vpLoopCand.size() < nNumCandidates || vpMergeCand.size() < nNumCandidates))
@@ -716,6 +718,21 @@ void KeyFrameDatabase::DetectNBestCandidates(KeyFrame *pKF, vector<KeyFrame*> &v
             continue;
         }
 
+        // Both keyframes located by iGPS and too far apart, no need to match descriptors
+        if(bGate && pKFi->mfiGPSPositionUncertainty >= 0 &&
+           (pKFi->miGPSPosition - pKF->miGPSPosition).norm() > fiGPSGateRadius + pKF->mfiGPSPositionUncertainty + pKFi->mfiGPSPositionUncertainty)
+        {
+            if(!spAlreadyAddedKF.count(pKFi))
+            {
+                spAlreadyAddedKF.insert(pKFi);
+                if(pnGatePruned)
+                    (*pnGatePruned)++;
+            }
+            i++;
+            it++;
+            continue;
+        }
+
         if(!spAlreadyAddedKF.count(pKFi))
         {
             if(pKF->GetMap() == pKFi->GetMap() && vpLoopCand.size() < nNumCandidates)
@@ -759,12 +776,62 @@ vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F, Map
             }
         }
     }
+
+    return ScoreRelocalizationCandidates(F, pMap, lKFsSharingWords);
+}
+
+vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F, Map* pMap, const vector<KeyFrame*> &vpNearKFs)
+{
+    list<KeyFrame*> lKFsSharingWords;
+
+    // Count the words each keyframe around the prior shares with the current frame
+    for(vector<KeyFrame*>::const_iterator vit=vpNearKFs.begin(), vend=vpNearKFs.end(); vit!=vend; vit++)
+    {
+        KeyFrame* pKFi = *vit;
+        if(pKFi->isBad() || pKFi->GetMap() != pMap)
+            continue;
+
+        int nWords=0;
+        DBoW2::BowVector::const_iterator fit=F->mBowVec.begin(), fend=F->mBowVec.end();
+        DBoW2::BowVector::const_iterator kit=pKFi->mBowVec.begin(), kend=pKFi->mBowVec.end();
+        while(fit!=fend && kit!=kend)
+        {
+            if(fit->first<kit->first)
+                fit++;
+            else if(kit->first<fit->first)
+                kit++;
+            else
+            {
+                nWords++;
+                fit++;
+                kit++;
+            }
+        }
+        if(nWords==0)
+            continue;
+
+        pKFi->mnRelocQuery=F->mnId;
+        pKFi->mnRelocWords=nWords;
+        lKFsSharingWords.push_back(pKFi);
+    }
+
+    const vector<KeyFrame*> vpRelocCandidates = ScoreRelocalizationCandidates(F, pMap, lKFsSharingWords);
+
+    // Leave the query marks free for a full search of the same frame
+    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+        (*lit)->mnRelocQuery=0;
+
+    return vpRelocCandidates;
+}
+
+vector<KeyFrame*> KeyFrameDatabase::ScoreRelocalizationCandidates(Frame *F, Map* pMap, const list<KeyFrame*> &lKFsSharingWords)
+{
     if(lKFsSharingWords.empty())
         return vector<KeyFrame*>();
 
     // Only compare against those keyframes that share enough words
     int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(list<KeyFrame*>::const_iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
     {
         if((*lit)->mnRelocWords>maxCommonWords)
             maxCommonWords=(*lit)->mnRelocWords;
@@ -777,7 +844,7 @@ vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F, Map
     int nscores=0;
 
     // Compute similarity score.
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(list<KeyFrame*>::const_iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
     {
         KeyFrame* pKFi = *lit;
 
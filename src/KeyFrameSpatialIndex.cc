@@ -0,0 +1,138 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+#include "KeyFrameSpatialIndex.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ORB_SLAM3
+{
+
+KeyFrameSpatialIndex::KeyFrameSpatialIndex(const double voxelSize):
+    mdInvVoxelSize(1.0/voxelSize)
+{
+}
+
+Eigen::Vector3i KeyFrameSpatialIndex::voxel(const Eigen::Vector3d &p) const
+{
+    return Eigen::Vector3i((int)std::floor(p.x()*mdInvVoxelSize), (int)std::floor(p.y()*mdInvVoxelSize), (int)std::floor(p.z()*mdInvVoxelSize));
+}
+
+int64_t KeyFrameSpatialIndex::key(const Eigen::Vector3i &v)
+{
+    // 21 bits per axis
+    const int64_t mask = (1 << 21) - 1;
+    return ((int64_t)(v.x() & mask) << 42) | ((int64_t)(v.y() & mask) << 21) | (int64_t)(v.z() & mask);
+}
+
+void KeyFrameSpatialIndex::insert(KeyFrame* pKF, const Eigen::Vector3d &Ow)
+{
+    if(mmEntries.count(pKF))
+    {
+        update(pKF, Ow);
+        return;
+    }
+
+    Entry entry;
+    entry.Ow = Ow;
+    entry.key = key(voxel(Ow));
+    mmEntries[pKF] = entry;
+    mmVoxels[entry.key].push_back(pKF);
+}
+
+void KeyFrameSpatialIndex::erase(KeyFrame* pKF)
+{
+    auto it = mmEntries.find(pKF);
+    if(it == mmEntries.end())
+        return;
+
+    auto vit = mmVoxels.find(it->second.key);
+    std::vector<KeyFrame*> &vpKFs = vit->second;
+    vpKFs.erase(std::find(vpKFs.begin(), vpKFs.end(), pKF));
+    if(vpKFs.empty())
+        mmVoxels.erase(vit);
+    mmEntries.erase(it);
+}
+
+void KeyFrameSpatialIndex::update(KeyFrame* pKF, const Eigen::Vector3d &Ow)
+{
+    auto it = mmEntries.find(pKF);
+    if(it == mmEntries.end())
+        return;
+
+    it->second.Ow = Ow;
+    const int64_t newKey = key(voxel(Ow));
+    if(newKey == it->second.key)
+        return;
+
+    // Moved to another voxel (loop correction, GBA)
+    auto vit = mmVoxels.find(it->second.key);
+    std::vector<KeyFrame*> &vpKFs = vit->second;
+    vpKFs.erase(std::find(vpKFs.begin(), vpKFs.end(), pKF));
+    if(vpKFs.empty())
+        mmVoxels.erase(vit);
+    it->second.key = newKey;
+    mmVoxels[newKey].push_back(pKF);
+}
+
+void KeyFrameSpatialIndex::clear()
+{
+    mmVoxels.clear();
+    mmEntries.clear();
+}
+
+void KeyFrameSpatialIndex::collect(const Eigen::Vector3i &v, const Eigen::Vector3d &Ow, const double radius, std::vector<Candidate> &vCandidates) const
+{
+    auto vit = mmVoxels.find(key(v));
+    if(vit == mmVoxels.end())
+        return;
+
+    const std::vector<KeyFrame*> &vpKFs = vit->second;
+    for(size_t i = 0; i < vpKFs.size(); i++)
+    {
+        const double d = (mmEntries.find(vpKFs[i])->second.Ow - Ow).norm();
+        if(d < radius)
+            vCandidates.push_back(std::make_pair(d, vpKFs[i]));
+    }
+}
+
+void KeyFrameSpatialIndex::collectAll(const Eigen::Vector3d &Ow, const double radius, std::vector<Candidate> &vCandidates) const
+{
+    for(auto it = mmEntries.begin(); it != mmEntries.end(); it++)
+    {
+        const double d = (it->second.Ow - Ow).norm();
+        if(d < radius)
+            vCandidates.push_back(std::make_pair(d, it->first));
+    }
+}
+
+std::vector<KeyFrame*> KeyFrameSpatialIndex::radiusSearch(const Eigen::Vector3d &Ow, const double radius) const
+{
+    std::vector<Candidate> vCandidates;
+    const Eigen::Vector3i v0 = voxel(Ow - Eigen::Vector3d::Constant(radius));
+    const Eigen::Vector3i v1 = voxel(Ow + Eigen::Vector3d::Constant(radius));
+    const Eigen::Vector3i n = v1 - v0 + Eigen::Vector3i::Ones();
+
+    // A radius spanning more voxels than are occupied is cheaper as a plain scan
+    if((double)n.x()*n.y()*n.z() > (double)mmVoxels.size())
+        collectAll(Ow, radius, vCandidates);
+    else
+    {
+        for(int x = v0.x(); x <= v1.x(); x++)
+            for(int y = v0.y(); y <= v1.y(); y++)
+                for(int z = v0.z(); z <= v1.z(); z++)
+                    collect(Eigen::Vector3i(x,y,z), Ow, radius, vCandidates);
+    }
+
+    std::sort(vCandidates.begin(), vCandidates.end());
+    std::vector<KeyFrame*> vpKFs(vCandidates.size());
+    for(size_t i = 0; i < vCandidates.size(); i++)
+        vpKFs[i] = vCandidates[i].second;
+    return vpKFs;
+}
+
+} //namespace ORB_SLAM3
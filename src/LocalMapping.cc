@@ -23,9 +23,11 @@
 #include "Optimizer.h"
 #include "Converter.h"
 #include "Config.h"
+#include "WorkerPool.h"
 
 #include<mutex>
 #include<chrono>
+#include<thread>
 
 namespace ORB_SLAM3
 {
@@ -34,7 +36,7 @@ LocalMapping::LocalMapping(System* pSys, Atlas *pAtlas, const float bMonocular,
     mpSystem(pSys), mbMonocular(bMonocular), mbInertial(bInertial), mbResetRequested(false), mbResetRequestedActiveMap(false), mbFinishRequested(false), mbFinished(true), mpAtlas(pAtlas), bInitializing(false),
     mbAbortBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false), mbAcceptKeyFrames(true),
     mbNewInit(false), mIdxInit(0), mScale(1.0), mInitSect(0), mbNotBA1(true), mbNotBA2(true), infoInertial(Eigen::MatrixXd::Zero(9,9)),
-    iGPSPoseScale(1.0)
+    iGPSPoseScale(1.0), mnNewiGPSDirections(0), mnMinNewiGPSDirections(300)
 {
     mnMatchesInliers = 0;
 
@@ -62,6 +64,11 @@ void LocalMapping::SetTracker(Tracking *pTracker)
     mpTracker=pTracker;
 }
 
+void LocalMapping::SetiGPSGBATrigger(const int nMinNewDirections)
+{
+    mnMinNewiGPSDirections = nMinNewDirections;
+}
+
 void LocalMapping::Run()
 {
 
@@ -159,16 +166,16 @@ void LocalMapping::Run()
                         b_doneLBA = true;
                     }
                     //else if(mbiGPSDirInitialized)
-                    //else if(mbiGPSDirInitialized && (mpAtlas->KeyFramesInMap())>=40 && mbMonocular && !mvTci.empty())
+                    //else if(mbiGPSDirInitialized && (mpAtlas->KeyFramesInMap())>=40 && mbMonocular && !mTransmitters.empty())
                     //{
-                    //    Optimizer::LocaliGPSDirBA(mpCurrentKeyFrame,&mbAbortBA, mpCurrentKeyFrame->GetMap(),num_FixedKF_BA,num_OptKF_BA,num_MPs_BA,num_edges_BA,iGPSPoseScale,mvTci,mvTcw,mbScaleFixFlag,mbMonocular,mlKF);
+                    //    Optimizer::LocaliGPSDirBA(mpCurrentKeyFrame,&mbAbortBA, mpCurrentKeyFrame->GetMap(),num_FixedKF_BA,num_OptKF_BA,num_MPs_BA,num_edges_BA,iGPSPoseScale,mTransmitters,mvTcw,mbScaleFixFlag,mbMonocular,mlKF);
                     //    mbScaleFixFlag = true;
                     //    b_doneLBA = true;
                     //}
 
-                    //else if(!mbiGPSDirInitialized && !mvTci.empty())   // try to global BA
+                    //else if(!mbiGPSDirInitialized && !mTransmitters.empty())   // try to global BA
                     //{
-                    //    bool ret = Optimizer::GlobalVisualiGPSBundleAdjustemnt(mpCurrentKeyFrame->GetMap(),mvTci,mbMonocular,20,1);
+                    //    bool ret = Optimizer::GlobalVisualiGPSBundleAdjustemnt(mpCurrentKeyFrame->GetMap(),mTransmitters,mbMonocular,20,1);
                     //    if(ret == true)
                     //    {
                     //        mbiGPSDirInitialized = true;
@@ -180,9 +187,9 @@ void LocalMapping::Run()
                     //        b_doneLBA = true;
                     //    }
                     //}
-                    //else if(mbiGPSDirInitialized && !mvTci.empty())
+                    //else if(mbiGPSDirInitialized && !mTransmitters.empty())
                     //{
-                    //    Optimizer::LocaliGPSDirBA(mpCurrentKeyFrame,&mbAbortBA, mpCurrentKeyFrame->GetMap(),num_FixedKF_BA,num_OptKF_BA,num_MPs_BA,num_edges_BA,iGPSPoseScale,mvTci,mvTcw,mbScaleFixFlag, mbMonocular,mlKF,1e7);
+                    //    Optimizer::LocaliGPSDirBA(mpCurrentKeyFrame,&mbAbortBA, mpCurrentKeyFrame->GetMap(),num_FixedKF_BA,num_OptKF_BA,num_MPs_BA,num_edges_BA,iGPSPoseScale,mTransmitters,mvTcw,mbScaleFixFlag, mbMonocular,mlKF,1e7);
                     //    b_doneLBA = true;
                     //}
                     else
@@ -295,6 +302,19 @@ void LocalMapping::Run()
 
             mpLoopCloser->InsertKeyFrame(mpCurrentKeyFrame);
 
+            // Enough new iGPS evidence, refine the whole map with the directions in the background
+            mnNewiGPSDirections += mpCurrentKeyFrame->miGPSDirection.size();
+            if(mnNewiGPSDirections >= mnMinNewiGPSDirections)
+            {
+                // Not before the transmitters are located in this map
+                unique_lock<mutex> lock(mMutexTransmitters);
+                if(mTransmitters.isInitialized())
+                {
+                    mpLoopCloser->RequestiGPSGlobalBA(mpCurrentKeyFrame->GetMap(),mTransmitters,mbMonocular);
+                    mnNewiGPSDirections = 0;
+                }
+            }
+
 
 #ifdef REGISTER_TIMES
             std::chrono::steady_clock::time_point time_EndLocalMap = std::chrono::steady_clock::now();
@@ -308,7 +328,7 @@ void LocalMapping::Run()
             // Safe area to stop
             while(isStopped() && !CheckFinish())
             {
-                usleep(3000);
+                mWakeEvent.Wait(50000);
             }
             if(CheckFinish())
                 break;
@@ -322,11 +342,23 @@ void LocalMapping::Run()
         if(CheckFinish())
             break;
 
-        usleep(3000);
+        // Sleep until Tracking inserts a keyframe or a stop/reset/finish request arrives
+        if(!CheckNewKeyFrames() || mbBadImu)
+            mWakeEvent.Wait(50000);
+    }
+
+    // Final visual-iGPS refinement with the directions that arrived since the last request. Loop Closing
+    // runs it as its last GBA, warm-started like the others.
+    if(mnNewiGPSDirections > 0)
+    {
+        unique_lock<mutex> lock(mMutexTransmitters);
+        if(mTransmitters.isInitialized())
+        {
+            mpLoopCloser->RequestiGPSGlobalBA(mpAtlas->GetCurrentMap(),mTransmitters,mbMonocular);
+            mnNewiGPSDirections = 0;
+        }
     }
 
-    //暂时隐藏
-    Optimizer::GlobalVisualiGPSBundleAdjustemnt(mpCurrentKeyFrame->GetMap(),mvTci,mbMonocular,20, 1e9);
     SetFinish();
 }
 
@@ -335,6 +367,7 @@ void LocalMapping::InsertKeyFrame(KeyFrame *pKF)
     unique_lock<mutex> lock(mMutexNewKFs);
     mlNewKeyFrames.push_back(pKF);
     mbAbortBA=true;
+    mWakeEvent.Notify();
 }
 
 
@@ -947,6 +980,7 @@ void LocalMapping::RequestStop()
     mbStopRequested = true;
     unique_lock<mutex> lock2(mMutexNewKFs);
     mbAbortBA = true;
+    mWakeEvent.Notify();
 }
 
 bool LocalMapping::Stop()
@@ -985,6 +1019,7 @@ void LocalMapping::Release()
     for(list<KeyFrame*>::iterator lit = mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++)
         delete *lit;
     mlNewKeyFrames.clear();
+    mWakeEvent.Notify();
 
     cout << "Local Mapping RELEASE" << endl;
 }
@@ -1009,6 +1044,8 @@ bool LocalMapping::SetNotStop(bool flag)
         return false;
 
     mbNotStop = flag;
+    if(!flag)
+        mWakeEvent.Notify();
 
     return true;
 }
@@ -1196,6 +1233,7 @@ void LocalMapping::RequestReset()
         cout << "LM: Map reset recieved" << endl;
         mbResetRequested = true;
     }
+    mWakeEvent.Notify();
     cout << "LM: Map reset, waiting..." << endl;
 
     while(1)
@@ -1218,6 +1256,7 @@ void LocalMapping::RequestResetActiveMap(Map* pMap)
         mbResetRequestedActiveMap = true;
         mpMapToReset = pMap;
     }
+    mWakeEvent.Notify();
     cout << "LM: Active map reset, waiting..." << endl;
 
     while(1)
@@ -1281,8 +1320,11 @@ void LocalMapping::ResetIfRequested()
 
 void LocalMapping::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    mWakeEvent.Shutdown();
 }
 
 bool LocalMapping::CheckFinish()
@@ -1470,9 +1512,10 @@ void LocalMapping::InitializeIMU(float priorG, float priorA, bool bFIBA)
     return;
 }
 
-void LocalMapping::GetiGPStoCamTci(vector<cv::Mat> vTci)
+void LocalMapping::SetiGPSTransmitters(const iGPS::TransmitterRegistry &transmitters)
 {
-    mvTci = vTci;
+    unique_lock<mutex> lock(mMutexTransmitters);
+    mTransmitters = transmitters;
     return;
 };
 
@@ -1532,38 +1575,37 @@ void LocalMapping::InitializeiGPSDir(vector<Eigen::Matrix4d>& Tcw)
     //Eigen::Matrix4d Tcw = Eigen::Matrix4d::Identity();
     //initial estimation
 
-    for(auto i = 0; i < mvTci.size(); i++)
-    {
-        Eigen::Matrix4d Twc = Eigen::Matrix4d::Identity();
+    // The transmitters are calibrated independently on the shared pool, from a snapshot of the
+    // keyframe poses and directions
+    vector<Optimizer::iGPSCalibrationSample> vSamples;
+    Optimizer::GetiGPSCalibrationSamples(mpAtlas->GetCurrentMap(),vSamples);
 
-        //int ch = mpCurrentKeyFrame->miGPSChannel[i];
-        switch(i){
-            case 0:
-                Optimizer::iGPSDirectionOptimization(mpAtlas->GetCurrentMap(),Twc, 1800);
-                break;
-            case 1:
-                Optimizer::iGPSDirectionOptimization(mpAtlas->GetCurrentMap(),Twc, 1900);
-                break;
-            case 2:
-                Optimizer::iGPSDirectionOptimization(mpAtlas->GetCurrentMap(),Twc, 2000);
-                break;
-        }
+    // Tracking may replace the registry meanwhile, the workers read a copy
+    iGPS::TransmitterRegistry transmitters;
+    {
+        unique_lock<mutex> lock(mMutexTransmitters);
+        transmitters = mTransmitters;
+    }
 
-        //Optimizer::iGPSDirectionOptimization(mpAtlas->GetCurrentMap(),Twc, i+1);
-        //Eigen::Matrix3d Rwc = Twc.block<3,3>(0,0);
-        //Eigen::Vector3d twc = Twc.block<3,1>(0,3);
+    const int nTrans = transmitters.size();
+    vector<Eigen::Matrix4d> vTwc(nTrans, Eigen::Matrix4d::Identity());
+    WorkerPool::Shared().ParallelFor(nTrans, [&](const int i)
+    {
+        Optimizer::iGPSDirectionOptimization(vSamples, vTwc[i], transmitters[i].id, false);
+    });
 
-        //cout << "Tcw = "<< Twc.inverse().block<3,1>(0,3).transpose() <<endl;
-        mvTcw.push_back(Twc.inverse());
-        if(Twc(0,3) != 0.0)
+    // Commit all transmitters at once
+    vector<Eigen::Matrix4d> vTcw(nTrans);
+    for(int i = 0; i < nTrans; i++)
+    {
+        vTcw[i] = vTwc[i].inverse();
+        if(vTwc[i](0,3) != 0.0)
         {
             //Successful initialization
-            //cout<< "iGPS Initialization Success" <<endl;
-            cout << "Transm " << i <<" iGPS transmitter initialization Success, Tcw = "<< Twc.inverse() <<endl;
-            //mbiGPSDirInitialized = true;
-            //mbiGPSDirection = false;
+            cout << "Transm " << i <<" iGPS transmitter initialization Success, Tcw = "<< vTcw[i] <<endl;
         }
     }
+    mvTcw.insert(mvTcw.end(), vTcw.begin(), vTcw.end());
 
     //Eigen::Quaterniond qr(rMatrix3d);
     //cout<< "rMatrix q = " << qr <<endl;
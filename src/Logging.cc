@@ -0,0 +1,101 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+#include "Logging.h"
+
+#include <cstdlib>
+#include <iostream>
+
+namespace ORB_SLAM3
+{
+
+Verbose::eLevel Verbose::th = Verbose::VERBOSITY_NORMAL;
+
+namespace
+{
+
+void FlushAtExit()
+{
+    LogSink::Instance().Flush();
+}
+
+}
+
+LogSink& LogSink::Instance()
+{
+    // Never destroyed, threads still logging at exit must not find it gone
+    static LogSink* pSink = new LogSink(8192);
+    return *pSink;
+}
+
+LogSink::LogSink(const size_t capacity):
+    mnCapacity(capacity), mnPushed(0), mnWritten(0), mnDropped(0), mnDroppedTotal(0)
+{
+    mptWriter = new std::thread(&LogSink::Run, this);
+    std::atexit(FlushAtExit);
+}
+
+void LogSink::Push(const std::string &line)
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if(mqLines.size() >= mnCapacity)
+        {
+            mnDropped++;
+            mnDroppedTotal++;
+            return;
+        }
+        mqLines.push_back(line);
+        mnPushed++;
+    }
+    mCondPush.notify_one();
+}
+
+void LogSink::Flush()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    const unsigned long nTarget = mnPushed;
+    mCondWritten.wait(lock, [&]{ return mnWritten >= nTarget; });
+}
+
+unsigned long LogSink::dropped()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mnDroppedTotal;
+}
+
+void LogSink::Run()
+{
+    std::deque<std::string> qLines;
+    std::string buffer;
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(true)
+    {
+        mCondPush.wait(lock, [&]{ return !mqLines.empty(); });
+        qLines.swap(mqLines);
+        const unsigned long nDropped = mnDropped;
+        mnDropped = 0;
+        lock.unlock();
+
+        // One write per batch
+        buffer.clear();
+        for(size_t i = 0; i < qLines.size(); i++)
+        {
+            buffer += qLines[i];
+            buffer += '\n';
+        }
+        if(nDropped > 0)
+            buffer += "[log: " + std::to_string(nDropped) + " lines dropped]\n";
+        std::cout << buffer << std::flush;
+
+        lock.lock();
+        mnWritten += qLines.size();
+        qLines.clear();
+        mCondWritten.notify_all();
+    }
+}
+
+} //namespace ORB_SLAM3
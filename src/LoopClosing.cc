@@ -35,7 +35,9 @@ namespace ORB_SLAM3
 LoopClosing::LoopClosing(Atlas *pAtlas, KeyFrameDatabase *pDB, ORBVocabulary *pVoc, const bool bFixScale):
     mbResetRequested(false), mbResetActiveMapRequested(false), mbFinishRequested(false), mbFinished(true), mpAtlas(pAtlas),
     mpKeyFrameDB(pDB), mpORBVocabulary(pVoc), mpMatchedKF(NULL), mLastLoopKFid(0), mbRunningGBA(false), mbFinishedGBA(true),
-    mbStopGBA(false), mpThreadGBA(NULL), mbFixScale(bFixScale), mnFullBAIdx(0), mnLoopNumCoincidences(0), mnMergeNumCoincidences(0),
+    mbStopGBA(false), mpThreadGBA(NULL), mbFixScale(bFixScale), mnFullBAIdx(0), mbiGPSGBARequested(false), mpiGPSGBAMap(NULL),
+    mbMonocularGBA(false), mniGPSGBAIdx(-1), mdiGPSGBALambda(0.0), mfiGPSLoopGateRadius(0.f),
+    mniGPSGateQueries(0), mniGPSGatePruned(0), mnLoopNumCoincidences(0), mnMergeNumCoincidences(0),
     mbLoopDetected(false), mbMergeDetected(false), mnLoopNumNotFound(0), mnMergeNumNotFound(0)
 {
     mnCovisibilityConsistencyTh = 3;
@@ -57,6 +59,11 @@ void LoopClosing::SetiGPSFusioner(iGPSFusion *piGPSFusioner)
     mpiGPSFusioner = piGPSFusioner;
 }
 
+void LoopClosing::SetiGPSLoopGate(const float radius)
+{
+    mfiGPSLoopGateRadius = radius;
+}
+
 void LoopClosing::LoadiGPSPosition(vector<double> vTimestamps, vector<cv::Point3f> viGPSPosition)
 {
     mviGPSTimestamps = vTimestamps;
@@ -267,13 +274,34 @@ void LoopClosing::Run()
 
         }
 
+        LaunchiGPSGlobalBA();
+
         ResetIfRequested();
 
         if(CheckFinish()){
             break;
         }
 
-        usleep(5000);
+        // Sleep until Local Mapping inserts a keyframe or a reset/finish request arrives
+        if(!CheckNewKeyFrames())
+            mWakeEvent.Wait(50000);
+    }
+
+    if(mniGPSGateQueries > 0)
+        cout << "iGPS loop gate: " << mniGPSGatePruned << " candidates pruned in " << mniGPSGateQueries << " keyframes" << endl;
+
+    // Local Mapping requests a last iGPS GBA when it finishes, if directions arrived since the previous
+    // request. An iGPS GBA in flight is let finish, the final one refines its result; a loop closure GBA
+    // is aborted like when a new loop is found. System::Shutdown waits for the final iGPS GBA.
+    while(!mpLocalMapper->isFinished())
+        usleep(3000);
+    if(isiGPSGlobalBARequested())
+    {
+        if(isRunningGBA() && !isRunningiGPSGBA())
+            StopGlobalBundleAdjustment();
+        while(isRunningiGPSGBA())
+            usleep(3000);
+        LaunchiGPSGlobalBA();
     }
 
     SetFinish();
@@ -283,7 +311,10 @@ void LoopClosing::InsertKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexLoopQueue);
     if(pKF->mnId!=0)
+    {
         mlpLoopKeyFrameQueue.push_back(pKF);
+        mWakeEvent.Notify();
+    }
 }
 
 bool LoopClosing::CheckNewKeyFrames()
@@ -441,7 +472,18 @@ bool LoopClosing::NewDetectCommonRegions()
         std::chrono::steady_clock::time_point time_StartDetectBoW = std::chrono::steady_clock::now();
 #endif
         // Search in BoW
-        mpKeyFrameDB->DetectNBestCandidates(mpCurrentKF, vpLoopBowCand, vpMergeBowCand,3);
+        if(mfiGPSLoopGateRadius > 0 && mpCurrentKF->mfiGPSPositionUncertainty >= 0)
+        {
+            int nPruned = 0;
+            mpKeyFrameDB->DetectNBestCandidates(mpCurrentKF, vpLoopBowCand, vpMergeBowCand,3,mfiGPSLoopGateRadius,&nPruned);
+            mniGPSGateQueries++;
+            mniGPSGatePruned += nPruned;
+            if(nPruned > 0)
+                Verbose::PrintMess("PR: iGPS gate pruned " + to_string(nPruned) + " candidates (" + to_string(mniGPSGatePruned) + " in " +
+                                   to_string(mniGPSGateQueries) + " keyframes)", Verbose::VERBOSITY_DEBUG);
+        }
+        else
+            mpKeyFrameDB->DetectNBestCandidates(mpCurrentKF, vpLoopBowCand, vpMergeBowCand,3);
 #ifdef REGISTER_TIMES
         std::chrono::steady_clock::time_point time_EndDetectBoW = std::chrono::steady_clock::now();
         timeDetectBoW = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndDetectBoW - time_StartDetectBoW).count();
@@ -1869,6 +1911,7 @@ void LoopClosing::RequestReset()
         unique_lock<mutex> lock(mMutexReset);
         mbResetRequested = true;
     }
+    mWakeEvent.Notify();
 
     while(1)
     {
@@ -1888,6 +1931,7 @@ void LoopClosing::RequestResetActiveMap(Map *pMap)
         mbResetActiveMapRequested = true;
         mpMapToReset = pMap;
     }
+    mWakeEvent.Notify();
 
     while(1)
     {
@@ -1970,140 +2014,267 @@ void LoopClosing::RunGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoop
 
         if(!mbStopGBA)
         {
-            Verbose::PrintMess("Global Bundle Adjustment finished", Verbose::VERBOSITY_NORMAL);
-            Verbose::PrintMess("Updating map ...", Verbose::VERBOSITY_NORMAL);
+            ApplyGlobalBundleAdjustment(pActiveMap, nLoopKF);
+        }
 
-            mpLocalMapper->RequestStop();
-            // Wait until Local Mapping has effectively stopped
+        mbFinishedGBA = true;
+        mbRunningGBA = false;
+    }
 
-            while(!mpLocalMapper->isStopped() && !mpLocalMapper->isFinished())
-            {
-                usleep(1000);
-            }
+#ifdef REGISTER_TIMES
+    std::chrono::steady_clock::time_point time_EndMapUpdate = std::chrono::steady_clock::now();
 
-            // Get Map Mutex
-            unique_lock<mutex> lock(pActiveMap->mMutexMapUpdate);
+    double timeMapUpdate = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndMapUpdate - time_StartMapUpdate).count();
+    vTimeMapUpdate_ms.push_back(timeMapUpdate);
 
-            // Correct keyframes starting at map first keyframe
-            list<KeyFrame*> lpKFtoCheck(pActiveMap->mvpKeyFrameOrigins.begin(),pActiveMap->mvpKeyFrameOrigins.end());
+    double timeGBA = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndMapUpdate - time_StartFGBA).count();
+    vTimeGBATotal_ms.push_back(timeGBA);
+#endif
+}
 
-            while(!lpKFtoCheck.empty())
-            {
-                KeyFrame* pKF = lpKFtoCheck.front();
-                const set<KeyFrame*> sChilds = pKF->GetChilds();
-                cv::Mat Twc = pKF->GetPoseInverse();
-                for(set<KeyFrame*>::const_iterator sit=sChilds.begin();sit!=sChilds.end();sit++)
-                {
-                    KeyFrame* pChild = *sit;
-                    if(!pChild || pChild->isBad())
-                        continue;
+void LoopClosing::RequestiGPSGlobalBA(Map* pMap, const iGPS::TransmitterRegistry &transmitters, const bool bMonocular)
+{
+    {
+        unique_lock<mutex> lock(mMutexiGPSGBA);
+        mbiGPSGBARequested = true;
+        mpiGPSGBAMap = pMap;
+        mTransmittersGBA = transmitters;
+        mbMonocularGBA = bMonocular;
+    }
+    mWakeEvent.Notify();
+}
 
-                    if(pChild->mnBAGlobalForKF!=nLoopKF)
-                    {
-                        cv::Mat Tchildc = pChild->GetPose()*Twc;
-                        pChild->mTcwGBA = Tchildc*pKF->mTcwGBA;
+void LoopClosing::LaunchiGPSGlobalBA()
+{
+    // A loop closure GBA has priority, keep the request until it is done
+    if(isRunningGBA())
+        return;
 
-                        cv::Mat Rcor = pChild->mTcwGBA.rowRange(0,3).colRange(0,3).t()*pChild->GetRotation();
-                        if(!pChild->GetVelocity().empty()){
-                            pChild->mVwbGBA = Rcor*pChild->GetVelocity();
-                        }
-                        else
-                            Verbose::PrintMess("Child velocity empty!! ", Verbose::VERBOSITY_NORMAL);
+    Map* pMap;
+    {
+        unique_lock<mutex> lock(mMutexiGPSGBA);
+        if(!mbiGPSGBARequested)
+            return;
+        mbiGPSGBARequested = false;
+        pMap = mpiGPSGBAMap;
+    }
 
+    if(pMap != mpAtlas->GetCurrentMap() || pMap->KeyFramesInMap() < 12)
+        return;
 
-                        pChild->mBiasGBA = pChild->GetImuBias();
+    // The iGPS GBA optimizes no velocities and biases, ApplyGlobalBundleAdjustment would set stale ones
+    if(pMap->isImuInitialized())
+        return;
 
+    unique_lock<mutex> lock(mMutexGBA);
+    if(mpThreadGBA)
+    {
+        // The previous GBA has finished
+        mpThreadGBA->detach();
+        delete mpThreadGBA;
+    }
 
-                        pChild->mnBAGlobalForKF=nLoopKF;
+    mbRunningGBA = true;
+    mbFinishedGBA = false;
+    mbStopGBA = false;
+    mniGPSGBAIdx = mnFullBAIdx;
 
-                    }
-                    lpKFtoCheck.push_back(pChild);
-                }
+    mpThreadGBA = new thread(&LoopClosing::RuniGPSGlobalBundleAdjustment, this, pMap, pMap->GetMaxKFid(), mnFullBAIdx);
+}
 
-                pKF->mTcwBefGBA = pKF->GetPose();
-                pKF->SetPose(pKF->mTcwGBA);
+bool LoopClosing::isiGPSGlobalBARequested()
+{
+    unique_lock<mutex> lock(mMutexiGPSGBA);
+    return mbiGPSGBARequested;
+}
 
-                if(pKF->bImu)
-                {
-                    pKF->mVwbBefGBA = pKF->GetVelocity();
-                    if (pKF->mVwbGBA.empty())
-                        Verbose::PrintMess("pKF->mVwbGBA is empty", Verbose::VERBOSITY_NORMAL);
+void LoopClosing::StopGlobalBundleAdjustment()
+{
+    thread* pThreadGBA;
+    {
+        unique_lock<mutex> lock(mMutexGBA);
+        mbStopGBA = true;
+        mnFullBAIdx++;
+        pThreadGBA = mpThreadGBA;
+        mpThreadGBA = NULL;
+    }
 
-                    assert(!pKF->mVwbGBA.empty());
-                    pKF->SetVelocity(pKF->mVwbGBA);
-                    pKF->SetNewBias(pKF->mBiasGBA);                    
-                }
+    // The optimizer polls mbStopGBA, the aborted job returns at its index check
+    if(pThreadGBA)
+    {
+        pThreadGBA->join();
+        delete pThreadGBA;
+    }
 
-                lpKFtoCheck.pop_front();
-            }
+    unique_lock<mutex> lock(mMutexGBA);
+    mbRunningGBA = false;
+    mbFinishedGBA = true;
+}
 
-            // Correct MapPoints
-            const vector<MapPoint*> vpMPs = pActiveMap->GetAllMapPoints();
+void LoopClosing::RuniGPSGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoopKF, int idx)
+{
+    Verbose::PrintMess("Starting Global Visual-iGPS Bundle Adjustment", Verbose::VERBOSITY_NORMAL);
 
-            for(size_t i=0; i<vpMPs.size(); i++)
-            {
-                MapPoint* pMP = vpMPs[i];
+    iGPS::TransmitterRegistry transmitters;
+    bool bMonocular;
+    {
+        unique_lock<mutex> lock(mMutexiGPSGBA);
+        transmitters = mTransmittersGBA;
+        bMonocular = mbMonocularGBA;
+    }
 
-                if(pMP->isBad())
-                    continue;
+    double lambda;
+    {
+        unique_lock<mutex> lock(mMutexGBA);
+        lambda = mdiGPSGBALambda;
+    }
+    const bool bSolved = Optimizer::GlobalVisualiGPSBundleAdjustemnt(pActiveMap,transmitters,bMonocular,10,1e9,&mbStopGBA,nLoopKF,false,&lambda,true);
 
-                if(pMP->mnBAGlobalForKF==nLoopKF)
-                {
-                    // If optimized by Global BA, just update
-                    pMP->SetWorldPos(pMP->mPosGBA);
+    {
+        unique_lock<mutex> lock(mMutexGBA);
+        // Aborted meanwhile, the GBA state belongs to whatever was launched after this job
+        if(idx!=mnFullBAIdx)
+            return;
+
+        // IMU initialized during the solve, as in RunGlobalBundleAdjustment the result is dropped
+        if(bSolved && !mbStopGBA && !pActiveMap->isImuInitialized())
+        {
+            mdiGPSGBALambda = lambda;
+            ApplyGlobalBundleAdjustment(pActiveMap, nLoopKF);
+        }
+
+        mbFinishedGBA = true;
+        mbRunningGBA = false;
+        mniGPSGBAIdx = -1;
+    }
+}
+
+// Applies a finished global BA stored in mTcwGBA/mPosGBA. Keyframes created while it ran are
+// corrected through the spanning tree. Called with mMutexGBA locked.
+void LoopClosing::ApplyGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoopKF)
+{
+    Verbose::PrintMess("Global Bundle Adjustment finished", Verbose::VERBOSITY_NORMAL);
+    Verbose::PrintMess("Updating map ...", Verbose::VERBOSITY_NORMAL);
+
+    mpLocalMapper->RequestStop();
+    // Wait until Local Mapping has effectively stopped
+
+    while(!mpLocalMapper->isStopped() && !mpLocalMapper->isFinished())
+    {
+        usleep(1000);
+    }
+
+    // Get Map Mutex
+    unique_lock<mutex> lock(pActiveMap->mMutexMapUpdate);
+
+    // Correct keyframes starting at map first keyframe
+    list<KeyFrame*> lpKFtoCheck(pActiveMap->mvpKeyFrameOrigins.begin(),pActiveMap->mvpKeyFrameOrigins.end());
+
+    while(!lpKFtoCheck.empty())
+    {
+        KeyFrame* pKF = lpKFtoCheck.front();
+        const set<KeyFrame*> sChilds = pKF->GetChilds();
+        cv::Mat Twc = pKF->GetPoseInverse();
+        for(set<KeyFrame*>::const_iterator sit=sChilds.begin();sit!=sChilds.end();sit++)
+        {
+            KeyFrame* pChild = *sit;
+            if(!pChild || pChild->isBad())
+                continue;
+
+            if(pChild->mnBAGlobalForKF!=nLoopKF)
+            {
+                cv::Mat Tchildc = pChild->GetPose()*Twc;
+                pChild->mTcwGBA = Tchildc*pKF->mTcwGBA;
+
+                cv::Mat Rcor = pChild->mTcwGBA.rowRange(0,3).colRange(0,3).t()*pChild->GetRotation();
+                if(!pChild->GetVelocity().empty()){
+                    pChild->mVwbGBA = Rcor*pChild->GetVelocity();
                 }
                 else
-                {
-                    // Update according to the correction of its reference keyframe
-                    KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
+                    Verbose::PrintMess("Child velocity empty!! ", Verbose::VERBOSITY_NORMAL);
 
-                    if(pRefKF->mnBAGlobalForKF!=nLoopKF)
-                        continue;
 
-                    if(pRefKF->mTcwBefGBA.empty())
-                        continue;
+                pChild->mBiasGBA = pChild->GetImuBias();
 
-                    // Map to non-corrected camera
-                    cv::Mat Rcw = pRefKF->mTcwBefGBA.rowRange(0,3).colRange(0,3);
-                    cv::Mat tcw = pRefKF->mTcwBefGBA.rowRange(0,3).col(3);
-                    cv::Mat Xc = Rcw*pMP->GetWorldPos()+tcw;
 
-                    // Backproject using corrected camera
-                    cv::Mat Twc = pRefKF->GetPoseInverse();
-                    cv::Mat Rwc = Twc.rowRange(0,3).colRange(0,3);
-                    cv::Mat twc = Twc.rowRange(0,3).col(3);
+                pChild->mnBAGlobalForKF=nLoopKF;
 
-                    pMP->SetWorldPos(Rwc*Xc+twc);
-                }
             }
+            lpKFtoCheck.push_back(pChild);
+        }
 
-            pActiveMap->InformNewBigChange();
-            pActiveMap->IncreaseChangeIndex();
+        pKF->mTcwBefGBA = pKF->GetPose();
+        pKF->SetPose(pKF->mTcwGBA);
 
-            mpLocalMapper->Release();
+        if(pKF->bImu)
+        {
+            pKF->mVwbBefGBA = pKF->GetVelocity();
+            if (pKF->mVwbGBA.empty())
+                Verbose::PrintMess("pKF->mVwbGBA is empty", Verbose::VERBOSITY_NORMAL);
 
-            Verbose::PrintMess("Map updated!", Verbose::VERBOSITY_NORMAL);
+            assert(!pKF->mVwbGBA.empty());
+            pKF->SetVelocity(pKF->mVwbGBA);
+            pKF->SetNewBias(pKF->mBiasGBA);                    
         }
 
-        mbFinishedGBA = true;
-        mbRunningGBA = false;
+        lpKFtoCheck.pop_front();
     }
 
-#ifdef REGISTER_TIMES
-    std::chrono::steady_clock::time_point time_EndMapUpdate = std::chrono::steady_clock::now();
+    // Correct MapPoints
+    const vector<MapPoint*> vpMPs = pActiveMap->GetAllMapPoints();
 
-    double timeMapUpdate = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndMapUpdate - time_StartMapUpdate).count();
-    vTimeMapUpdate_ms.push_back(timeMapUpdate);
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        MapPoint* pMP = vpMPs[i];
 
-    double timeGBA = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndMapUpdate - time_StartFGBA).count();
-    vTimeGBATotal_ms.push_back(timeGBA);
-#endif
+        if(pMP->isBad())
+            continue;
+
+        if(pMP->mnBAGlobalForKF==nLoopKF)
+        {
+            // If optimized by Global BA, just update
+            pMP->SetWorldPos(pMP->mPosGBA);
+        }
+        else
+        {
+            // Update according to the correction of its reference keyframe
+            KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
+
+            if(pRefKF->mnBAGlobalForKF!=nLoopKF)
+                continue;
+
+            if(pRefKF->mTcwBefGBA.empty())
+                continue;
+
+            // Map to non-corrected camera
+            cv::Mat Rcw = pRefKF->mTcwBefGBA.rowRange(0,3).colRange(0,3);
+            cv::Mat tcw = pRefKF->mTcwBefGBA.rowRange(0,3).col(3);
+            cv::Mat Xc = Rcw*pMP->GetWorldPos()+tcw;
+
+            // Backproject using corrected camera
+            cv::Mat Twc = pRefKF->GetPoseInverse();
+            cv::Mat Rwc = Twc.rowRange(0,3).colRange(0,3);
+            cv::Mat twc = Twc.rowRange(0,3).col(3);
+
+            pMP->SetWorldPos(Rwc*Xc+twc);
+        }
+    }
+
+    pActiveMap->InformNewBigChange();
+    pActiveMap->IncreaseChangeIndex();
+
+    mpLocalMapper->Release();
+
+    Verbose::PrintMess("Map updated!", Verbose::VERBOSITY_NORMAL);
 }
 
 void LoopClosing::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    mWakeEvent.Shutdown();
 }
 
 bool LoopClosing::CheckFinish()
@@ -18,6 +18,7 @@
 
 
 #include "Map.h"
+#include "Converter.h"
 
 #include<mutex>
 
@@ -67,6 +68,11 @@ void Map::AddKeyFrame(KeyFrame *pKF)
         mpKFlowerID = pKF;
     }
     mspKeyFrames.insert(pKF);
+    {
+        // Center read under the index lock, so a concurrent SetPose cannot leave a stale position
+        unique_lock<mutex> lockIndex(mMutexKeyFrameIndex);
+        mKeyFrameIndex.insert(pKF, Converter::toVector3d(pKF->GetCameraCenter()));
+    }
     if(pKF->mnId>mnMaxKFid)
     {
         mnMaxKFid=pKF->mnId;
@@ -108,6 +114,10 @@ void Map::EraseKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexMap);
     mspKeyFrames.erase(pKF);
+    {
+        unique_lock<mutex> lockIndex(mMutexKeyFrameIndex);
+        mKeyFrameIndex.erase(pKF);
+    }
     if(mspKeyFrames.size()>0)
     {
         if(pKF->mnId == mpKFlowerID->mnId)
@@ -150,6 +160,19 @@ vector<KeyFrame*> Map::GetAllKeyFrames()
     return vector<KeyFrame*>(mspKeyFrames.begin(),mspKeyFrames.end());
 }
 
+vector<KeyFrame*> Map::GetKeyFramesInRadius(const Eigen::Vector3d &Ow, const double radius)
+{
+    unique_lock<mutex> lock(mMutexKeyFrameIndex);
+    return mKeyFrameIndex.radiusSearch(Ow, radius);
+}
+
+void Map::UpdateKeyFramePosition(KeyFrame* pKF)
+{
+    // The center is read under the index lock, so of two concurrent SetPose the index keeps the last one
+    unique_lock<mutex> lock(mMutexKeyFrameIndex);
+    mKeyFrameIndex.update(pKF, Converter::toVector3d(pKF->GetCameraCenter()));
+}
+
 vector<MapPoint*> Map::GetAllMapPoints()
 {
     unique_lock<mutex> lock(mMutexMap);
@@ -225,6 +248,10 @@ void Map::clear()
 
     mspMapPoints.clear();
     mspKeyFrames.clear();
+    {
+        unique_lock<mutex> lockIndex(mMutexKeyFrameIndex);
+        mKeyFrameIndex.clear();
+    }
     mnMaxKFid = mnInitKFid;
     mnLastLoopKFid = 0;
     mbImuInitialized = false;
@@ -113,7 +113,7 @@ MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF
     mfMaxDistance = dist*levelScaleFactor;
     mfMinDistance = mfMaxDistance/pFrame->mvScaleFactors[nLevels-1];
 
-    pFrame->mDescriptors.row(idxF).copyTo(mDescriptor);
+    mDescriptor.store(pFrame->mDescriptors.ptr<uint8_t>(idxF));
 
     // MapPoints can be created from Tracking and Local Mapping. This mutex avoid conflicts with id.
     unique_lock<mutex> lock(mpMap->mMutexPointCreation);
@@ -348,8 +348,8 @@ float MapPoint::GetFoundRatio()
 
 void MapPoint::ComputeDistinctiveDescriptors()
 {
-    // Retrieve all observed descriptors
-    vector<cv::Mat> vDescriptors;
+    // Retrieve all observed descriptors, they stay in the KeyFrames' storage
+    vector<const uint8_t*> vpDescriptors;
 
     map<KeyFrame*,tuple<int,int>> observations;
 
@@ -363,7 +363,7 @@ void MapPoint::ComputeDistinctiveDescriptors()
     if(observations.empty())
         return;
 
-    vDescriptors.reserve(observations.size());
+    vpDescriptors.reserve(2*observations.size());
 
     for(map<KeyFrame*,tuple<int,int>>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
     {
@@ -374,40 +374,40 @@ void MapPoint::ComputeDistinctiveDescriptors()
             int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
 
             if(leftIndex != -1){
-                vDescriptors.push_back(pKF->mDescriptors.row(leftIndex));
+                vpDescriptors.push_back(pKF->mDescriptors.ptr<uint8_t>(leftIndex));
             }
             if(rightIndex != -1){
-                vDescriptors.push_back(pKF->mDescriptors.row(rightIndex));
+                vpDescriptors.push_back(pKF->mDescriptors.ptr<uint8_t>(rightIndex));
             }
         }
     }
 
-    if(vDescriptors.empty())
+    if(vpDescriptors.empty())
         return;
 
     // Compute distances between them
-    const size_t N = vDescriptors.size();
+    const size_t N = vpDescriptors.size();
 
-    float Distances[N][N];
+    vector<int> vDistances(N*N);
     for(size_t i=0;i<N;i++)
     {
-        Distances[i][i]=0;
+        int* pRow = &vDistances[i*N];
+        pRow[i]=0;
+        Hamming::Distances(vpDescriptors[i],vpDescriptors.data()+i+1,N-i-1,pRow+i+1);
         for(size_t j=i+1;j<N;j++)
-        {
-            int distij = ORBmatcher::DescriptorDistance(vDescriptors[i],vDescriptors[j]);
-            Distances[i][j]=distij;
-            Distances[j][i]=distij;
-        }
+            vDistances[j*N+i]=pRow[j];
     }
 
     // Take the descriptor with least median distance to the rest
     int BestMedian = INT_MAX;
     int BestIdx = 0;
+    vector<int> vDists(N);
+    const size_t nMedian = 0.5*(N-1);
     for(size_t i=0;i<N;i++)
     {
-        vector<int> vDists(Distances[i],Distances[i]+N);
-        sort(vDists.begin(),vDists.end());
-        int median = vDists[0.5*(N-1)];
+        vDists.assign(vDistances.begin()+i*N,vDistances.begin()+(i+1)*N);
+        nth_element(vDists.begin(),vDists.begin()+nMedian,vDists.end());
+        int median = vDists[nMedian];
 
         if(median<BestMedian)
         {
@@ -418,14 +418,14 @@ void MapPoint::ComputeDistinctiveDescriptors()
 
     {
         unique_lock<mutex> lock(mMutexFeatures);
-        mDescriptor = vDescriptors[BestIdx].clone();
+        mDescriptor.store(vpDescriptors[BestIdx]);
     }
 }
 
-cv::Mat MapPoint::GetDescriptor()
+Descriptor MapPoint::GetDescriptor()
 {
-    unique_lock<mutex> lock(mMutexFeatures);
-    return mDescriptor.clone();
+    // Lock free, matching reads it for every candidate
+    return mDescriptor.load();
 }
 
 tuple<int,int> MapPoint::GetIndexInKeyFrame(KeyFrame *pKF)
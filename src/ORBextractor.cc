@@ -59,6 +59,7 @@
 #include <iostream>
 
 #include "ORBextractor.h"
+#include "WorkerPool.h"
 
 
 using namespace cv;
@@ -766,98 +767,94 @@ namespace ORB_SLAM3
 
         const float W = 35;
 
+        // Cells of every level. FAST runs on the cell rows of all levels at once, then each level is
+        // distributed on its own.
+        struct LevelCells
+        {
+            int minBorderX, minBorderY, maxBorderX, maxBorderY;
+            int nCols, nRows, wCell, hCell;
+        };
+        vector<LevelCells> vLevels(nlevels);
+        vector<vector<vector<cv::KeyPoint> > > vRowKeys(nlevels);
+        vector<pair<int,int> > vRows;
         for (int level = 0; level < nlevels; ++level)
         {
-            const int minBorderX = EDGE_THRESHOLD-3;
-            const int minBorderY = minBorderX;
-            const int maxBorderX = mvImagePyramid[level].cols-EDGE_THRESHOLD+3;
-            const int maxBorderY = mvImagePyramid[level].rows-EDGE_THRESHOLD+3;
+            LevelCells &lc = vLevels[level];
+            lc.minBorderX = EDGE_THRESHOLD-3;
+            lc.minBorderY = lc.minBorderX;
+            lc.maxBorderX = mvImagePyramid[level].cols-EDGE_THRESHOLD+3;
+            lc.maxBorderY = mvImagePyramid[level].rows-EDGE_THRESHOLD+3;
+
+            const float width = (lc.maxBorderX-lc.minBorderX);
+            const float height = (lc.maxBorderY-lc.minBorderY);
+
+            lc.nCols = width/W;
+            lc.nRows = height/W;
+            lc.wCell = ceil(width/lc.nCols);
+            lc.hCell = ceil(height/lc.nRows);
+
+            vRowKeys[level].resize(lc.nRows);
+            for(int i=0; i<lc.nRows; i++)
+                vRows.push_back(make_pair(level,i));
+        }
 
-            vector<cv::KeyPoint> vToDistributeKeys;
-            vToDistributeKeys.reserve(nfeatures*10);
+        WorkerPool::Shared().ParallelFor(vRows.size(), [&](const int r)
+        {
+            const int level = vRows[r].first;
+            const int i = vRows[r].second;
+            const LevelCells &lc = vLevels[level];
+            vector<cv::KeyPoint> &vKeysRow = vRowKeys[level][i];
 
-            const float width = (maxBorderX-minBorderX);
-            const float height = (maxBorderY-minBorderY);
+            const float iniY =lc.minBorderY+i*lc.hCell;
+            float maxY = iniY+lc.hCell+6;
 
-            const int nCols = width/W;
-            const int nRows = height/W;
-            const int wCell = ceil(width/nCols);
-            const int hCell = ceil(height/nRows);
+            if(iniY>=lc.maxBorderY-3)
+                return;
+            if(maxY>lc.maxBorderY)
+                maxY = lc.maxBorderY;
 
-            for(int i=0; i<nRows; i++)
+            for(int j=0; j<lc.nCols; j++)
             {
-                const float iniY =minBorderY+i*hCell;
-                float maxY = iniY+hCell+6;
-
-                if(iniY>=maxBorderY-3)
+                const float iniX =lc.minBorderX+j*lc.wCell;
+                float maxX = iniX+lc.wCell+6;
+                if(iniX>=lc.maxBorderX-6)
                     continue;
-                if(maxY>maxBorderY)
-                    maxY = maxBorderY;
+                if(maxX>lc.maxBorderX)
+                    maxX = lc.maxBorderX;
 
-                for(int j=0; j<nCols; j++)
-                {
-                    const float iniX =minBorderX+j*wCell;
-                    float maxX = iniX+wCell+6;
-                    if(iniX>=maxBorderX-6)
-                        continue;
-                    if(maxX>maxBorderX)
-                        maxX = maxBorderX;
+                vector<cv::KeyPoint> vKeysCell;
 
-                    vector<cv::KeyPoint> vKeysCell;
+                FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
+                     vKeysCell,iniThFAST,true);
 
+                if(vKeysCell.empty())
+                {
                     FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                         vKeysCell,iniThFAST,true);
-
-                    /*if(bRight && j <= 13){
-                        FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                             vKeysCell,10,true);
-                    }
-                    else if(!bRight && j >= 16){
-                        FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                             vKeysCell,10,true);
-                    }
-                    else{
-                        FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                             vKeysCell,iniThFAST,true);
-                    }*/
-
-
-                    if(vKeysCell.empty())
-                    {
-                        FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                             vKeysCell,minThFAST,true);
-                        /*if(bRight && j <= 13){
-                            FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                                 vKeysCell,5,true);
-                        }
-                        else if(!bRight && j >= 16){
-                            FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                                 vKeysCell,5,true);
-                        }
-                        else{
-                            FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                                 vKeysCell,minThFAST,true);
-                        }*/
-                    }
-
-                    if(!vKeysCell.empty())
-                    {
-                        for(vector<cv::KeyPoint>::iterator vit=vKeysCell.begin(); vit!=vKeysCell.end();vit++)
-                        {
-                            (*vit).pt.x+=j*wCell;
-                            (*vit).pt.y+=i*hCell;
-                            vToDistributeKeys.push_back(*vit);
-                        }
-                    }
+                         vKeysCell,minThFAST,true);
+                }
 
+                for(vector<cv::KeyPoint>::iterator vit=vKeysCell.begin(); vit!=vKeysCell.end();vit++)
+                {
+                    (*vit).pt.x+=j*lc.wCell;
+                    (*vit).pt.y+=i*lc.hCell;
+                    vKeysRow.push_back(*vit);
                 }
             }
+        });
 
-            vector<KeyPoint> & keypoints = allKeypoints[level];
-            keypoints.reserve(nfeatures);
+        WorkerPool::Shared().ParallelFor(nlevels, [&](const int level)
+        {
+            const LevelCells &lc = vLevels[level];
+
+            // Rows in order, the same keypoint order as a cell by cell scan
+            vector<cv::KeyPoint> vToDistributeKeys;
+            vToDistributeKeys.reserve(nfeatures*10);
+            for(size_t i=0; i<vRowKeys[level].size(); i++)
+                vToDistributeKeys.insert(vToDistributeKeys.end(), vRowKeys[level][i].begin(), vRowKeys[level][i].end());
 
-            keypoints = DistributeOctTree(vToDistributeKeys, minBorderX, maxBorderX,
-                                          minBorderY, maxBorderY,mnFeaturesPerLevel[level], level);
+            vector<KeyPoint> & keypoints = allKeypoints[level];
+            keypoints = DistributeOctTree(vToDistributeKeys, lc.minBorderX, lc.maxBorderX,
+                                          lc.minBorderY, lc.maxBorderY,mnFeaturesPerLevel[level], level);
 
             const int scaledPatchSize = PATCH_SIZE*mvScaleFactor[level];
 
@@ -865,16 +862,15 @@ namespace ORB_SLAM3
             const int nkps = keypoints.size();
             for(int i=0; i<nkps ; i++)
             {
-                keypoints[i].pt.x+=minBorderX;
-                keypoints[i].pt.y+=minBorderY;
+                keypoints[i].pt.x+=lc.minBorderX;
+                keypoints[i].pt.y+=lc.minBorderY;
                 keypoints[i].octave=level;
                 keypoints[i].size = scaledPatchSize;
             }
-        }
 
-        // compute orientations
-        for (int level = 0; level < nlevels; ++level)
-            computeOrientation(mvImagePyramid[level], allKeypoints[level], umax);
+            // compute orientations
+            computeOrientation(mvImagePyramid[level], keypoints, umax);
+        });
     }
 
     void ORBextractor::ComputeKeyPointsOld(std::vector<std::vector<KeyPoint> > &allKeypoints)
@@ -1099,6 +1095,22 @@ namespace ORB_SLAM3
         //_keypoints.reserve(nkeypoints);
         _keypoints = vector<cv::KeyPoint>(nkeypoints);
 
+        // Descriptors of every level in parallel
+        vector<Mat> vDescriptors(nlevels);
+        WorkerPool::Shared().ParallelFor(nlevels, [&](const int level)
+        {
+            vector<KeyPoint>& keypoints = allKeypoints[level];
+            if(keypoints.empty())
+                return;
+
+            // preprocess the resized image
+            Mat workingMat = mvImagePyramid[level].clone();
+            GaussianBlur(workingMat, workingMat, Size(7, 7), 2, 2, BORDER_REFLECT_101);
+
+            // Compute the descriptors
+            computeDescriptors(workingMat, keypoints, vDescriptors[level], pattern);
+        });
+
         int offset = 0;
         //Modified for speeding up stereo fisheye matching
         int monoIndex = 0, stereoIndex = nkeypoints-1;
@@ -1110,14 +1122,7 @@ namespace ORB_SLAM3
             if(nkeypointsLevel==0)
                 continue;
 
-            // preprocess the resized image
-            Mat workingMat = mvImagePyramid[level].clone();
-            GaussianBlur(workingMat, workingMat, Size(7, 7), 2, 2, BORDER_REFLECT_101);
-
-            // Compute the descriptors
-            //Mat desc = descriptors.rowRange(offset, offset + nkeypointsLevel);
-            Mat desc = cv::Mat(nkeypointsLevel, 32, CV_8U);
-            computeDescriptors(workingMat, keypoints, desc, pattern);
+            const Mat &desc = vDescriptors[level];
 
             offset += nkeypointsLevel;
 
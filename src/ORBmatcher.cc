@@ -25,6 +25,7 @@
 #include<opencv2/features2d/features2d.hpp>
 
 #include "Thirdparty/DBoW2/DBoW2/FeatureVector.h"
+#include "Hamming.h"
 
 #include<stdint-gcc.h>
 
@@ -47,6 +48,20 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
 
     const bool bFactor = th!=1.0;
 
+    // Octave of keypoint idx, left or right image
+    auto octave = [&F](const size_t idx)
+    {
+        return (F.Nleft == -1) ? F.mvKeysUn[idx].octave
+                               : (idx < (size_t)F.Nleft) ? F.mvKeys[idx].octave
+                                                         : F.mvKeysRight[idx - F.Nleft].octave;
+    };
+
+    // Candidates of the current MapPoint, reused across points
+    vector<size_t> vCandIdx;
+    vector<const uint8_t*> vpCandDesc;
+    vCandIdx.reserve(64);
+    vpCandDesc.reserve(64);
+
     for(size_t iMP=0; iMP<vpMapPoints.size(); iMP++)
     {
         MapPoint* pMP = vpMapPoints[iMP];
@@ -73,15 +88,11 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
                     F.GetFeaturesInArea(pMP->mTrackProjX,pMP->mTrackProjY,r*F.mvScaleFactors[nPredictedLevel],nPredictedLevel-1,nPredictedLevel);
 
             if(!vIndices.empty()){
-                const cv::Mat MPdescriptor = pMP->GetDescriptor();
+                const Descriptor MPdescriptor = pMP->GetDescriptor();
 
-                int bestDist=256;
-                int bestLevel= -1;
-                int bestDist2=256;
-                int bestLevel2 = -1;
-                int bestIdx =-1 ;
-
-                // Get best and second matches with near keypoints
+                // Gather the free keypoints near the projection
+                vCandIdx.clear();
+                vpCandDesc.clear();
                 for(vector<size_t>::const_iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)
                 {
                     const size_t idx = *vit;
@@ -97,32 +108,21 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
                             continue;
                     }
 
-                    const cv::Mat &d = F.mDescriptors.row(idx);
-
-                    const int dist = DescriptorDistance(MPdescriptor,d);
-
-                    if(dist<bestDist)
-                    {
-                        bestDist2=bestDist;
-                        bestDist=dist;
-                        bestLevel2 = bestLevel;
-                        bestLevel = (F.Nleft == -1) ? F.mvKeysUn[idx].octave
-                                                    : (idx < F.Nleft) ? F.mvKeys[idx].octave
-                                                                      : F.mvKeysRight[idx - F.Nleft].octave;
-                        bestIdx=idx;
-                    }
-                    else if(dist<bestDist2)
-                    {
-                        bestLevel2 = (F.Nleft == -1) ? F.mvKeysUn[idx].octave
-                                                     : (idx < F.Nleft) ? F.mvKeys[idx].octave
-                                                                       : F.mvKeysRight[idx - F.Nleft].octave;
-                        bestDist2=dist;
-                    }
+                    vCandIdx.push_back(idx);
+                    vpCandDesc.push_back(F.mDescriptors.ptr<uint8_t>(idx));
                 }
 
+                // Get best and second matches with near keypoints
+                int bestDist, bestDist2, best2;
+                const int best = Hamming::BestTwo(MPdescriptor.data,vpCandDesc.data(),vpCandDesc.size(),bestDist,bestDist2,&best2);
+
                 // Apply ratio to second match (only if best and second are in the same scale level)
                 if(bestDist<=TH_HIGH)
                 {
+                    const int bestIdx = vCandIdx[best];
+                    const int bestLevel = octave(bestIdx);
+                    const int bestLevel2 = (best2>=0) ? octave(vCandIdx[best2]) : -1;
+
                     if(bestLevel==bestLevel2 && bestDist>mfNNratio*bestDist2)
                         continue;
 
@@ -153,15 +153,10 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
                 if(vIndices.empty())
                     continue;
 
-                const cv::Mat MPdescriptor = pMP->GetDescriptor();
-
-                int bestDist=256;
-                int bestLevel= -1;
-                int bestDist2=256;
-                int bestLevel2 = -1;
-                int bestIdx =-1 ;
+                const Descriptor MPdescriptor = pMP->GetDescriptor();
 
-                // Get best and second matches with near keypoints
+                vCandIdx.clear();
+                vpCandDesc.clear();
                 for(vector<size_t>::const_iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)
                 {
                     const size_t idx = *vit;
@@ -170,29 +165,21 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
                         if(F.mvpMapPoints[idx + F.Nleft]->Observations()>0)
                             continue;
 
-
-                    const cv::Mat &d = F.mDescriptors.row(idx + F.Nleft);
-
-                    const int dist = DescriptorDistance(MPdescriptor,d);
-
-                    if(dist<bestDist)
-                    {
-                        bestDist2=bestDist;
-                        bestDist=dist;
-                        bestLevel2 = bestLevel;
-                        bestLevel = F.mvKeysRight[idx].octave;
-                        bestIdx=idx;
-                    }
-                    else if(dist<bestDist2)
-                    {
-                        bestLevel2 = F.mvKeysRight[idx].octave;
-                        bestDist2=dist;
-                    }
+                    vCandIdx.push_back(idx);
+                    vpCandDesc.push_back(F.mDescriptors.ptr<uint8_t>(idx + F.Nleft));
                 }
 
+                // Get best and second matches with near keypoints
+                int bestDist, bestDist2, best2;
+                const int best = Hamming::BestTwo(MPdescriptor.data,vpCandDesc.data(),vpCandDesc.size(),bestDist,bestDist2,&best2);
+
                 // Apply ratio to second match (only if best and second are in the same scale level)
                 if(bestDist<=TH_HIGH)
                 {
+                    const int bestIdx = vCandIdx[best];
+                    const int bestLevel = F.mvKeysRight[bestIdx].octave;
+                    const int bestLevel2 = (best2>=0) ? F.mvKeysRight[vCandIdx[best2]].octave : -1;
+
                     if(bestLevel==bestLevel2 && bestDist>mfNNratio*bestDist2)
                         continue;
 
@@ -281,6 +268,10 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
         rotHist[i].reserve(500);
     const float factor = 1.0f/HISTO_LENGTH;
 
+    // Candidates of the current KeyFrame feature, reused across features
+    vector<unsigned int> vCandIdx, vCandIdxR;
+    vector<const uint8_t*> vpCandDesc, vpCandDescR;
+
     // We perform the matching over ORB that belong to the same vocabulary node (at a certain level)
     DBoW2::FeatureVector::const_iterator KFit = vFeatVecKF.begin();
     DBoW2::FeatureVector::const_iterator Fit = F.mFeatVec.begin();
@@ -306,70 +297,40 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
                 if(pMP->isBad())
                     continue;
 
-                const cv::Mat &dKF= pKF->mDescriptors.row(realIdxKF);
-
-                int bestDist1=256;
-                int bestIdxF =-1 ;
-                int bestDist2=256;
-
-                int bestDist1R=256;
-                int bestIdxFR =-1 ;
-                int bestDist2R=256;
+                const uint8_t* dKF = pKF->mDescriptors.ptr<uint8_t>(realIdxKF);
 
+                // Unmatched keypoints of the node, the right camera ones apart
+                vCandIdx.clear();
+                vpCandDesc.clear();
+                vCandIdxR.clear();
+                vpCandDescR.clear();
                 for(size_t iF=0; iF<vIndicesF.size(); iF++)
                 {
-                    if(F.Nleft == -1){
-                        const unsigned int realIdxF = vIndicesF[iF];
+                    const unsigned int realIdxF = vIndicesF[iF];
 
-                        if(vpMapPointMatches[realIdxF])
-                            continue;
-
-                        const cv::Mat &dF = F.mDescriptors.row(realIdxF);
-
-                        const int dist =  DescriptorDistance(dKF,dF);
+                    if(vpMapPointMatches[realIdxF])
+                        continue;
 
-                        if(dist<bestDist1)
-                        {
-                            bestDist2=bestDist1;
-                            bestDist1=dist;
-                            bestIdxF=realIdxF;
-                        }
-                        else if(dist<bestDist2)
-                        {
-                            bestDist2=dist;
-                        }
+                    if(F.Nleft == -1 || realIdxF < (unsigned int)F.Nleft)
+                    {
+                        vCandIdx.push_back(realIdxF);
+                        vpCandDesc.push_back(F.mDescriptors.ptr<uint8_t>(realIdxF));
                     }
-                    else{
-                        const unsigned int realIdxF = vIndicesF[iF];
-
-                        if(vpMapPointMatches[realIdxF])
-                            continue;
-
-                        const cv::Mat &dF = F.mDescriptors.row(realIdxF);
-
-                        const int dist =  DescriptorDistance(dKF,dF);
-
-                        if(realIdxF < F.Nleft && dist<bestDist1){
-                            bestDist2=bestDist1;
-                            bestDist1=dist;
-                            bestIdxF=realIdxF;
-                        }
-                        else if(realIdxF < F.Nleft && dist<bestDist2){
-                            bestDist2=dist;
-                        }
-
-                        if(realIdxF >= F.Nleft && dist<bestDist1R){
-                            bestDist2R=bestDist1R;
-                            bestDist1R=dist;
-                            bestIdxFR=realIdxF;
-                        }
-                        else if(realIdxF >= F.Nleft && dist<bestDist2R){
-                            bestDist2R=dist;
-                        }
+                    else
+                    {
+                        vCandIdxR.push_back(realIdxF);
+                        vpCandDescR.push_back(F.mDescriptors.ptr<uint8_t>(realIdxF));
                     }
-
                 }
 
+                int bestDist1, bestDist2;
+                const int best = Hamming::BestTwo(dKF,vpCandDesc.data(),vpCandDesc.size(),bestDist1,bestDist2);
+                const int bestIdxF = (best>=0) ? vCandIdx[best] : -1;
+
+                int bestDist1R, bestDist2R;
+                const int bestR = Hamming::BestTwo(dKF,vpCandDescR.data(),vpCandDescR.size(),bestDist1R,bestDist2R);
+                const int bestIdxFR = (bestR>=0) ? vCandIdxR[bestR] : -1;
+
                 if(bestDist1<=TH_LOW)
                 {
                     if(static_cast<float>(bestDist1)<mfNNratio*static_cast<float>(bestDist2))
@@ -547,7 +508,7 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapP
             continue;
 
         // Match to the most similar keypoint in the radius
-        const cv::Mat dMP = pMP->GetDescriptor();
+        const Descriptor dMP = pMP->GetDescriptor();
 
         int bestDist = 256;
         int bestIdx = -1;
@@ -562,9 +523,9 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapP
             if(kpLevel<nPredictedLevel-1 || kpLevel>nPredictedLevel)
                 continue;
 
-            const cv::Mat &dKF = pKF->mDescriptors.row(idx);
+            const uint8_t* dKF = pKF->mDescriptors.ptr<uint8_t>(idx);
 
-            const int dist = DescriptorDistance(dMP,dKF);
+            const int dist = Hamming::Distance(dMP.data,dKF);
 
             if(dist<bestDist)
             {
@@ -664,7 +625,7 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const std::vector
             continue;
 
         // Match to the most similar keypoint in the radius
-        const cv::Mat dMP = pMP->GetDescriptor();
+        const Descriptor dMP = pMP->GetDescriptor();
 
         int bestDist = 256;
         int bestIdx = -1;
@@ -679,9 +640,9 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const std::vector
             if(kpLevel<nPredictedLevel-1 || kpLevel>nPredictedLevel)
                 continue;
 
-            const cv::Mat &dKF = pKF->mDescriptors.row(idx);
+            const uint8_t* dKF = pKF->mDescriptors.ptr<uint8_t>(idx);
 
-            const int dist = DescriptorDistance(dMP,dKF);
+            const int dist = Hamming::Distance(dMP.data,dKF);
 
             if(dist<bestDist)
             {
@@ -847,6 +808,10 @@ int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
     DBoW2::FeatureVector::const_iterator f1end = vFeatVec1.end();
     DBoW2::FeatureVector::const_iterator f2end = vFeatVec2.end();
 
+    // Candidates of the current keypoint, reused across keypoints
+    vector<size_t> vCandIdx;
+    vector<const uint8_t*> vpCandDesc;
+
     while(f1it != f1end && f2it != f2end)
     {
         if(f1it->first == f2it->first)
@@ -864,12 +829,8 @@ int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
                 if(pMP1->isBad())
                     continue;
 
-                const cv::Mat &d1 = Descriptors1.row(idx1);
-
-                int bestDist1=256;
-                int bestIdx2 =-1 ;
-                int bestDist2=256;
-
+                vCandIdx.clear();
+                vpCandDesc.clear();
                 for(size_t i2=0, iend2=f2it->second.size(); i2<iend2; i2++)
                 {
                     const size_t idx2 = f2it->second[i2];
@@ -886,24 +847,17 @@ int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
                     if(pMP2->isBad())
                         continue;
 
-                    const cv::Mat &d2 = Descriptors2.row(idx2);
-
-                    int dist = DescriptorDistance(d1,d2);
-
-                    if(dist<bestDist1)
-                    {
-                        bestDist2=bestDist1;
-                        bestDist1=dist;
-                        bestIdx2=idx2;
-                    }
-                    else if(dist<bestDist2)
-                    {
-                        bestDist2=dist;
-                    }
+                    vCandIdx.push_back(idx2);
+                    vpCandDesc.push_back(Descriptors2.ptr<uint8_t>(idx2));
                 }
 
+                int bestDist1, bestDist2;
+                const int best = Hamming::BestTwo(Descriptors1.ptr<uint8_t>(idx1),vpCandDesc.data(),vpCandDesc.size(),bestDist1,bestDist2);
+
                 if(bestDist1<TH_LOW)
                 {
+                    const size_t bestIdx2 = vCandIdx[best];
+
                     if(static_cast<float>(bestDist1)<mfNNratio*static_cast<float>(bestDist2))
                     {
                         vpMatches12[idx1]=vpMapPoints2[bestIdx2];
@@ -1021,6 +975,11 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
     DBoW2::FeatureVector::const_iterator f1end = vFeatVec1.end();
     DBoW2::FeatureVector::const_iterator f2end = vFeatVec2.end();
 
+    // Candidates of the current keypoint, reused across keypoints
+    vector<size_t> vCandIdx;
+    vector<const uint8_t*> vpCandDesc;
+    vector<int> vDist;
+
     while(f1it!=f1end && f2it!=f2end)
     {
         if(f1it->first == f2it->first)
@@ -1051,30 +1010,39 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
                 const bool bRight1 = (pKF1 -> NLeft == -1 || idx1 < pKF1 -> NLeft) ? false
                                                                                    : true;
                 //if(bRight1) continue;
-                const cv::Mat &d1 = pKF1->mDescriptors.row(idx1);
-                
-                int bestDist = TH_LOW;
-                int bestIdx2 = -1;
-                
+                const uint8_t* d1 = pKF1->mDescriptors.ptr<uint8_t>(idx1);
+
+                // Unmatched keypoints of the node without MapPoint, distances in one batch
+                vCandIdx.clear();
+                vpCandDesc.clear();
                 for(size_t i2=0, iend2=f2it->second.size(); i2<iend2; i2++)
                 {
-                    size_t idx2 = f2it->second[i2];
-                    
-                    MapPoint* pMP2 = pKF2->GetMapPoint(idx2);
-                    
+                    const size_t idx2 = f2it->second[i2];
+
                     // If we have already matched or there is a MapPoint skip
-                    if(vbMatched2[idx2] || pMP2)
+                    if(vbMatched2[idx2] || pKF2->GetMapPoint(idx2))
                         continue;
 
-                    const bool bStereo2 = (!pKF2->mpCamera2 &&  pKF2->mvuRight[idx2]>=0);
-
                     if(bOnlyStereo)
-                        if(!bStereo2)
+                        if(pKF2->mpCamera2 || pKF2->mvuRight[idx2]<0)
                             continue;
-                    
-                    const cv::Mat &d2 = pKF2->mDescriptors.row(idx2);
-                    
-                    const int dist = DescriptorDistance(d1,d2);
+
+                    vCandIdx.push_back(idx2);
+                    vpCandDesc.push_back(pKF2->mDescriptors.ptr<uint8_t>(idx2));
+                }
+                vDist.resize(vCandIdx.size());
+                Hamming::Distances(d1,vpCandDesc.data(),vpCandDesc.size(),vDist.data());
+
+                int bestDist = TH_LOW;
+                int bestIdx2 = -1;
+
+                for(size_t i2=0; i2<vCandIdx.size(); i2++)
+                {
+                    size_t idx2 = vCandIdx[i2];
+
+                    const bool bStereo2 = (!pKF2->mpCamera2 &&  pKF2->mvuRight[idx2]>=0);
+
+                    const int dist = vDist[i2];
                     
                     if(dist>TH_LOW || dist>bestDist)
                         continue;
@@ -1264,6 +1232,11 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
         DBoW2::FeatureVector::const_iterator f1end = vFeatVec1.end();
         DBoW2::FeatureVector::const_iterator f2end = vFeatVec2.end();
 
+        // Candidates of the current keypoint, reused across keypoints
+        vector<size_t> vCandIdx;
+        vector<const uint8_t*> vpCandDesc;
+        vector<int> vDist;
+
         while(f1it!=f1end && f2it!=f2end)
         {
             if(f1it->first == f2it->first)
@@ -1294,29 +1267,39 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
                     const bool bRight1 = (pKF1 -> NLeft == -1 || idx1 < pKF1 -> NLeft) ? false
                                                                                        : true;
                     //if(bRight1) continue;
-                    const cv::Mat &d1 = pKF1->mDescriptors.row(idx1);
+                    const uint8_t* d1 = pKF1->mDescriptors.ptr<uint8_t>(idx1);
 
-                    int bestDist = TH_LOW;
-                    int bestIdx2 = -1;
+                    // Unmatched keypoints of the node without MapPoint, distances in one batch
+                    vCandIdx.clear();
+                    vpCandDesc.clear();
                     for(size_t i2=0, iend2=f2it->second.size(); i2<iend2; i2++)
                     {
-                        size_t idx2 = f2it->second[i2];
-
-                        MapPoint* pMP2 = pKF2->GetMapPoint(idx2);
+                        const size_t idx2 = f2it->second[i2];
 
                         // If we have already matched or there is a MapPoint skip
-                        if(vbMatched2[idx2] || pMP2)
+                        if(vbMatched2[idx2] || pKF2->GetMapPoint(idx2))
                             continue;
 
-                        const bool bStereo2 = (!pKF2->mpCamera2 &&  pKF2->mvuRight[idx2]>=0);
-
                         if(bOnlyStereo)
-                            if(!bStereo2)
+                            if(pKF2->mpCamera2 || pKF2->mvuRight[idx2]<0)
                                 continue;
 
-                        const cv::Mat &d2 = pKF2->mDescriptors.row(idx2);
+                        vCandIdx.push_back(idx2);
+                        vpCandDesc.push_back(pKF2->mDescriptors.ptr<uint8_t>(idx2));
+                    }
+                    vDist.resize(vCandIdx.size());
+                    Hamming::Distances(d1,vpCandDesc.data(),vpCandDesc.size(),vDist.data());
 
-                        const int dist = DescriptorDistance(d1,d2);
+                    int bestDist = TH_LOW;
+                    int bestIdx2 = -1;
+
+                    for(size_t i2=0; i2<vCandIdx.size(); i2++)
+                    {
+                        size_t idx2 = vCandIdx[i2];
+
+                        const bool bStereo2 = (!pKF2->mpCamera2 &&  pKF2->mvuRight[idx2]>=0);
+
+                        const int dist = vDist[i2];
 
                         if(dist>TH_LOW || dist>bestDist)
                             continue;
@@ -1668,6 +1651,10 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
 
     const int nMPs = vpMapPoints.size();
 
+    // Candidates of the current MapPoint, reused across points
+    vector<size_t> vCandIdx;
+    vector<const uint8_t*> vpCandDesc;
+
     // For debbuging
     int count_notMP = 0, count_bad=0, count_isinKF = 0, count_negdepth = 0, count_notinim = 0, count_dist = 0, count_normal=0, count_notidx = 0, count_thcheck = 0;
     for(int i=0; i<nMPs; i++)
@@ -1754,10 +1741,10 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
 
         // Match to the most similar keypoint in the radius
 
-        const cv::Mat dMP = pMP->GetDescriptor();
+        const Descriptor dMP = pMP->GetDescriptor();
 
-        int bestDist = 256;
-        int bestIdx = -1;
+        vCandIdx.clear();
+        vpCandDesc.clear();
         for(vector<size_t>::const_iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)
         {
             size_t idx = *vit;
@@ -1798,20 +1785,17 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
 
             if(bRight) idx += pKF->NLeft;
 
-            const cv::Mat &dKF = pKF->mDescriptors.row(idx);
-
-            const int dist = DescriptorDistance(dMP,dKF);
-
-            if(dist<bestDist)
-            {
-                bestDist = dist;
-                bestIdx = idx;
-            }
+            vCandIdx.push_back(idx);
+            vpCandDesc.push_back(pKF->mDescriptors.ptr<uint8_t>(idx));
         }
 
+        int bestDist, bestDist2;
+        const int best = Hamming::BestTwo(dMP.data,vpCandDesc.data(),vpCandDesc.size(),bestDist,bestDist2);
+
         // If there is already a MapPoint replace otherwise add new measurement
         if(bestDist<=TH_LOW)
         {
+            const size_t bestIdx = vCandIdx[best];
             MapPoint* pMPinKF = pKF->GetMapPoint(bestIdx);
             if(pMPinKF)
             {
@@ -1918,7 +1902,7 @@ int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoi
 
         // Match to the most similar keypoint in the radius
 
-        const cv::Mat dMP = pMP->GetDescriptor();
+        const Descriptor dMP = pMP->GetDescriptor();
 
         int bestDist = INT_MAX;
         int bestIdx = -1;
@@ -1930,9 +1914,9 @@ int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoi
             if(kpLevel<nPredictedLevel-1 || kpLevel>nPredictedLevel)
                 continue;
 
-            const cv::Mat &dKF = pKF->mDescriptors.row(idx);
+            const uint8_t* dKF = pKF->mDescriptors.ptr<uint8_t>(idx);
 
-            int dist = DescriptorDistance(dMP,dKF);
+            int dist = Hamming::Distance(dMP.data,dKF);
 
             if(dist<bestDist)
             {
@@ -2057,7 +2041,7 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
             continue;
 
         // Match to the most similar keypoint in the radius
-        const cv::Mat dMP = pMP->GetDescriptor();
+        const Descriptor dMP = pMP->GetDescriptor();
 
         int bestDist = INT_MAX;
         int bestIdx = -1;
@@ -2070,9 +2054,9 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
             if(kp.octave<nPredictedLevel-1 || kp.octave>nPredictedLevel)
                 continue;
 
-            const cv::Mat &dKF = pKF2->mDescriptors.row(idx);
+            const uint8_t* dKF = pKF2->mDescriptors.ptr<uint8_t>(idx);
 
-            const int dist = DescriptorDistance(dMP,dKF);
+            const int dist = Hamming::Distance(dMP.data,dKF);
 
             if(dist<bestDist)
             {
@@ -2137,7 +2121,7 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
             continue;
 
         // Match to the most similar keypoint in the radius
-        const cv::Mat dMP = pMP->GetDescriptor();
+        const Descriptor dMP = pMP->GetDescriptor();
 
         int bestDist = INT_MAX;
         int bestIdx = -1;
@@ -2150,9 +2134,9 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
             if(kp.octave<nPredictedLevel-1 || kp.octave>nPredictedLevel)
                 continue;
 
-            const cv::Mat &dKF = pKF1->mDescriptors.row(idx);
+            const uint8_t* dKF = pKF1->mDescriptors.ptr<uint8_t>(idx);
 
-            const int dist = DescriptorDistance(dMP,dKF);
+            const int dist = Hamming::Distance(dMP.data,dKF);
 
             if(dist<bestDist)
             {
@@ -2211,6 +2195,10 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
         const bool bForward = tlc.at<float>(2)>CurrentFrame.mb && !bMono;
         const bool bBackward = -tlc.at<float>(2)>CurrentFrame.mb && !bMono;
 
+        // Candidates of the current MapPoint, reused across points
+        vector<size_t> vCandIdx;
+        vector<const uint8_t*> vpCandDesc;
+
         for(int i=0; i<LastFrame.N; i++)
         {
             MapPoint* pMP = LastFrame.mvpMapPoints[i];
@@ -2254,11 +2242,10 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
                     if(vIndices2.empty())
                         continue;
 
-                    const cv::Mat dMP = pMP->GetDescriptor();
-
-                    int bestDist = 256;
-                    int bestIdx2 = -1;
+                    const Descriptor dMP = pMP->GetDescriptor();
 
+                    vCandIdx.clear();
+                    vpCandDesc.clear();
                     for(vector<size_t>::const_iterator vit=vIndices2.begin(), vend=vIndices2.end(); vit!=vend; vit++)
                     {
                         const size_t i2 = *vit;
@@ -2275,19 +2262,17 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
                                 continue;
                         }
 
-                        const cv::Mat &d = CurrentFrame.mDescriptors.row(i2);
-
-                        const int dist = DescriptorDistance(dMP,d);
-
-                        if(dist<bestDist)
-                        {
-                            bestDist=dist;
-                            bestIdx2=i2;
-                        }
+                        vCandIdx.push_back(i2);
+                        vpCandDesc.push_back(CurrentFrame.mDescriptors.ptr<uint8_t>(i2));
                     }
 
+                    int bestDist, bestDist2;
+                    const int best = Hamming::BestTwo(dMP.data,vpCandDesc.data(),vpCandDesc.size(),bestDist,bestDist2);
+
                     if(bestDist<=TH_HIGH)
                     {
+                        const int bestIdx2 = vCandIdx[best];
+
                         CurrentFrame.mvpMapPoints[bestIdx2]=pMP;
                         //double t = (CurrentFrame.mTimeStamp - LastFrame.mTimeStamp)*1e7;
                         //CurrentFrame.mvKeysUnSpeed[bestIdx2] = (CurrentFrame.mvKeysUn[bestIdx2].pt - LastFrame.mvKeysUn[i].pt)/t;
@@ -2333,11 +2318,10 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
                         else
                             vIndices2 = CurrentFrame.GetFeaturesInArea(uv.x,uv.y, radius, nLastOctave-1, nLastOctave+1, true);
 
-                        const cv::Mat dMP = pMP->GetDescriptor();
-
-                        int bestDist = 256;
-                        int bestIdx2 = -1;
+                        const Descriptor dMP = pMP->GetDescriptor();
 
+                        vCandIdx.clear();
+                        vpCandDesc.clear();
                         for(vector<size_t>::const_iterator vit=vIndices2.begin(), vend=vIndices2.end(); vit!=vend; vit++)
                         {
                             const size_t i2 = *vit;
@@ -2345,19 +2329,17 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
                                 if(CurrentFrame.mvpMapPoints[i2 + CurrentFrame.Nleft]->Observations()>0)
                                     continue;
 
-                            const cv::Mat &d = CurrentFrame.mDescriptors.row(i2 + CurrentFrame.Nleft);
-
-                            const int dist = DescriptorDistance(dMP,d);
-
-                            if(dist<bestDist)
-                            {
-                                bestDist=dist;
-                                bestIdx2=i2;
-                            }
+                            vCandIdx.push_back(i2);
+                            vpCandDesc.push_back(CurrentFrame.mDescriptors.ptr<uint8_t>(i2 + CurrentFrame.Nleft));
                         }
 
+                        int bestDist, bestDist2;
+                        const int best = Hamming::BestTwo(dMP.data,vpCandDesc.data(),vpCandDesc.size(),bestDist,bestDist2);
+
                         if(bestDist<=TH_HIGH)
                         {
+                            const int bestIdx2 = vCandIdx[best];
+
                             CurrentFrame.mvpMapPoints[bestIdx2 + CurrentFrame.Nleft]=pMP;
                             //double t = (CurrentFrame.mTimeStamp - LastFrame.mTimeStamp)*1e7;
                             //CurrentFrame.mvKeysUnSpeed[bestIdx2 + CurrentFrame.Nleft] = (CurrentFrame.mvKeysUn[bestIdx2 + CurrentFrame.Nleft].pt - LastFrame.mvKeysUn[i].pt)/t;
@@ -2427,6 +2409,10 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
 
     const vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
 
+    // Candidates of the current MapPoint, reused across points
+    vector<size_t> vCandIdx;
+    vector<const uint8_t*> vpCandDesc;
+
     for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
     {
         MapPoint* pMP = vpMPs[i];
@@ -2467,30 +2453,27 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
                 if(vIndices2.empty())
                     continue;
 
-                const cv::Mat dMP = pMP->GetDescriptor();
-
-                int bestDist = 256;
-                int bestIdx2 = -1;
+                const Descriptor dMP = pMP->GetDescriptor();
 
+                vCandIdx.clear();
+                vpCandDesc.clear();
                 for(vector<size_t>::const_iterator vit=vIndices2.begin(); vit!=vIndices2.end(); vit++)
                 {
                     const size_t i2 = *vit;
                     if(CurrentFrame.mvpMapPoints[i2])
                         continue;
 
-                    const cv::Mat &d = CurrentFrame.mDescriptors.row(i2);
-
-                    const int dist = DescriptorDistance(dMP,d);
-
-                    if(dist<bestDist)
-                    {
-                        bestDist=dist;
-                        bestIdx2=i2;
-                    }
+                    vCandIdx.push_back(i2);
+                    vpCandDesc.push_back(CurrentFrame.mDescriptors.ptr<uint8_t>(i2));
                 }
 
+                int bestDist, bestDist2;
+                const int best = Hamming::BestTwo(dMP.data,vpCandDesc.data(),vpCandDesc.size(),bestDist,bestDist2);
+
                 if(bestDist<=ORBdist)
                 {
+                    const size_t bestIdx2 = vCandIdx[best];
+
                     CurrentFrame.mvpMapPoints[bestIdx2]=pMP;
                     //double t = (CurrentFrame.mTimeStamp - pKF->mTimeStamp)*1e7;
                     //CurrentFrame.mvKeysUnSpeed[bestIdx2] = (CurrentFrame.mvKeysUn[bestIdx2].pt - pKF->mvKeysUn[i].pt)/t;
@@ -2585,20 +2568,7 @@ void ORBmatcher::ComputeThreeMaxima(vector<int>* histo, const int L, int &ind1,
 // http://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetParallel
 int ORBmatcher::DescriptorDistance(const cv::Mat &a, const cv::Mat &b)
 {
-    const int *pa = a.ptr<int32_t>();
-    const int *pb = b.ptr<int32_t>();
-
-    int dist=0;
-
-    for(int i=0; i<8; i++, pa++, pb++)
-    {
-        unsigned  int v = *pa ^ *pb;
-        v = v - ((v >> 1) & 0x55555555);
-        v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
-        dist += (((v + (v >> 4)) & 0xF0F0F0F) * 0x1010101) >> 24;
-    }
-
-    return dist;
+    return Hamming::Distance(a.ptr<uint8_t>(),b.ptr<uint8_t>());
 }
 
 } //namespace ORB_SLAM
@@ -37,6 +37,7 @@
 #include "Thirdparty/g2o/g2o/solvers/linear_solver_dense.h"
 #include "G2oTypes.h"
 #include "Converter.h"
+#include "Logging.h"
 
 #include<mutex>
 
@@ -51,6 +52,16 @@ bool sortByVal(const pair<MapPoint*, int> &a, const pair<MapPoint*, int> &b)
     return (a.second < b.second);
 }
 
+// 95% chi2 bound of an iGPS direction residual of dimension dim
+static double iGPSDirectionChi2(const int dim)
+{
+    if(dim <= 2)
+        return 5.991;
+    else if(dim == 3)
+        return 7.815;
+    return 9.488;
+}
+
 void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
 {
     vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
@@ -58,7 +69,7 @@ void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopF
     BundleAdjustment(vpKFs,vpMP,nIterations,pbStopFlag, nLoopKF, bRobust);
 }
 
-bool Optimizer::GlobalVisualiGPSBundleAdjustemnt(Map* pMap, vector<cv::Mat>& vTci, bool mbMonocular, int nIterations, long weight, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
+bool Optimizer::GlobalVisualiGPSBundleAdjustemnt(Map* pMap, const iGPS::TransmitterRegistry& transmitters, bool mbMonocular, int nIterations, long weight, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust, double* pLambda, const bool bStage)
 {
     vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
     vector<MapPoint*> vpMP = pMap->GetAllMapPoints();
@@ -67,11 +78,11 @@ bool Optimizer::GlobalVisualiGPSBundleAdjustemnt(Map* pMap, vector<cv::Mat>& vTc
     {
         Num_Dir += i->miGPSDirection.size();
     }
-    cout << "i->miGPSDirection.size() = " << Num_Dir <<endl;
+    LOG_VERBOSE("GBA iGPS directions: " << Num_Dir);
 
     if(Num_Dir<30)
     {
-        cout << "Direction not enough" <<endl;
+        LOG_VERBOSE("Direction not enough");
         return false;
     }
     //for(auto i:vpKFs)
@@ -82,7 +93,7 @@ bool Optimizer::GlobalVisualiGPSBundleAdjustemnt(Map* pMap, vector<cv::Mat>& vTc
     //        cout << "miGPSDirection = "<< j <<endl;
     //    }
     //}
-    GlobalViBundleAdjustemnt(vpKFs,vpMP,vTci,mbMonocular,nIterations, weight,pbStopFlag, nLoopKF, bRobust);
+    GlobalViBundleAdjustemnt(vpKFs,vpMP,transmitters,mbMonocular,nIterations, weight,pbStopFlag, nLoopKF, bRobust, pLambda, bStage);
     return true;
 }
 
@@ -422,9 +433,9 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
 }
 
 void Optimizer::GlobalViBundleAdjustemnt(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP,
-                                  vector<cv::Mat>& vTci, bool mbMonocular, int nIterations, long weight, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
+                                  const iGPS::TransmitterRegistry& transmitters, bool mbMonocular, int nIterations, long weight, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust, double* pLambda, const bool bStage)
 {
-    cout << "Start GlobalViBundleAdjustemnt" <<endl;
+    LOG_VERBOSE("Start GlobalViBundleAdjustemnt");
 
     vector<bool> vbNotIncludedMP;
     vbNotIncludedMP.resize(vpMP.size());
@@ -436,9 +447,11 @@ void Optimizer::GlobalViBundleAdjustemnt(const vector<KeyFrame *> &vpKFs, const
     linearSolver = new g2o::LinearSolverDense<g2o::BlockSolverX::PoseMatrixType>();
     g2o::BlockSolverX * solver_ptr = new g2o::BlockSolverX(linearSolver);
     g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-    solver->setUserLambdaInit(1e-8);
+    // Warm start: continue with the damping the previous solve ended with
+    const bool bWarmStart = pLambda && *pLambda > 0;
+    solver->setUserLambdaInit(bWarmStart ? *pLambda : 1e-8);
     optimizer.setAlgorithm(solver);
-    optimizer.setVerbose(true);
+    optimizer.setVerbose(LOG_MAX_LEVEL >= Verbose::VERBOSITY_DEBUG && Verbose::Enabled(Verbose::VERBOSITY_DEBUG));
 
     if(pbStopFlag)
         optimizer.setForceStopFlag(pbStopFlag);
@@ -496,13 +509,14 @@ void Optimizer::GlobalViBundleAdjustemnt(const vector<KeyFrame *> &vpKFs, const
         mnKF.insert(pair<int,int>(vpKFs[i]->mnId,0));
     }
 
-    int num_trans = vTci.size();
+    // MapPoint vertex ids are offset by the transmitter vertices
+    const int num_trans = transmitters.size();
 
-    vector<EdgeiGPSDir6DoFPose*> ep;
+    vector<g2o::OptimizableGraph::Edge*> ep;
     ep.reserve(vpKFs.size());
     if(!mbMonocular)
     {
-        addiGPSDirectionEdge(optimizer,vpKFs,vTci,ep, weight);
+        addiGPSDirectionEdge(optimizer,vpKFs,transmitters,ep, weight);
     }
 
     const float thHuber2D = sqrt(5.99);
@@ -661,14 +675,20 @@ void Optimizer::GlobalViBundleAdjustemnt(const vector<KeyFrame *> &vpKFs, const
     const float chi2Stereo[5]={1.0,1.0,1.0, 1.0,1.0};
     const int its[5]={20,20,20,20,20};
 
-    optimizer.initializeOptimization();
-    optimizer.optimize(20);
+    // The keyframes already carry the previous solution, a warm start skips the coarse pass
+    if(!bWarmStart)
+    {
+        optimizer.initializeOptimization();
+        optimizer.optimize(20);
+    }
 
     // Optimize!
     //delete points whose chi2()>1.0
     int nBad=0;
     for(size_t it=0; it<5; it++)
     {
+        if(pbStopFlag && *pbStopFlag)
+            break;
         optimizer.initializeOptimization();
         optimizer.optimize(its[it]);
         Verbose::PrintMess("BA: End of the optimization", Verbose::VERBOSITY_NORMAL);
@@ -681,7 +701,7 @@ void Optimizer::GlobalViBundleAdjustemnt(const vector<KeyFrame *> &vpKFs, const
                 e->setLevel(1);
                 nBad++;
                 //cout << "e->vertex(1)->id() = " <<  e->vertex(1)->id() <<endl;
-                cout << "chi2 = " <<chi2 <<endl;
+                LOG_DEBUG("chi2 = " << chi2);
             }
             else
             {
@@ -695,12 +715,30 @@ void Optimizer::GlobalViBundleAdjustemnt(const vector<KeyFrame *> &vpKFs, const
             break;
     }
 
-    // Recover optimized data
+    if(pLambda)
+        *pLambda = solver->currentLambda();
+
+    // Recover optimized data. A staged result is stored like a loop closure GBA and applied through
+    // the spanning tree by LoopClosing
+    const bool bDirect = !bStage;
+
+    // An aborted staged job leaves mTcwGBA/mnBAGlobalForKF to the GBA that stopped it
+    if(!bDirect && pbStopFlag && *pbStopFlag)
+        return;
     for (auto lit = vpKFs.begin(), lend = vpKFs.end(); lit != lend; lit++) {
         KeyFrame *pKFi = *lit;
         g2o::VertexSE3Expmap *vSE3 = static_cast<g2o::VertexSE3Expmap *>(optimizer.vertex(pKFi->mnId));
+        if(!vSE3)
+            continue;
         g2o::SE3Quat SE3quat = vSE3->estimate();
-        pKFi->SetPose(Converter::toCvMat(SE3quat));
+        if(bDirect)
+            pKFi->SetPose(Converter::toCvMat(SE3quat));
+        else
+        {
+            pKFi->mTcwGBA.create(4,4,CV_32F);
+            Converter::toCvMat(SE3quat).copyTo(pKFi->mTcwGBA);
+            pKFi->mnBAGlobalForKF = nLoopKF;
+        }
     }
 
     //Points
@@ -715,7 +753,7 @@ void Optimizer::GlobalViBundleAdjustemnt(const vector<KeyFrame *> &vpKFs, const
         g2o::VertexSBAPointXYZ *vPoint = static_cast<g2o::VertexSBAPointXYZ *>(optimizer.vertex(
                 pMP->mnId + maxKFid + 2 + num_trans));
 
-        if (nLoopKF == pMap->GetOriginKF()->mnId) {
+        if (bDirect) {
             pMP->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
             pMP->UpdateNormalAndDepth();
         } else {
@@ -725,7 +763,7 @@ void Optimizer::GlobalViBundleAdjustemnt(const vector<KeyFrame *> &vpKFs, const
         }
     }
 
-    cout << "End GlobalViBundleAdjustemnt" <<endl;
+    LOG_VERBOSE("End GlobalViBundleAdjustemnt");
 }
 
 void Optimizer::FullInertialBA(Map *pMap, int its, const bool bFixLocal, const long unsigned int nLoopId, bool *pbStopFlag, bool bInit, float priorG, float priorA, Eigen::VectorXd *vSingVal, bool *bHess)
@@ -1473,10 +1511,9 @@ int Optimizer::PoseOptimization(Frame *pFrame)
         return nInitialCorrespondences-nBad;
     }
 
-int Optimizer::iGPSDirectionPoseOptimization(Frame *pFrame,vector<cv::Mat>& vTci,double weight)
+int Optimizer::iGPSDirectionPoseOptimization(Frame *pFrame,const iGPS::TransmitterRegistry& transmitters,double weight,
+                                             int* pnDirInliers, const bool bDirectionsOnly)
 {
-    //cout << " Start iGPSPoseOptimization " <<endl << endl;
-
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
 
@@ -1486,7 +1523,6 @@ int Optimizer::iGPSDirectionPoseOptimization(Frame *pFrame,vector<cv::Mat>& vTci
 
     g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
     optimizer.setAlgorithm(solver);
-    optimizer.setVerbose(true);
     int nInitialCorrespondences=0;
 
     // Set Frame vertex
@@ -1497,7 +1533,7 @@ int Optimizer::iGPSDirectionPoseOptimization(Frame *pFrame,vector<cv::Mat>& vTci
     optimizer.addVertex(vSE3);
 
     // Set MapPoint vertices
-    const int N = pFrame->N;
+    const int N = bDirectionsOnly ? 0 : pFrame->N;
 
     vector<ORB_SLAM3::EdgeSE3ProjectXYZOnlyPose*> vpEdgesMono;
     vector<ORB_SLAM3::EdgeSE3ProjectXYZOnlyPoseToBody *> vpEdgesMono_FHR;
@@ -1669,11 +1705,13 @@ int Optimizer::iGPSDirectionPoseOptimization(Frame *pFrame,vector<cv::Mat>& vTci
     }
     }
 
-    vector<EdgeiGPSDir6DoFPose*> ep;
-    ep.reserve(6);
-    addiGPSDirectionPoseOptimizationEdge(optimizer,pFrame,vTci,ep, weight);
+    vector<g2o::OptimizableGraph::Edge*> ep;
+    ep.reserve(pFrame->miGPSDirection.size());
+    addiGPSDirectionPoseOptimizationEdge(optimizer,pFrame,transmitters,ep, weight);
 
-    if(nInitialCorrespondences<3)
+    if(pnDirInliers)
+        *pnDirInliers = 0;
+    if(nInitialCorrespondences<3 && ep.size()<3)
         return 0;
 
     // We perform 4 optimizations, after each optimization we classify observation as inlier/outlier
@@ -1683,6 +1721,7 @@ int Optimizer::iGPSDirectionPoseOptimization(Frame *pFrame,vector<cv::Mat>& vTci
     const int its[4]={10,10,10,10};
 
     int nBad=0;
+    int nDirInliers=0;
     for(size_t it=0; it<4; it++)
     {
 
@@ -1795,7 +1834,32 @@ int Optimizer::iGPSDirectionPoseOptimization(Frame *pFrame,vector<cv::Mat>& vTci
                 e->setRobustKernel(0);
         }
 
-        if(optimizer.edges().size()<10)
+        nDirInliers=0;
+        for(size_t i=0, iend=ep.size(); i<iend; i++)
+        {
+            g2o::OptimizableGraph::Edge* e = ep[i];
+
+            if(e->level()==1)
+            {
+                e->computeError();
+            }
+
+            if(e->chi2()>iGPSDirectionChi2(e->dimension()))
+            {
+                e->setLevel(1);
+            }
+            else
+            {
+                e->setLevel(0);
+                nDirInliers++;
+            }
+
+            if(it==2)
+                e->setRobustKernel(0);
+        }
+
+        // The directions alone are always few edges, they still get all rounds of outlier rejection
+        if(!bDirectionsOnly && optimizer.edges().size()<10)
             break;
     }
 
@@ -1804,8 +1868,9 @@ int Optimizer::iGPSDirectionPoseOptimization(Frame *pFrame,vector<cv::Mat>& vTci
     g2o::SE3Quat SE3quat_recov = vSE3_recov->estimate();
     cv::Mat pose = Converter::toCvMat(SE3quat_recov);
     pFrame->SetPose(pose);
-    //cout << " End iGPSPoseOptimization " <<endl << endl;
 
+    if(pnDirInliers)
+        *pnDirInliers = nDirInliers;
     return nInitialCorrespondences-nBad;
 }
 
@@ -2300,9 +2365,9 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, vector<Ke
     pCurrentMap->IncreaseChangeIndex();
 }
 
-void Optimizer::LocaliGPSDirBA(KeyFrame *pKF, bool* pbStopFlag, Map* pMap, int& num_fixedKF, int& num_OptKF, int& num_MPs, int& num_edges, double& iGPSPoseScale,vector<cv::Mat>& vTci, vector<Eigen::Matrix4d>& vTcw, bool bScaleFixFlag, bool bMonocular, list<KeyFrame*> lKF, long weight)
+void Optimizer::LocaliGPSDirBA(KeyFrame *pKF, bool* pbStopFlag, Map* pMap, int& num_fixedKF, int& num_OptKF, int& num_MPs, int& num_edges, double& iGPSPoseScale,iGPS::TransmitterRegistry& transmitters, vector<Eigen::Matrix4d>& vTcw, bool bScaleFixFlag, bool bMonocular, list<KeyFrame*> lKF, long weight)
 {
-    cout<< "Start Local iGPS Direction BA" <<endl;
+    LOG_VERBOSE("Start Local iGPS Direction BA");
 
     // Local KeyFrames: First Breath Search from Current Keyframe
     list<KeyFrame*> lLocalKeyFrames;
@@ -2421,7 +2486,7 @@ void Optimizer::LocaliGPSDirBA(KeyFrame *pKF, bool* pbStopFlag, Map* pMap, int&
     //    solver->setUserLambdaInit(100.0);
 
     optimizer.setAlgorithm(solver);
-    optimizer.setVerbose(true);
+    optimizer.setVerbose(LOG_MAX_LEVEL >= Verbose::VERBOSITY_DEBUG && Verbose::Enabled(Verbose::VERBOSITY_DEBUG));
 
     if(pbStopFlag)
         optimizer.setForceStopFlag(pbStopFlag);
@@ -2474,12 +2539,12 @@ void Optimizer::LocaliGPSDirBA(KeyFrame *pKF, bool* pbStopFlag, Map* pMap, int&
     //    }
     //}
 
-    int num_trans = vTci.size();
+    int num_trans = transmitters.size();
     //cout << " num_trans = " <<num_trans <<endl;
     //iGPS Position scale estimation
     //cout << "test iGPSPoseScale = " << iGPSPoseScale <<endl;
 
-    vector<EdgeiGPSDir6DoFPose*> ep;
+    vector<g2o::OptimizableGraph::Edge*> ep;
     //ep.reserve(lLocalKeyFrames.size()+lFixedCameras.size()+lKF.size());
 
     if(bMonocular)
@@ -2495,7 +2560,7 @@ void Optimizer::LocaliGPSDirBA(KeyFrame *pKF, bool* pbStopFlag, Map* pMap, int&
         for(auto i = 0; i < num_trans; i ++)
         {
             g2o::VertexSE3Expmap* VP = new g2o::VertexSE3Expmap();
-            VP->setEstimate(Converter::toSE3Quat(vTci[i]));
+            VP->setEstimate(transmitters[i].Tci);
             VP->setId(maxKFid+2+i);
             //VP->setFixed(bScaleFixFlag);
             VP->setFixed(true);
@@ -2503,14 +2568,11 @@ void Optimizer::LocaliGPSDirBA(KeyFrame *pKF, bool* pbStopFlag, Map* pMap, int&
 
             //restrict the span of transmitter pose vertex optimization
             {
-                Eigen::Matrix4d eTci = Converter::toMatrix4d(vTci[i]);
                 Edge6DoFPoseVertex* epv = new Edge6DoFPoseVertex();
                 epv->setVertex(0,dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(maxKFid+2+i)));
                 Vector6d Vertex6DPose;
-                Eigen::Matrix3d R = eTci.block<3,3>(0,0);
-                Eigen::Vector3d t = eTci.block<3,1>(0,3);
-                Eigen::Quaterniond q(R);
-                Vertex6DPose << q.x(),q.y(),q.z(),t;
+                Eigen::Quaterniond q(transmitters[i].Rci);
+                Vertex6DPose << q.x(),q.y(),q.z(),transmitters[i].tci;
                 epv->setMeasurement(Vertex6DPose);
                 Eigen::Matrix<double, 6, 6> inforMat = Eigen::Matrix<double, 6, 6>::Identity();
                 inforMat = 100000 * inforMat;
@@ -2518,8 +2580,6 @@ void Optimizer::LocaliGPSDirBA(KeyFrame *pKF, bool* pbStopFlag, Map* pMap, int&
                 optimizer.addEdge(epv);
             }
         }
-        //vector<EdgeiGPSDir6DoFPose*> ep;
-        //ep.reserve(lLocalKeyFrames.size());
         for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
         {
             KeyFrame* pKFi = *lit;
@@ -2528,33 +2588,27 @@ void Optimizer::LocaliGPSDirBA(KeyFrame *pKF, bool* pbStopFlag, Map* pMap, int&
             if(pKFi->miGPSDirection.empty() || CamPose.translation().x() == 0.0)
                 continue;
 
-            for(auto i = 0; i < num_trans; i ++)
+            for(int j = 0; j < pKFi->miGPSDirection.size(); j ++)
             {
-                Eigen::Vector3d Dir;
-                /* 需要修改成不同发射站不同接收器
-                 * Eigen::Vector3d Dir = pKFi->mmiGPSChDir.find(i + 1)->second;
-                */
-                //EdgeiGPSDir6DoFPose *e = new EdgeiGPSDir6DoFPose(eTci);
-                //EdgeiGPSDir6DoFPose *e = new EdgeiGPSDir6DoFPose(mTcw);
-                EdgeiGPSDirUptoScale6DoFPose *e = new EdgeiGPSDirUptoScale6DoFPose();
+                const int i = transmitters.index(pKFi->miGPSTransmitter[j]);
+                if(i < 0)
+                    continue;
+
+                g2o::OptimizableGraph::Edge *e = CreateiGPSDirectionUptoScaleEdge(transmitters.residual(),pKFi->miGPSDirection[j],
+                                                                                  transmitters[i].invSigma2*1000000);
                 e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(pKFi->mnId)));
                 e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(maxKFid + 1)));
                 e->setVertex(2, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(maxKFid + 2 + i)));
-                e->setMeasurement(Dir);
-                //e->num_trans = num_trans;
-                //cout << "pKFi->miGPSDirection = " << pKFi->miGPSDirection <<endl;
-                Eigen::Matrix<double, 3, 3> inforMatrix = Eigen::Matrix<double, 3, 3>::Identity();
-                inforMatrix = 1000000 * inforMatrix;
-                e->setInformation(inforMatrix);
+                ep.push_back(e);
                 optimizer.addEdge(e);
             }
         }
     }
     else
     {
-        addiGPSDirectionEdge(optimizer, lLocalKeyFrames,vTci,ep,weight);
-        //addiGPSDirectionEdge(optimizer, lFixedCameras,vTci,ep,weight);
-        //addiGPSDirectionEdge(optimizer, lKF,vTci,ep,weight);
+        addiGPSDirectionEdge(optimizer, lLocalKeyFrames,transmitters,ep,weight);
+        //addiGPSDirectionEdge(optimizer, lFixedCameras,transmitters,ep,weight);
+        //addiGPSDirectionEdge(optimizer, lKF,transmitters,ep,weight);
     }
 
     // Set MapPoint vertices
@@ -2844,25 +2898,23 @@ void Optimizer::LocaliGPSDirBA(KeyFrame *pKF, bool* pbStopFlag, Map* pMap, int&
         double Scale = VS->estimate();  //estimated scale
         if (Scale<1e-1)
         {
-            cout << "iGPS Pose scale too small!" << endl;
+            LOG_VERBOSE("iGPS Pose scale too small!");
             return;
         }
         else
         {
             iGPSPoseScale = VS->estimate();
-            cout << "iGPSPoseScale = " << iGPSPoseScale << endl;
+            LOG_DEBUG("iGPSPoseScale = " << iGPSPoseScale);
         }
     }
 
     if(bMonocular)
     {
-        vTci.clear();
         for(int i = 0 ; i < num_trans ; i++)
         {
             g2o::VertexSE3Expmap* VP = static_cast<g2o::VertexSE3Expmap*>(optimizer.vertex(maxKFid + 2 + i));
-            g2o::SE3Quat T = VP->estimate();
-            vTci.push_back(Converter::toCvMat(T));
-            //cout << "vTci[" << i + 1 << "] = " << T << endl;
+            transmitters.SetTci(i, VP->estimate());
+            //cout << "Tci[" << i + 1 << "] = " << VP->estimate() << endl;
         }
     }
     // Get Map Mutex
@@ -2906,7 +2958,7 @@ void Optimizer::LocaliGPSDirBA(KeyFrame *pKF, bool* pbStopFlag, Map* pMap, int&
 
     // TODO Check this changeindex
     pMap->IncreaseChangeIndex();
-    cout << "Vision-iGPS BA success!" << endl;
+    LOG_VERBOSE("Vision-iGPS BA success!");
 
 }
 
@@ -5961,13 +6013,46 @@ Eigen::MatrixXd Optimizer::Sparsify(const Eigen::MatrixXd &H, const int &start1,
 
 void Optimizer::iGPSDirectionOptimization(Map *pMap,Eigen::Matrix4d& Twc, int TrmSpeed)
 {
-    cout<< "--------------------" <<endl;
+    vector<iGPSCalibrationSample> vSamples;
+    GetiGPSCalibrationSamples(pMap,vSamples);
+    iGPSDirectionOptimization(vSamples,Twc,TrmSpeed);
+}
 
-    cout<< "Start iGPSDirection Initialization" <<endl;
-    int its = 200; // Check number of iterations
+void Optimizer::GetiGPSCalibrationSamples(Map *pMap, vector<iGPSCalibrationSample>& vSamples)
+{
     long unsigned int maxKFid = pMap->GetMaxKFid();
     const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
 
+    vSamples.clear();
+    for(size_t i=0;i<vpKFs.size();i++)
+    {
+        KeyFrame* pKFi = vpKFs[i];
+        if(pKFi->miGPSDirection.empty() || pKFi->mnId > maxKFid)
+            continue;
+
+        const g2o::SE3Quat Tcw = Converter::toSE3Quat(pKFi->GetPose());
+        for(auto k = 0; k < pKFi->miGPSTransmitter.size(); k++)
+        {
+            if(pKFi->miGPSChannel[k] != 1 || pKFi->miGPSDirection[k].x() == 0.0)
+                continue;
+
+            iGPSCalibrationSample sample;
+            sample.Tcw = Tcw;
+            sample.Dir = pKFi->miGPSDirection[k];
+            sample.transmitter = pKFi->miGPSTransmitter[k];
+            vSamples.push_back(sample);
+        }
+    }
+}
+
+void Optimizer::iGPSDirectionOptimization(const vector<iGPSCalibrationSample>& vSamples,Eigen::Matrix4d& Twc, int TrmSpeed, bool bVerbose)
+{
+    if(bVerbose)
+    {
+        cout<< "--------------------" <<endl;
+        cout<< "Start iGPSDirection Initialization" <<endl;
+    }
+
     // Setup optimizer
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
@@ -5978,111 +6063,49 @@ void Optimizer::iGPSDirectionOptimization(Map *pMap,Eigen::Matrix4d& Twc, int Tr
 
     g2o::OptimizationAlgorithmGaussNewton* solver = new g2o::OptimizationAlgorithmGaussNewton(solver_ptr);
 
-    //solver->setUserLambdaInit(1e2);
-
     optimizer.setAlgorithm(solver);
 
-    //// Set KeyFrame vertices (fixed poses and optimizable velocities)
-    //int num = 0;
-    //for(size_t i=0; i<vpKFs.size(); i++)
-    //{
-    //    KeyFrame *pKFi = vpKFs[i];
-    //    if (pKFi->mnId > maxKFid || pKFi->miGPSDirection.x() == 0.0)
-    //        continue;
-    //    //if(num%5 != 0)
-    //    //    continue;
-    //    g2o::VertexSE3Expmap * vP = new g2o::VertexSE3Expmap();
-    //    vP->setEstimate(Converter::toSE3Quat(pKFi->GetPose())); //Tcw 注意在优化的时候改一下
-    //    vP->setId(pKFi->mnId);
-    //    vP->setFixed(true);
-    //    optimizer.addVertex(vP);
-    //    num++;
-    //}
-
     Eigen::Matrix3d ER = Eigen::Matrix3d::Identity();
     Eigen::Vector3d ET = Eigen::Vector3d::Zero();
 
-    //ER << 0.33287972, -0.94216716, -0.03888493,
-    //0.05812376, 0.061659206, -0.9964034,
-    //0.94117624, 0.32942235, 0.075287431;
-
-    //ET << -0.28746653,0.8349902,9.3440628;
-
     auto * vRT = new g2o::VertexSE3Expmap();
     vRT->setId(0);
     vRT->setFixed(false);
     vRT->setEstimate(g2o::SE3Quat(ER,ET));
     optimizer.addVertex(vRT);
 
-    vector<EdgeiGPSSE3Graph*> vpei;
-    int num = 0;
     int num2= 0;
-    for(size_t i=0;i<vpKFs.size();i++)
+    for(size_t i=0;i<vSamples.size();i++)
     {
-        num ++;
-        KeyFrame* pKFi = vpKFs[i];
-        if(pKFi->miGPSDirection.empty())
-            continue;
-
         //Find correspond transmitter
-        for(auto k = 0; k < pKFi->miGPSTransmitter.size(); k++)
-        {
-            if(pKFi->miGPSTransmitter[k] != TrmSpeed || pKFi->miGPSChannel[k] != 1)
-                continue;
-            else
-            {
-                if (pKFi->mnId > maxKFid || pKFi->miGPSDirection[k].x() == 0.0)
-                    continue;
-
-                //if(num %5 !=0)   ///Strategy of Initialization   1 0 0 0 0 0 0 0 0 0 1 0 0 0 0 0 0 0 1 ....
-                //{
-                //    continue;
-                //}
-                //g2o::HyperGraph::Vertex* VP  = optimizer.vertex(pKFi->mnId);
-                g2o::HyperGraph::Vertex* vRT = optimizer.vertex(0);
-
-                if( !vRT )
-                {
-                    cout << "Error" << ", "<< vRT <<endl;
-                    continue;
-                }
+        const iGPSCalibrationSample &sample = vSamples[i];
+        if(sample.transmitter != TrmSpeed)
+            continue;
 
-                cout << "pKFi->mTimeStamps         = " << pKFi->mTimeStamp<<endl;
-                cout << "pKFi->miGPSChannel[k]         = " << pKFi->miGPSChannel[k]<<endl;
-                cout << "pKFi->miGPSTransmitter[k] = " << pKFi->miGPSTransmitter[k]<<endl;
-                cout << "pKFi->miGPSDirection[k]   = " << pKFi->miGPSDirection[k].transpose()<<endl;
-
-                EdgeiGPSSE3Graph* ei = new EdgeiGPSSE3Graph();
-                //ei->setVertex(0,dynamic_cast<g2o::OptimizableGraph::Vertex*>(VP));
-                ei->setVertex(0,dynamic_cast<g2o::OptimizableGraph::Vertex*>(vRT));
-                ei->setMeasurement(pKFi->miGPSDirection[k]);
-                ei->setInformation(Eigen::Matrix3d::Identity());
-                ei->Tcw = g2o::SE3Quat(Converter::toSE3Quat(pKFi->GetPose()));
-                optimizer.addEdge(ei);
-                vpei.push_back(ei);
-                num2 ++;   //Need enough number of Direction for estimation
-            }
-        }
+        EdgeiGPSSE3Graph* ei = new EdgeiGPSSE3Graph();
+        ei->setVertex(0,dynamic_cast<g2o::OptimizableGraph::Vertex*>(vRT));
+        ei->setMeasurement(sample.Dir);
+        ei->setInformation(Eigen::Matrix3d::Identity());
+        ei->Tcw = sample.Tcw;
+        optimizer.addEdge(ei);
+        num2 ++;   //Need enough number of Direction for estimation
     }
 
-    //if(num2 >=5)
-    //{
-        //std::cout << "start optimization" << std::endl;
-        optimizer.initializeOptimization();
-        optimizer.setVerbose(true);
-        optimizer.optimize(10);
-        //std::cout << "end optimization" << std::endl;
+    if(bVerbose)
+        cout << "Transmitter " << TrmSpeed << ": " << num2 << " directions" << endl;
+
+    optimizer.initializeOptimization();
+    optimizer.setVerbose(bVerbose);
+    optimizer.optimize(10);
 
-        g2o::SE3Quat RT = vRT->estimate();      //应该是Tcw
-        g2o::SE3Quat RT_inverse = RT.inverse(); //应该是Twc
-        //cout << "RT = " << RT <<endl;
-        //cout << "RT_inverse = " << RT_inverse <<endl;
+    g2o::SE3Quat RT = vRT->estimate();      //应该是Tcw
+    g2o::SE3Quat RT_inverse = RT.inverse(); //应该是Twc
 
-        Twc.block<3,3>(0,0) = RT_inverse.rotation().toRotationMatrix();
-        Twc.block<3,1>(0,3) = RT_inverse.translation();
+    Twc.block<3,3>(0,0) = RT_inverse.rotation().toRotationMatrix();
+    Twc.block<3,1>(0,3) = RT_inverse.translation();
 
-    //}
-    cout<< "End iGPSDirection Initialization" <<endl;
+    if(bVerbose)
+        cout<< "End iGPSDirection Initialization" <<endl;
     return;
 }
 
@@ -9226,51 +9249,29 @@ void Optimizer::OptimizeEssentialGraph4DoF(Map* pMap, KeyFrame* pLoopKF, KeyFram
     pMap->IncreaseChangeIndex();
 }
 
-void Optimizer::addiGPSDirectionPoseOptimizationEdge(g2o::SparseOptimizer& optimizer,Frame* pKFi,vector<cv::Mat>& vTci,vector<EdgeiGPSDir6DoFPose*>& ep,double infoWeight)
+void Optimizer::addiGPSDirectionPoseOptimizationEdge(g2o::SparseOptimizer& optimizer,Frame* pKFi,const iGPS::TransmitterRegistry& transmitters,vector<g2o::OptimizableGraph::Edge*>& ep,double infoWeight)
 {
-    if(pKFi->miGPSDirection.empty())
+    if(pKFi->miGPSDirection.empty() || !pKFi->mpiGPSReceive)
         return;
 
     //cout<< "mTimeStamp = " << pKFi->mTimeStamp <<endl;
     for(int j = 0; j < pKFi->miGPSDirection.size(); j ++)
     {
         int channel = pKFi->miGPSChannel[j];
-        Eigen::Vector3d Dir = pKFi->miGPSDirection[j];
-        int Trm = pKFi->miGPSTransmitter[j];
-        int i = 0;
-        identifyTransmitter(Trm,i);
-        //if(i == 1|| i ==2)
-        //    continue;
-
-        int td = abs(pKFi->miGPStime[j] - pKFi->mTimeStamp*1e9);
+        if(!pKFi->mpiGPSReceive->has(channel))
+            continue;
+        const int i = transmitters.index(pKFi->miGPSTransmitter[j]);
+        if(i < 0 || !transmitters[i].bTci)
+            continue;
+        const iGPS::Transmitter& trm = transmitters[i];
 
-        EdgeiGPSDir6DoFPose *e = new EdgeiGPSDir6DoFPose();
+        g2o::OptimizableGraph::Edge *e = CreateiGPSDirectionEdge(transmitters.residual(),pKFi->mpiGPSReceive.get(),channel,trm.Rci,trm.tci,
+                                                                 pKFi->miGPSDirection[j],trm.invSigma2*infoWeight);
         e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(0)));
-        g2o::SE3Quat gTci = Converter::toSE3Quat(vTci[i]);
-        e->Dir = Dir;
-        e->Tci = gTci;
-        e->channel = channel;
-        e->miGPSReceive = pKFi->miGPSReceive;
-        //cout << "Time = " << pKFi->mTimeStamp*1e9 <<endl;
-        //cout << "channel = " << channel <<endl;
-        //cout << "GT = " << (gTci.rotation().toRotationMatrix()*Dir).transpose() <<endl;
-
-        const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(optimizer.vertex(0));    //Tcw
-        Eigen::Matrix4d Twc = Converter::toMatrix4d(Converter::toCvMat(v1->estimate().inverse()));
-        Eigen::Vector3d iGPSPosition = gTci.translation();
-        Eigen::Vector4d iGPSPosInCam4d = Eigen::Vector4d( pKFi->miGPSReceive[channel].x(), pKFi->miGPSReceive[channel].y(),pKFi->miGPSReceive[channel].z() , 1.0);
-        Eigen::Vector4d iGPSPosition4d = Twc * iGPSPosInCam4d;
-        Eigen::Vector3d iGPSPosition3d = iGPSPosition4d.block<3,1>(0,0);
-        Eigen::Vector3d measurement = (iGPSPosition3d-iGPSPosition)/(iGPSPosition3d-iGPSPosition).norm();
-        //cout << "measurement = " << measurement.transpose() <<endl;
-
-        Eigen::Matrix<double, 4, 4> inforMatrix = Eigen::Matrix<double, 4, 4>::Identity();
-        inforMatrix = infoWeight * inforMatrix;
-        e->setInformation(inforMatrix);
 
         g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
         e->setRobustKernel(rk);
-        rk->setDelta(5.991);
+        rk->setDelta(sqrt(iGPSDirectionChi2(e->dimension())));
 
         ep.push_back(e);
         optimizer.addEdge(e);
@@ -9279,7 +9280,7 @@ void Optimizer::addiGPSDirectionPoseOptimizationEdge(g2o::SparseOptimizer& optim
 }
 
 template<class T>
-void Optimizer::addiGPSDirectionEdge(g2o::SparseOptimizer& optimizer,T lLocalKeyFrames,vector<cv::Mat>& vTci,vector<EdgeiGPSDir6DoFPose*>& ep,long infoWeight)
+void Optimizer::addiGPSDirectionEdge(g2o::SparseOptimizer& optimizer,T lLocalKeyFrames,const iGPS::TransmitterRegistry& transmitters,vector<g2o::OptimizableGraph::Edge*>& ep,long infoWeight)
 {
     for(auto lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
     {
@@ -9287,47 +9288,23 @@ void Optimizer::addiGPSDirectionEdge(g2o::SparseOptimizer& optimizer,T lLocalKey
         if(pKFi->isBad())
             continue;
 
-        if(pKFi->miGPSDirection.empty())
+        if(pKFi->miGPSDirection.empty() || !pKFi->mpiGPSReceive)
             continue;
 
         //cout<< "mTimeStamp = " << pKFi->mTimeStamp <<endl;
         for(int j = 0; j < pKFi->miGPSDirection.size(); j ++)
         {
             int channel = pKFi->miGPSChannel[j];
-            Eigen::Vector3d Dir = pKFi->miGPSDirection[j];
-            int Trm = pKFi->miGPSTransmitter[j];
-            int i = 0;
-            identifyTransmitter(Trm,i);
-            //if(i == 1|| i ==2)
-            //    continue;
-
-            int td = abs(pKFi->miGPStime[j] - pKFi->mTimeStamp*1e9);
-            int weight = 1;
-            calculateiGPSDirectionWeight(td,weight);
-
-            EdgeiGPSDir6DoFPose *e = new EdgeiGPSDir6DoFPose();
+            if(!pKFi->mpiGPSReceive->has(channel))
+                continue;
+            const int i = transmitters.index(pKFi->miGPSTransmitter[j]);
+            if(i < 0 || !transmitters[i].bTci)
+                continue;
+            const iGPS::Transmitter& trm = transmitters[i];
+
+            g2o::OptimizableGraph::Edge *e = CreateiGPSDirectionEdge(transmitters.residual(),pKFi->mpiGPSReceive.get(),channel,trm.Rci,trm.tci,
+                                                                     pKFi->miGPSDirection[j],trm.invSigma2*infoWeight);
             e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(pKFi->mnId)));
-            g2o::SE3Quat gTci = Converter::toSE3Quat(vTci[i]);
-            e->Dir = Dir;
-            e->Tci = gTci;
-            e->channel = channel;
-            e->miGPSReceive = pKFi->miGPSReceive;
-            cout << "Time = " << pKFi->mTimeStamp*1e9 <<endl;
-            cout << "channel = " << channel <<endl;
-            cout << "GT = " << (gTci.rotation().toRotationMatrix()*Dir).transpose() <<endl;
-
-            const g2o::VertexSE3Expmap * v1 = static_cast<const g2o::VertexSE3Expmap*>(optimizer.vertex(pKFi->mnId));    //Tcw
-            Eigen::Matrix4d Twc = Converter::toMatrix4d(Converter::toCvMat(v1->estimate().inverse()));
-            Eigen::Vector3d iGPSPosition = gTci.translation();
-            Eigen::Vector4d iGPSPosInCam4d = Eigen::Vector4d( pKFi->miGPSReceive[channel].x(), pKFi->miGPSReceive[channel].y(),pKFi->miGPSReceive[channel].z() , 1.0);
-            Eigen::Vector4d iGPSPosition4d = Twc * iGPSPosInCam4d;
-            Eigen::Vector3d iGPSPosition3d = iGPSPosition4d.block<3,1>(0,0);
-            Eigen::Vector3d measurement = (iGPSPosition3d-iGPSPosition)/(iGPSPosition3d-iGPSPosition).norm();
-            cout << "measurement = " << measurement.transpose() <<endl;
-
-            Eigen::Matrix<double, 4, 4> inforMatrix = Eigen::Matrix<double, 4, 4>::Identity();
-            inforMatrix = infoWeight * inforMatrix;
-            e->setInformation(inforMatrix);
 
             //g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
             //e->setRobustKernel(rk);
@@ -9340,51 +9317,6 @@ void Optimizer::addiGPSDirectionEdge(g2o::SparseOptimizer& optimizer,T lLocalKey
     return;
 }
 
-void Optimizer::identifyTransmitter(int Trm,int &i)
-{
-    switch(Trm)
-    {
-        case 1800:
-            i = 0;
-            break;
-        case 1900:
-            i = 1;
-            break;
-        case 2000:
-            i = 2;
-            break;
-    }
-    return;
-}
-
-void Optimizer::calculateiGPSDirectionWeight(int td, int& weight)
-{
-    switch(td)
-    {
-        case 0:
-            weight = 64;
-            break;
-        case 1:
-            weight = 32;
-            break;
-        case 2:
-            weight = 16;
-            break;
-        case 3:
-            weight = 8;
-            break;
-        case 4:
-            weight = 4;
-            break;
-        case 5:
-            weight = 2;
-            break;
-        default:
-            weight = 1;
-    }
-    return;
-}
-
 
 
 
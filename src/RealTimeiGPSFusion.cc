@@ -2,34 +2,66 @@
 // Created by Alex Xiangchen Liu on 2022/4/20.
 //
 #include "RealTimeiGPSFusion.h"
+#include "Optimizer.h"
+#include "Logging.h"
 
 namespace ORB_SLAM3
 {
 
-    RealTimeiGPSFusion::RealTimeiGPSFusion():mbScaleFlag(false),mScale(1.0),mLastScale(1.0),mbFinishRequested(false), mbFinished(true),mLast_time(0.0),
-                             mbStopped(false)
+    RealTimeiGPSFusion::RealTimeiGPSFusion(const string &strResultFile):mnRejectedSamples(0),mnSolves(0),mdTotalSolveTime(0.0),mbScaleFlag(false),mScale(1.0),mLastScale(1.0),mbFinishRequested(false), mbFinished(true),mLast_time(0.0),
+                             mbStopped(false), mpTracker(NULL), mpLoopCloser(NULL)
     {
         mbfusionFlag = false;
-        last_p = Eigen::Vector3d(0.0,0.0,0.0);
-        last_q = Eigen::Quaterniond(0.0,0.0,0.0,0.0);
+        mbProcessingiGPS = false;
         iGPS_T_VO = Eigen::Matrix4d::Identity();
         mEstimatedTransformation= Eigen::Matrix4d::Identity();
+
+        mpWindowOptimizer = NULL;
+        mnWindowSize = 100;
+        mnWindowIterations = 4;
+        mdMaxAssociationGap = 0.2;
+        ResetWindow();
+        mpResultSink = new TrajectorySink(strResultFile);
         std::cout<< "Run Real Time Frame-to-Frame Monocular-iGPS thread"<<std::endl;
     }
 
+    RealTimeiGPSFusion::~RealTimeiGPSFusion()
+    {
+        delete mpResultSink;
+        delete mpWindowOptimizer;
+    }
+
     void RealTimeiGPSFusion::inputiGPS(double t, cv::Point3f p3D)
     {
-        iGPSPositionMap[t] = p3D;
-        mLast_time = t;
+        {
+            unique_lock<mutex> lock(m_PoseMap);
+            if(!miGPSPositions.push_back(iGPS::Point(p3D,t)))
+            {
+                mnRejectedSamples++;
+                LOG_VERBOSE("iGPS fusion: out of order iGPS sample at t = " << t << " dropped");
+                return;
+            }
+            mLast_time = t;
+        }
         mMutexiGPS.lock();
         mbfusionFlag = true;
         mMutexiGPS.unlock();
+        mWakeEvent.Notify();
     }
 
     void RealTimeiGPSFusion::RequestFinish()
     {
-        unique_lock<mutex> lock(mMutexFinish);
-        mbFinishRequested = true;
+        {
+            unique_lock<mutex> lock(mMutexFinish);
+            mbFinishRequested = true;
+        }
+        mWakeEvent.Shutdown();
+    }
+
+    bool RealTimeiGPSFusion::isIdle()
+    {
+        unique_lock<mutex> lock(mMutexiGPS);
+        return !mbfusionFlag && !mbProcessingiGPS;
     }
 
     bool RealTimeiGPSFusion::isFinished()
@@ -56,70 +88,206 @@ namespace ORB_SLAM3
         mpLoopCloser = mptLoopCloser;
     }
 
-    void RealTimeiGPSFusion::inputVO(double t, cv::Mat Tcw)
+    void RealTimeiGPSFusion::ResetWindow()
     {
-        if (Tcw.empty())
+        if(mpWindowOptimizer)
+            delete mpWindowOptimizer;
+
+        mpWindowOptimizer = new g2o::SparseOptimizer();
+        g2o::BlockSolverX::LinearSolverType * linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolverX::PoseMatrixType>();
+        auto * solver_ptr = new g2o::BlockSolverX(linearSolver);
+        g2o::OptimizationAlgorithmGaussNewton* solver = new g2o::OptimizationAlgorithmGaussNewton(solver_ptr);
+        mpWindowOptimizer->setAlgorithm(solver);
+        mpWindowOptimizer->setVerbose(false);
+
+        mmWindowVertices.clear();
+        mpWindowPrior = NULL;
+        mnNextWindowId = 0;
+        mLastWindowiGPSTime = -1.0;
+    }
+
+    // Pose at time t interpolated on SE(3) between the two bracketing samples of the buffer.
+    // Fails when t is outside the buffer or the bracketing samples are further apart than mdMaxAssociationGap.
+    bool RealTimeiGPSFusion::InterpolatePose(const iGPS::TimeBuffer<iGPS::Pose> &poses, const double &t, g2o::SE3Quat &T, const double scale)
+    {
+        size_t j = poses.lower_bound(t);
+        if(j == poses.size())
+            return false;
+
+        g2o::SE3Quat Tb(poses[j].rotation(), scale * poses[j].position());
+        if(poses[j].t == t)
+        {
+            T = Tb;
+            return true;
+        }
+        if(j == 0)
+            return false;
+
+        const double dt = poses[j].t - poses[j-1].t;
+        if(dt > mdMaxAssociationGap)
+            return false;
+
+        g2o::SE3Quat Ta(poses[j-1].rotation(), scale * poses[j-1].position());
+        const double s = (t - poses[j-1].t) / dt;
+        T = Ta * g2o::SE3Quat::exp(s * (Ta.inverse() * Tb).log());
+        return true;
+    }
+
+    // Append the VO pose at time t to the window. It is initialized with the current fusion estimate
+    // and linked to the previous pose with the scaled relative VO motion, or held by a weak prior on
+    // that estimate when there is no previous pose, so the solve never sees an unconstrained vertex.
+    void RealTimeiGPSFusion::AddPoseToWindow(double t)
+    {
+        long iFusion = mFusionPoses.find(t);
+        long iVO = mVOPoses.find(t);
+        if(iFusion < 0 || iVO < 0)
             return;
+
+        const iGPS::Pose &FusionPose = mFusionPoses[iFusion];
+        auto *v = new g2o::VertexSE3Expmap();
+        v->setId(mnNextWindowId++);
+        v->setFixed(false);
+        v->setEstimate(g2o::SE3Quat(FusionPose.rotation(),FusionPose.position()));
+        v->setMarginalized(false);
+        mpWindowOptimizer->addVertex(v);
+
+        // The first pose of the window, or one whose predecessor already left the VO buffer, has no odometry link
+        long iPrev = mmWindowVertices.empty() ? -1 : mVOPoses.find(mmWindowVertices.rbegin()->first);
+        if(iPrev >= 0)
+        {
+            g2o::SE3Quat wTi = g2o::SE3Quat (mVOPoses[iPrev].rotation(),mVOPoses[iPrev].position());
+            g2o::SE3Quat wTj = g2o::SE3Quat (mVOPoses[iVO].rotation(),mVOPoses[iVO].position());
+            g2o::SE3Quat iTj = wTi.inverse() * wTj;
+            RealTimeEdgeSE3Graph *e = new RealTimeEdgeSE3Graph(mLastScale);
+            e->setVertex(0,mmWindowVertices.rbegin()->second);
+            e->setVertex(1,v);
+            e->setMeasurement(iTj);
+            Eigen::Matrix<double, 6, 6> inforMatrix = Eigen::Matrix<double, 6, 6>::Identity();
+            inforMatrix.block<3,3>(0,0) =  0.1*inforMatrix.block<3,3>(0,0) ;
+            e->setInformation(inforMatrix);
+            mpWindowOptimizer->addEdge(e);
+        }
         else
         {
-            m_PoseMap.lock();
+            RealTimeEdgeSE3Prior* ep = new RealTimeEdgeSE3Prior();
+            ep->setVertex(0,v);
+            ep->setMeasurement(v->estimate());
+            ep->setInformation(1e-4 * Eigen::Matrix<double,6,6>::Identity());
+            mpWindowOptimizer->addEdge(ep);
+        }
+
+        mmWindowVertices[t] = v;
+    }
 
-            if(VOPoseMap.size())
+    // Remove the oldest pose of the window. Its prior, iGPS fix and VO link are folded (Schur complement)
+    // into a new prior on the next pose, so the information is kept without growing the graph.
+    void RealTimeiGPSFusion::MarginalizeOldestPose()
+    {
+        g2o::VertexSE3Expmap* v0 = mmWindowVertices.begin()->second;
+        mmWindowVertices.erase(mmWindowVertices.begin());
+        if(mmWindowVertices.empty())
+        {
+            mpWindowOptimizer->removeVertex(v0);
+            mpWindowPrior = NULL;
+            return;
+        }
+        g2o::VertexSE3Expmap* v1 = mmWindowVertices.begin()->second;
+
+        // Edges added since the last solve have no Jacobian memory assigned yet
+        g2o::JacobianWorkspace jacobianWorkspace;
+        for(auto it = v0->edges().begin(); it != v0->edges().end(); it++)
+            jacobianWorkspace.updateSize(*it);
+        jacobianWorkspace.allocate();
+
+        Eigen::MatrixXd H = Eigen::MatrixXd::Zero(12,12);
+        for(auto it = v0->edges().begin(); it != v0->edges().end(); it++)
+        {
+            g2o::OptimizableGraph::Edge* pEdge = static_cast<g2o::OptimizableGraph::Edge*>(*it);
+            pEdge->computeError();
+            pEdge->linearizeOplus(jacobianWorkspace);
+            if(RealTimeEdgeSE3Graph* e = dynamic_cast<RealTimeEdgeSE3Graph*>(*it))
             {
-                auto iterator = VOPoseMap.rbegin();
-                auto iteratoriGPS = iGPSPositionMap.find(iterator->first);
-                if(iteratoriGPS == iGPSPositionMap.end())
+                if(e->vertex(1) == v1)
+                    H += e->GetHessian();
+            }
+            else if(RealTimeEdgeSE3iGPSFusion* e = dynamic_cast<RealTimeEdgeSE3iGPSFusion*>(*it))
+                H.block<6,6>(0,0) += e->GetHessian();
+            else if(RealTimeEdgeSE3Prior* e = dynamic_cast<RealTimeEdgeSE3Prior*>(*it))
+                H.block<6,6>(0,0) += e->GetHessian();
+        }
+        H = Optimizer::Marginalize(H,0,5);
+        Eigen::Matrix<double,6,6> Hprior = H.block(6,6,6,6);
+        Hprior = 0.5 * (Hprior + Hprior.transpose());
+
+        mpWindowOptimizer->removeVertex(v0);
+
+        RealTimeEdgeSE3Prior* ep = new RealTimeEdgeSE3Prior();
+        ep->setVertex(0,v1);
+        ep->setMeasurement(v1->estimate());
+        ep->setInformation(Hprior);
+        mpWindowOptimizer->addEdge(ep);
+        mpWindowPrior = ep;
+    }
+
+    // Covariance of the newest window pose. The window is a chain, so folding the information of each
+    // pose into the next one (Schur complement), from the oldest pose on, gives the exact marginal of the newest.
+    bool RealTimeiGPSFusion::ComputeLatestCovariance(Eigen::Matrix<double,6,6> &cov)
+    {
+        g2o::JacobianWorkspace jacobianWorkspace;
+        for(auto it = mpWindowOptimizer->edges().begin(); it != mpWindowOptimizer->edges().end(); it++)
+            jacobianWorkspace.updateSize(*it);
+        jacobianWorkspace.allocate();
+
+        Eigen::Matrix<double,6,6> Hcur = Eigen::Matrix<double,6,6>::Zero();
+        for(auto iterVertex = mmWindowVertices.begin(); iterVertex != mmWindowVertices.end(); iterVertex++)
+        {
+            g2o::VertexSE3Expmap* v0 = iterVertex->second;
+            auto iterNext = std::next(iterVertex);
+            g2o::VertexSE3Expmap* v1 = iterNext == mmWindowVertices.end() ? NULL : iterNext->second;
+
+            Eigen::MatrixXd H = Eigen::MatrixXd::Zero(12,12);
+            H.block<6,6>(0,0) = Hcur;
+            for(auto it = v0->edges().begin(); it != v0->edges().end(); it++)
+            {
+                g2o::OptimizableGraph::Edge* pEdge = static_cast<g2o::OptimizableGraph::Edge*>(*it);
+                pEdge->computeError();
+                pEdge->linearizeOplus(jacobianWorkspace);
+                if(RealTimeEdgeSE3Graph* e = dynamic_cast<RealTimeEdgeSE3Graph*>(*it))
                 {
-                    auto iterator_next =  VOPoseMap.find(mLast_time);
-                    if(iterator_next != VOPoseMap.end())
-                    {
-                        Eigen::Quaterniond localQ(iterator->second[3],iterator->second[4],iterator->second[5],iterator->second[6]);
-                        Eigen::Vector3d localP = Eigen::Vector3d(iterator->second[0],iterator->second[1],iterator->second[2]);
-                        localQ = Eigen::Quaterniond(iGPS_T_VO.block<3,3>(0,0)) * localQ;
-                        localP = mLastScale * iGPS_T_VO.block<3,3>(0,0) * localP + iGPS_T_VO.block<3,1>(0,3);
-
-                        Eigen::Quaterniond localQ_next (iterator_next->second[3],iterator_next->second[4],iterator_next->second[5],iterator_next->second[6]);
-                        Eigen::Vector3d localP_next = Eigen::Vector3d(iterator_next->second[0],iterator_next->second[1],iterator_next->second[2]);
-                        localQ_next = Eigen::Quaterniond(iGPS_T_VO.block<3,3>(0,0)) * localQ_next;
-                        localP_next = mLastScale * iGPS_T_VO.block<3,3>(0,0) * localP_next + iGPS_T_VO.block<3,1>(0,3);
-
-                        Eigen::Matrix4d T = Eigen::Matrix4d::Identity(); Eigen::Matrix4d T1= Eigen::Matrix4d::Identity(); Eigen::Matrix4d T2 = Eigen::Matrix4d::Identity();
-                        T1.block<3,3>(0,0) = localQ.toRotationMatrix();
-                        T1.block<3,1>(0,3) = localP;
-
-                        T2.block<3,3>(0,0) = localQ_next.toRotationMatrix();
-                        T2.block<3,1>(0,3) = localP_next;
-                        T = T1* T2.inverse();
-
-                        auto iter = mmFusionPoseMap.find(iterator->first);
-                        auto iter_next = mmFusionPoseMap.find(iterator_next->first);
-
-                        Eigen::Quaterniond GlobalQ(iter_next->second[3],iter_next->second[4],iter_next->second[5],iter_next->second[6]);
-                        Eigen::Vector3d GlobalP = Eigen::Vector3d(iter_next->second[0],iter_next->second[1],iter_next->second[2]);
-
-                        Eigen::Matrix4d GlobalT = Eigen::Matrix4d::Identity();
-                        GlobalT.block<3,3>(0,0) = GlobalQ.toRotationMatrix();
-                        GlobalT.block<3,1>(0,3) = GlobalP;
-                        GlobalT = T * GlobalT ;
-
-                        Eigen::Vector3d testP = GlobalT.block<3,1>(0,3);
-
-                        //ofstream f;
-                        //f.open("./RealTimeResult.txt",ios::app);
-                        //f << fixed;
-                        //f << iter->first  << "," <<  setprecision(9) << ( testP.x() + iter->second[0])/2 << "," << (testP.y() +iter->second[1]) /2 << "," << (testP.z() +iter->second[2]) /2 <<endl;
-                        //f << iter->first  << "," <<  setprecision(9) << estimated1.x() << "," << estimated1.y() << "," << estimated1.z()  <<endl;
-                        //f << iter->first  << "," <<  setprecision(9) << iter->second[0]<< "," << iter->second[1]<< "," << iter->second[2] <<endl;
-                        //f << iter->first  << "," <<  setprecision(9) << testP.x()  << "," << testP.y()  << "," << testP.z() <<endl;
-
-                        //f << iter->first  << "," <<  setprecision(9) << iter->second[0] << "," << iter->second[1] << "," << iter->second[2] << "," << iter->second[3] << "," << iter->second[4] << "," << iter->second[5] << ","  << iter->second[6]  <<endl;
-                        //f.close();
-                        //cout<< "Fail to track iGPS, Global localization result2 = " << iter->first << "," << testP.x() << "," << testP.y() << "," << testP.z() <<endl;
-                        //cout<< "Fail to track iGPS, Global localization result3 = " << iter->first << "," << iter->second[0] << "," << iter->second[1] << "," << iter->second[2] <<endl;
-                    }
+                    if(v1 && e->vertex(0) == v0 && e->vertex(1) == v1)
+                        H += e->GetHessian();
                 }
+                else if(RealTimeEdgeSE3iGPSFusion* e = dynamic_cast<RealTimeEdgeSE3iGPSFusion*>(*it))
+                    H.block<6,6>(0,0) += e->GetHessian();
+                else if(RealTimeEdgeSE3Prior* e = dynamic_cast<RealTimeEdgeSE3Prior*>(*it))
+                    H.block<6,6>(0,0) += e->GetHessian();
             }
 
+            if(!v1)
+            {
+                Hcur = H.block<6,6>(0,0);
+                break;
+            }
+            H = Optimizer::Marginalize(H,0,5);
+            Hcur = H.block<6,6>(6,6);
+        }
+
+        Hcur = 0.5 * (Hcur + Hcur.transpose());
+        Eigen::FullPivLU<Eigen::Matrix<double,6,6> > lu(Hcur);
+        if(!lu.isInvertible())
+            return false;
+        cov = lu.inverse();
+        return true;
+    }
+
+    void RealTimeiGPSFusion::inputVO(double t, cv::Mat Tcw)
+    {
+        if (Tcw.empty())
+            return;
+        else
+        {
+            m_PoseMap.lock();
+
             Eigen::Quaterniond localQ(Converter::toMatrix3d(Tcw.rowRange(0,3).colRange(0,3)));
             Eigen::Vector3d localPinv = Converter::toVector3d(Tcw.rowRange(0,3).col(3));
             Eigen::Vector3d localP = -(localQ.inverse()*localPinv);
@@ -129,46 +297,48 @@ namespace ORB_SLAM3
             if(mScale != 1.0)
                 mLastScale = mScale;
 
-            std::vector<double> localPose{localP.x(),localP.y(),localP.z(),
-                                          localQ.w(),localQ.x(),localQ.y(),localQ.z()};
-            VOPoseMap[t] = localPose;
-
-            std::vector<double> FusionPose{ FusionP.x(),FusionP.y(),FusionP.z(),
-                                            FusionQ.w(),FusionQ.x(),FusionQ.y(),FusionQ.z()};
-
-            mmFusionPoseMap[t] = FusionPose;
+            if(!mVOPoses.push_back(iGPS::Pose(t,localP,localQ)))
+            {
+                mnRejectedSamples++;
+                LOG_VERBOSE("iGPS fusion: out of order VO pose at t = " << t << " dropped");
+                m_PoseMap.unlock();
+                return;
+            }
+            mFusionPoses.push_back(iGPS::Pose(t,FusionP,FusionQ));
 
             //if scale is estimated successfully
             if(mbScaleFlag && mScale != 1.0)
             {
                 mScale = 1;
-                mmFusionPoseMap.clear();
-                std::cout<< "iGPS_T_VO = " << iGPS_T_VO <<std::endl;
-                std::cout<< "mLastScale = " << mLastScale <<std::endl;
-                for(auto iterator = VOPoseMap.begin(); iterator != VOPoseMap.end();iterator++)
+                mFusionPoses.clear();
+                ResetWindow();
+                LOG_VERBOSE("iGPS_T_VO = " << iGPS_T_VO);
+                LOG_VERBOSE("mLastScale = " << mLastScale);
+                for(size_t i = 0; i < mVOPoses.size(); i++)
                 {
-                    Eigen::Quaterniond localQ(iterator->second[3],iterator->second[4],iterator->second[5],iterator->second[6]);
-                    Eigen::Vector3d localP = Eigen::Vector3d(iterator->second[0],iterator->second[1],iterator->second[2]);
-
-                    FusionQ = Eigen::Quaterniond(iGPS_T_VO.block<3,3>(0,0)) * localQ;
-                    FusionP = mLastScale * iGPS_T_VO.block<3,3>(0,0) * localP + iGPS_T_VO.block<3,1>(0,3);
-
-                    std::vector<double> FusionPose{ FusionP.x(),FusionP.y(),FusionP.z(),
-                                                    FusionQ.w(),FusionQ.x(),FusionQ.y(),FusionQ.z()};
-                    mmFusionPoseMap[iterator->first] = FusionPose;
+                    FusionQ = Eigen::Quaterniond(iGPS_T_VO.block<3,3>(0,0)) * mVOPoses[i].rotation();
+                    FusionP = mLastScale * iGPS_T_VO.block<3,3>(0,0) * mVOPoses[i].position() + iGPS_T_VO.block<3,1>(0,3);
+                    mFusionPoses.push_back(iGPS::Pose(mVOPoses[i].t,FusionP,FusionQ));
                 }
             }
 
-            //last_p = FusionP;
-            //last_q = FusionQ;
             m_PoseMap.unlock();
         }
     }
 
     bool RealTimeiGPSFusion::getFusionResult(Eigen::Vector3d & P, Eigen::Quaterniond & Q)
     {
-        P = last_p;
-        Q = last_q;
+        iGPS::FusionResult result;
+        if(!mFusionResult.read(result))
+            return false;
+        P = result.pose.position();
+        Q = result.pose.rotation();
+        return true;
+    }
+
+    bool RealTimeiGPSFusion::getFusionResult(iGPS::FusionResult & result)
+    {
+        return mFusionResult.read(result);
     }
 
     void RealTimeiGPSFusion::optimize()
@@ -185,164 +355,147 @@ namespace ORB_SLAM3
                 bFusionSolution = true;
                 mbfusionFlag = false;
             }
+            mbProcessingiGPS = bFusionSolution;
             mMutexiGPS.unlock();
 
             if(bFusionSolution)
             {
-                int num = iGPSPositionMap.size();
+                int num = miGPSPositions.size();
                 //cout << "num " << num << endl;
                 if(num <20)
                     continue;
 
                 if(mbScaleFlag)
                 {
-                    //Pose Graph Optimize
-                    g2o::SparseOptimizer optimizer;
-                    g2o::BlockSolverX::LinearSolverType * linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolverX::PoseMatrixType>();
-                    auto * solver_ptr = new g2o::BlockSolverX(linearSolver);
-                    g2o::OptimizationAlgorithmGaussNewton* solver = new g2o::OptimizationAlgorithmGaussNewton(solver_ptr);
-                    optimizer.setAlgorithm(solver);
-                    optimizer.setVerbose(true);
+                    //Pose Graph Optimize over the fixed-lag window, warm-started from the previous solve
+                    std::chrono::steady_clock::time_point time_StartSolve = std::chrono::steady_clock::now();
                     m_PoseMap.lock();
 
-                    int index = 0;
-                    int length = mmFusionPoseMap.size();
-                    int iFixLength = 100;
-                    for(auto iterator = mmFusionPoseMap.begin(); iterator != mmFusionPoseMap.end();iterator++)
+                    if(mmWindowVertices.empty() && !mVOPoses.empty())
                     {
-                        if(length - iFixLength>0)
-                        {
-                            length--;
-                            continue;
-                        }
-                        Eigen::Quaterniond localQ(iterator->second[3],iterator->second[4],iterator->second[5],iterator->second[6]);
-                        Eigen::Vector3d localP = Eigen::Vector3d(iterator->second[0],iterator->second[1],iterator->second[2]);
-                        auto *v = new g2o::VertexSE3Expmap();
-                        v->setId(index);
-                        v->setFixed(false);
-                        v->setEstimate(g2o::SE3Quat(localQ,localP));
-                        v->setMarginalized(false);
-                        optimizer.addVertex(v);
-                        index++;
+                        // First solve after (re)initialization: only the newest poses enter the window
+                        size_t first = mVOPoses.size() > mnWindowSize ? mVOPoses.size() - mnWindowSize : 0;
+                        for(size_t i = first; i < mVOPoses.size(); i++)
+                            AddPoseToWindow(mVOPoses[i].t);
+                    }
+                    else if(!mmWindowVertices.empty())
+                    {
+                        for(size_t i = mVOPoses.upper_bound(mmWindowVertices.rbegin()->first); i < mVOPoses.size(); i++)
+                            AddPoseToWindow(mVOPoses[i].t);
                     }
 
-                    index = 0;
-                    length = mmFusionPoseMap.size();
-                    for(auto iterator = VOPoseMap.begin(); iterator != VOPoseMap.end();iterator++)
+                    // iGPS fixes received since the last solve. Each fix is attached to the nearest window pose,
+                    // with the lever to the VO pose interpolated at the fix time. Fixes newer than the
+                    // newest VO pose wait for the next solve.
+                    const float thHuber = sqrt(5.991);
+                    for(size_t j = miGPSPositions.upper_bound(mLastWindowiGPSTime); j < miGPSPositions.size(); j++)
                     {
-                        if(length-iFixLength>0)
-                        {
-                            length--;
+                        const iGPS::Point &iGPSPoint = miGPSPositions[j];
+                        if(mmWindowVertices.empty() || iGPSPoint.t > mmWindowVertices.rbegin()->first)
+                            break;
+                        mLastWindowiGPSTime = iGPSPoint.t;
+                        if(iGPSPoint.t < mmWindowVertices.begin()->first)
                             continue;
-                        }
-                        auto iteratorNext = iterator;
-                        iteratorNext++;
-                        if(iteratorNext != VOPoseMap.end())
-                        {
-                            Eigen::Quaterniond localQ(iterator->second[3],iterator->second[4],iterator->second[5],iterator->second[6]);
-                            Eigen::Vector3d localP = Eigen::Vector3d(iterator->second[0],iterator->second[1],iterator->second[2]);
-                            g2o::SE3Quat wTi = g2o::SE3Quat (localQ,localP);
-                            localQ = Eigen::Quaterniond(iteratorNext->second[3],iteratorNext->second[4],iteratorNext->second[5],iteratorNext->second[6]);
-                            localP = Eigen::Vector3d(iteratorNext->second[0],iteratorNext->second[1],iteratorNext->second[2]);
-                            g2o::SE3Quat wTj = g2o::SE3Quat (localQ,localP);
-                            g2o::SE3Quat iTj = wTi.inverse() * wTj;
-                            RealTimeEdgeSE3Graph *e = new RealTimeEdgeSE3Graph(mLastScale);
-                            e->setVertex(0,dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(index)));
-                            e->setVertex(1,dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(index+1)));
-                            e->setMeasurement(iTj);
-                            Eigen::Matrix<double, 6, 6> inforMatrix = Eigen::Matrix<double, 6, 6>::Identity();
-                            inforMatrix.block<3,3>(0,0) =  0.1*inforMatrix.block<3,3>(0,0) ;
-                            inforMatrix.block<3,3>(3,3) =  inforMatrix.block<3,3>(3,3) ;
-                            e->setInformation(inforMatrix);
-                            optimizer.addEdge(e);
-                        }
 
-                        double t = iterator->first;
-                        auto iteratoriGPS = iGPSPositionMap.find(t);
-                        const float thHuber = sqrt(5.991);
-                        if(iteratoriGPS != iGPSPositionMap.end())
+                        g2o::SE3Quat VOT;
+                        if(!InterpolatePose(mVOPoses, iGPSPoint.t, VOT, mLastScale))
+                            continue;
+
+                        auto iteratorVertex = mmWindowVertices.lower_bound(iGPSPoint.t);
+                        if(iteratorVertex != mmWindowVertices.begin())
                         {
-                            g2o::Vector3D iGPSPosition = g2o::Vector3D(iteratoriGPS->second.x,iteratoriGPS->second.y,iteratoriGPS->second.z);
-                            RealTimeEdgeSE3iGPSFusion *e = new RealTimeEdgeSE3iGPSFusion();
-                            e->setVertex(0,dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(index)));
-                            e->setMeasurement(iGPSPosition);
-                            e->setInformation(Eigen::Matrix3d::Identity());
-                            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                            e->setRobustKernel(rk);
-                            rk->setDelta(thHuber);
-                            optimizer.addEdge(e);
+                            auto iteratorPrev = std::prev(iteratorVertex);
+                            if(iGPSPoint.t - iteratorPrev->first < iteratorVertex->first - iGPSPoint.t)
+                                iteratorVertex = iteratorPrev;
                         }
-                        index++;
+                        long iAnchor = mVOPoses.find(iteratorVertex->first);
+                        if(iAnchor < 0)
+                            continue;
+                        g2o::SE3Quat AnchorT(mVOPoses[iAnchor].rotation(), mLastScale * mVOPoses[iAnchor].position());
+                        Eigen::Vector3d lever = (AnchorT.inverse() * VOT).translation();
+
+                        g2o::Vector3D iGPSPosition = g2o::Vector3D(iGPSPoint.p.x,iGPSPoint.p.y,iGPSPoint.p.z);
+                        RealTimeEdgeSE3iGPSFusion *e = new RealTimeEdgeSE3iGPSFusion(lever);
+                        e->setVertex(0,iteratorVertex->second);
+                        e->setMeasurement(iGPSPosition);
+                        e->setInformation(Eigen::Matrix3d::Identity());
+                        g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+                        e->setRobustKernel(rk);
+                        rk->setDelta(thHuber);
+                        mpWindowOptimizer->addEdge(e);
                     }
 
-                    optimizer.initializeOptimization();
-                    optimizer.optimize(10);
-                    ofstream f;
-                    f.open("./RealTimeResult.txt",ios::app);
-                    length = mmFusionPoseMap.size();
-                    auto iter = mmFusionPoseMap.begin();
+                    while(mmWindowVertices.size() > mnWindowSize)
+                        MarginalizeOldestPose();
 
-                    for(int i = 0; i< length; iter++)
+                    if(mmWindowVertices.size() < 2)
                     {
-                        if(length-iFixLength>0)
-                        {
-                            length--;
+                        m_PoseMap.unlock();
+                        continue;
+                    }
+
+                    mpWindowOptimizer->initializeOptimization();
+                    mpWindowOptimizer->optimize(mnWindowIterations);
+
+                    int length = mmWindowVertices.size();
+                    int i = 0;
+                    for(auto iterVertex = mmWindowVertices.begin(); iterVertex != mmWindowVertices.end(); iterVertex++, i++)
+                    {
+                        long iter = mFusionPoses.find(iterVertex->first);
+                        if(iter < 0)
                             continue;
-                        }
+                        iGPS::Pose &StoredPose = mFusionPoses[iter];
+
+                        g2o::SE3Quat SE3quat = iterVertex->second->estimate();
+                        Eigen::Quaterniond FusionQ = SE3quat.rotation();
+                        Eigen::Vector3d FusionP = SE3quat.translation();
+                        iGPS::Pose FusionPose(StoredPose.t,FusionP,FusionQ);
+
                         if(i < length -1 && i > length -30) // 将位姿图中的除了最后一个节点以外都设置成优化以后的pose
                         {
-                            //cout << "iter->second     " << iter->second[0] << " " << iter->second[1] << " "
-                            //     << iter->second[2] << endl;
-
-                            g2o::VertexSE3Expmap *vSE3 = static_cast<g2o::VertexSE3Expmap *>(optimizer.vertex(i));
-                            g2o::SE3Quat SE3quat = vSE3->estimate();
-                            Eigen::Quaterniond FusionQ = SE3quat.rotation();
-                            Eigen::Vector3d FusionP = SE3quat.translation();
-                            std::vector<double> FusionPose{FusionP.x(), FusionP.y(), FusionP.z(),
-                                                           FusionQ.w(), FusionQ.x(), FusionQ.y(), FusionQ.z()};
-                            iter->second = FusionPose;
+                            StoredPose = FusionPose;
                         }
-                        if(i == length -1) // 将位姿图中的除了最后一个节点以外都设置成优化以后的pose
+                        if(i == length -1)
                         {
-                            //cout<< "Initial estimated global localization result  = " << iter->second[0] << " "<< iter->second[1] << " " << iter->second[2]   <<endl;
-
-                            g2o::VertexSE3Expmap* vSE3 = static_cast<g2o::VertexSE3Expmap*>(optimizer.vertex(i));
-                            g2o::SE3Quat SE3quat = vSE3->estimate();
-                            Eigen::Quaterniond FusionQ = SE3quat.rotation();
-                            Eigen::Vector3d FusionP = SE3quat.translation();
-                            std::vector<double> FusionPose{ FusionP.x(),FusionP.y(),FusionP.z(),
-                                                            FusionQ.w(),FusionQ.x(),FusionQ.y(),FusionQ.z()};
-
-                            //cout<< "Estimated global localization result = " << FusionP.x() << "," << FusionP.y() << "," << FusionP.z() <<endl;
-                            Eigen::Vector3d itertest = Eigen::Vector3d(FusionP.x()- iter->second[0],FusionP.y()-iter->second[1],FusionP.z()- iter->second[2]);
+                            Eigen::Vector3d itertest = FusionP - StoredPose.position();
                             double error = itertest.norm();
                             if(error>0.1)
-                            cout<< "estimated global localization error  = " << FusionP.x()- iter->second[0] << " "<< FusionP.y() - iter->second[1] << " " << FusionP.z() - iter->second[2]   <<endl;
+                                LOG_DEBUG("estimated global localization error  = " << itertest.transpose());
 
-                            iter->second = FusionPose;
-                            //cout << "SE3quat         " << SE3quat.translation().transpose() <<endl;
-                            f << fixed;
-                            f << iter->first  << "," <<  setprecision(9) << FusionP.x() << "," << FusionP.y() << "," << FusionP.z() << "," << FusionQ.x() << "," << FusionQ.y() << "," << FusionQ.z() << ","  << FusionQ.w()  <<endl;
+                            StoredPose = FusionPose;
+                            mpResultSink->Push(FusionPose);
 
+                            long localPose = mVOPoses.find(StoredPose.t);
+                            if(localPose < 0)
+                                continue;
                             Eigen::Matrix4d WVO_T_body = Eigen::Matrix4d::Identity();
                             Eigen::Matrix4d WGPS_T_body = Eigen::Matrix4d::Identity();
-                            double t = iter->first;
-                            auto localPose = VOPoseMap.find(t);
-                            Eigen::Quaterniond localQ(localPose->second[3],localPose->second[4],localPose->second[5],localPose->second[6]);
-                            Eigen::Vector3d localP = Eigen::Vector3d(localPose->second[0],localPose->second[1],localPose->second[2]);
-                            WVO_T_body.block<3,3>(0,0) = localQ.toRotationMatrix();
-                            WVO_T_body.block<3,1>(0,3) = mLastScale * localP;
-                            WGPS_T_body.block<3,3>(0,0) = Eigen::Quaterniond(FusionQ.w(),FusionQ.x(),FusionQ.y(),FusionQ.z()).toRotationMatrix();
-                            WGPS_T_body.block<3,1>(0,3) =Eigen::Vector3d(FusionP.x(),FusionP.y(),FusionP.z());
+                            WVO_T_body.block<3,3>(0,0) = mVOPoses[localPose].rotation().toRotationMatrix();
+                            WVO_T_body.block<3,1>(0,3) = mLastScale * mVOPoses[localPose].position();
+                            WGPS_T_body.block<3,3>(0,0) = FusionQ.toRotationMatrix();
+                            WGPS_T_body.block<3,1>(0,3) = FusionP;
                             Eigen::Matrix4d test = WGPS_T_body * WVO_T_body.inverse();
-                            //iGPS_T_VO = WGPS_T_body * WVO_T_body.inverse();
                             iGPS_T_VO.block<3,3>(0,0) = test.block<3,3>(0,0);
                             iGPS_T_VO.block<3,1>(0,3) = test.block<3,1>(0,3);
                         }
-                        i++;
                     }
 
-                    f.close();
+                    // Publish the newest pose for getFusionResult
+                    iGPS::FusionResult result;
+                    const g2o::SE3Quat LatestT = mmWindowVertices.rbegin()->second->estimate();
+                    result.pose = iGPS::Pose(mmWindowVertices.rbegin()->first, LatestT.translation(), LatestT.rotation());
+                    Eigen::Matrix<double,6,6> cov;
+                    if(ComputeLatestCovariance(cov))
+                        Eigen::Map<Eigen::Matrix<double,6,6,Eigen::RowMajor> >(result.cov) = cov;
+                    const std::chrono::steady_clock::time_point time_EndSolve = std::chrono::steady_clock::now();
+                    result.latency = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndSolve - time_StartSolve).count();
+                    mnSolves++;
+                    mdTotalSolveTime += result.latency;
+                    result.nSolves = mnSolves;
+                    result.totalLatency = mdTotalSolveTime;
+                    result.stamp = std::chrono::duration<double>(time_EndSolve.time_since_epoch()).count();
+                    mFusionResult.write(result);
+
                     m_PoseMap.unlock();
 
                 }
@@ -363,7 +516,8 @@ namespace ORB_SLAM3
                     //solver->setUserLambdaInit(1e-16);
 
                     optimizer.setAlgorithm(solver);
-                    optimizer.setVerbose(true);
+                    // g2o prints every iteration to the terminal, only at debug verbosity
+                    optimizer.setVerbose(LOG_MAX_LEVEL >= Verbose::VERBOSITY_DEBUG && Verbose::Enabled(Verbose::VERBOSITY_DEBUG));
 
                     m_PoseMap.lock();
 
@@ -377,25 +531,32 @@ namespace ORB_SLAM3
 
                     g2o::Vector3D VOPositionAvg(0,0,0),iGPSPositionAvg(0,0,0);
                     int iterNum = 0;
-                    for(auto iterator = iGPSPositionMap.begin(); iterator != iGPSPositionMap.end();iterator++)
+                    for(size_t j = 0; j < miGPSPositions.size(); j++)
                     {
-                        double t = iterator->first;
-                        auto iterVO = mmFusionPoseMap.find(t);
-                        g2o::Vector3D VOpos3d(iterVO->second[0],iterVO->second[1],iterVO->second[2]);
-                        g2o::Vector3D iGPSpos3d(iterator->second.x,iterator->second.y,iterator->second.z);
+                        g2o::SE3Quat FusionT;
+                        if(!InterpolatePose(mFusionPoses, miGPSPositions[j].t, FusionT))
+                            continue;
+                        g2o::Vector3D VOpos3d = FusionT.translation();
+                        g2o::Vector3D iGPSpos3d(miGPSPositions[j].p.x,miGPSPositions[j].p.y,miGPSPositions[j].p.z);
                         VOPositionAvg += VOpos3d;
                         iGPSPositionAvg += iGPSpos3d;
                         iterNum++;
                     }
+                    if(iterNum < 3)
+                    {
+                        m_PoseMap.unlock();
+                        continue;
+                    }
                     VOPositionAvg /=iterNum; iGPSPositionAvg/=iterNum;
                     double dis1 = 0,dis2 = 0;
                     iterNum = 0;
-                    for(auto iterator = iGPSPositionMap.begin(); iterator != iGPSPositionMap.end();iterator++)
+                    for(size_t j = 0; j < miGPSPositions.size(); j++)
                     {
-                        double t = iterator->first;
-                        auto iterVO = mmFusionPoseMap.find(t);
-                        g2o::Vector3D VOpos3d(iterVO->second[0],iterVO->second[1],iterVO->second[2]);
-                        g2o::Vector3D iGPSpos3d(iterator->second.x,iterator->second.y,iterator->second.z);
+                        g2o::SE3Quat FusionT;
+                        if(!InterpolatePose(mFusionPoses, miGPSPositions[j].t, FusionT))
+                            continue;
+                        g2o::Vector3D VOpos3d = FusionT.translation();
+                        g2o::Vector3D iGPSpos3d(miGPSPositions[j].p.x,miGPSPositions[j].p.y,miGPSPositions[j].p.z);
                         if(iterNum == 0)
                         {
                             dis1 = (VOpos3d - VOPositionAvg).norm();
@@ -411,16 +572,17 @@ namespace ORB_SLAM3
                         iterNum++;
                     }
                     double scale = dis2 /dis1;   //initial scale estimate
-                    std::cout<< "scale = " << scale <<endl;
+                    LOG_VERBOSE("scale = " << scale);
 
 
                     const float thHuber = sqrt(14.07);
-                    for(auto iterator = iGPSPositionMap.begin(); iterator != iGPSPositionMap.end();iterator++)
+                    for(size_t j = 0; j < miGPSPositions.size(); j++)
                     {
-                        double t = iterator->first;
-                        auto iterVO = mmFusionPoseMap.find(t);
-                        g2o::Vector3D VOpos3d(scale*iterVO->second[0],scale*iterVO->second[1],scale*iterVO->second[2]);
-                        g2o::Vector3D iGPSpos3d(iterator->second.x,iterator->second.y,iterator->second.z);
+                        g2o::SE3Quat FusionT;
+                        if(!InterpolatePose(mFusionPoses, miGPSPositions[j].t, FusionT))
+                            continue;
+                        g2o::Vector3D VOpos3d = scale * FusionT.translation();
+                        g2o::Vector3D iGPSpos3d(miGPSPositions[j].p.x,miGPSPositions[j].p.y,miGPSPositions[j].p.z);
                         //std::cout<< "VOpos3d = " << VOpos3d <<std::endl;
                         //std::cout<< "iGPSpos3d = " << iGPSpos3d <<std::endl;
                         RealTimeEdgeSim3 *e = new RealTimeEdgeSim3(VOpos3d);
@@ -440,7 +602,7 @@ namespace ORB_SLAM3
                     mScale = scale * v->estimate().scale();
                     if(mScale > scale/3 && mScale < scale*3)
                     {
-                        std::cout << "mScale = " << mScale << std::endl;
+                        LOG_VERBOSE("mScale = " << mScale);
                         mbScaleFlag = true;
                         iGPS_T_VO.block<3,3>(0,0) = v->estimate().rotation().toRotationMatrix();
                         iGPS_T_VO.block<3,1>(0,3) = v->estimate().translation();
@@ -457,9 +619,19 @@ namespace ORB_SLAM3
                 }
             }
 
-            usleep(5000);
-            if(mpLoopCloser->isFinished())
+            mMutexiGPS.lock();
+            mbProcessingiGPS = false;
+            mMutexiGPS.unlock();
+
+            // Sleep until the next iGPS sample or RequestFinish
+            mWakeEvent.Wait(50000);
+            if(mWakeEvent.isShutdown() || (mpLoopCloser && mpLoopCloser->isFinished()))
             {
+                {
+                    unique_lock<mutex> lock(m_PoseMap);
+                    if(mnRejectedSamples > 0)
+                        cout << "iGPS fusion: " << mnRejectedSamples << " out of order samples dropped" << endl;
+                }
                 SetFinish();
                 break;
             }
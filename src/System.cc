@@ -20,6 +20,7 @@
 
 #include "System.h"
 #include "Converter.h"
+#include "TrajectorySink.h"
 #include <thread>
 #include <pangolin/pangolin.h>
 #include <iomanip>
@@ -36,8 +37,6 @@
 namespace ORB_SLAM3
 {
 
-Verbose::eLevel Verbose::th = Verbose::VERBOSITY_NORMAL;
-
 System::System(const string &strVocFile, const string &strSettingsFile, const eSensor sensor,
                const bool bUseViewer, const int initFr, const string &strSequence, const string &strLoadingFile):
     mSensor(sensor), mpViewer(static_cast<Viewer*>(NULL)), mbReset(false), mbResetActiveMap(false),
@@ -144,8 +143,13 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     mpLoopCloser->SetTracker(mpTracker);
     mpLoopCloser->SetLocalMapper(mpLocalMapper);
 
-    // Fix verbosity
-    Verbose::SetTh(Verbose::VERBOSITY_QUIET);
+    // Verbosity, quiet unless System.LogLevel (0 quiet ... 4 debug) is set
+    cv::FileNode nodeLogLevel = fsSettings["System.LogLevel"];
+    int logLevel = nodeLogLevel.empty() ? (int)Verbose::VERBOSITY_QUIET : (int)nodeLogLevel;
+    logLevel = std::max((int)Verbose::VERBOSITY_QUIET, std::min(logLevel, (int)Verbose::VERBOSITY_DEBUG));
+    if(logLevel > LOG_MAX_LEVEL)
+        cout << "System.LogLevel " << logLevel << " above the compiled LOG_MAX_LEVEL " << LOG_MAX_LEVEL << endl;
+    Verbose::SetTh((Verbose::eLevel)logLevel);
 
 }
 
@@ -333,12 +337,23 @@ cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp, const
     return Tcw;
 }
 
-void System::LoadiGPSDirection(vector<double> vTimestamps, ORB_SLAM3::iGPS::Direction* iGPSDirection)
+void System::LoadiGPSDirection(const vector<double> &vTimestamps, ORB_SLAM3::iGPS::Direction* iGPSDirection)
 {
     mpTracker->LoadiGPSDirection(vTimestamps,iGPSDirection);
     return;
 }
 
+void System::LoadiGPSDirection(const iGPS::LogReader* piGPSLog)
+{
+    mpTracker->LoadiGPSDirection(piGPSLog);
+    return;
+}
+
+void System::GrabiGPSDirection(const iGPS::Direction &iGPSDirection)
+{
+    mpTracker->GrabiGPSDirection(iGPSDirection);
+}
+
 void System::LoadCameraPose(vector<double> &vTimeStamps,vector<Eigen::VectorXf> &vCameraPose)
 {
     mpTracker->LoadCameraPose(vTimeStamps,vCameraPose);
@@ -400,7 +415,9 @@ void System::Shutdown()
             cout << "mpLocalMapper is not finished" << endl;
         if(!mpLoopCloser->isFinished())
             cout << "mpLoopCloser is not finished" << endl;
-        if(mpLoopCloser->isRunningGBA()){
+        // The final iGPS GBA is waited for, a loop closure GBA is not. Loop Closing aborts a loop closure GBA
+        // only to run a final iGPS GBA, otherwise it finishes with the loop closure GBA still running
+        if(mpLoopCloser->isFinished() && mpLoopCloser->isRunningGBA() && !mpLoopCloser->isRunningiGPSGBA()){
             cout << "mpLoopCloser is running GBA" << endl;
             cout << "break anyway..." << endl;
             break;
@@ -411,6 +428,11 @@ void System::Shutdown()
     if(mpViewer)
         pangolin::BindToContext("ORB-SLAM2: Map Viewer");
 
+    // Queued messages go out before the statistics and trajectories printed next
+    LogSink::Instance().Flush();
+    if(LogSink::Instance().dropped() > 0)
+        cout << LogSink::Instance().dropped() << " log lines dropped" << endl;
+
 #ifdef REGISTER_TIMES
     mpTracker->PrintTimeStats();
 #endif
@@ -434,9 +456,8 @@ void System::SaveTrajectoryTUM(const string &filename)
     // After a loop closure the first keyframe might not be at the origin.
     cv::Mat Two = vpKFs[0]->GetPoseInverse();
 
-    ofstream f;
-    f.open(filename.c_str());
-    f << fixed;
+    // Rows are formatted and written by the sink's writer thread while the poses are still being computed
+    TrajectorySink sink(filename, ' ', 1.0, TrajectorySink::CSV, false);
 
     // Frame pose is stored relative to its reference keyframe (which is optimized by BA and pose graph).
     // We need to get first the keyframe pose and then concatenate the relative transformation.
@@ -472,9 +493,9 @@ void System::SaveTrajectoryTUM(const string &filename)
 
         vector<float> q = Converter::toQuaternion(Rwc);
 
-        f << setprecision(6) << *lT << " " <<  setprecision(9) << twc.at<float>(0) << " " << twc.at<float>(1) << " " << twc.at<float>(2) << " " << q[0] << " " << q[1] << " " << q[2] << " " << q[3] << endl;
+        sink.Push(iGPS::Pose(*lT, Converter::toVector3d(twc), Eigen::Quaterniond(q[3],q[0],q[1],q[2])), true);
     }
-    f.close();
+    sink.Close();
     // cout << endl << "trajectory saved!" << endl;
 }
 
@@ -544,9 +565,8 @@ void System::SaveTrajectoryEuRoC(const string &filename)
     else
         Twb = vpKFs[0]->GetPoseInverse();
 
-    ofstream f;
-    f.open(filename.c_str());
-    f << fixed;
+    // Rows are formatted and written by the sink's writer thread while the poses are still being computed
+    TrajectorySink sink(filename, ' ', 1e9, TrajectorySink::CSV, false);
 
     // Frame pose is stored relative to its reference keyframe (which is optimized by BA and pose graph).
     // We need to get first the keyframe pose and then concatenate the relative transformation.
@@ -593,7 +613,7 @@ void System::SaveTrajectoryEuRoC(const string &filename)
             cv::Mat Rwb = Tbw.rowRange(0,3).colRange(0,3).t();
             cv::Mat twb = -Rwb*Tbw.rowRange(0,3).col(3);
             vector<float> q = Converter::toQuaternion(Rwb);
-            f << setprecision(6) << 1e9*(*lT) << " " <<  setprecision(9) << twb.at<float>(0) << " " << twb.at<float>(1) << " " << twb.at<float>(2) << " " << q[0] << " " << q[1] << " " << q[2] << " " << q[3] << endl;
+            sink.Push(iGPS::Pose(*lT, Converter::toVector3d(twb), Eigen::Quaterniond(q[3],q[0],q[1],q[2])), true);
         }
         else
         {
@@ -601,12 +621,12 @@ void System::SaveTrajectoryEuRoC(const string &filename)
             cv::Mat Rwc = Tcw.rowRange(0,3).colRange(0,3).t();
             cv::Mat twc = -Rwc*Tcw.rowRange(0,3).col(3);
             vector<float> q = Converter::toQuaternion(Rwc);
-            f << setprecision(6) << 1e9*(*lT) << " " <<  setprecision(9) << twc.at<float>(0) << " " << twc.at<float>(1) << " " << twc.at<float>(2) << " " << q[0] << " " << q[1] << " " << q[2] << " " << q[3] << endl;
+            sink.Push(iGPS::Pose(*lT, Converter::toVector3d(twc), Eigen::Quaterniond(q[3],q[0],q[1],q[2])), true);
         }
 
     }
     //cout << "end saving trajectory" << endl;
-    f.close();
+    sink.Close();
     cout << endl << "End of saving trajectory to " << filename << " ..." << endl;
 }
 
@@ -0,0 +1,51 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+#include "ThreadEvent.h"
+
+#include <chrono>
+
+namespace ORB_SLAM3
+{
+
+ThreadEvent::ThreadEvent(): mbSignaled(false), mbShutdown(false)
+{
+}
+
+void ThreadEvent::Notify()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mbSignaled = true;
+    }
+    mCond.notify_one();
+}
+
+void ThreadEvent::Shutdown()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mbShutdown = true;
+    }
+    mCond.notify_all();
+}
+
+bool ThreadEvent::isShutdown()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mbShutdown;
+}
+
+bool ThreadEvent::Wait(const int timeout_us)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    bool bWoken = mCond.wait_for(lock, std::chrono::microseconds(timeout_us),
+                                 [this]{ return mbSignaled || mbShutdown; });
+    mbSignaled = false;
+    return bWoken;
+}
+
+} //namespace ORB_SLAM3
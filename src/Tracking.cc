@@ -48,7 +48,8 @@ Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer,
     mbOnlyTracking(false), mbMapUpdated(false), mbVO(false), mpORBVocabulary(pVoc), mpKeyFrameDB(pKFDB),
     mpInitializer(static_cast<Initializer*>(NULL)), mpSystem(pSys), mpViewer(NULL),
     mpFrameDrawer(pFrameDrawer), mpMapDrawer(pMapDrawer), mpAtlas(pAtlas), mnLastRelocFrameId(0), time_recently_lost(5.0), time_recently_lost_visual(2.0),
-    mnInitialFrameId(0), mbCreatedMap(false), mnFirstFrameId(0), mpCamera2(nullptr)
+    mnInitialFrameId(0), mbCreatedMap(false), mnFirstFrameId(0), mpCamera2(nullptr),
+    miGPSAllDirection(NULL), mpiGPSLog(NULL), mnMaxiGPSQueue(20000), mbiGPSStreaming(false)
 {
     // Load camera parameters from settings file
     cv::FileStorage fSettings(strSettingPath, cv::FileStorage::READ);
@@ -82,71 +83,25 @@ Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer,
     }
 
 
-    cv::Mat mTwi,mTwi2,mTwi3;
-    bool b_parse_iGPS = true;
-    cv::FileNode node = fSettings["Twi"];
-
-    if(!node.empty())
-    {
-        mTwi = node.mat();
-        if(mTwi.rows != 4 || mTwi.cols != 4)
-        {
-            std::cerr << "*Twi matrix have to be a 4x4 transformation matrix*" << std::endl;
-            b_parse_iGPS = true;
-        }
-        else
-        {
-            vTwi.push_back(mTwi);
-        }
-    }
-    else
-    {
-        std::cerr << "*Twi matrix doesn't exist*" << std::endl;
-        b_parse_iGPS = true;
-    }
-
-    cv::FileNode node2 = fSettings["Twi2"];
-    if(!node2.empty())
-    {
-        mTwi2 = node2.mat();
-        if(mTwi2.rows != 4 || mTwi2.cols != 4)
-        {
-            std::cerr << "*Twi2 matrix have to be a 4x4 transformation matrix*" << std::endl;
-            b_parse_iGPS = true;
-        }
-        else
-        {
-            vTwi.push_back(mTwi2);
-        }
-    }
-    else
-    {
-        std::cerr << "*Twi2 matrix doesn't exist*" << std::endl;
-        b_parse_iGPS = true;
-    }
-
-    cv::FileNode node3 = fSettings["Twi3"];
-    if(!node3.empty())
-    {
-        mTwi3 = node3.mat();
-        if(mTwi3.rows != 4 || mTwi3.cols != 4)
-        {
-            std::cerr << "*Twi3 matrix have to be a 4x4 transformation matrix*" << std::endl;
-            b_parse_iGPS = true;
-        }
-        else
-        {
-            vTwi.push_back(mTwi3);
-        }
-    }
-    else
-    {
-        std::cerr << "*Twi2 matrix doesn't exist*" << std::endl;
-        b_parse_iGPS = true;
-    }
+    if(!mTransmitters.Load(fSettings))
+        std::cerr << "*No iGPS transmitter poses in the settings file*" << std::endl;
+    cv::FileNode nodeReloc = fSettings["iGPS.RelocalizationRadius"];
+    mfiGPSRelocRadius = nodeReloc.empty() ? 2.f : (float)nodeReloc;
+    cv::FileNode nodeLoopGate = fSettings["iGPS.LoopGateRadius"];
+    mfiGPSLoopGateRadius = nodeLoopGate.empty() ? 0.f : (float)nodeLoopGate;
+    cv::FileNode nodeGBA = fSettings["iGPS.GBAMinNewDirections"];
+    mniGPSGBAMinNewDirections = nodeGBA.empty() ? 300 : (int)nodeGBA;
 
     GetiGSReceivesInCameraFrame();
-    mPnpWeight = 1e7;
+    cv::FileNode nodeDirTracking = fSettings["iGPS.DirectionTracking"];
+    mbiGPSDirTracking = !nodeDirTracking.empty() && (int)nodeDirTracking != 0;
+    cv::FileNode nodePnpWeight = fSettings["iGPS.TrackingWeight"];
+    mPnpWeight = nodePnpWeight.empty() ? 1e7 : (double)nodePnpWeight;
+    cv::FileNode nodeMinDir = fSettings["iGPS.TrackingMinDirections"];
+    mniGPSMinDirInliers = nodeMinDir.empty() ? 4 : (int)nodeMinDir;
+    mnFrameDirInliers = 0;
+    if(mbiGPSDirTracking)
+        cout << "iGPS direction tracking: weight " << mPnpWeight << ", " << mniGPSMinDirInliers << " directions" << endl;
 
     cout << endl;
 
@@ -1285,11 +1240,13 @@ bool Tracking::ParseIMUParamFile(cv::FileStorage &fSettings)
 void Tracking::SetLocalMapper(LocalMapping *pLocalMapper)
 {
     mpLocalMapper=pLocalMapper;
+    mpLocalMapper->SetiGPSGBATrigger(mniGPSGBAMinNewDirections);
 }
 
 void Tracking::SetLoopClosing(LoopClosing *pLoopClosing)
 {
     mpLoopClosing=pLoopClosing;
+    mpLoopClosing->SetiGPSLoopGate(mfiGPSLoopGateRadius);
 }
 
 void Tracking::SetViewer(Viewer *pViewer)
@@ -1454,6 +1411,25 @@ cv::Mat Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp,
 }
 
 
+void Tracking::GrabiGPSDirection(const iGPS::Direction &iGPSDirection)
+{
+    unique_lock<mutex> lock(mMutexiGPSQueue);
+    mbiGPSStreaming = true;
+
+    // Channels share timestamps, a late sample is inserted after the ones with the same time
+    if(mlQueueiGPSDirection.empty() || mlQueueiGPSDirection.back().time <= iGPSDirection.time)
+        mlQueueiGPSDirection.push_back(iGPSDirection);
+    else
+    {
+        auto it = upper_bound(mlQueueiGPSDirection.begin(), mlQueueiGPSDirection.end(), iGPSDirection.time,
+                              [](const double t, const iGPS::Direction &d){ return t < d.time; });
+        mlQueueiGPSDirection.insert(it, iGPSDirection);
+    }
+
+    if(mlQueueiGPSDirection.size() > mnMaxiGPSQueue)
+        mlQueueiGPSDirection.pop_front();
+}
+
 void Tracking::GrabImuData(const IMU::Point &imuMeasurement)
 {
     unique_lock<mutex> lock(mMutexImuQueue);
@@ -2366,14 +2342,10 @@ void Tracking::StereoInitialization()
         cout << "Tcw = " << Tcw <<endl;
         if(!Tcw.empty())
         {
-            for(auto i = 0; i < vTwi.size(); i++ )
-            {
-                cv::Mat Tci;
-                Tci = Tcw * vTwi[i];
-                cout << "Tci " << i << " = " << Tci <<endl;
-                vTci.push_back(Tci);
-            }
-            mpLocalMapper->GetiGPStoCamTci(vTci);
+            mTransmitters.SetCameraPose(Tcw);
+            for(size_t i = 0; i < mTransmitters.size(); i++ )
+                cout << "Tci " << i << " = " << endl << mTransmitters[i].Tci;
+            mpLocalMapper->SetiGPSTransmitters(mTransmitters);
         }
         else
         {
@@ -2618,15 +2590,11 @@ void Tracking::CreateInitialMapMonocular()
 
     if(!Tcw.empty())
     {
-        for(auto i = 0; i < vTwi.size(); i++ )
-        {
-            cv::Mat Tci;
-            Tci = Tcw * vTwi[i];
-            cout << "Tci = " << Tci <<endl;
-            vTci.push_back(Tci);
-        }
+        mTransmitters.SetCameraPose(Tcw);
+        for(size_t i = 0; i < mTransmitters.size(); i++ )
+            cout << "Tci = " << endl << mTransmitters[i].Tci;
 
-        mpLocalMapper->GetiGPStoCamTci(vTci);
+        mpLocalMapper->SetiGPSTransmitters(mTransmitters);
     }
     else
     {
@@ -2642,6 +2610,7 @@ void Tracking::CreateMapInAtlas()
     mpAtlas->CreateNewMap();
     if (mSensor==System::IMU_STEREO || mSensor == System::IMU_MONOCULAR)
         mpAtlas->SetInertialSensor();
+    ResetTransmitterPoses();
     mbSetInit=false;
 
     mnInitialFrameId = mCurrentFrame.mnId+1;
@@ -2709,21 +2678,23 @@ bool Tracking::TrackReferenceKeyFrame()
 
     int nmatches = matcher.SearchByBoW(mpReferenceKF,mCurrentFrame,vpMapPointMatches);
 
-    if(nmatches<15)
+    // Fewer matches are enough only if the directions agree with a pose, not just because the frame has them
+    mCurrentFrame.SetPose(mLastFrame.mTcw);
+    const bool bDirPrior = RefinePoseWithDirections();
+
+    if(nmatches<MatchesNeeded(15,bDirPrior))
     {
         cout << "TRACK_REF_KF: Less than 15 matches!!\n";
         return false;
     }
 
     mCurrentFrame.mvpMapPoints = vpMapPointMatches;
-    mCurrentFrame.SetPose(mLastFrame.mTcw);
 
     //mCurrentFrame.PrintPointDistribution();
 
 
     // cout << " TrackReferenceKeyFrame mLastFrame.mTcw:  " << mLastFrame.mTcw << endl;
-    Optimizer::PoseOptimization(&mCurrentFrame);
-    //Optimizer::iGPSDirectionPoseOptimization(&mCurrentFrame,vTci,mPnpWeight);
+    OptimizeFramePose();
 
     // Discard outliers
     int nmatchesMap = 0;
@@ -2756,7 +2727,7 @@ bool Tracking::TrackReferenceKeyFrame()
     if (mSensor == System::IMU_MONOCULAR || mSensor == System::IMU_STEREO)
         return true;
     else
-        return nmatchesMap>=10;
+        return nmatchesMap>=MatchesNeeded(10,mnFrameDirInliers>=mniGPSMinDirInliers);
 }
 
 void Tracking::UpdateLastFrame()
@@ -2847,6 +2818,8 @@ bool Tracking::TrackWithMotionModel()
         mCurrentFrame.SetPose(mVelocity*mLastFrame.mTcw);
     }
 
+    // With the predicted pose on the iGPS directions the points land closer to their match
+    const bool bDirPrior = RefinePoseWithDirections();
 
     fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
 
@@ -2857,6 +2830,8 @@ bool Tracking::TrackWithMotionModel()
         th=7;
     else
         th=15;
+    if(bDirPrior)
+        th=(th+1)/2;
 
     int nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,th,mSensor==System::MONOCULAR || mSensor==System::IMU_MONOCULAR);
 
@@ -2871,7 +2846,7 @@ bool Tracking::TrackWithMotionModel()
 
     }
 
-    if(nmatches<20)
+    if(nmatches<MatchesNeeded(20,bDirPrior))
     {
         Verbose::PrintMess("Not enough matches!!", Verbose::VERBOSITY_NORMAL);
         if (mSensor == System::IMU_MONOCULAR || mSensor == System::IMU_STEREO)
@@ -2881,8 +2856,7 @@ bool Tracking::TrackWithMotionModel()
     }
 
     // Optimize frame pose with all matches
-    Optimizer::PoseOptimization(&mCurrentFrame);
-    //Optimizer::iGPSDirectionPoseOptimization(&mCurrentFrame,vTci,mPnpWeight);
+    OptimizeFramePose();
 
     // Discard outliers
     int nmatchesMap = 0;
@@ -2910,16 +2884,17 @@ bool Tracking::TrackWithMotionModel()
         }
     }
 
+    const bool biGPS = mnFrameDirInliers>=mniGPSMinDirInliers;
     if(mbOnlyTracking)
     {
         mbVO = nmatchesMap<10;
-        return nmatches>20;
+        return nmatches>MatchesNeeded(20,biGPS);
     }
 
     if (mSensor == System::IMU_MONOCULAR || mSensor == System::IMU_STEREO)
         return true;
     else
-        return nmatchesMap>=10;
+        return nmatchesMap>=MatchesNeeded(10,biGPS);
 }
 
 bool Tracking::TrackLocalMap()
@@ -2959,18 +2934,17 @@ bool Tracking::TrackLocalMap()
         }
 
     int inliers;
+    mnFrameDirInliers = 0;
     if (!mpAtlas->isImuInitialized())
     {
-        Optimizer::PoseOptimization(&mCurrentFrame);
-        //Optimizer::iGPSDirectionPoseOptimization(&mCurrentFrame,vTci,mPnpWeight);
+        OptimizeFramePose();
     }
     else
     {
         if(mCurrentFrame.mnId<=mnLastRelocFrameId+mnFramesToResetIMU)
         {
             Verbose::PrintMess("TLM: PoseOptimization ", Verbose::VERBOSITY_DEBUG);
-            Optimizer::PoseOptimization(&mCurrentFrame);
-            //Optimizer::iGPSDirectionPoseOptimization(&mCurrentFrame,vTci,mPnpWeight);
+            OptimizeFramePose();
         }
         else
         {
@@ -3031,10 +3005,11 @@ bool Tracking::TrackLocalMap()
     // Decide if the tracking was succesful
     // More restrictive if there was a relocalization recently
     mpLocalMapper->mnMatchesInliers=mnMatchesInliers;
-    if(mCurrentFrame.mnId<mnLastRelocFrameId+mMaxFrames && mnMatchesInliers<50)
+    const bool biGPS = mnFrameDirInliers>=mniGPSMinDirInliers;
+    if(mCurrentFrame.mnId<mnLastRelocFrameId+mMaxFrames && mnMatchesInliers<MatchesNeeded(50,biGPS))
         return false;
 
-    if((mnMatchesInliers>10)&&(mState==RECENTLY_LOST))
+    if((mnMatchesInliers>MatchesNeeded(10,biGPS))&&(mState==RECENTLY_LOST))
         return true;
 
 
@@ -3058,7 +3033,7 @@ bool Tracking::TrackLocalMap()
     }
     else
     {
-        if(mnMatchesInliers<30)
+        if(mnMatchesInliers<MatchesNeeded(30,biGPS))
             return false;
         else
             return true;
@@ -3217,6 +3192,18 @@ void Tracking::CreateNewKeyFrame()
     if(mpAtlas->isImuInitialized())
         pKF->bImu = true;
 
+    // Global position for the spatial gate of place recognition
+    {
+        Eigen::Vector3d Ow;
+        cv::Mat Tcw;
+        float fUncertainty;
+        if(PredictiGPSPose(mCurrentFrame,Ow,Tcw,fUncertainty))
+        {
+            pKF->miGPSPosition = mTransmitters.ToiGPSWorld(Ow);
+            pKF->mfiGPSPositionUncertainty = fUncertainty;
+        }
+    }
+
     pKF->SetNewBias(mCurrentFrame.mImuBias);
     mpReferenceKF = pKF;
     mCurrentFrame.mpReferenceKF = pKF;
@@ -3605,15 +3592,71 @@ bool Tracking::Relocalization()
     // Compute Bag of Words Vector
     mCurrentFrame.ComputeBoW();
 
+    Map* pCurrentMap = mpAtlas->GetCurrentMap();
+
+    // With an iGPS prior only the keyframes around the predicted position are scored
+    cv::Mat TcwPrior;
+    Eigen::Vector3d Ow;
+    float fUncertainty;
+    bool bMatch = false;
+    vector<KeyFrame*> vpGatedKFs;
+    if(mfiGPSRelocRadius > 0 && MapHasMetricScale() && PredictiGPSPose(mCurrentFrame, Ow, TcwPrior, fUncertainty))
+    {
+        const float radius = mfiGPSRelocRadius + fUncertainty;
+        const vector<KeyFrame*> vpNearKFs = pCurrentMap->GetKeyFramesInRadius(Ow, radius);
+        vpGatedKFs = mpKeyFrameDB->DetectRelocalizationCandidates(&mCurrentFrame, pCurrentMap, vpNearKFs);
+        Verbose::PrintMess("iGPS prior: " + to_string(vpNearKFs.size()) + " keyframes in " + to_string(radius) + " m, " +
+                           to_string(vpGatedKFs.size()) + " candidates", Verbose::VERBOSITY_NORMAL);
+        if(!vpGatedKFs.empty())
+        {
+            bMatch = RelocalizeFromCandidates(vpGatedKFs, TcwPrior);
+            if(!bMatch)
+                Verbose::PrintMess("No pose from the iGPS-gated candidates, searching the whole map", Verbose::VERBOSITY_NORMAL);
+        }
+    }
+
     // Relocalization is performed when tracking is lost
-    // Track Lost: Query KeyFrame Database for keyframe candidates for relocalisation
-    vector<KeyFrame*> vpCandidateKFs = mpKeyFrameDB->DetectRelocalizationCandidates(&mCurrentFrame, mpAtlas->GetCurrentMap());
+    // Track Lost: Query KeyFrame Database for keyframe candidates for relocalisation.
+    // A stale transmitter pose or a wrong prior must not keep the rest of the map out of reach.
+    if(!bMatch)
+    {
+        vector<KeyFrame*> vpCandidateKFs = mpKeyFrameDB->DetectRelocalizationCandidates(&mCurrentFrame, pCurrentMap);
+
+        // The gated candidates have already failed
+        if(!vpGatedKFs.empty())
+        {
+            const set<KeyFrame*> spGatedKFs(vpGatedKFs.begin(), vpGatedKFs.end());
+            vector<KeyFrame*> vpUntried;
+            vpUntried.reserve(vpCandidateKFs.size());
+            for(size_t i=0; i<vpCandidateKFs.size(); i++)
+                if(!spGatedKFs.count(vpCandidateKFs[i]))
+                    vpUntried.push_back(vpCandidateKFs[i]);
+            vpCandidateKFs.swap(vpUntried);
+        }
+
+        if(vpCandidateKFs.empty()) {
+            Verbose::PrintMess("There are not candidates", Verbose::VERBOSITY_NORMAL);
+            return false;
+        }
 
-    if(vpCandidateKFs.empty()) {
-        Verbose::PrintMess("There are not candidates", Verbose::VERBOSITY_NORMAL);
+        bMatch = RelocalizeFromCandidates(vpCandidateKFs, cv::Mat());
+    }
+
+    if(!bMatch)
+    {
         return false;
     }
+    else
+    {
+        mnLastRelocFrameId = mCurrentFrame.mnId;
+        cout << "Relocalized!!" << endl;
+        return true;
+    }
+
+}
 
+bool Tracking::RelocalizeFromCandidates(const vector<KeyFrame*> &vpCandidateKFs, const cv::Mat &TcwPrior)
+{
     const int nKFs = vpCandidateKFs.size();
 
     // We perform first an ORB matching with each candidate
@@ -3654,11 +3697,44 @@ bool Tracking::Relocalization()
         }
     }
 
-    // Alternatively perform some iterations of P4P RANSAC
-    // Until we found a camera pose supported by enough inliers
     bool bMatch = false;
     ORBmatcher matcher2(0.9,true);
 
+    // A full iGPS pose seeds the pose optimization of the BoW matches, RANSAC is only needed if it fails
+    if(!TcwPrior.empty())
+    {
+        for(int i=0; i<nKFs && !bMatch; i++)
+        {
+            if(vbDiscarded[i])
+                continue;
+
+            mCurrentFrame.SetPose(TcwPrior);
+            mCurrentFrame.mvpMapPoints = vvpMapPointMatches[i];
+
+            int nGood = Optimizer::PoseOptimization(&mCurrentFrame);
+            if(nGood<10)
+                continue;
+
+            set<MapPoint*> sFound;
+            for(int io =0; io<mCurrentFrame.N; io++)
+            {
+                if(mCurrentFrame.mvbOutlier[io])
+                    mCurrentFrame.mvpMapPoints[io]=static_cast<MapPoint*>(NULL);
+                else if(mCurrentFrame.mvpMapPoints[io])
+                    sFound.insert(mCurrentFrame.mvpMapPoints[io]);
+            }
+
+            nGood = RefineRelocalizationPose(vpCandidateKFs[i],sFound,nGood,matcher2);
+            if(nGood>=50)
+                bMatch = true;
+        }
+        if(bMatch)
+            Verbose::PrintMess("Relocalized from the iGPS prior", Verbose::VERBOSITY_NORMAL);
+    }
+
+    // Alternatively perform some iterations of P4P RANSAC
+    // Until we found a camera pose supported by enough inliers
+
     while(nCandidates>0 && !bMatch)
     {
         for(int i=0; i<nKFs; i++)
@@ -3702,7 +3778,7 @@ bool Tracking::Relocalization()
                 }
 
                 int nGood = Optimizer::PoseOptimization(&mCurrentFrame);
-                //int nGood = Optimizer::iGPSDirectionPoseOptimization(&mCurrentFrame,vTci,mPnpWeight);
+                //int nGood = Optimizer::iGPSDirectionPoseOptimization(&mCurrentFrame,mTransmitters,mPnpWeight);
 
                 if(nGood<10)
                     continue;
@@ -3711,39 +3787,7 @@ bool Tracking::Relocalization()
                     if(mCurrentFrame.mvbOutlier[io])
                         mCurrentFrame.mvpMapPoints[io]=static_cast<MapPoint*>(NULL);
 
-                // If few inliers, search by projection in a coarse window and optimize again
-                if(nGood<50)
-                {
-                    int nadditional =matcher2.SearchByProjection(mCurrentFrame,vpCandidateKFs[i],sFound,10,100);
-
-                    if(nadditional+nGood>=50)
-                    {
-                        nGood = Optimizer::PoseOptimization(&mCurrentFrame);
-                        //nGood = Optimizer::iGPSDirectionPoseOptimization(&mCurrentFrame,vTci,mPnpWeight);
-
-                        // If many inliers but still not enough, search by projection again in a narrower window
-                        // the camera has been already optimized with many points
-                        if(nGood>30 && nGood<50)
-                        {
-                            sFound.clear();
-                            for(int ip =0; ip<mCurrentFrame.N; ip++)
-                                if(mCurrentFrame.mvpMapPoints[ip])
-                                    sFound.insert(mCurrentFrame.mvpMapPoints[ip]);
-                            nadditional =matcher2.SearchByProjection(mCurrentFrame,vpCandidateKFs[i],sFound,3,64);
-
-                            // Final optimization
-                            if(nGood+nadditional>=50)
-                            {
-                                nGood = Optimizer::PoseOptimization(&mCurrentFrame);
-                                //nGood = Optimizer::iGPSDirectionPoseOptimization(&mCurrentFrame,vTci,mPnpWeight);
-
-                                for(int io =0; io<mCurrentFrame.N; io++)
-                                    if(mCurrentFrame.mvbOutlier[io])
-                                        mCurrentFrame.mvpMapPoints[io]=NULL;
-                            }
-                        }
-                    }
-                }
+                nGood = RefineRelocalizationPose(vpCandidateKFs[i],sFound,nGood,matcher2);
 
 
                 // If the pose is supported by enough inliers stop ransacs and continue
@@ -3756,17 +3800,119 @@ bool Tracking::Relocalization()
         }
     }
 
-    if(!bMatch)
+    for(int i=0; i<nKFs; i++)
+        delete vpMLPnPsolvers[i];
+
+    return bMatch;
+}
+
+int Tracking::RefineRelocalizationPose(KeyFrame* pKF, set<MapPoint*> &sFound, int nGood, ORBmatcher &matcher)
+{
+    // If few inliers, search by projection in a coarse window and optimize again
+    if(nGood<50)
     {
-        return false;
+        int nadditional =matcher.SearchByProjection(mCurrentFrame,pKF,sFound,10,100);
+
+        if(nadditional+nGood>=50)
+        {
+            nGood = Optimizer::PoseOptimization(&mCurrentFrame);
+            //nGood = Optimizer::iGPSDirectionPoseOptimization(&mCurrentFrame,mTransmitters,mPnpWeight);
+
+            // If many inliers but still not enough, search by projection again in a narrower window
+            // the camera has been already optimized with many points
+            if(nGood>30 && nGood<50)
+            {
+                sFound.clear();
+                for(int ip =0; ip<mCurrentFrame.N; ip++)
+                    if(mCurrentFrame.mvpMapPoints[ip])
+                        sFound.insert(mCurrentFrame.mvpMapPoints[ip]);
+                nadditional =matcher.SearchByProjection(mCurrentFrame,pKF,sFound,3,64);
+
+                // Final optimization
+                if(nGood+nadditional>=50)
+                {
+                    nGood = Optimizer::PoseOptimization(&mCurrentFrame);
+                    //nGood = Optimizer::iGPSDirectionPoseOptimization(&mCurrentFrame,mTransmitters,mPnpWeight);
+
+                    for(int io =0; io<mCurrentFrame.N; io++)
+                        if(mCurrentFrame.mvbOutlier[io])
+                            mCurrentFrame.mvpMapPoints[io]=NULL;
+                }
+            }
+        }
     }
-    else
+    return nGood;
+}
+
+bool Tracking::PredictiGPSPose(Frame &F, Eigen::Vector3d &Ow, cv::Mat &Tcw, float &fUncertainty)
+{
+    Tcw.release();
+    if(F.miGPSDirection.empty() || !F.mpiGPSReceive || !mTransmitters.isInitialized())
+        return false;
+
+    double uncertainty;
+    Eigen::Matrix4d Twc;
+    bool bPose;
+    if(!mTransmitters.LocateCamera(F.miGPSChannel,F.miGPSTransmitter,F.miGPSDirection,*F.mpiGPSReceive,Ow,uncertainty,Twc,bPose))
+        return false;
+
+    if(bPose)
+        Tcw = Converter::toCvMat(Eigen::Matrix4d(Twc.inverse()));
+    fUncertainty = uncertainty;
+    return true;
+}
+
+bool Tracking::MapHasMetricScale() const
+{
+    if(mSensor == System::MONOCULAR)
+        return false;
+    if(mSensor == System::IMU_MONOCULAR)
+        return mpAtlas->isImuInitialized();
+    return true;
+}
+
+void Tracking::ResetTransmitterPoses()
+{
+    mTransmitters.ResetTci();
+    mpLocalMapper->SetiGPSTransmitters(mTransmitters);
+}
+
+int Tracking::OptimizeFramePose()
+{
+    mnFrameDirInliers = 0;
+    if(!FrameHasDirections())
+        return Optimizer::PoseOptimization(&mCurrentFrame);
+
+    const int nGood = Optimizer::iGPSDirectionPoseOptimization(&mCurrentFrame,mTransmitters,mPnpWeight,&mnFrameDirInliers);
+    LOG_DEBUG("iGPS pose optimization: " << nGood << " matches, " << mnFrameDirInliers << "/" << mCurrentFrame.miGPSDirection.size() << " directions");
+    return nGood;
+}
+
+bool Tracking::RefinePoseWithDirections()
+{
+    if(!FrameHasDirections())
+        return false;
+
+    const cv::Mat Tcw = mCurrentFrame.mTcw.clone();
+    int nDirInliers = 0;
+    Optimizer::iGPSDirectionPoseOptimization(&mCurrentFrame,mTransmitters,mPnpWeight,&nDirInliers,true);
+    if(nDirInliers<mniGPSMinDirInliers)
     {
-        mnLastRelocFrameId = mCurrentFrame.mnId;
-        cout << "Relocalized!!" << endl;
-        return true;
+        mCurrentFrame.SetPose(Tcw);
+        return false;
     }
+    return true;
+}
+
+bool Tracking::FrameHasDirections() const
+{
+    return mbiGPSDirTracking && MapHasMetricScale() && mCurrentFrame.mpiGPSReceive &&
+           (int)mCurrentFrame.miGPSDirection.size()>=mniGPSMinDirInliers;
+}
 
+int Tracking::MatchesNeeded(const int n, const bool biGPS) const
+{
+    return biGPS ? n/2 : n;
 }
 
 void Tracking::Reset(bool bLocMap)
@@ -3805,6 +3951,7 @@ void Tracking::Reset(bool bLocMap)
     if (mSensor==System::IMU_STEREO || mSensor == System::IMU_MONOCULAR)
         mpAtlas->SetInertialSensor();
     mnInitialFrameId = 0;
+    ResetTransmitterPoses();
 
     KeyFrame::nNextId = 0;
     Frame::nNextId = 0;
@@ -3865,6 +4012,7 @@ void Tracking::ResetActiveMap(bool bLocMap)
 
     // Clear Map (this erase MapPoints and KeyFrames)
     mpAtlas->clearMap();
+    ResetTransmitterPoses();
 
     mnLastInitFrameId = Frame::nNextId;
     mnLastRelocFrameId = mnLastInitFrameId;
@@ -4303,32 +4451,54 @@ void Tracking::CreateNewMapPoints()
     TrackReferenceKeyFrame();
 }
 
-void Tracking::LoadiGPSDirection(vector<double> vTimestamps, ORB_SLAM3::iGPS::Direction *iGPSDirection)
+void Tracking::LoadiGPSDirection(const vector<double> &vTimestamps, ORB_SLAM3::iGPS::Direction *iGPSDirection)
 {
     mviGPSTimestamps = vTimestamps;
     miGPSAllDirection = iGPSDirection;
+    mpiGPSLog = NULL;
+    mTimeIndexiGPS.assign(mviGPSTimestamps, 1e3);
     return;
 }
 
+void Tracking::LoadiGPSDirection(const iGPS::LogReader* piGPSLog)
+{
+    mviGPSTimestamps.clear();
+    miGPSAllDirection = NULL;
+    mpiGPSLog = piGPSLog;
+    mTimeIndexiGPS.assign(mpiGPSLog->times(), mpiGPSLog->size(), 1e3);
+    return;
+}
+
+iGPS::Direction Tracking::GetiGPSDirection(const size_t m)
+{
+    if(mpiGPSLog)
+        return mpiGPSLog->direction(m);
+    return miGPSAllDirection[m];
+}
+
 void Tracking::LoadCameraPose(vector<double> &vTimeStamps,vector<Eigen::VectorXf> &vCameraPose)
 {
     mvCamTimestamps = vTimeStamps;
     mvCamPose = vCameraPose;
+    mTimeIndexCam.assign(mvCamTimestamps, 1e3);
     return;
 }
 
 
 void Tracking::GetInitialCamPoseTcw(const double mTimeStamp, cv::Mat &Tcw)
 {
-    cout << "Start GetInitialCamPoseTcw " <<endl;
+    LOG_VERBOSE("Start GetInitialCamPoseTcw");
     //double t_frame = mTimeStamp;
     double t_frame = mTimeStamp*1e6;
 
     //cout<< "GetInitialCamPoseTcw t_frame = " << t_frame <<endl;
-    for(int m = 0 ; m < mvCamTimestamps.size()-1 ; m ++ )
+    // Only poses within 10ms of the frame can match, start at the first of them
+    for(size_t m = mTimeIndexCam.seek(t_frame - 0.005) ; m + 1 < mTimeIndexCam.size() ; m ++ )
     {
-        double t_iGPS      = mvCamTimestamps[m]  /1e3;
-        double t_iGPS_next = mvCamTimestamps[m+1]/1e3;
+        double t_iGPS      = mTimeIndexCam[m];
+        double t_iGPS_next = mTimeIndexCam[m+1];
+        if(t_iGPS - t_frame > 0.005)
+            break;
         //double t_iGPS      = mvCamTimestamps[m]  /1e9;
         //double t_iGPS_next = mvCamTimestamps[m+1]/1e9;
         //cout<< "t_iGPS = "   << t_iGPS <<endl;
@@ -4336,7 +4506,7 @@ void Tracking::GetInitialCamPoseTcw(const double mTimeStamp, cv::Mat &Tcw)
 
         if(t_frame >= t_iGPS -0.005 && t_frame <= t_iGPS +0.005)  //10ms
         {
-            cout<< "Same Time t_frame t_iGPS = " << t_frame << " "<<t_iGPS << endl;
+            LOG_DEBUG("Same Time t_frame t_iGPS = " << t_frame << " " << t_iGPS);
             Eigen::VectorXf CamPose(7);
             CamPose = mvCamPose[m];
             //Eigen::Quaterniond q(CamPose[3],CamPose[4],CamPose[5],CamPose[6]);
@@ -4402,6 +4572,7 @@ int Tracking::GetiGSReceivesInCameraFrame()
     fTimes.open(strSettingsFile);
     if(!fTimes)
         return 2;
+    iGPS::ReceiverTable* pReceivers = new iGPS::ReceiverTable();
     while(!fTimes.eof()) {
         string s;
         getline(fTimes, s);
@@ -4416,15 +4587,17 @@ int Tracking::GetiGSReceivesInCameraFrame()
             double index, x, y, z;  // Frame
             int ch;
             ss >> index; ss>> x; ss >> y;  ss>>z;
-            miGPSReceive.insert(make_pair<int,Eigen::Vector3d>(index,Eigen::Vector3d(x,y,z)));
+            pReceivers->insert((int)index,Eigen::Vector3d(x,y,z));
         }
     }
-    cout << "Get " << miGPSReceive.size() << " Receiver Position in Camera Frame" <<endl;
+    mpiGPSReceive.reset(pReceivers);
+    cout << "Get " << mpiGPSReceive->size() << " Receiver Position in Camera Frame" <<endl;
     cout << " -------------- " << endl;
 
     cout << "miGPSReceive = " << endl;
-    for(auto i : miGPSReceive)
-        cout << "     " << i.first << " " << i.second.transpose() << endl;
+    for(int ch = 0; ch < (int)mpiGPSReceive->capacity(); ch++)
+        if(mpiGPSReceive->has(ch))
+            cout << "     " << ch << " " << (*mpiGPSReceive)[ch].transpose() << endl;
     cout << " -------------- " << endl;
 
     cout << "end read Pic" << endl;
@@ -4439,22 +4612,59 @@ void Tracking::GetiGPSDirectionMeasurement()
 
     //cout<< "t_frame = " << t_frame <<endl;
 
-    for(int m = 0 ; m < mviGPSTimestamps.size() ; m ++ )
+    // Samples older than the 40ms interpolation gap or newer than the 2ms match window cannot be used,
+    // so only the samples around the frame (and the one after, for interpolation) are collected
+    vector<iGPS::Direction> vDirections;
+    vector<double> vTimes;
+    bool bStreaming;
+    {
+        unique_lock<mutex> lock(mMutexiGPSQueue);
+        bStreaming = mbiGPSStreaming;
+        if(bStreaming)
+        {
+            // Too old for this frame means too old for every later frame
+            while(!mlQueueiGPSDirection.empty() && mlQueueiGPSDirection.front().time/1e3 < t_frame - 0.040)
+                mlQueueiGPSDirection.pop_front();
+
+            for(size_t m = 0 ; m < mlQueueiGPSDirection.size() ; m ++ )
+            {
+                vDirections.push_back(mlQueueiGPSDirection[m]);
+                vTimes.push_back(mlQueueiGPSDirection[m].time/1e3);
+                if(vTimes.back() - t_frame > 0.002)
+                    break;
+            }
+        }
+    }
+    if(!bStreaming)
+    {
+        for(size_t m = mTimeIndexiGPS.seek(t_frame - 0.040) ; m < mTimeIndexiGPS.size() ; m ++ )
+        {
+            vDirections.push_back(GetiGPSDirection(m));
+            vTimes.push_back(mTimeIndexiGPS[m]);
+            if(vTimes.back() - t_frame > 0.002)
+                break;
+        }
+    }
+
+    for(size_t m = 0 ; m < vDirections.size() ; m ++ )
     {
         //double t_iGPS = mviGPSTimestamps[m] /1e9;
         //double t_iGPS_next = mviGPSTimestamps[m+1] /1e9;
-        double t_iGPS = mviGPSTimestamps[m] /1e3;
-        double t_iGPS_next = mviGPSTimestamps[m+1] /1e3;
+        double t_iGPS = vTimes[m];
+        if(t_iGPS - t_frame > 0.002)
+            break;
+        double t_iGPS_next = m + 1 < vTimes.size() ? vTimes[m+1] : t_iGPS;
         //cout<< "t_iGPS = " << t_iGPS <<endl;
         //cout<< "t_iGPS_next = " << t_iGPS_next <<endl;
 
         if( abs(t_frame - t_iGPS) <= 0.002 )
         {
-            mCurrentFrame.miGPSChannel.push_back(miGPSAllDirection[m].channel);
-            mCurrentFrame.miGPSTransmitter.push_back(miGPSAllDirection[m].transmitter);
-            mCurrentFrame.miGPStime.push_back(miGPSAllDirection[m].time);
-            mCurrentFrame.miGPSDirection.push_back(miGPSAllDirection[m].dir);
-            cout << "Same t_frame,t_iGPS, t_iGPS_next= " << t_frame << " " << t_iGPS <<endl;
+            const iGPS::Direction &iGPSDir = vDirections[m];
+            mCurrentFrame.miGPSChannel.push_back(iGPSDir.channel);
+            mCurrentFrame.miGPSTransmitter.push_back(iGPSDir.transmitter);
+            mCurrentFrame.miGPStime.push_back(iGPSDir.time);
+            mCurrentFrame.miGPSDirection.push_back(iGPSDir.dir);
+            LOG_DEBUG("Same t_frame,t_iGPS = " << t_frame << " " << t_iGPS);
             //cout << "miGPSAllDirection[m].dir = " << miGPSAllDirection[m].dir.transpose() <<endl;
 
             //mCurrentFrame.mmiGPSChDir.insert(pair<int, Eigen::Vector3d>(miGPSAllDirection[m].channel,miGPSAllDirection[m].dir));
@@ -4470,12 +4680,14 @@ void Tracking::GetiGPSDirectionMeasurement()
             double t2 = t_iGPS_next - t_frame;
             double w1 = t2 / ( t1 + t2 );
             double w2 = t1 / ( t1 + t2 );
-            double x =  w1 * miGPSAllDirection[m].dir.x()      + w2 * miGPSAllDirection[m+1].dir.x();
-            double y =  w1 * miGPSAllDirection[m].dir.y()      + w2 * miGPSAllDirection[m+1].dir.y();
-            double z =  w1 * miGPSAllDirection[m].dir.z()      + w2 * miGPSAllDirection[m+1].dir.z();
-            mCurrentFrame.miGPSChannel.push_back(miGPSAllDirection[m].channel);
-            mCurrentFrame.miGPSTransmitter.push_back(miGPSAllDirection[m].transmitter);
-            mCurrentFrame.miGPStime.push_back(miGPSAllDirection[m].time);
+            const iGPS::Direction &iGPSDir = vDirections[m];
+            const iGPS::Direction &iGPSDirNext = vDirections[m+1];
+            double x =  w1 * iGPSDir.dir.x()      + w2 * iGPSDirNext.dir.x();
+            double y =  w1 * iGPSDir.dir.y()      + w2 * iGPSDirNext.dir.y();
+            double z =  w1 * iGPSDir.dir.z()      + w2 * iGPSDirNext.dir.z();
+            mCurrentFrame.miGPSChannel.push_back(iGPSDir.channel);
+            mCurrentFrame.miGPSTransmitter.push_back(iGPSDir.transmitter);
+            mCurrentFrame.miGPStime.push_back(iGPSDir.time);
             mCurrentFrame.miGPSDirection.push_back(Eigen::Vector3d(x,y,z));
             //cout << "t_frame,t_iGPS, t_iGPS_next= " << t_frame << " " << t_iGPS << " " << t_iGPS_next <<endl;
             //cout << "t1,t2 = " << t1 << " " << t2 <<endl;
@@ -4491,7 +4703,7 @@ void Tracking::GetiGPSDirectionMeasurement()
             //break;
         }
     }
-    mCurrentFrame.miGPSReceive = miGPSReceive;
+    mCurrentFrame.mpiGPSReceive = mpiGPSReceive;
 
     return;
 }
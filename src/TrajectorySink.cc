@@ -0,0 +1,152 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+#include "TrajectorySink.h"
+
+#include <cstdio>
+#include <iostream>
+
+namespace ORB_SLAM3
+{
+
+TrajectorySink::TrajectorySink(const std::string &filename, const char separator, const double timeScale,
+                               const eFormat format, const bool bAppend, const size_t capacity):
+    mFilename(filename), mSeparator(separator), mTimeScale(timeScale), mFormat(format),
+    mnHead(0), mnTail(0), mnDropped(0), mptWriter(NULL)
+{
+    size_t n = 1;
+    while(n < capacity)
+        n <<= 1;
+    mvRing.resize(n);
+    mnMask = n-1;
+
+    std::ios_base::openmode mode = std::ios::out;
+    mode |= bAppend ? std::ios::app : std::ios::trunc;
+    if(mFormat == BINARY)
+        mode |= std::ios::binary;
+    mFile.open(mFilename.c_str(), mode);
+    if(!mFile.is_open())
+        std::cerr << "TrajectorySink: could not open " << mFilename << std::endl;
+
+    mptWriter = new std::thread(&TrajectorySink::Run, this);
+}
+
+TrajectorySink::~TrajectorySink()
+{
+    Close();
+}
+
+bool TrajectorySink::Push(const iGPS::Pose &pose, const bool bWait)
+{
+    const size_t tail = mnTail.load(std::memory_order_relaxed);
+    while(tail - mnHead.load(std::memory_order_acquire) >= mvRing.size())
+    {
+        mWakeEvent.Notify();
+        if(!bWait || !mptWriter)
+        {
+            mnDropped++;
+            return false;
+        }
+        mDrainedEvent.Wait(1000);
+    }
+
+    mvRing[tail & mnMask] = pose;
+    mnTail.store(tail+1, std::memory_order_release);
+    mWakeEvent.Notify();
+    return true;
+}
+
+void TrajectorySink::Flush()
+{
+    mWakeEvent.Notify();
+    while(mptWriter && mnHead.load(std::memory_order_acquire) != mnTail.load(std::memory_order_relaxed))
+        mDrainedEvent.Wait(1000);
+}
+
+void TrajectorySink::Close()
+{
+    if(mptWriter)
+    {
+        mWakeEvent.Shutdown();
+        mptWriter->join();
+        delete mptWriter;
+        mptWriter = NULL;
+    }
+    if(mFile.is_open())
+        mFile.close();
+}
+
+bool TrajectorySink::isOpen()
+{
+    return mFile.is_open();
+}
+
+size_t TrajectorySink::GetDropped()
+{
+    return mnDropped;
+}
+
+void TrajectorySink::Run()
+{
+    while(1)
+    {
+        WriteBatch();
+        mDrainedEvent.Notify();
+
+        if(mWakeEvent.isShutdown())
+        {
+            // Poses pushed before Close()
+            WriteBatch();
+            mDrainedEvent.Notify();
+            break;
+        }
+        mWakeEvent.Wait(100000);
+    }
+}
+
+// Format everything queued so far into one buffer and write it with a single call.
+// The slots are handed back to the producer only after the write, so Flush() returns once the poses are on disk.
+size_t TrajectorySink::WriteBatch()
+{
+    const size_t head = mnHead.load(std::memory_order_relaxed);
+    const size_t tail = mnTail.load(std::memory_order_acquire);
+    if(head == tail)
+        return 0;
+
+    std::string buffer;
+    buffer.reserve((tail-head) * (mFormat == BINARY ? 8*sizeof(double) : 128));
+    char line[256];
+    for(size_t i = head; i != tail; i++)
+    {
+        const iGPS::Pose &pose = mvRing[i & mnMask];
+        if(mFormat == BINARY)
+        {
+            const double row[8] = {mTimeScale * pose.t, pose.p[0], pose.p[1], pose.p[2],
+                                   pose.q[1], pose.q[2], pose.q[3], pose.q[0]};
+            buffer.append(reinterpret_cast<const char*>(row), sizeof(row));
+        }
+        else
+        {
+            const char s = mSeparator;
+            int n = snprintf(line, sizeof(line), "%.6f%c%.9f%c%.9f%c%.9f%c%.9f%c%.9f%c%.9f%c%.9f\n",
+                             mTimeScale * pose.t, s, pose.p[0], s, pose.p[1], s, pose.p[2],
+                             s, pose.q[1], s, pose.q[2], s, pose.q[3], s, pose.q[0]);
+            if(n > 0)
+                buffer.append(line, std::min((size_t)n, sizeof(line)-1));
+        }
+    }
+
+    if(mFile.is_open())
+    {
+        mFile.write(buffer.data(), buffer.size());
+        mFile.flush();
+    }
+
+    mnHead.store(tail, std::memory_order_release);
+    return tail - head;
+}
+
+} //namespace ORB_SLAM3
@@ -0,0 +1,109 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+namespace ORB_SLAM3
+{
+
+WorkerPool::WorkerPool(const int nThreads): mbFinish(false)
+{
+    for(int i = 0; i < nThreads; i++)
+        mvThreads.push_back(std::thread(&WorkerPool::Run, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mbFinish = true;
+    }
+    mCondWork.notify_all();
+    for(size_t i = 0; i < mvThreads.size(); i++)
+        mvThreads[i].join();
+}
+
+WorkerPool& WorkerPool::Shared()
+{
+    // Never destroyed, tracking may still be running when static destructors are
+    static WorkerPool* pPool = new WorkerPool(std::max(1, (int)std::thread::hardware_concurrency()-1));
+    return *pPool;
+}
+
+bool WorkerPool::Claim(Job* &pJob, int &i)
+{
+    if(mqJobs.empty())
+        return false;
+
+    pJob = mqJobs.front();
+    i = pJob->next++;
+    // Every index handed out, nobody else needs to see the job
+    if(pJob->next == pJob->n)
+        mqJobs.pop_front();
+    return true;
+}
+
+void WorkerPool::ParallelFor(const int n, const std::function<void(int)> &f)
+{
+    if(n <= 0)
+        return;
+    if(n == 1 || mvThreads.empty())
+    {
+        for(int i = 0; i < n; i++)
+            f(i);
+        return;
+    }
+
+    Job job;
+    job.pf = &f;
+    job.n = n;
+    job.next = 0;
+    job.done = 0;
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mqJobs.push_back(&job);
+    mCondWork.notify_all();
+
+    // Work on our own job until all of it is claimed, then wait for the workers that took a piece
+    while(job.next < job.n)
+    {
+        const int i = job.next++;
+        if(job.next == job.n)
+            mqJobs.erase(std::find(mqJobs.begin(), mqJobs.end(), &job));
+        lock.unlock();
+        f(i);
+        lock.lock();
+        job.done++;
+    }
+    mCondDone.wait(lock, [&]{ return job.done == job.n; });
+}
+
+void WorkerPool::Run()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(true)
+    {
+        mCondWork.wait(lock, [&]{ return mbFinish || !mqJobs.empty(); });
+        if(mbFinish)
+            return;
+
+        Job* pJob;
+        int i;
+        while(Claim(pJob, i))
+        {
+            lock.unlock();
+            (*pJob->pf)(i);
+            lock.lock();
+            // The caller returns once done reaches n, pJob must not be used after this
+            if(++pJob->done == pJob->n)
+                mCondDone.notify_all();
+        }
+    }
+}
+
+} //namespace ORB_SLAM3
@@ -6,30 +6,58 @@
 
 
 #include "iGPSFusion.h"
+#include "Optimizer.h"
+#include "Logging.h"
 
 namespace ORB_SLAM3
 {
 
-iGPSFusion::iGPSFusion():mbScaleFlag(false),mScale(1.0),mLastScale(1.0),mbFinishRequested(false), mbFinished(true),
-                         mbStopped(false)
+iGPSFusion::iGPSFusion(const string &strResultFile):mVOPoses(4096,true),miGPSPositions(4096,true),mFusionPoses(4096,true),
+                         mnRejectedSamples(0),mnSolves(0),mdTotalSolveTime(0.0),mbScaleFlag(false),mScale(1.0),mLastScale(1.0),mbFinishRequested(false), mbFinished(true),
+                         mbStopped(false), mpLoopClosing(NULL)
 {
     mbfusionFlag = false;
+    mbProcessingiGPS = false;
     iGPS_T_VO = Eigen::Matrix4d::Identity();
+    mpResultSink = new TrajectorySink(strResultFile, ',', 1e9);
     std::cout<< "Run Monocular-iGPS thread"<<std::endl;
 }
 
+iGPSFusion::~iGPSFusion()
+{
+    delete mpResultSink;
+}
+
 void iGPSFusion::inputiGPS(double t, cv::Point3f p3D)
 {
-    iGPSPositionMap[t] = p3D;
+    {
+        unique_lock<mutex> lock(m_PoseMap);
+        if(!miGPSPositions.push_back(iGPS::Point(p3D,t)))
+        {
+            mnRejectedSamples++;
+            LOG_VERBOSE("iGPS fusion: out of order iGPS sample at t = " << t << " dropped");
+            return;
+        }
+    }
     mMutexiGPS.lock();
     mbfusionFlag = true;
     mMutexiGPS.unlock();
+    mWakeEvent.Notify();
 }
 
 void iGPSFusion::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    mWakeEvent.Shutdown();
+}
+
+bool iGPSFusion::isIdle()
+{
+    unique_lock<mutex> lock(mMutexiGPS);
+    return !mbfusionFlag && !mbProcessingiGPS;
 }
 
 bool iGPSFusion::isFinished()
@@ -69,49 +97,98 @@ void iGPSFusion::inputVO(double t, cv::Mat Tcw)
         if(mScale>1.2)
             mLastScale = mScale;
 
-        std::vector<double> localPose{localP.x(),localP.y(),localP.z(),
-                                      localQ.w(),localQ.x(),localQ.y(),localQ.z()};
-        VOPoseMap[t] = localPose;
-
-        std::vector<double> FusionPose{ FusionP.x(),FusionP.y(),FusionP.z(),
-                                        FusionQ.w(),FusionQ.x(),FusionQ.y(),FusionQ.z()};
+        if(!mVOPoses.push_back(iGPS::Pose(t,localP,localQ)))
+        {
+            mnRejectedSamples++;
+            LOG_VERBOSE("iGPS fusion: out of order VO pose at t = " << t << " dropped");
+            m_PoseMap.unlock();
+            return;
+        }
         //cout<< "FusionP     " << FusionP<< endl;
 
-        mmFusionPoseMap[t] = FusionPose;
+        mFusionPoses.push_back(iGPS::Pose(t,FusionP,FusionQ));
 
         //if scale is estimated successfully
         if(mbScaleFlag && mScale > 1.2)
         {
             mScale = 1;
-            mmFusionPoseMap.clear();
-            std::cout<< "iGPS_T_VO = " << iGPS_T_VO <<std::endl;
-            std::cout<< "mLastScale = " << mLastScale <<std::endl;
-            for(auto iterator = VOPoseMap.begin(); iterator != VOPoseMap.end();iterator++)
+            mFusionPoses.clear();
+            LOG_VERBOSE("iGPS_T_VO = " << iGPS_T_VO);
+            LOG_VERBOSE("mLastScale = " << mLastScale);
+            for(size_t i = 0; i < mVOPoses.size(); i++)
             {
-                Eigen::Quaterniond localQ(iterator->second[3],iterator->second[4],iterator->second[5],iterator->second[6]);
-                Eigen::Vector3d localP = Eigen::Vector3d(iterator->second[0],iterator->second[1],iterator->second[2]);
-
-                FusionQ = Eigen::Quaterniond(iGPS_T_VO.block<3,3>(0,0)) * localQ;
-                FusionP = mLastScale * iGPS_T_VO.block<3,3>(0,0) * localP + iGPS_T_VO.block<3,1>(0,3);
+                FusionQ = Eigen::Quaterniond(iGPS_T_VO.block<3,3>(0,0)) * mVOPoses[i].rotation();
+                FusionP = mLastScale * iGPS_T_VO.block<3,3>(0,0) * mVOPoses[i].position() + iGPS_T_VO.block<3,1>(0,3);
 
-                std::vector<double> FusionPose{ FusionP.x(),FusionP.y(),FusionP.z(),
-                                               FusionQ.w(),FusionQ.x(),FusionQ.y(),FusionQ.z()};
-                mmFusionPoseMap[iterator->first] = FusionPose;
+                mFusionPoses.push_back(iGPS::Pose(mVOPoses[i].t,FusionP,FusionQ));
             }
         }
 
-        //last_p = FusionP;
-        //last_q = FusionQ;
-
-
         m_PoseMap.unlock();
     }
 }
 
 bool iGPSFusion::getFusionResult(Eigen::Vector3d & P, Eigen::Quaterniond & Q)
 {
-    P = last_p;
-    Q = last_q;
+    iGPS::FusionResult result;
+    if(!mFusionResult.read(result))
+        return false;
+    P = result.pose.position();
+    Q = result.pose.rotation();
+    return true;
+}
+
+bool iGPSFusion::getFusionResult(iGPS::FusionResult & result)
+{
+    return mFusionResult.read(result);
+}
+
+// Covariance of the newest pose (vertex nPoses-1) of the chain built in optimize(), by folding the
+// information of each pose into the next one (Schur complement) from the first pose on.
+bool iGPSFusion::ComputeLatestCovariance(g2o::SparseOptimizer &optimizer, const int nPoses, Eigen::Matrix<double,6,6> &cov)
+{
+    g2o::JacobianWorkspace jacobianWorkspace;
+    for(auto it = optimizer.edges().begin(); it != optimizer.edges().end(); it++)
+        jacobianWorkspace.updateSize(*it);
+    jacobianWorkspace.allocate();
+
+    Eigen::Matrix<double,6,6> Hcur = Eigen::Matrix<double,6,6>::Zero();
+    for(int i = 0; i < nPoses; i++)
+    {
+        g2o::OptimizableGraph::Vertex* v0 = static_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(i));
+        g2o::OptimizableGraph::Vertex* v1 = i+1 < nPoses ? static_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(i+1)) : NULL;
+
+        Eigen::MatrixXd H = Eigen::MatrixXd::Zero(12,12);
+        H.block<6,6>(0,0) = Hcur;
+        for(auto it = v0->edges().begin(); it != v0->edges().end(); it++)
+        {
+            g2o::OptimizableGraph::Edge* pEdge = static_cast<g2o::OptimizableGraph::Edge*>(*it);
+            pEdge->computeError();
+            pEdge->linearizeOplus(jacobianWorkspace);
+            if(EdgeSE3Graph* e = dynamic_cast<EdgeSE3Graph*>(*it))
+            {
+                if(v1 && e->vertex(0) == v0 && e->vertex(1) == v1)
+                    H += e->GetHessian();
+            }
+            else if(EdgeSE3iGPSFusion* e = dynamic_cast<EdgeSE3iGPSFusion*>(*it))
+                H.block<6,6>(0,0) += e->GetHessian();
+        }
+
+        if(!v1)
+        {
+            Hcur = H.block<6,6>(0,0);
+            break;
+        }
+        H = Optimizer::Marginalize(H,0,5);
+        Hcur = H.block<6,6>(6,6);
+    }
+
+    Hcur = 0.5 * (Hcur + Hcur.transpose());
+    Eigen::FullPivLU<Eigen::Matrix<double,6,6> > lu(Hcur);
+    if(!lu.isInvertible())
+        return false;
+    cov = lu.inverse();
+    return true;
 }
 
 void iGPSFusion::optimize()
@@ -129,10 +206,11 @@ void iGPSFusion::optimize()
             bFusionSolution = true;
             mbfusionFlag = false;
         }
+        mbProcessingiGPS = bFusionSolution;
         mMutexiGPS.unlock();
         if(bFusionSolution)
         {
-            int num = iGPSPositionMap.size();
+            int num = miGPSPositions.size();
             //cout << "num " << num << endl;
             if(num <100)
                 continue;
@@ -140,6 +218,7 @@ void iGPSFusion::optimize()
             if(mbScaleFlag)
             {
                 //Pose Graph Optimize
+                std::chrono::steady_clock::time_point time_StartSolve = std::chrono::steady_clock::now();
                 g2o::SparseOptimizer optimizer;
                 g2o::BlockSolverX::LinearSolverType * linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolverX::PoseMatrixType>();
                 auto * solver_ptr = new g2o::BlockSolverX(linearSolver);
@@ -148,34 +227,24 @@ void iGPSFusion::optimize()
                 optimizer.setVerbose(false);
                 m_PoseMap.lock();
 
-                int index = 0;
-                for(auto iterator = mmFusionPoseMap.begin(); iterator != mmFusionPoseMap.end();iterator++)
+                // VO and fusion poses are pushed together, so index i refers to the same frame in both buffers
+                for(size_t i = 0; i < mFusionPoses.size(); i++)
                 {
-                    Eigen::Quaterniond localQ(iterator->second[3],iterator->second[4],iterator->second[5],iterator->second[6]);
-                    Eigen::Vector3d localP = Eigen::Vector3d(iterator->second[0],iterator->second[1],iterator->second[2]);
                     auto *v = new g2o::VertexSE3Expmap();
-                    v->setId(index);
+                    v->setId(i);
                     v->setFixed(false);
-                    v->setEstimate(g2o::SE3Quat(localQ,localP));
+                    v->setEstimate(g2o::SE3Quat(mFusionPoses[i].rotation(),mFusionPoses[i].position()));
                     v->setMarginalized(false);
                     optimizer.addVertex(v);
-                    index++;
                 }
 
-                index = 0;
-                for(auto iterator = VOPoseMap.begin(); iterator != VOPoseMap.end();iterator++)
+                int index = 0;
+                for(size_t i = 0; i < mVOPoses.size(); i++)
                 {
-
-                    auto iteratorNext = iterator;
-                    iteratorNext++;
-                    if(iteratorNext != VOPoseMap.end())
+                    if(i + 1 < mVOPoses.size())
                     {
-                        Eigen::Quaterniond localQ(iterator->second[3],iterator->second[4],iterator->second[5],iterator->second[6]);
-                        Eigen::Vector3d localP = Eigen::Vector3d(iterator->second[0],iterator->second[1],iterator->second[2]);
-                        g2o::SE3Quat wTi = g2o::SE3Quat (localQ,localP);
-                        localQ = Eigen::Quaterniond(iteratorNext->second[3],iteratorNext->second[4],iteratorNext->second[5],iteratorNext->second[6]);
-                        localP = Eigen::Vector3d(iteratorNext->second[0],iteratorNext->second[1],iteratorNext->second[2]);
-                        g2o::SE3Quat wTj = g2o::SE3Quat (localQ,localP);
+                        g2o::SE3Quat wTi = g2o::SE3Quat (mVOPoses[i].rotation(),mVOPoses[i].position());
+                        g2o::SE3Quat wTj = g2o::SE3Quat (mVOPoses[i+1].rotation(),mVOPoses[i+1].position());
                         g2o::SE3Quat iTj = wTi.inverse() * wTj;
                         EdgeSE3Graph *e = new EdgeSE3Graph(mLastScale);
                         e->setVertex(0,dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(index)));
@@ -188,12 +257,12 @@ void iGPSFusion::optimize()
                         optimizer.addEdge(e);
                     }
 
-                    double t = iterator->first;
-                    auto iteratoriGPS = iGPSPositionMap.find(t);
+                    long iteratoriGPS = miGPSPositions.find(mVOPoses[i].t);
                     const float thHuber = sqrt(5.991);
-                    if(iteratoriGPS != iGPSPositionMap.end())
+                    if(iteratoriGPS >= 0)
                     {
-                        g2o::Vector3D iGPSPosition = g2o::Vector3D(iteratoriGPS->second.x,iteratoriGPS->second.y,iteratoriGPS->second.z);
+                        const cv::Point3f &p3D = miGPSPositions[iteratoriGPS].p;
+                        g2o::Vector3D iGPSPosition = g2o::Vector3D(p3D.x,p3D.y,p3D.z);
                         EdgeSE3iGPSFusion *e = new EdgeSE3iGPSFusion();
                         e->setVertex(0,dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(index)));
                         e->setMeasurement(iGPSPosition);
@@ -209,12 +278,10 @@ void iGPSFusion::optimize()
                 optimizer.initializeOptimization();
                 optimizer.optimize(10);
 
-                ofstream f;
-                f.open("./result.txt",ios::app);
-                int length = mmFusionPoseMap.size();
-                auto iter = mmFusionPoseMap.begin();
-                for(int i = 0; i< length; i++, iter++)
+                int length = mFusionPoses.size();
+                for(int i = 0; i< length; i++)
                 {
+                    iGPS::Pose &iter = mFusionPoses[i];
                     if(i < length -1 && i > length -30) // 将位姿图中的除了最后一个节点以外都设置成优化以后的pose
                     {
                         //cout << "iter->second     " << iter->second[0] << " " << iter->second[1] << " "
@@ -224,9 +291,7 @@ void iGPSFusion::optimize()
                         g2o::SE3Quat SE3quat = vSE3->estimate();
                         Eigen::Quaterniond FusionQ = SE3quat.rotation();
                         Eigen::Vector3d FusionP = SE3quat.translation();
-                        std::vector<double> FusionPose{FusionP.x(), FusionP.y(), FusionP.z(),
-                                                       FusionQ.w(), FusionQ.x(), FusionQ.y(), FusionQ.z()};
-                        iter->second = FusionPose;
+                        iter = iGPS::Pose(iter.t, FusionP, FusionQ);
                     }
                     if(i == length -1) // 将位姿图中的除了最后一个节点以外都设置成优化以后的pose
                     {
@@ -236,21 +301,15 @@ void iGPSFusion::optimize()
                         g2o::SE3Quat SE3quat = vSE3->estimate();
                         Eigen::Quaterniond FusionQ = SE3quat.rotation();
                         Eigen::Vector3d FusionP = SE3quat.translation();
-                        std::vector<double> FusionPose{ FusionP.x(),FusionP.y(),FusionP.z(),
-                                                        FusionQ.w(),FusionQ.x(),FusionQ.y(),FusionQ.z()};
-                        iter->second = FusionPose;
+                        iter = iGPS::Pose(iter.t,FusionP,FusionQ);
                         //cout << "SE3quat         " << SE3quat.translation().transpose() <<endl;
-                        f << fixed;
-                        f <<  1e9 * iter->first  << "," <<  setprecision(9) << FusionP.x() << "," << FusionP.y() << "," << FusionP.z() << "," << FusionQ.x() << "," << FusionQ.y() << "," << FusionQ.z() << ","  << FusionQ.w()  <<endl;
+                        mpResultSink->Push(iter);
 
                         Eigen::Matrix4d WVO_T_body = Eigen::Matrix4d::Identity();
                         Eigen::Matrix4d WGPS_T_body = Eigen::Matrix4d::Identity();
-                        double t = iter->first;
-                        auto localPose = VOPoseMap.find(t);
-                        Eigen::Quaterniond localQ(localPose->second[3],localPose->second[4],localPose->second[5],localPose->second[6]);
-                        Eigen::Vector3d localP = Eigen::Vector3d(localPose->second[0],localPose->second[1],localPose->second[2]);
-                        WVO_T_body.block<3,3>(0,0) = localQ.toRotationMatrix();
-                        WVO_T_body.block<3,1>(0,3) = mLastScale * localP;
+                        const iGPS::Pose &localPose = mVOPoses[i];
+                        WVO_T_body.block<3,3>(0,0) = localPose.rotation().toRotationMatrix();
+                        WVO_T_body.block<3,1>(0,3) = mLastScale * localPose.position();
                         WGPS_T_body.block<3,3>(0,0) = Eigen::Quaterniond(FusionQ.w(),FusionQ.x(),FusionQ.y(),FusionQ.z()).toRotationMatrix();
                         WGPS_T_body.block<3,1>(0,3) =Eigen::Vector3d(FusionP.x(),FusionP.y(),FusionP.z());
                         iGPS_T_VO = WGPS_T_body * WVO_T_body.inverse();
@@ -275,7 +334,24 @@ void iGPSFusion::optimize()
                     //    cout<< "iGPS_T_VO           "<< iGPS_T_VO <<endl;
                     //}
                 }
-                f.close();
+
+                // Publish the newest pose for getFusionResult
+                if(length > 0)
+                {
+                    iGPS::FusionResult result;
+                    result.pose = mFusionPoses[length-1];
+                    Eigen::Matrix<double,6,6> cov;
+                    if(ComputeLatestCovariance(optimizer, length, cov))
+                        Eigen::Map<Eigen::Matrix<double,6,6,Eigen::RowMajor> >(result.cov) = cov;
+                    const std::chrono::steady_clock::time_point time_EndSolve = std::chrono::steady_clock::now();
+                    result.latency = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndSolve - time_StartSolve).count();
+                    mnSolves++;
+                    mdTotalSolveTime += result.latency;
+                    result.nSolves = mnSolves;
+                    result.totalLatency = mdTotalSolveTime;
+                    result.stamp = std::chrono::duration<double>(time_EndSolve.time_since_epoch()).count();
+                    mFusionResult.write(result);
+                }
                 m_PoseMap.unlock();
 
             }
@@ -310,25 +386,32 @@ void iGPSFusion::optimize()
 
                 g2o::Vector3D VOPositionAvg(0,0,0),iGPSPositionAvg(0,0,0);
                 int iterNum = 0;
-                for(auto iterator = iGPSPositionMap.begin(); iterator != iGPSPositionMap.end();iterator++)
+                for(size_t j = 0; j < miGPSPositions.size(); j++)
                 {
-                    double t = iterator->first;
-                    auto iterVO = mmFusionPoseMap.find(t);
-                    g2o::Vector3D VOpos3d(iterVO->second[0],iterVO->second[1],iterVO->second[2]);
-                    g2o::Vector3D iGPSpos3d(iterator->second.x,iterator->second.y,iterator->second.z);
+                    long iterVO = mFusionPoses.find(miGPSPositions[j].t);
+                    if(iterVO < 0)
+                        continue;
+                    g2o::Vector3D VOpos3d = mFusionPoses[iterVO].position();
+                    g2o::Vector3D iGPSpos3d(miGPSPositions[j].p.x,miGPSPositions[j].p.y,miGPSPositions[j].p.z);
                     VOPositionAvg += VOpos3d;
                     iGPSPositionAvg += iGPSpos3d;
                     iterNum++;
                 }
+                if(iterNum < 3)
+                {
+                    m_PoseMap.unlock();
+                    continue;
+                }
                 VOPositionAvg /=iterNum; iGPSPositionAvg/=iterNum;
                 double dis1 = 0,dis2 = 0;
                 iterNum = 0;
-                for(auto iterator = iGPSPositionMap.begin(); iterator != iGPSPositionMap.end();iterator++)
+                for(size_t j = 0; j < miGPSPositions.size(); j++)
                 {
-                    double t = iterator->first;
-                    auto iterVO = mmFusionPoseMap.find(t);
-                    g2o::Vector3D VOpos3d(iterVO->second[0],iterVO->second[1],iterVO->second[2]);
-                    g2o::Vector3D iGPSpos3d(iterator->second.x,iterator->second.y,iterator->second.z);
+                    long iterVO = mFusionPoses.find(miGPSPositions[j].t);
+                    if(iterVO < 0)
+                        continue;
+                    g2o::Vector3D VOpos3d = mFusionPoses[iterVO].position();
+                    g2o::Vector3D iGPSpos3d(miGPSPositions[j].p.x,miGPSPositions[j].p.y,miGPSPositions[j].p.z);
                     if(iterNum == 0)
                     {
                         dis1 = (VOpos3d - VOPositionAvg).norm();
@@ -344,15 +427,16 @@ void iGPSFusion::optimize()
                     iterNum++;
                 }
                 double scale = dis2 /dis1;   //initial scale estimate
-                std::cout<< "scale = " << scale <<endl;
+                LOG_VERBOSE("scale = " << scale);
 
                 const float thHuber = sqrt(14.07);
-                for(auto iterator = iGPSPositionMap.begin(); iterator != iGPSPositionMap.end();iterator++)
+                for(size_t j = 0; j < miGPSPositions.size(); j++)
                 {
-                    double t = iterator->first;
-                    auto iterVO = mmFusionPoseMap.find(t);
-                    g2o::Vector3D VOpos3d(scale*iterVO->second[0],scale*iterVO->second[1],scale*iterVO->second[2]);
-                    g2o::Vector3D iGPSpos3d(iterator->second.x,iterator->second.y,iterator->second.z);
+                    long iterVO = mFusionPoses.find(miGPSPositions[j].t);
+                    if(iterVO < 0)
+                        continue;
+                    g2o::Vector3D VOpos3d = scale * mFusionPoses[iterVO].position();
+                    g2o::Vector3D iGPSpos3d(miGPSPositions[j].p.x,miGPSPositions[j].p.y,miGPSPositions[j].p.z);
                     //std::cout<< "VOpos3d = " << VOpos3d <<std::endl;
                     //std::cout<< "iGPSpos3d = " << iGPSpos3d <<std::endl;
                     EdgeSim3 *e = new EdgeSim3(VOpos3d);
@@ -388,9 +472,19 @@ void iGPSFusion::optimize()
             }
 
         }
-        usleep(5000);
-        if(mpLoopClosing->isFinished())
+        mMutexiGPS.lock();
+        mbProcessingiGPS = false;
+        mMutexiGPS.unlock();
+
+        // Sleep until the next iGPS sample or RequestFinish
+        mWakeEvent.Wait(50000);
+        if(mWakeEvent.isShutdown() || (mpLoopClosing && mpLoopClosing->isFinished()))
         {
+            {
+                unique_lock<mutex> lock(m_PoseMap);
+                if(mnRejectedSamples > 0)
+                    cout << "iGPS fusion: " << mnRejectedSamples << " out of order samples dropped" << endl;
+            }
             SetFinish();
             break;
         }
@@ -0,0 +1,251 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+#include "iGPSLog.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ORB_SLAM3
+{
+
+namespace iGPS
+{
+
+namespace
+{
+
+const char kLogMagic[8] = {'I','G','P','S','L','O','G','\0'};
+const uint32_t kLogVersion = 1;
+const size_t kColumnAlignment = 64;
+
+// Bytes per sample of every column
+const size_t kDirectionWidths[] = {sizeof(double), sizeof(int32_t), sizeof(int32_t), 3*sizeof(double), 2*sizeof(double)};
+const size_t kPoseWidths[] = {sizeof(double), 3*sizeof(double), 4*sizeof(double)};
+
+size_t AlignColumn(const size_t n)
+{
+    return (n + kColumnAlignment - 1) & ~(kColumnAlignment - 1);
+}
+
+void ColumnWidths(const uint32_t kind, const size_t* &widths, size_t &nColumns)
+{
+    if(kind == DIRECTION_LOG)
+    {
+        widths = kDirectionWidths;
+        nColumns = sizeof(kDirectionWidths)/sizeof(size_t);
+    }
+    else
+    {
+        widths = kPoseWidths;
+        nColumns = sizeof(kPoseWidths)/sizeof(size_t);
+    }
+}
+
+template<class T>
+void Append(std::string &column, const T &x)
+{
+    column.append(reinterpret_cast<const char*>(&x), sizeof(T));
+}
+
+bool WriteColumns(const std::string &filename, const LogKind kind, const size_t count, const std::vector<std::string> &vColumns)
+{
+    LogHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kLogMagic, sizeof(kLogMagic));
+    header.version = kLogVersion;
+    header.kind = kind;
+    header.count = count;
+
+    size_t offset = AlignColumn(sizeof(LogHeader));
+    for(size_t i = 0; i < vColumns.size(); i++)
+    {
+        header.offsets[i] = offset;
+        offset = AlignColumn(offset + vColumns[i].size());
+    }
+
+    std::ofstream f(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!f.is_open())
+    {
+        std::cerr << "iGPS log: could not open " << filename << std::endl;
+        return false;
+    }
+
+    const std::string padding(kColumnAlignment, '\0');
+    f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    f.write(padding.data(), header.offsets[0] - sizeof(header));
+    for(size_t i = 0; i < vColumns.size(); i++)
+    {
+        f.write(vColumns[i].data(), vColumns[i].size());
+        f.write(padding.data(), AlignColumn(vColumns[i].size()) - vColumns[i].size());
+    }
+    return f.good();
+}
+
+}
+
+bool WriteDirectionLog(const std::string &filename, const std::vector<Direction> &vDirections)
+{
+    std::vector<std::string> vColumns(5);
+    for(size_t i = 0; i < vColumns.size(); i++)
+        vColumns[i].reserve(vDirections.size() * kDirectionWidths[i]);
+
+    for(size_t i = 0; i < vDirections.size(); i++)
+    {
+        const Direction &d = vDirections[i];
+        Append(vColumns[0], d.time);
+        Append(vColumns[1], (int32_t)d.channel);
+        Append(vColumns[2], (int32_t)d.transmitter);
+        for(int j = 0; j < 3; j++)
+            Append(vColumns[3], d.dir[j]);
+        for(int j = 0; j < 2; j++)
+            Append(vColumns[4], d.dirAngle[j]);
+    }
+    return WriteColumns(filename, DIRECTION_LOG, vDirections.size(), vColumns);
+}
+
+bool WritePoseLog(const std::string &filename, const std::vector<double> &vTimestamps, const std::vector<Eigen::VectorXf> &vCameraPose)
+{
+    if(vTimestamps.size() != vCameraPose.size())
+        return false;
+
+    std::vector<std::string> vColumns(3);
+    for(size_t i = 0; i < vColumns.size(); i++)
+        vColumns[i].reserve(vTimestamps.size() * kPoseWidths[i]);
+
+    for(size_t i = 0; i < vTimestamps.size(); i++)
+    {
+        Append(vColumns[0], vTimestamps[i]);
+        for(int j = 0; j < 3; j++)
+            Append(vColumns[1], (double)vCameraPose[i][j]);
+        for(int j = 3; j < 7; j++)
+            Append(vColumns[2], (double)vCameraPose[i][j]);
+    }
+    return WriteColumns(filename, POSE_LOG, vTimestamps.size(), vColumns);
+}
+
+LogReader::LogReader(): mpData(NULL), mnBytes(0), mpHeader(NULL)
+{
+}
+
+LogReader::~LogReader()
+{
+    Close();
+}
+
+bool LogReader::isLog(const std::string &filename)
+{
+    std::ifstream f(filename.c_str(), std::ios::in | std::ios::binary);
+    char magic[8];
+    if(!f.read(magic, sizeof(magic)))
+        return false;
+    return std::memcmp(magic, kLogMagic, sizeof(kLogMagic)) == 0;
+}
+
+bool LogReader::Open(const std::string &filename)
+{
+    Close();
+
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        std::cerr << "iGPS log: could not open " << filename << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(LogHeader))
+    {
+        std::cerr << "iGPS log: " << filename << " is not a valid log" << std::endl;
+        close(fd);
+        return false;
+    }
+    void* pData = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(pData == MAP_FAILED)
+    {
+        std::cerr << "iGPS log: could not map " << filename << std::endl;
+        return false;
+    }
+
+    // Samples are read in time order while tracking
+    madvise(pData, st.st_size, MADV_SEQUENTIAL);
+
+    mpData = static_cast<const char*>(pData);
+    mnBytes = st.st_size;
+    const LogHeader* pHeader = reinterpret_cast<const LogHeader*>(mpData);
+
+    bool bValid = std::memcmp(pHeader->magic, kLogMagic, sizeof(kLogMagic)) == 0 && pHeader->version == kLogVersion &&
+                  (pHeader->kind == DIRECTION_LOG || pHeader->kind == POSE_LOG);
+    if(bValid)
+    {
+        const size_t* widths;
+        size_t nColumns;
+        ColumnWidths(pHeader->kind, widths, nColumns);
+        for(size_t i = 0; i < nColumns && bValid; i++)
+        {
+            const uint64_t offset = pHeader->offsets[i];
+            bValid = offset % kColumnAlignment == 0 && offset <= mnBytes &&
+                     pHeader->count <= (mnBytes - offset) / widths[i];
+        }
+    }
+    if(!bValid)
+    {
+        std::cerr << "iGPS log: " << filename << " is not a valid log" << std::endl;
+        Close();
+        return false;
+    }
+
+    mpHeader = pHeader;
+    return true;
+}
+
+void LogReader::Close()
+{
+    if(mpData)
+        munmap(const_cast<char*>(mpData), mnBytes);
+    mpData = NULL;
+    mnBytes = 0;
+    mpHeader = NULL;
+}
+
+Direction LogReader::direction(const size_t i) const
+{
+    Direction d;
+    d.time = times()[i];
+    d.channel = channels()[i];
+    d.transmitter = transmitters()[i];
+    const double* dir = directions() + 3*i;
+    d.dir = Eigen::Vector3d(dir[0], dir[1], dir[2]);
+    const double* angle = dirAngles() + 2*i;
+    d.dirAngle = Eigen::Vector2d(angle[0], angle[1]);
+    return d;
+}
+
+void LogReader::GetCameraPoses(std::vector<double> &vTimestamps, std::vector<Eigen::VectorXf> &vCameraPose) const
+{
+    const size_t n = size();
+    vTimestamps.assign(times(), times() + n);
+    vCameraPose.resize(n);
+    for(size_t i = 0; i < n; i++)
+    {
+        const double* p = positions() + 3*i;
+        const double* q = rotations() + 4*i;
+        Eigen::VectorXf CameraPose(7);
+        CameraPose << p[0], p[1], p[2], q[0], q[1], q[2], q[3];
+        vCameraPose[i] = CameraPose;
+    }
+}
+
+}
+
+} //namespace ORB_SLAM3
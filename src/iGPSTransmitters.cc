@@ -0,0 +1,281 @@
+/**
+* This file is part of ORB-SLAM3
+*
+* Copyright (C) 2021 Ze Yang
+*/
+
+#include "iGPSTransmitters.h"
+#include "Converter.h"
+
+#include <iostream>
+#include <sstream>
+#include <map>
+
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+namespace ORB_SLAM3
+{
+
+namespace iGPS
+{
+
+namespace
+{
+
+bool ReadPose(const cv::FileNode &node, const std::string &name, Eigen::Matrix4d &T)
+{
+    if(node.empty())
+    {
+        std::cerr << "*" << name << " matrix doesn't exist*" << std::endl;
+        return false;
+    }
+    cv::Mat M = node.mat();
+    if(M.rows != 4 || M.cols != 4)
+    {
+        std::cerr << "*" << name << " matrix have to be a 4x4 transformation matrix*" << std::endl;
+        return false;
+    }
+    M.convertTo(M, CV_32F);
+    T = Converter::toMatrix4d(M);
+    return true;
+}
+
+bool ReadResidual(const cv::FileNode &node, DirectionResidual &model)
+{
+    model = DIR_DEFAULT;
+    if(node.empty())
+        return true;
+
+    const std::string name = node;
+    if(name == "VectorAngle")
+        model = DIR_VECTOR_ANGLE;
+    else if(name == "Vector")
+        model = DIR_VECTOR;
+    else if(name == "Tangent")
+        model = DIR_TANGENT;
+    else if(name == "Angles")
+        model = DIR_ANGLES;
+    else
+    {
+        std::cerr << "*iGPS.DirectionResidual " << name << " unknown, using the default of each edge*" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+}
+
+bool TransmitterRegistry::Load(const cv::FileStorage &fSettings)
+{
+    Clear();
+    ReadResidual(fSettings["iGPS.DirectionResidual"], mResidual);
+
+    cv::FileNode node = fSettings["iGPS.Transmitters"];
+    if(node.empty())
+    {
+        // Old settings files: three transmitters with fixed rotation speeds
+        const char* names[] = {"Twi", "Twi2", "Twi3"};
+        const int ids[] = {1800, 1900, 2000};
+        for(int i = 0; i < 3; i++)
+        {
+            Eigen::Matrix4d Twi;
+            if(ReadPose(fSettings[names[i]], names[i], Twi))
+                Add(ids[i], Twi);
+        }
+        return !empty();
+    }
+
+    const int n = (int)node;
+    for(int i = 1; i <= n; i++)
+    {
+        std::stringstream ss;
+        ss << "iGPS.Transmitter" << i << ".";
+        const std::string prefix = ss.str();
+
+        cv::FileNode nodeId = fSettings[prefix + "Id"];
+        if(nodeId.empty())
+        {
+            std::cerr << "*" << prefix << "Id doesn't exist*" << std::endl;
+            continue;
+        }
+        Eigen::Matrix4d Twi;
+        if(!ReadPose(fSettings[prefix + "Twi"], prefix + "Twi", Twi))
+            continue;
+        cv::FileNode nodeNoise = fSettings[prefix + "Noise"];
+        const double noise = nodeNoise.empty() ? 1.0 : (double)nodeNoise;
+
+        Add((int)nodeId, Twi, noise);
+    }
+
+    std::cout << "iGPS transmitters: " << size() << ", direction residual ";
+    if(mResidual == DIR_DEFAULT)
+        std::cout << "default" << std::endl;
+    else
+        std::cout << mResidual << std::endl;
+    return !empty();
+}
+
+void TransmitterRegistry::Add(const int id, const Eigen::Matrix4d &Twi, const double noise)
+{
+    if(id < 0 || index(id) >= 0 || noise <= 0.0)
+    {
+        std::cerr << "iGPS transmitter " << id << " ignored" << std::endl;
+        return;
+    }
+
+    Transmitter trm;
+    trm.id = id;
+    trm.Twi = Twi;
+    trm.invSigma2 = 1.0/(noise*noise);
+    trm.bTci = false;
+    trm.Rci.setIdentity();
+    trm.tci.setZero();
+
+    if(id >= (int)mvIndex.size())
+        mvIndex.resize(id+1, -1);
+    mvIndex[id] = mvTransmitters.size();
+    mvTransmitters.push_back(trm);
+}
+
+void TransmitterRegistry::Clear()
+{
+    mvTransmitters.clear();
+    mvIndex.clear();
+}
+
+void TransmitterRegistry::SetCameraPose(const cv::Mat &Tcw)
+{
+    const Eigen::Matrix4d eTcw = Converter::toMatrix4d(Tcw);
+    for(size_t i = 0; i < mvTransmitters.size(); i++)
+    {
+        const Eigen::Matrix4d Tci = eTcw * mvTransmitters[i].Twi;
+        SetTci(i, g2o::SE3Quat(Tci.block<3,3>(0,0), Tci.block<3,1>(0,3)));
+    }
+}
+
+void TransmitterRegistry::SetTci(const size_t i, const g2o::SE3Quat &Tci)
+{
+    Transmitter &trm = mvTransmitters[i];
+    trm.Tci = Tci;
+    trm.Rci = Tci.rotation().toRotationMatrix();
+    trm.tci = Tci.translation();
+    trm.bTci = true;
+}
+
+void TransmitterRegistry::ResetTci()
+{
+    for(size_t i = 0; i < mvTransmitters.size(); i++)
+        mvTransmitters[i].bTci = false;
+}
+
+bool TransmitterRegistry::isInitialized() const
+{
+    for(size_t i = 0; i < mvTransmitters.size(); i++)
+        if(!mvTransmitters[i].bTci)
+            return false;
+    return !mvTransmitters.empty();
+}
+
+int TransmitterRegistry::TriangulateReceivers(const std::vector<int> &vChannels, const std::vector<int> &vTransmitters,
+                                              const std::vector<Eigen::Vector3d> &vDirections,
+                                              std::vector<std::pair<int,Eigen::Vector3d> > &vPositions) const
+{
+    vPositions.clear();
+
+    // Least squares point closest to every ray: sum (I - d d^T)(P - tci) = 0
+    std::map<int,Eigen::Matrix3d> mA;
+    std::map<int,Eigen::Vector3d> mb;
+    std::map<int,int> mnRays;
+    for(size_t j = 0; j < vDirections.size(); j++)
+    {
+        const int i = index(vTransmitters[j]);
+        if(i < 0 || !mvTransmitters[i].bTci)
+            continue;
+        const Transmitter &trm = mvTransmitters[i];
+        const Eigen::Vector3d d = (trm.Rci*vDirections[j]).normalized();
+        const Eigen::Matrix3d P = Eigen::Matrix3d::Identity() - d*d.transpose();
+
+        const int ch = vChannels[j];
+        if(!mnRays.count(ch))
+        {
+            mA[ch].setZero();
+            mb[ch].setZero();
+            mnRays[ch] = 0;
+        }
+        mA[ch] += P;
+        mb[ch] += P*trm.tci;
+        mnRays[ch]++;
+    }
+
+    for(std::map<int,int>::const_iterator it = mnRays.begin(); it != mnRays.end(); it++)
+    {
+        if(it->second < 2)
+            continue;
+        const Eigen::Matrix3d &A = mA[it->first];
+        // Near parallel rays leave the position along them undetermined
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> es(A);
+        if(es.eigenvalues()[0] < 1e-3*it->second)
+            continue;
+        vPositions.push_back(std::make_pair(it->first, Eigen::Vector3d(A.ldlt().solve(mb[it->first]))));
+    }
+    return vPositions.size();
+}
+
+Eigen::Vector3d TransmitterRegistry::ToiGPSWorld(const Eigen::Vector3d &p) const
+{
+    for(size_t i = 0; i < mvTransmitters.size(); i++)
+    {
+        const Transmitter &trm = mvTransmitters[i];
+        if(!trm.bTci)
+            continue;
+        // Twi * Tci^-1
+        const Eigen::Vector3d pi = trm.Rci.transpose()*(p - trm.tci);
+        return trm.Twi.block<3,3>(0,0)*pi + trm.Twi.block<3,1>(0,3);
+    }
+    return p;
+}
+
+bool TransmitterRegistry::LocateCamera(const std::vector<int> &vChannels, const std::vector<int> &vTransmitters,
+                                       const std::vector<Eigen::Vector3d> &vDirections, const ReceiverTable &receivers,
+                                       Eigen::Vector3d &Ow, double &uncertainty, Eigen::Matrix4d &Twc, bool &bPose) const
+{
+    bPose = false;
+    std::vector<std::pair<int,Eigen::Vector3d> > vPositions;
+    if(TriangulateReceivers(vChannels, vTransmitters, vDirections, vPositions) == 0)
+        return false;
+
+    const int N = vPositions.size();
+    Eigen::Matrix<double,3,Eigen::Dynamic> Pc(3,N), Pw(3,N);
+    for(int i = 0; i < N; i++)
+    {
+        if(!receivers.has(vPositions[i].first))
+            return false;
+        Pc.col(i) = receivers[vPositions[i].first];
+        Pw.col(i) = vPositions[i].second;
+    }
+
+    // Three receivers not on a line fix the whole pose
+    if(N >= 3)
+    {
+        const Eigen::Matrix<double,3,Eigen::Dynamic> Pc0 = Pc.colwise() - Pc.rowwise().mean();
+        Eigen::JacobiSVD<Eigen::MatrixXd> svd(Pc0);
+        if(svd.singularValues()[1] > 1e-2*svd.singularValues()[0])
+        {
+            Twc = Eigen::umeyama(Pc, Pw, false);
+            Ow = Twc.block<3,1>(0,3);
+            uncertainty = 0.0;
+            bPose = true;
+            return true;
+        }
+    }
+
+    // Otherwise only the position, the camera is within the receiver offsets of their mean
+    Ow = Pw.rowwise().mean();
+    uncertainty = Pc.colwise().norm().maxCoeff();
+    return true;
+}
+
+}
+
+} //namespace ORB_SLAM3